@@ -0,0 +1,438 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    assets.cpp : Parallel asset loading.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Model parsing and image decoding run on a pool of worker threads, only the
+ *          OpenGL uploads stay on the thread owning the context.
+ *
+ * Uncompressed BMP and uncompressed/RLE TGA files are decoded here and scale with the
+ * number of workers. Other formats go through DevIL, which keeps global state and is
+ * therefore serialized by a mutex.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <IL/il.h>
+#include "assets.h"
+#include "textures.h"
+#include "profiler.h"
+
+using namespace manaeste;
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	std::mutex devilMutex;
+
+	double elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	uint16_t readU16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+	uint32_t readU32(const unsigned char* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+	bool hasExtension(const std::string& fileName, const char* extension)
+	{
+		const size_t length = std::strlen(extension);
+		if (fileName.size() < length)
+			return false;
+		return std::equal(fileName.end() - length, fileName.end(), extension,
+			[](char a, char b) { return std::tolower((unsigned char)a) == b; });
+	}
+
+	void flipRows(DecodedImage& image)
+	{
+		const size_t rowSize = 4 * (size_t)image.width;
+		for (int y = 0; y < image.height / 2; y++)
+			std::swap_ranges(image.pixels.begin() + y * rowSize, image.pixels.begin() + (y + 1) * rowSize,
+				image.pixels.begin() + (image.height - 1 - y) * rowSize);
+	}
+
+	/**
+	 * @brief Decodes an uncompressed 24/32-bit BMP.
+	*/
+	bool decodeBmp(const MappedFile& file, DecodedImage& image)
+	{
+		const unsigned char* data = file.data();
+		if (file.size() < 54 || data[0] != 'B' || data[1] != 'M')
+			return false;
+
+		const uint32_t pixelOffset = readU32(data + 10);
+		const int32_t width = (int32_t)readU32(data + 18);
+		const int32_t height = (int32_t)readU32(data + 22);
+		const uint16_t bitsPerPixel = readU16(data + 28);
+		const uint32_t compression = readU32(data + 30);
+		if (compression != 0 || (bitsPerPixel != 24 && bitsPerPixel != 32) || width <= 0 || height == 0)
+			return false;
+
+		const int rows = height < 0 ? -height : height;
+		const size_t bytesPerPixel = bitsPerPixel / 8;
+		const size_t stride = (bytesPerPixel * width + 3) & ~(size_t)3;
+		if (pixelOffset + stride * rows > file.size())
+			return false;
+
+		image.width = width;
+		image.height = rows;
+		image.pixels.resize(4 * (size_t)width * rows);
+		for (int y = 0; y < rows; y++)
+		{
+			const unsigned char* src = data + pixelOffset + stride * y;
+			unsigned char* dst = &image.pixels[4 * (size_t)width * y];
+			for (int x = 0; x < width; x++, src += bytesPerPixel, dst += 4)
+			{
+				dst[0] = src[2];
+				dst[1] = src[1];
+				dst[2] = src[0];
+				dst[3] = bytesPerPixel == 4 ? src[3] : 255;
+			}
+		}
+
+		// positive height means the rows are stored bottom-up, which is what OpenGL wants
+		if (height < 0)
+			flipRows(image);
+		return true;
+	}
+
+	/**
+	 * @brief Decodes an uncompressed or RLE compressed 24/32-bit true-color TGA.
+	*/
+	bool decodeTga(const MappedFile& file, DecodedImage& image)
+	{
+		const unsigned char* data = file.data();
+		if (file.size() < 18)
+			return false;
+
+		const unsigned char idLength = data[0];
+		const unsigned char colorMapType = data[1];
+		const unsigned char imageType = data[2];
+		const int width = readU16(data + 12);
+		const int height = readU16(data + 14);
+		const unsigned char bitsPerPixel = data[16];
+		const unsigned char descriptor = data[17];
+		if (colorMapType != 0 || (imageType != 2 && imageType != 10) || (bitsPerPixel != 24 && bitsPerPixel != 32)
+			|| width == 0 || height == 0)
+			return false;
+
+		const size_t bytesPerPixel = bitsPerPixel / 8;
+		const size_t numPixels = (size_t)width * height;
+		const unsigned char* src = data + 18 + idLength;
+		const unsigned char* end = data + file.size();
+
+		image.width = width;
+		image.height = height;
+		image.pixels.resize(4 * numPixels);
+		unsigned char* dst = image.pixels.data();
+
+		auto copyPixel = [&](const unsigned char* pixel) {
+			dst[0] = pixel[2];
+			dst[1] = pixel[1];
+			dst[2] = pixel[0];
+			dst[3] = bytesPerPixel == 4 ? pixel[3] : 255;
+			dst += 4;
+		};
+
+		size_t decoded = 0;
+		while (decoded < numPixels)
+		{
+			size_t count = numPixels - decoded;
+			bool repeat = false;
+			if (imageType == 10)
+			{
+				if (src >= end)
+					return false;
+				repeat = (*src & 0x80) != 0;
+				count = std::min(count, (size_t)(*src & 0x7f) + 1);
+				src++;
+			}
+
+			const size_t packetBytes = repeat ? bytesPerPixel : bytesPerPixel * count;
+			if ((size_t)(end - src) < packetBytes)
+				return false;
+
+			for (size_t i = 0; i < count; i++)
+				copyPixel(repeat ? src : src + i * bytesPerPixel);
+			src += packetBytes;
+			decoded += count;
+		}
+
+		// bit 5 of the descriptor marks images stored top-down
+		if (descriptor & 0x20)
+			flipRows(image);
+		return true;
+	}
+
+	/**
+	 * @brief Decodes any format DevIL understands. DevIL is not thread-safe.
+	*/
+	bool decodeWithDevil(const std::string& fileName, DecodedImage& image)
+	{
+		std::lock_guard<std::mutex> lock(devilMutex);
+
+		ILuint imageId;
+		ilGenImages(1, &imageId);
+		ilBindImage(imageId);
+		ilEnable(IL_ORIGIN_SET);
+		ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+
+		bool success = ilLoadImage(fileName.c_str()) && ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+		if (success)
+		{
+			image.width = ilGetInteger(IL_IMAGE_WIDTH);
+			image.height = ilGetInteger(IL_IMAGE_HEIGHT);
+			const ILubyte* pixels = ilGetData();
+			image.pixels.assign(pixels, pixels + 4 * (size_t)image.width * image.height);
+		}
+		ilDeleteImages(1, &imageId);
+		return success;
+	}
+}
+
+TaskPool::TaskPool(unsigned int numThreads)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		workers_.emplace_back(&TaskPool::workerLoop, this);
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wakeUp_.notify_all();
+	for (auto& worker : workers_)
+		worker.join();
+}
+
+void TaskPool::workerLoop()
+{
+	setProfileThreadName("worker");
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wakeUp_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty())
+				return;
+			task = std::move(tasks_.front());
+			tasks_.pop();
+		}
+		task();
+	}
+}
+
+/**
+ * @brief Decodes an image file into RGBA8. Safe to call from any thread.
+ * @param fileName image to decode
+ * @param image decoded image
+ * @return true if decoding was successful
+*/
+bool manaeste::decodeImage(const std::string& fileName, DecodedImage& image)
+{
+	PROFILE_ZONE("decodeImage");
+	const auto start = Clock::now();
+	image.fileName = fileName;
+
+	bool success = false;
+	if (hasExtension(fileName, ".bmp") || hasExtension(fileName, ".tga"))
+	{
+		MappedFile file;
+		if (file.open(fileName))
+			success = hasExtension(fileName, ".bmp") ? decodeBmp(file, image) : decodeTga(file, image);
+	}
+	if (!success)
+		success = decodeWithDevil(fileName, image);
+
+	if (!success)
+		std::cerr << "decodeImage(): cannot decode " << fileName << std::endl;
+
+	image.decodeMs = elapsedMs(start);
+	return success;
+}
+
+/**
+ * @brief Uploads a decoded image into the texture currently bound to the given target.
+ * @param image decoded image
+ * @param target GL_TEXTURE_2D or one of the cube map faces
+ * @return true if the image contained any data
+*/
+bool manaeste::uploadTexImage2D(const DecodedImage& image, GLenum target)
+{
+	if (image.pixels.empty())
+		return false;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(target, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return true;
+}
+
+/**
+ * @brief Creates a mipmapped 2D texture from a decoded image, like pgr::createTexture() does from a file.
+ * @param image decoded image
+ * @return texture name, 0 if the image is empty
+*/
+GLuint manaeste::createTextureFromImage(const DecodedImage& image)
+{
+	if (image.pixels.empty())
+		return 0;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	uploadTexImage2D(image, GL_TEXTURE_2D);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	CHECK_GL_ERROR();
+
+	return texture;
+}
+
+/**
+ * @brief Creates a mipmapped cube map from six decoded faces.
+ * @param faces decoded faces in the order +x, -x, +y, -y, +z, -z
+ * @return texture name, 0 if any face is empty
+*/
+GLuint manaeste::createCubeMapFromImages(const std::vector<std::shared_future<DecodedImage>>& faces)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		if (!uploadTexImage2D(faces[i].get(), GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i))
+		{
+			glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+			glDeleteTextures(1, &texture);
+			return 0;
+		}
+	}
+
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	CHECK_GL_ERROR();
+
+	return texture;
+}
+
+/**
+ * @brief Schedules decoding of an image on the pool.
+ * @param pool worker pool
+ * @param fileName image to decode
+ * @return future decoded image
+*/
+std::shared_future<DecodedImage> manaeste::decodeImageAsync(TaskPool& pool, const std::string& fileName)
+{
+	return pool.submit([fileName]() {
+		DecodedImage image;
+		decodeImage(fileName, image);
+		return image;
+	}).share();
+}
+
+/**
+ * @brief Schedules parsing of a model on the pool. As soon as the model is parsed, decoding of
+ *        its textures is scheduled too through the texture registry, each file only once.
+ * @param pool worker pool
+ * @param fileName model to load
+ * @return future loaded model
+*/
+std::future<ModelLoad> manaeste::loadModelAsync(TaskPool& pool, const std::string& fileName)
+{
+	return pool.submit([&pool, fileName]() {
+		const auto start = Clock::now();
+
+		ModelLoad load;
+		load.fileName = fileName;
+		load.loaded = loadModelData(fileName, load.model);
+		load.parseMs = elapsedMs(start);
+
+		for (const auto& mesh : load.model.meshes)
+		{
+			const std::string& textureName = mesh.material.textureName;
+			load.images.push_back(textureName.empty() ? std::shared_future<DecodedImage>() : requestTextureImage(pool, textureName));
+		}
+		return load;
+	});
+}
+
+/**
+ * @brief Waits until all textures of the model are decoded.
+ * @param load loaded model
+ * @return summed decode time of the distinct textures
+*/
+double manaeste::waitForImages(const ModelLoad& load)
+{
+	double decodeMs = 0.0;
+	for (size_t i = 0; i < load.images.size(); i++)
+	{
+		if (!load.images[i].valid())
+			continue;
+
+		const DecodedImage& image = load.images[i].get();
+		bool counted = false;
+		for (size_t j = 0; j < i && !counted; j++)
+			counted = load.images[j].valid() && &load.images[j].get() == &image;
+		if (!counted)
+			decodeMs += image.decodeMs;
+	}
+	return decodeMs;
+}
+
+/**
+ * @brief Prints how long parsing, decoding and uploading of every asset took.
+ * @param out output stream
+ * @param timings per-asset timings
+ * @param numThreads number of worker threads
+ * @param wallMs wall time of the whole loading
+*/
+void manaeste::printStartupReport(std::ostream& out, const std::vector<AssetTiming>& timings, unsigned int numThreads, double wallMs)
+{
+	AssetTiming total;
+	size_t nameWidth = 5;
+	for (const auto& timing : timings)
+	{
+		nameWidth = std::max(nameWidth, timing.name.size());
+		total.parseMs += timing.parseMs;
+		total.decodeMs += timing.decodeMs;
+		total.uploadMs += timing.uploadMs;
+	}
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << std::fixed << std::setprecision(1);
+	out << "Asset loading on " << numThreads << " worker thread(s):" << std::endl;
+	out << "  " << std::left << std::setw(nameWidth) << "asset" << std::right
+		<< std::setw(11) << "parse ms" << std::setw(11) << "decode ms" << std::setw(11) << "upload ms" << std::endl;
+	for (const auto& timing : timings)
+	{
+		out << "  " << std::left << std::setw(nameWidth) << timing.name << std::right
+			<< std::setw(11) << timing.parseMs << std::setw(11) << timing.decodeMs << std::setw(11) << timing.uploadMs << std::endl;
+	}
+	out << "  " << std::left << std::setw(nameWidth) << "total" << std::right
+		<< std::setw(11) << total.parseMs << std::setw(11) << total.decodeMs << std::setw(11) << total.uploadMs << std::endl;
+	out << "  wall time " << wallMs << " ms" << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
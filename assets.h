@@ -0,0 +1,101 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    assets.h : Header file for assets.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Worker pool, image decoding and the parallel asset loading pipeline.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pgr.h"
+#include "mesh.h"
+
+namespace manaeste
+{
+	/// Fixed set of worker threads executing submitted tasks in FIFO order.
+	class TaskPool
+	{
+	public:
+		explicit TaskPool(unsigned int numThreads = 0);
+		TaskPool(const TaskPool&) = delete;
+		TaskPool& operator=(const TaskPool&) = delete;
+		~TaskPool();
+
+		template<typename F>
+		auto submit(F&& task) -> std::future<decltype(task())>
+		{
+			using Result = decltype(task());
+			auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+			std::future<Result> result = packaged->get_future();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				tasks_.push([packaged]() { (*packaged)(); });
+			}
+			wakeUp_.notify_one();
+			return result;
+		}
+
+		unsigned int size() const { return (unsigned int)workers_.size(); }
+
+	private:
+		void workerLoop();
+
+		std::vector<std::thread> workers_;
+		std::queue<std::function<void()>> tasks_;
+		std::mutex mutex_;
+		std::condition_variable wakeUp_;
+		bool stopping_{};
+	};
+
+	/// Decoded image in RGBA8, bottom row first (OpenGL convention).
+	typedef struct DecodedImage
+	{
+		std::string fileName;
+		int width{};
+		int height{};
+		std::vector<unsigned char> pixels;
+		double decodeMs{};
+	} DecodedImage;
+
+	/// A model parsed on a worker thread together with the decode jobs of its textures.
+	typedef struct ModelLoad
+	{
+		std::string fileName;
+		bool loaded{};
+		ModelData model;
+		std::vector<std::shared_future<DecodedImage>> images; ///< diffuse texture decode per mesh, invalid if none or resident
+		double parseMs{};
+	} ModelLoad;
+
+	/// Per-asset timings of the startup.
+	typedef struct AssetTiming
+	{
+		std::string name;
+		double parseMs{};
+		double decodeMs{};
+		double uploadMs{};
+	} AssetTiming;
+
+	bool decodeImage(const std::string& fileName, DecodedImage& image);
+	GLuint createTextureFromImage(const DecodedImage& image);
+	GLuint createCubeMapFromImages(const std::vector<std::shared_future<DecodedImage>>& faces);
+	bool uploadTexImage2D(const DecodedImage& image, GLenum target);
+
+	std::shared_future<DecodedImage> decodeImageAsync(TaskPool& pool, const std::string& fileName);
+	std::future<ModelLoad> loadModelAsync(TaskPool& pool, const std::string& fileName);
+	double waitForImages(const ModelLoad& load);
+
+	void printStartupReport(std::ostream& out, const std::vector<AssetTiming>& timings, unsigned int numThreads, double wallMs);
+}
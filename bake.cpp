@@ -0,0 +1,375 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    bake.cpp : Offline texture and mesh baker.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Converts the scene's images into KTX containers with all mipmap levels, so the
+ *          game uploads them directly instead of decoding and generating mipmaps at startup,
+ *          and writes the optimized mesh cache of every model.
+ *
+ * Usage: wildisland_bake [--format auto|rgba8|bc1|bc3] [--force] [PATH...]
+ *
+ * Every .bmp, .tga, .jpg and .png file under the given paths (default "data") is baked into
+ * FILE.ktx next to it. Six files named PREFIX_posx/negx/posy/negy/posz/negz.EXT are baked
+ * together into the cube map PREFIX.ktx instead. The auto format picks BC3 for images with
+ * transparent texels and BC1 for the rest. Containers newer than their sources are skipped
+ * unless --force is given. Run it from the directory the game is started from, the paths
+ * are stored relative to it.
+ *
+ * Every .obj model is imported, simplified and reordered exactly like the game does on a
+ * mesh cache miss, and its cache is rewritten. The vertex cache (ACMR, ATVR) and overdraw
+ * statistics of every full detail mesh are printed before and after the reordering.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <string>
+#include <vector>
+#include <IL/il.h>
+#include "assets.h"
+#include "textures.h"
+#include "ktx.h"
+#include "mesh.h"
+#include "objparser.h"
+#include "simplify.h"
+#include "optimize.h"
+
+using namespace manaeste;
+
+namespace
+{
+	const char* CUBE_FACE_SUFFIXES[6] = { "_posx", "_negx", "_posy", "_negy", "_posz", "_negz" };
+
+	struct BakeOptions
+	{
+		std::string format = "auto";
+		bool force = false;
+		std::vector<std::string> paths;
+	};
+
+	/// One container to write, from one image or from the six faces of a cube map.
+	struct BakeJob
+	{
+		std::string name;
+		std::vector<std::string> sources;
+	};
+
+	struct BakeResult
+	{
+		bool baked{};
+		bool skipped{};
+		BakeFormat format{};
+		int width{};
+		int height{};
+		uint32_t numLevels{};
+		size_t rgbaBytes{};
+		size_t bakedBytes{};
+	};
+
+	/// Order statistics of one mesh of a model, before and after optimizeMesh().
+	struct MeshBakeStats
+	{
+		uint32_t numTriangles{};
+		size_t numLods{};
+		MeshOrderStats before;
+		MeshOrderStats after;
+	};
+
+	struct ModelBakeResult
+	{
+		bool baked{};
+		std::vector<MeshBakeStats> meshes;
+	};
+
+	void printUsage()
+	{
+		std::cerr << "usage: wildisland_bake [--format auto|rgba8|bc1|bc3] [--force] [PATH...]" << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, BakeOptions& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if (arg == "--format" && hasValue) options.format = argv[++i];
+			else if (arg == "--force") options.force = true;
+			else if (!arg.empty() && arg[0] != '-') options.paths.push_back(arg);
+			else
+			{
+				printUsage();
+				return false;
+			}
+		}
+
+		if (options.format != "auto" && options.format != "rgba8" && options.format != "bc1" && options.format != "bc3")
+		{
+			printUsage();
+			return false;
+		}
+		if (options.paths.empty())
+			options.paths.push_back("data");
+		return true;
+	}
+
+	bool isImageFile(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return extension == ".bmp" || extension == ".tga" || extension == ".jpg" || extension == ".png";
+	}
+
+	bool isModelFile(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return extension == ".obj";
+	}
+
+	/**
+	 * @brief Lists the given files and the matching files under the given directories, sorted.
+	*/
+	template <typename Filter>
+	std::vector<std::string> collectFiles(const std::vector<std::string>& paths, Filter matches)
+	{
+		std::vector<std::string> files;
+		for (const auto& root : paths)
+		{
+			std::error_code error;
+			if (std::filesystem::is_regular_file(root, error))
+			{
+				if (matches(std::filesystem::path(root)))
+					files.push_back(canonicalTexturePath(root));
+				continue;
+			}
+			for (auto it = std::filesystem::recursive_directory_iterator(root, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+			{
+				if (it->is_regular_file() && matches(it->path()))
+					files.push_back(canonicalTexturePath(it->path().generic_string()));
+			}
+			if (error)
+				std::cerr << "collectFiles(): cannot read " << root << ": " << error.message() << std::endl;
+		}
+		std::sort(files.begin(), files.end());
+		files.erase(std::unique(files.begin(), files.end()), files.end());
+		return files;
+	}
+
+	/**
+	 * @brief Collects the images under the given paths, grouping complete sets of cube map faces.
+	*/
+	std::vector<BakeJob> collectJobs(const std::vector<std::string>& paths)
+	{
+		const std::vector<std::string> images = collectFiles(paths, isImageFile);
+
+		// key of a cube map -> its faces, a face's key being its path without the suffix and extension
+		std::map<std::string, std::vector<std::string>> cubeMaps;
+		for (const auto& image : images)
+		{
+			const std::string stem = image.substr(0, image.rfind('.'));
+			for (int face = 0; face < 6; face++)
+			{
+				const std::string suffix = CUBE_FACE_SUFFIXES[face];
+				if (stem.size() > suffix.size() && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0)
+				{
+					auto& faces = cubeMaps[stem.substr(0, stem.size() - suffix.size())];
+					faces.resize(6);
+					faces[face] = image;
+				}
+			}
+		}
+
+		std::vector<BakeJob> jobs;
+		std::vector<std::string> cubeFaces;
+		for (const auto& cubeMap : cubeMaps)
+		{
+			if (std::none_of(cubeMap.second.begin(), cubeMap.second.end(), [](const std::string& face) { return face.empty(); }))
+			{
+				jobs.push_back(BakeJob{ cubeMap.first, cubeMap.second });
+				cubeFaces.insert(cubeFaces.end(), cubeMap.second.begin(), cubeMap.second.end());
+			}
+		}
+		for (const auto& image : images)
+		{
+			if (std::find(cubeFaces.begin(), cubeFaces.end(), image) == cubeFaces.end())
+				jobs.push_back(BakeJob{ image, { image } });
+		}
+		return jobs;
+	}
+
+	BakeResult bakeJob(const BakeJob& job, const BakeOptions& options)
+	{
+		BakeResult result;
+
+		KtxTexture existing;
+		const std::string path = bakedTexturePath(job.name);
+		if (!options.force && openKtx(path, existing) && isKtxFresh(path, existing) && existing.sources == job.sources)
+		{
+			result.skipped = true;
+			return result;
+		}
+		existing = KtxTexture();
+
+		std::vector<DecodedImage> images(job.sources.size());
+		std::vector<const DecodedImage*> faces;
+		bool transparent = false;
+		for (size_t i = 0; i < job.sources.size(); i++)
+		{
+			if (!decodeImage(job.sources[i], images[i]))
+				return result;
+			transparent = transparent || hasTransparency(images[i]);
+			faces.push_back(&images[i]);
+		}
+
+		if (options.format == "rgba8") result.format = BAKE_RGBA8;
+		else if (options.format == "bc1") result.format = BAKE_BC1;
+		else if (options.format == "bc3") result.format = BAKE_BC3;
+		else result.format = transparent ? BAKE_BC3 : BAKE_BC1;
+
+		result.width = images[0].width;
+		result.height = images[0].height;
+		for (const auto& image : images)
+			result.rgbaBytes += rgbaMipChainBytes(image.width, image.height);
+		result.baked = bakeTexture(job.name, faces, job.sources, result.format, result.bakedBytes);
+
+		KtxTexture written;
+		if (result.baked && openKtx(path, written))
+			result.numLevels = written.numLevels;
+		return result;
+	}
+
+	/**
+	 * @brief Imports, simplifies and reorders the meshes of a model and rewrites its mesh cache.
+	*/
+	ModelBakeResult bakeModel(const std::string& fileName)
+	{
+		ModelBakeResult result;
+		std::vector<MeshData> meshes;
+		bool parsed = hasObjExtension(fileName) && parseObjModel(fileName, meshes);
+		if (!parsed && !importModel(fileName, meshes))
+			return result;
+
+		// the same steps as loadModelData(), measured around the reordering
+		for (auto& mesh : meshes)
+		{
+			MeshBakeStats stats;
+			buildLodChain(mesh);
+			stats.before = analyzeMeshOrder(mesh);
+			optimizeMesh(mesh);
+			stats.after = analyzeMeshOrder(mesh);
+			mesh.packIndices();
+
+			const MeshView view = mesh.view();
+			stats.numTriangles = view.numTriangles;
+			stats.numLods = view.lods.size();
+			result.meshes.push_back(stats);
+		}
+
+		const uint64_t sourceHash = hashModelSource(fileName);
+		result.baked = sourceHash != 0 && writeMeshCache(fileName, sourceHash, meshes);
+		return result;
+	}
+
+	const char* formatName(BakeFormat format)
+	{
+		switch (format)
+		{
+		case BAKE_RGBA8: return "RGBA8";
+		case BAKE_BC1: return "BC1";
+		case BAKE_BC3: return "BC3";
+		}
+		return "?";
+	}
+}
+
+/**
+ * @brief Entry point of the texture baker.
+ * @param argc number of command-line arguments
+ * @param argv command-line arguments array
+ * @return program exit code
+*/
+int main(int argc, char** argv)
+{
+	BakeOptions options;
+	if (!parseOptions(argc, argv, options))
+		return EXIT_FAILURE;
+
+	ilInit();
+
+	const std::vector<BakeJob> jobs = collectJobs(options.paths);
+	const std::vector<std::string> models = collectFiles(options.paths, isModelFile);
+	TaskPool pool;
+	std::vector<std::future<BakeResult>> results;
+	for (const auto& job : jobs)
+		results.push_back(pool.submit([&job, &options]() { return bakeJob(job, options); }));
+	std::vector<std::future<ModelBakeResult>> modelResults;
+	for (const auto& model : models)
+		modelResults.push_back(pool.submit([&model]() { return bakeModel(model); }));
+
+	size_t rgbaTotal = 0, bakedTotal = 0;
+	int numBaked = 0, numSkipped = 0, numFailed = 0;
+	const auto flags = std::cout.flags();
+	std::cout << std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const BakeResult result = results[i].get();
+		const std::string path = bakedTexturePath(jobs[i].name);
+		if (result.skipped)
+		{
+			std::cout << std::left << std::setw(40) << path << std::right << " up to date" << std::endl;
+			numSkipped++;
+			continue;
+		}
+		if (!result.baked)
+		{
+			std::cerr << path << " baking failed." << std::endl;
+			numFailed++;
+			continue;
+		}
+
+		std::cout << std::left << std::setw(40) << path << std::right
+			<< std::setw(6) << result.width << "x" << std::left << std::setw(6) << result.height << std::right
+			<< std::setw(3) << result.numLevels << " levels " << std::setw(6) << formatName(result.format)
+			<< std::setw(9) << result.rgbaBytes / (1024.0 * 1024.0) << " MiB ->"
+			<< std::setw(7) << result.bakedBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+		rgbaTotal += result.rgbaBytes;
+		bakedTotal += result.bakedBytes;
+		numBaked++;
+	}
+
+	std::cout << numBaked << " baked, " << numSkipped << " up to date, " << numFailed << " failed; VRAM "
+		<< rgbaTotal / (1024.0 * 1024.0) << " MiB as RGBA8 with mipmaps -> " << bakedTotal / (1024.0 * 1024.0)
+		<< " MiB baked, " << (rgbaTotal - bakedTotal) / (1024.0 * 1024.0) << " MiB saved" << std::endl;
+
+	int numModelsFailed = 0;
+	std::cout << std::setprecision(3) << "Meshes (full detail, " << VERTEX_CACHE_SIZE << " entry FIFO cache):" << std::endl;
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		const ModelBakeResult result = modelResults[i].get();
+		if (!result.baked)
+		{
+			std::cerr << meshCachePath(models[i]) << " baking failed." << std::endl;
+			numModelsFailed++;
+		}
+		for (size_t m = 0; m < result.meshes.size(); m++)
+		{
+			const MeshBakeStats& stats = result.meshes[m];
+			const std::string name = result.meshes.size() > 1 ? models[i] + "#" + std::to_string(m) : models[i];
+			std::cout << "  " << std::left << std::setw(34) << name << std::right
+				<< std::setw(7) << stats.numTriangles << " t " << stats.numLods << " lods"
+				<< "  ACMR " << stats.before.acmr << " -> " << stats.after.acmr
+				<< "  ATVR " << stats.before.atvr << " -> " << stats.after.atvr
+				<< "  overdraw " << stats.before.overdraw << " -> " << stats.after.overdraw << std::endl;
+		}
+	}
+	std::cout << models.size() - numModelsFailed << " mesh caches written, " << numModelsFailed << " failed" << std::endl;
+	std::cout.flags(flags);
+
+	return numFailed == 0 && numModelsFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,843 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    bench.cpp : Headless frame benchmark.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Renders the scene into an offscreen framebuffer without a window and reports
+ *          CPU/GPU frame time statistics as JSON or CSV.
+ *
+ * Usage: wildisland_bench [--frames N] [--warmup N] [--width W] [--height H] [--camera C]
+ *                         [--dt SECONDS] [--fog] [--flash] [--sparkles] [--no-sun]
+ *                         [--float-vertices] [--no-occlusion] [--no-multidraw] [--no-gpu-culling]
+ *                         [--palms N] [--terrain N] [--lights N] [--light-sweep]
+ *                         [--branching-lights] [--light-variants] [--format json|csv] [--out FILE]
+ *                         [--trace FILE]
+ *        wildisland_bench --parse-bench [--iterations N] [--format json|csv] [--out FILE]
+ *
+ * --palms and --terrain scatter that many more objects around the island, to see how the frame
+ * scales with the object count.
+ *
+ * --lights replaces the campfires of the scene with N point lights; --light-sweep renders the
+ * scene with 0 to 1024 of them instead and reports the frame times of every count.
+ *
+ * --branching-lights draws with the light shader build that branches on the lights of the frame
+ * instead of the permutation compiled for them; --light-variants renders every combination of
+ * sun, flashlight, sparkles light and fog with both builds and reports their GPU times and, where
+ * the driver returns program binaries, their sizes as a rough measure of instructions.
+ *
+ * Every frame also times the terrain, palms, props, GPU culling, skybox, sparkles and banner on
+ * the GPU (gputimer.cpp), reported as the gpu_<part>_ms series; gpu_ms is the whole frame.
+ *
+ * --trace writes the CPU zones of the startup and of the rendered frames (profiler.cpp) as a
+ * Chrome trace, to open in chrome://tracing or Perfetto.
+ *
+ * The JSON report also has the startup time and how many programs came from the program cache;
+ * delete data/programs to measure a cold start.
+ *
+ * --parse-bench needs no OpenGL: it compares the throughput (MB/s of .obj source) of the
+ * built-in OBJ parser against assimp.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+#include <cmath>
+
+#include "pgr.h"
+#include "render.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "gpuculling.h"
+#include "lighting.h"
+#include "gputimer.h"
+#include "profiler.h"
+#include "renderstats.h"
+#include "programcache.h"
+#include "utils.h"
+#include "objparser.h"
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace manaeste;
+
+extern RenderQueueStats renderQueueStats;
+extern CullStats cullStats;
+extern OcclusionStats occlusionStats;
+extern bool occlusionCulling;
+extern bool quantizeVertices;
+extern bool multiDraw;
+extern bool gpuCulling;
+extern GpuCullStats gpuCullStats;
+extern LightClusterStats lightClusterStats;
+extern bool lightVariants;
+extern MainShaderProgram shaderProgram;
+extern MultiDrawShaderProgram multiDrawShaderProgram;
+extern ProgramCacheStats programCacheStats;
+extern GpuTimes gpuTimes;
+
+namespace
+{
+	struct BenchOptions
+	{
+		int frames = 500;
+		int warmup = 50;
+		int width = 1000;
+		int height = 800;
+		int camera = 4;
+		float dt = 1.0f / 30.0f; ///< simulated time step, matches the 33 ms GLUT timer
+		bool fog{};
+		bool flash{};
+		bool sparkles{};
+		bool sun = true;
+		bool floatVertices{};
+		bool noOcclusion{};
+		bool noMultiDraw{};
+		bool noGpuCulling{};
+		int palms = 0;           ///< palms scattered in addition to the scene
+		int terrain = 0;         ///< terrain elements scattered in addition to the scene
+		int lights = -1;         ///< campfire lights, -1 keeps those of the scene
+		bool lightSweep{};
+		bool branchingLights{};
+		bool lightVariantSweep{};
+		std::string format = "json";
+		std::string outFile;
+		std::string traceFile;
+		bool parseBench{};
+		int iterations = 10;
+	};
+
+	/// One measured value per frame; every series gets its own statistics in the report.
+	struct Series
+	{
+		Series(const std::string& name) : name(name) {}
+
+		std::string name;
+		std::vector<double> values;
+	};
+
+	/// Times of one rendered frame.
+	struct FrameTimes
+	{
+		double cpuMs{};   ///< updateScene() + drawScene() submission
+		double gpuMs{};   ///< between the GL_TIMESTAMP queries of the frame, when measured
+		double frameMs{}; ///< submission + glFinish()
+		GpuTimes passes;  ///< GPU times of the parts of the frame, when measured
+	};
+
+	/// GL_TIMESTAMP queries around a frame, 0 when timer queries are not supported. Unlike a
+	/// GL_TIME_ELAPSED query they may enclose the GL_TIME_ELAPSED queries of the GPU timers.
+	struct FrameTimer
+	{
+		GLuint start{};
+		GLuint end{};
+	};
+
+	struct Offscreen
+	{
+		GLuint fbo{};
+		GLuint color{};
+		GLuint depthStencil{};
+	};
+
+#ifndef _WIN32
+	EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+	EGLContext eglContext = EGL_NO_CONTEXT;
+#endif
+
+	double startupMs = 0.0; ///< initApplication() until every light permutation is built
+
+	void printUsage()
+	{
+		std::cerr << "usage: wildisland_bench [--frames N] [--warmup N] [--width W] [--height H] [--camera 1|2|4|5]" << std::endl
+			<< "                        [--dt SECONDS] [--fog] [--flash] [--sparkles] [--no-sun]" << std::endl
+			<< "                        [--float-vertices] [--no-occlusion] [--no-multidraw] [--no-gpu-culling]" << std::endl
+			<< "                        [--palms N] [--terrain N] [--lights N] [--light-sweep]" << std::endl
+			<< "                        [--branching-lights] [--light-variants] [--format json|csv] [--out FILE]" << std::endl
+			<< "                        [--trace FILE]" << std::endl
+			<< "       wildisland_bench --parse-bench [--iterations N] [--format json|csv] [--out FILE]" << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, BenchOptions& options)
+	{
+		try
+		{
+			for (int i = 1; i < argc; ++i)
+			{
+				std::string arg = argv[i];
+				bool hasValue = i + 1 < argc;
+
+				if (arg == "--frames" && hasValue) options.frames = std::stoi(argv[++i]);
+				else if (arg == "--warmup" && hasValue) options.warmup = std::stoi(argv[++i]);
+				else if (arg == "--width" && hasValue) options.width = std::stoi(argv[++i]);
+				else if (arg == "--height" && hasValue) options.height = std::stoi(argv[++i]);
+				else if (arg == "--camera" && hasValue) options.camera = std::stoi(argv[++i]);
+				else if (arg == "--dt" && hasValue) options.dt = std::stof(argv[++i]);
+				else if (arg == "--format" && hasValue) options.format = argv[++i];
+				else if (arg == "--out" && hasValue) options.outFile = argv[++i];
+				else if (arg == "--trace" && hasValue) options.traceFile = argv[++i];
+				else if (arg == "--fog") options.fog = true;
+				else if (arg == "--flash") options.flash = true;
+				else if (arg == "--sparkles") options.sparkles = true;
+				else if (arg == "--no-sun") options.sun = false;
+				else if (arg == "--float-vertices") options.floatVertices = true;
+				else if (arg == "--no-occlusion") options.noOcclusion = true;
+				else if (arg == "--no-multidraw") options.noMultiDraw = true;
+				else if (arg == "--no-gpu-culling") options.noGpuCulling = true;
+				else if (arg == "--palms" && hasValue) options.palms = std::stoi(argv[++i]);
+				else if (arg == "--terrain" && hasValue) options.terrain = std::stoi(argv[++i]);
+				else if (arg == "--lights" && hasValue) options.lights = std::stoi(argv[++i]);
+				else if (arg == "--light-sweep") options.lightSweep = true;
+				else if (arg == "--branching-lights") options.branchingLights = true;
+				else if (arg == "--light-variants") options.lightVariantSweep = true;
+				else if (arg == "--parse-bench") options.parseBench = true;
+				else if (arg == "--iterations" && hasValue) options.iterations = std::stoi(argv[++i]);
+				else
+				{
+					printUsage();
+					return false;
+				}
+			}
+		}
+		catch (const std::exception&)
+		{
+			// std::stoi() and std::stof() throw on values that are not numbers or out of range
+			printUsage();
+			return false;
+		}
+
+		if (options.frames <= 0 || options.warmup < 0 || options.width <= 0 || options.height <= 0 || options.iterations <= 0 ||
+			options.palms < 0 || options.terrain < 0 || options.lights < -1 ||
+			(options.camera != 1 && options.camera != 2 && options.camera != 4 && options.camera != 5) ||
+			(options.format != "json" && options.format != "csv"))
+		{
+			printUsage();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Creates an OpenGL context without any window.
+	 * Uses a surfaceless EGL display (Mesa llvmpipe works) everywhere but Windows, where
+	 * a hidden GLUT window provides the context instead.
+	*/
+	bool createHeadlessContext(int argc, char** argv)
+	{
+#ifdef _WIN32
+		glutInit(&argc, argv);
+		glutInitContextVersion(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR);
+		glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
+		glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL);
+		glutInitWindowSize(1, 1);
+		glutCreateWindow("wildisland_bench");
+		glutHideWindow();
+		return true;
+#else
+		(void)argc;
+		(void)argv;
+
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (eglDisplay == EGL_NO_DISPLAY)
+			eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major, minor;
+		if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+		{
+			std::cerr << "createHeadlessContext(): no EGL display available" << std::endl;
+			return false;
+		}
+
+		const EGLint configAttribs[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+		{
+			std::cerr << "createHeadlessContext(): no suitable EGL config" << std::endl;
+			return false;
+		}
+
+		eglBindAPI(EGL_OPENGL_API);
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, pgr::OGL_VER_MAJOR,
+			EGL_CONTEXT_MINOR_VERSION, pgr::OGL_VER_MINOR,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+			EGL_NONE
+		};
+		eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+		if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+		{
+			std::cerr << "createHeadlessContext(): EGL context creation failed (0x" << std::hex << eglGetError() << ")" << std::endl;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	void destroyHeadlessContext()
+	{
+#ifndef _WIN32
+		eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(eglDisplay, eglContext);
+		eglTerminate(eglDisplay);
+#endif
+	}
+
+	/**
+	 * @brief Creates the framebuffer the scene is rendered into (color + depth/stencil,
+	 * the stencil is needed by the object picking passes in drawAllObjects()).
+	*/
+	bool createOffscreen(int width, int height, Offscreen& target)
+	{
+		glGenRenderbuffers(1, &target.color);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+		glGenRenderbuffers(1, &target.depthStencil);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.depthStencil);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &target.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depthStencil);
+
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+
+	void deleteOffscreen(Offscreen& target)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &target.fbo);
+		glDeleteRenderbuffers(1, &target.color);
+		glDeleteRenderbuffers(1, &target.depthStencil);
+	}
+
+	/**
+	 * @brief Nearest-rank percentile of an already sorted vector.
+	*/
+	double percentile(const std::vector<double>& sorted, double p)
+	{
+		size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	void writeStats(std::ostream& out, const std::vector<double>& values)
+	{
+		if (values.empty())
+		{
+			out << "null";
+			return;
+		}
+
+		std::vector<double> sorted = values;
+		std::sort(sorted.begin(), sorted.end());
+		double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+
+		out << "{ \"min\": " << sorted.front()
+			<< ", \"median\": " << percentile(sorted, 50.0)
+			<< ", \"p95\": " << percentile(sorted, 95.0)
+			<< ", \"p99\": " << percentile(sorted, 99.0)
+			<< ", \"max\": " << sorted.back()
+			<< ", \"mean\": " << mean << " }";
+	}
+
+	void writeJson(std::ostream& out, const BenchOptions& options, const std::vector<Series>& series)
+	{
+		out << "{" << std::endl;
+		out << "  \"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\"," << std::endl;
+		out << "  \"frames\": " << options.frames << "," << std::endl;
+		out << "  \"warmup\": " << options.warmup << "," << std::endl;
+		out << "  \"width\": " << options.width << "," << std::endl;
+		out << "  \"height\": " << options.height << "," << std::endl;
+		out << "  \"camera\": " << options.camera << "," << std::endl;
+		out << "  \"packed_vertices\": " << (options.floatVertices ? "false" : "true") << "," << std::endl;
+		out << "  \"scattered_palms\": " << options.palms << "," << std::endl;
+		out << "  \"scattered_terrain\": " << options.terrain << "," << std::endl;
+		out << "  \"startup_ms\": " << startupMs << "," << std::endl;
+		out << "  \"programs_from_cache\": " << programCacheStats.loaded << "," << std::endl;
+		out << "  \"programs_compiled\": " << programCacheStats.compiled << "," << std::endl;
+		out << "  \"program_wait_ms\": " << programCacheStats.waitMs << "," << std::endl;
+
+		for (size_t s = 0; s < series.size(); ++s)
+		{
+			out << "  \"" << series[s].name << "\": ";
+			writeStats(out, series[s].values);
+			out << (s + 1 < series.size() ? "," : "") << std::endl;
+		}
+		out << "}" << std::endl;
+	}
+
+	void writeCsv(std::ostream& out, const BenchOptions& options, const std::vector<Series>& series)
+	{
+		out << "frame";
+		for (const auto& s : series)
+			out << "," << s.name;
+		out << std::endl;
+
+		for (int frame = 0; frame < options.frames; ++frame)
+		{
+			out << frame;
+			for (const auto& s : series)
+			{
+				out << ",";
+				if (frame < (int)s.values.size())
+					out << s.values[frame];
+			}
+			out << std::endl;
+		}
+	}
+
+	/**
+	 * @brief Updates and draws the frame at the simulated time of its number and waits for it.
+	 * @param frame number of the frame, negative during the warmup
+	 * @param timer queries around the frame
+	*/
+	FrameTimes renderFrame(const BenchOptions& options, int frame, const FrameTimer& timer)
+	{
+		using Clock = std::chrono::steady_clock;
+		auto toMs = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+		sceneState.elapsedTime = (frame + options.warmup) * options.dt;
+
+		auto start = Clock::now();
+		if (timer.start)
+			glQueryCounter(timer.start, GL_TIMESTAMP);
+
+		updateScene(sceneState.elapsedTime);
+		clearGLbuffers();
+		drawScene();
+
+		if (timer.start)
+			glQueryCounter(timer.end, GL_TIMESTAMP);
+		auto submitted = Clock::now();
+		glFinish();
+		auto finished = Clock::now();
+		collectGpuTimers();
+		markCpuFrame();
+
+		FrameTimes times;
+		times.cpuMs = toMs(submitted - start);
+		times.frameMs = toMs(finished - start);
+		if (timer.start)
+		{
+			GLuint64 startNs = 0, endNs = 0;
+			glGetQueryObjectui64v(timer.start, GL_QUERY_RESULT, &startNs);
+			glGetQueryObjectui64v(timer.end, GL_QUERY_RESULT, &endNs);
+			times.gpuMs = (endNs - startNs) * 1e-6;
+			times.passes = gpuTimes;
+		}
+		return times;
+	}
+
+	/**
+	 * @brief Renders the scene with a growing number of campfire lights and reports the frame
+	 * times of every count, to see how the clustered lighting scales.
+	 * @param timer queries around the frames
+	*/
+	void runLightSweep(std::ostream& out, const BenchOptions& options, const FrameTimer& timer)
+	{
+		const int lightCounts[] = { 0, 16, 64, 256, 1024 };
+
+		const bool csv = options.format == "csv";
+		if (csv)
+			out << "lights,frame,cpu_ms,gpu_ms,frame_ms,light_cluster_entries" << std::endl;
+		else
+			out << "{" << std::endl << "  \"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\"," << std::endl
+				<< "  \"frames\": " << options.frames << "," << std::endl << "  \"light_sweep\": [" << std::endl;
+
+		for (size_t c = 0; c < std::size(lightCounts); ++c)
+		{
+			placeCampfires(lightCounts[c]);
+
+			Series sweep[4] = { { "cpu_ms" }, { "gpu_ms" }, { "frame_ms" }, { "light_cluster_entries" } };
+			for (int frame = -options.warmup; frame < options.frames; ++frame)
+			{
+				FrameTimes times = renderFrame(options, frame, timer);
+				if (frame < 0)
+					continue;
+
+				sweep[0].values.push_back(times.cpuMs);
+				sweep[2].values.push_back(times.frameMs);
+				sweep[3].values.push_back(lightClusterStats.entries);
+				if (timer.start)
+					sweep[1].values.push_back(times.gpuMs);
+
+				if (csv)
+					out << lightCounts[c] << "," << frame << "," << sweep[0].values.back() << ","
+						<< (timer.start ? std::to_string(sweep[1].values.back()) : "") << "," << sweep[2].values.back() << ","
+						<< sweep[3].values.back() << std::endl;
+			}
+
+			if (csv)
+				continue;
+			out << "    { \"lights\": " << lightCounts[c];
+			for (const auto& s : sweep)
+			{
+				out << "," << std::endl << "      \"" << s.name << "\": ";
+				writeStats(out, s.values);
+			}
+			out << " }" << (c + 1 < std::size(lightCounts) ? "," : "") << std::endl;
+		}
+
+		if (!csv)
+			out << "  ]" << std::endl << "}" << std::endl;
+	}
+
+	/**
+	 * @brief Size of the binary the driver returns for a program, -1 without GL 4.1 program binaries.
+	*/
+	GLint programBinaryBytes(GLuint program)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major < 4 || (major == 4 && minor < 1))
+			return -1;
+
+		GLint bytes = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &bytes);
+		return bytes;
+	}
+
+	/**
+	 * @brief Renders every combination of the sun, flashlight, sparkles light and fog, once with the
+	 * light permutation compiled for it and once with the branching build, and reports both.
+	 * The scene state of the options is restored afterwards.
+	 * @param timer queries around the frames
+	*/
+	void runLightVariants(std::ostream& out, const BenchOptions& options, const FrameTimer& timer)
+	{
+		const char* builds[2] = { "variant", "branching" };
+		const bool csv = options.format == "csv";
+		if (csv)
+			out << "variant,sun,flash,point,fog,build,program_bytes,frame,gpu_ms,frame_ms" << std::endl;
+		else
+			out << "{" << std::endl << "  \"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\"," << std::endl
+				<< "  \"frames\": " << options.frames << "," << std::endl << "  \"light_variants\": [" << std::endl;
+
+		for (int variant = 0; variant < NUM_LIGHT_VARIANTS; ++variant)
+		{
+			sceneState.sunOn = (variant & LIGHT_SUN) != 0;
+			sceneState.flashlightOn = (variant & LIGHT_FLASH) != 0;
+			sceneState.sparklesOn = (variant & LIGHT_POINT) != 0;
+			sceneState.fogOn = (variant & LIGHT_FOG) != 0;
+			const std::string flags = std::string(sceneState.sunOn ? "true" : "false") + "," + (sceneState.flashlightOn ? "true" : "false") +
+				"," + (sceneState.sparklesOn ? "true" : "false") + "," + (sceneState.fogOn ? "true" : "false");
+
+			Series gpuMs[2] = { { "variant_gpu_ms" }, { "branching_gpu_ms" } };
+			Series frameMs[2] = { { "variant_frame_ms" }, { "branching_frame_ms" } };
+			GLint programBytes[2] = {};
+			for (int build = 0; build < 2; ++build)
+			{
+				lightVariants = build == 0;
+				const bool multi = multiDrawActive();
+				programBytes[build] = programBinaryBytes(build == 0 ?
+					(multi ? multiDrawShaderProgram.variants[variant] : shaderProgram.variants[variant]) :
+					(multi ? multiDrawShaderProgram.branching : shaderProgram.branching));
+
+				for (int frame = -options.warmup; frame < options.frames; ++frame)
+				{
+					FrameTimes times = renderFrame(options, frame, timer);
+					if (frame < 0)
+						continue;
+
+					frameMs[build].values.push_back(times.frameMs);
+					if (timer.start)
+						gpuMs[build].values.push_back(times.gpuMs);
+					if (csv)
+						out << variant << "," << flags << "," << builds[build] << "," << programBytes[build] << "," << frame << ","
+							<< (timer.start ? std::to_string(times.gpuMs) : "") << "," << times.frameMs << std::endl;
+				}
+			}
+
+			if (csv)
+				continue;
+			out << "    { \"variant\": " << variant << ", \"sun\": " << (sceneState.sunOn ? "true" : "false")
+				<< ", \"flash\": " << (sceneState.flashlightOn ? "true" : "false")
+				<< ", \"point\": " << (sceneState.sparklesOn ? "true" : "false")
+				<< ", \"fog\": " << (sceneState.fogOn ? "true" : "false") << "," << std::endl
+				<< "      \"variant_program_bytes\": " << programBytes[0] << ", \"branching_program_bytes\": " << programBytes[1];
+			for (int build = 0; build < 2; ++build)
+			{
+				out << "," << std::endl << "      \"" << gpuMs[build].name << "\": ";
+				writeStats(out, gpuMs[build].values);
+				out << "," << std::endl << "      \"" << frameMs[build].name << "\": ";
+				writeStats(out, frameMs[build].values);
+			}
+			out << " }" << (variant + 1 < NUM_LIGHT_VARIANTS ? "," : "") << std::endl;
+		}
+
+		if (!csv)
+			out << "  ]" << std::endl << "}" << std::endl;
+
+		lightVariants = !options.branchingLights;
+		sceneState.sunOn = options.sun;
+		sceneState.flashlightOn = options.flash;
+		sceneState.sparklesOn = options.sparkles;
+		sceneState.fogOn = options.fog;
+	}
+
+	/**
+	 * @brief Times the built-in OBJ parser against assimp on the largest models of the scene.
+	 * Reports MB/s of .obj source; the mesh cache is bypassed.
+	*/
+	void runParseBench(std::ostream& out, const BenchOptions& options)
+	{
+		const std::vector<std::string> models = { "data/ground/ground.obj", "data/rubberduck/rubberduck.obj" };
+
+		using Clock = std::chrono::steady_clock;
+		const bool csv = options.format == "csv";
+		if (csv)
+			out << "model,parser,iteration,ms,mb_s" << std::endl;
+		else
+			out << "{" << std::endl << "  \"iterations\": " << options.iterations << "," << std::endl << "  \"models\": [" << std::endl;
+
+		for (size_t m = 0; m < models.size(); ++m)
+		{
+			MappedFile source;
+			if (!source.open(models[m]))
+			{
+				std::cerr << "Cannot open " << models[m] << std::endl;
+				continue;
+			}
+			const double megabytes = source.size() / 1e6;
+
+			Series parsers[2] = { { "objparser_mb_s" }, { "assimp_mb_s" } };
+			for (int i = 0; i < options.iterations; ++i)
+			{
+				for (int p = 0; p < 2; ++p)
+				{
+					std::vector<MeshData> meshes;
+					auto start = Clock::now();
+					bool loaded = p == 0 ? parseObjModel(models[m], meshes) : importModel(models[m], meshes);
+					double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+					if (!loaded)
+						continue;
+
+					parsers[p].values.push_back(megabytes / (ms * 1e-3));
+					if (csv)
+						out << models[m] << "," << (p == 0 ? "objparser" : "assimp") << "," << i << "," << ms << "," << parsers[p].values.back() << std::endl;
+				}
+			}
+
+			if (csv)
+				continue;
+			out << "    { \"model\": \"" << models[m] << "\", \"bytes\": " << source.size() << "," << std::endl;
+			out << "      \"" << parsers[0].name << "\": ";
+			writeStats(out, parsers[0].values);
+			out << "," << std::endl << "      \"" << parsers[1].name << "\": ";
+			writeStats(out, parsers[1].values);
+			out << " }" << (m + 1 < models.size() ? "," : "") << std::endl;
+		}
+
+		if (!csv)
+			out << "  ]" << std::endl << "}" << std::endl;
+	}
+}
+
+/**
+ * @brief Entry point of the benchmark.
+ * @param argc number of command-line arguments
+ * @param argv command-line arguments array
+ * @return program exit code
+*/
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!parseOptions(argc, argv, options))
+		return EXIT_FAILURE;
+
+	std::ofstream file;
+	if (!options.outFile.empty())
+		file.open(options.outFile);
+	std::ostream& out = options.outFile.empty() ? std::cout : file;
+
+	if (options.parseBench)
+	{
+		runParseBench(out, options);
+		return EXIT_SUCCESS;
+	}
+
+	sceneState.headless = true;
+	loadConfig("config.txt");
+
+	if (!createHeadlessContext(argc, argv))
+		return EXIT_FAILURE;
+	if (!pgr::initialize(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR))
+		pgr::dieWithError("pgr init failed, required OpenGL not supported?");
+
+	Offscreen target;
+	if (!createOffscreen(options.width, options.height, target))
+	{
+		std::cerr << "Offscreen framebuffer is incomplete." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	quantizeVertices = !options.floatVertices;
+	occlusionCulling = !options.noOcclusion;
+	multiDraw = !options.noMultiDraw;
+	gpuCulling = !options.noGpuCulling;
+	lightVariants = !options.branchingLights;
+	// the measured frames draw with the light permutations, not with the branching build standing in for them
+	const auto startupStart = std::chrono::steady_clock::now();
+	initApplication();
+	waitForLightVariants();
+	startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count();
+	scatterObjects(PALM, options.palms);
+	scatterObjects(TERRAIN_ELEMENT, options.terrain);
+	if (options.lights >= 0)
+		placeCampfires(options.lights);
+
+	sceneState.windowWidth = options.width;
+	sceneState.windowHeight = options.height;
+	glViewport(0, 0, options.width, options.height);
+
+	sceneState.cameraNum = options.camera;
+	sceneState.fogOn = options.fog;
+	sceneState.flashlightOn = options.flash;
+	sceneState.sparklesOn = options.sparkles;
+	sceneState.sunOn = options.sun;
+
+	bool gpuTiming = timerQueriesSupported();
+	FrameTimer timer;
+	if (gpuTiming)
+	{
+		glGenQueries(1, &timer.start);
+		glGenQueries(1, &timer.end);
+	}
+
+	if (options.lightSweep || options.lightVariantSweep)
+	{
+		if (options.lightSweep)
+			runLightSweep(out, options, timer);
+		else
+			runLightVariants(out, options, timer);
+		if (!options.traceFile.empty())
+			writeCpuTrace(options.traceFile);
+		if (gpuTiming)
+		{
+			glDeleteQueries(1, &timer.start);
+			glDeleteQueries(1, &timer.end);
+		}
+		finalizeApplication();
+		deleteOffscreen(target);
+		destroyHeadlessContext();
+		return EXIT_SUCCESS;
+	}
+
+	Series cpuMs{ "cpu_ms" };     ///< updateScene() + drawScene() submission
+	Series gpuMs{ "gpu_ms" };     ///< GPU time of the frame, between two GL_TIMESTAMP queries
+	Series frameMs{ "frame_ms" }; ///< submission + glFinish()
+	Series objects{ "objects" };                    ///< objects passed to drawObject() per frame
+	Series uniformCalls{ "uniform_calls" };         ///< glUniform* calls per frame
+	Series uniformUploads{ "uniform_block_uploads" }; ///< uniform block uploads per frame
+	Series uploadedBytes{ "uploaded_bytes" };       ///< bytes written into buffers per frame
+	Series drawCalls{ "draw_calls" };               ///< draw calls per frame
+	Series triangles{ "triangles" };                ///< triangles per frame, after the level of detail selection
+	Series instances{ "instances" };                ///< meshes drawn per frame, every instance counted
+	Series programSwitches{ "program_switches" };   ///< glUseProgram() calls per frame
+	Series vertexArrayBinds{ "vertex_array_binds" }; ///< glBindVertexArray() calls per frame
+	Series textureBinds{ "texture_binds" };         ///< glBindTexture() calls per frame
+	Series capabilityToggles{ "capability_toggles" }; ///< glEnable() and glDisable() calls per frame
+	Series stateChanges{ "state_changes" };         ///< program, vertex array, texture and stencil changes of the sorted render queue
+	Series queuedStateChanges{ "state_changes_unsorted" }; ///< the same, had the queue been submitted in drawing order
+	Series visible{ "visible" };                    ///< bounding spheres inside the view frustum (draws and instances)
+	Series culled{ "culled" };                      ///< bounding spheres culled
+	Series occluded{ "occluded" };                  ///< draws and instances hidden behind the occluders
+	Series occluderTriangles{ "occluder_triangles" }; ///< triangles rasterized into the occlusion buffer
+	Series stateCalls{ "gl_state_calls" };          ///< state calls the state cache passed to the driver
+	Series elidedStateCalls{ "gl_state_calls_elided" }; ///< state calls the state cache skipped as redundant
+	Series gpuInstances{ "gpu_instances" };         ///< instances culled on the GPU
+	Series gpuVisible{ "gpu_visible" };             ///< of those, drawn (read back after the frame)
+	Series lightsVisible{ "lights_visible" };       ///< point lights in at least one cluster
+	Series lightEntries{ "light_cluster_entries" }; ///< light indices of all clusters
+	std::vector<Series> passMs;                     ///< GPU time of every timed part of the frame
+	for (int pass = 0; pass < NUM_GPU_TIMERS; ++pass)
+		passMs.push_back({ std::string("gpu_") + gpuTimerName((GpuTimer)pass) + "_ms" });
+
+	for (int frame = -options.warmup; frame < options.frames; ++frame)
+	{
+		FrameTimes times = renderFrame(options, frame, timer);
+		if (frame < 0)
+			continue;
+
+		cpuMs.values.push_back(times.cpuMs);
+		frameMs.values.push_back(times.frameMs);
+		const RenderStats& stats = lastRenderStats();
+		objects.values.push_back(stats.objects);
+		uniformCalls.values.push_back(stats.uniformCalls);
+		uniformUploads.values.push_back(stats.uniformBlockUploads);
+		uploadedBytes.values.push_back((double)stats.uploadedBytes);
+		drawCalls.values.push_back(stats.drawCalls);
+		triangles.values.push_back(stats.triangles);
+		instances.values.push_back(stats.instances);
+		programSwitches.values.push_back(stats.programSwitches);
+		vertexArrayBinds.values.push_back(stats.vertexArrayBinds);
+		textureBinds.values.push_back(stats.textureBinds);
+		capabilityToggles.values.push_back(stats.capabilityToggles);
+		stateChanges.values.push_back(totalStateChanges(renderQueueStats.submitted));
+		queuedStateChanges.values.push_back(totalStateChanges(renderQueueStats.queued));
+		visible.values.push_back(cullStats.tested - cullStats.culled);
+		culled.values.push_back(cullStats.culled);
+		occluded.values.push_back(occlusionStats.occluded);
+		occluderTriangles.values.push_back(occlusionStats.occluderTriangles);
+		GlStateStats glStats = glStateStats();
+		stateCalls.values.push_back(totalGlStateCalls(glStats.issued));
+		elidedStateCalls.values.push_back(totalGlStateCalls(glStats.elided));
+		gpuInstances.values.push_back(gpuCullStats.instances);
+		gpuVisible.values.push_back(readGpuVisibleInstances());
+		lightsVisible.values.push_back(lightClusterStats.visible);
+		lightEntries.values.push_back(lightClusterStats.entries);
+		if (gpuTiming)
+		{
+			gpuMs.values.push_back(times.gpuMs);
+			for (int pass = 0; pass < NUM_GPU_TIMERS; ++pass)
+				passMs[pass].values.push_back(times.passes.ms[pass]);
+		}
+	}
+	CHECK_GL_ERROR();
+
+	std::vector<Series> series = { cpuMs, gpuMs, frameMs, objects, uniformCalls, uniformUploads, uploadedBytes, drawCalls, triangles,
+		instances, programSwitches, vertexArrayBinds, textureBinds, capabilityToggles, visible, culled, occluded, occluderTriangles,
+		stateChanges, queuedStateChanges, stateCalls, elidedStateCalls, gpuInstances, gpuVisible, lightsVisible, lightEntries };
+	series.insert(series.begin() + 2, passMs.begin(), passMs.end());
+
+	if (options.format == "csv")
+		writeCsv(out, options, series);
+	else
+		writeJson(out, options, series);
+	if (!options.traceFile.empty())
+		writeCpuTrace(options.traceFile);
+
+	if (gpuTiming)
+	{
+		glDeleteQueries(1, &timer.start);
+		glDeleteQueries(1, &timer.end);
+	}
+	finalizeApplication();
+	deleteOffscreen(target);
+	destroyHeadlessContext();
+
+	return EXIT_SUCCESS;
+}
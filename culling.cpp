@@ -0,0 +1,158 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    culling.cpp : View frustum culling.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Every mesh gets a bounding sphere when it is loaded. Each frame the spheres of the
+ *          queued draws are moved to world space and tested against the six frustum planes,
+ *          four at a time with SSE where the compiler targets it.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include "culling.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+
+using namespace manaeste;
+
+CullStats cullStats; ///< spheres tested and culled in the current frame
+
+namespace
+{
+	Frustum frameFrustum;
+
+	bool sphereVisible(const Frustum& frustum, float x, float y, float z, float radius)
+	{
+		for (const auto& plane : frustum.planes)
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < -radius)
+				return false;
+		return true;
+	}
+}
+
+/**
+ * @brief Extracts the frustum planes from a projection-view matrix (Gribb and Hartmann).
+ * @param projViewMat projection * view matrix
+ * @return world space frustum
+*/
+Frustum manaeste::frustumFromMatrix(const glm::mat4& projViewMat)
+{
+	const glm::mat4 rows = glm::transpose(projViewMat);
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // left
+	frustum.planes[1] = rows[3] - rows[0]; // right
+	frustum.planes[2] = rows[3] + rows[1]; // bottom
+	frustum.planes[3] = rows[3] - rows[1]; // top
+	frustum.planes[4] = rows[3] + rows[2]; // near
+	frustum.planes[5] = rows[3] - rows[2]; // far
+	for (auto& plane : frustum.planes)
+		plane = plane * (1.0f / glm::length(glm::vec3(plane)));
+	return frustum;
+}
+
+/**
+ * @brief Sets the frustum the draws of this frame are culled against and restarts the statistics.
+ * @param projViewMat projection * view matrix of the frame
+*/
+void manaeste::setCullingFrustum(const glm::mat4& projViewMat)
+{
+	frameFrustum = frustumFromMatrix(projViewMat);
+	cullStats = CullStats();
+}
+
+/**
+ * @brief Frustum set by setCullingFrustum().
+ * @return frustum of the frame
+*/
+const Frustum& manaeste::cullingFrustum()
+{
+	return frameFrustum;
+}
+
+/**
+ * @brief Moves an object space bounding sphere into world space.
+ * @param sphere center and radius
+ * @param modelMat model matrix
+ * @return world space sphere, scaled by the largest scale of the model matrix
+*/
+glm::vec4 manaeste::transformSphere(const glm::vec4& sphere, const glm::mat4& modelMat)
+{
+	const float scale = std::max(glm::length(glm::vec3(modelMat[0])),
+		std::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+	return glm::vec4(glm::vec3(modelMat * glm::vec4(glm::vec3(sphere), 1.0f)), sphere.w * scale);
+}
+
+/**
+ * @brief Appends a sphere.
+ * @param bounds spheres
+ * @param sphere world space center and radius
+*/
+void manaeste::addBounds(BoundsArray& bounds, const glm::vec4& sphere)
+{
+	bounds.x.push_back(sphere.x);
+	bounds.y.push_back(sphere.y);
+	bounds.z.push_back(sphere.z);
+	bounds.radius.push_back(sphere.w);
+}
+
+/**
+ * @brief Removes all spheres, keeping the memory.
+ * @param bounds spheres
+*/
+void manaeste::clearBounds(BoundsArray& bounds)
+{
+	bounds.x.clear();
+	bounds.y.clear();
+	bounds.z.clear();
+	bounds.radius.clear();
+}
+
+/**
+ * @brief Tests spheres against a frustum. A sphere is culled when it lies completely behind
+ *        one of the planes; spheres near a corner may be kept although they are outside.
+ * @param frustum frustum
+ * @param bounds spheres, a negative radius is never culled
+ * @param visible 1 for every sphere that may be visible, 0 for culled ones
+ * @return number of visible spheres
+*/
+size_t manaeste::cullSpheres(const Frustum& frustum, const BoundsArray& bounds, std::vector<uint8_t>& visible)
+{
+	const size_t count = bounds.x.size();
+	visible.resize(count);
+
+	size_t i = 0;
+#ifdef CULLING_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(&bounds.x[i]);
+		const __m128 y = _mm_loadu_ps(&bounds.y[i]);
+		const __m128 z = _mm_loadu_ps(&bounds.z[i]);
+		const __m128 radius = _mm_loadu_ps(&bounds.radius[i]);
+		const __m128 minusRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+		__m128 outside = _mm_setzero_ps();
+		for (const auto& plane : frustum.planes)
+		{
+			__m128 distance = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+			distance = _mm_add_ps(distance, _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, minusRadius));
+		}
+		// a negative radius makes minusRadius positive, keep those
+		outside = _mm_andnot_ps(_mm_cmplt_ps(radius, _mm_setzero_ps()), outside);
+		const int mask = _mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+			visible[i + lane] = ((mask >> lane) & 1) ? 0 : 1;
+	}
+#endif
+	for (; i < count; i++)
+		visible[i] = (bounds.radius[i] < 0.0f || sphereVisible(frustum, bounds.x[i], bounds.y[i], bounds.z[i], bounds.radius[i])) ? 1 : 0;
+
+	const size_t numVisible = (size_t)std::count(visible.begin(), visible.end(), (uint8_t)1);
+	cullStats.tested += (unsigned int)count;
+	cullStats.culled += (unsigned int)(count - numVisible);
+	return numVisible;
+}
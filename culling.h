@@ -0,0 +1,48 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    culling.h : Header file for culling.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   View frustum culling of bounding spheres.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "pgr.h"
+
+namespace manaeste
+{
+	/// Planes of the view frustum, normals point inside and are normalized.
+	typedef struct Frustum
+	{
+		glm::vec4 planes[6]{};
+	} Frustum;
+
+	/// World space bounding spheres, one array per component so four are tested at once.
+	typedef struct BoundsArray
+	{
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+		std::vector<float> radius;
+	} BoundsArray;
+
+	/// Bounding spheres tested in the current frame and how many were outside the frustum.
+	typedef struct CullStats
+	{
+		unsigned int tested{};
+		unsigned int culled{};
+	} CullStats;
+
+	Frustum frustumFromMatrix(const glm::mat4& projViewMat);
+	void setCullingFrustum(const glm::mat4& projViewMat);
+	const Frustum& cullingFrustum();
+
+	glm::vec4 transformSphere(const glm::vec4& sphere, const glm::mat4& modelMat);
+	void addBounds(BoundsArray& bounds, const glm::vec4& sphere);
+	void clearBounds(BoundsArray& bounds);
+	size_t cullSpheres(const Frustum& frustum, const BoundsArray& bounds, std::vector<uint8_t>& visible);
+}
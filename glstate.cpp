@@ -0,0 +1,289 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    glstate.cpp : GL state cache.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Every draw sets the state it needs through these functions instead of restoring
+ *          defaults after itself. The cache remembers the last value set and skips the driver
+ *          call when it would not change anything.
+ *
+ * The shadow copy is only right while nothing else changes the same state. Code outside the
+ * frame (loading, teardown) may call GL directly and must call resetGlState() afterwards.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include "glstate.h"
+#include "renderstats.h"
+
+using namespace manaeste;
+
+namespace
+{
+	const GLuint UNKNOWN = 0xFFFFFFFF; ///< shadowed value not known, the next call is always made
+
+	const GLenum CAPABILITIES[NUM_GL_CAPABILITIES] = { GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND };
+	const GLenum TEXTURE_TARGETS[] = { GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER, GL_TEXTURE_2D_ARRAY };
+	const GLenum BUFFER_TARGETS[] = { GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_TEXTURE_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_DRAW_INDIRECT_BUFFER };
+	const int NUM_TEXTURE_TARGETS = sizeof(TEXTURE_TARGETS) / sizeof(TEXTURE_TARGETS[0]);
+	const int NUM_BUFFER_TARGETS = sizeof(BUFFER_TARGETS) / sizeof(BUFFER_TARGETS[0]);
+
+	struct GlState
+	{
+		GLuint capabilities[NUM_GL_CAPABILITIES];
+		GLuint blendSource;
+		GLuint blendDestination;
+		GLuint stencilFunc;
+		GLuint stencilRef;
+		GLuint stencilMask;
+		GLuint stencilOp[3];
+		GLuint program;
+		GLuint vao;
+		GLuint activeTexture;
+		GLuint textures[SHADOWED_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+		GLuint buffers[NUM_BUFFER_TARGETS];
+	};
+
+	GlState state;
+	GlStateStats stats;
+	bool stateKnown = false;
+
+	/// Counts a call, returns whether it has to be made.
+	bool count(GlStateCall call, bool issued)
+	{
+#ifdef GL_STATE_DEBUG
+		if (issued)
+			stats.issued[call]++;
+		else
+			stats.elided[call]++;
+#else
+		(void)call;
+#endif
+		return issued;
+	}
+
+	/// Returns true when the call has to be made and remembers the new value.
+	bool changes(GlStateCall call, GLuint& shadowed, GLuint value)
+	{
+		if (!stateKnown)
+			resetGlState();
+		if (!count(call, shadowed != value))
+			return false;
+		shadowed = value;
+		return true;
+	}
+
+	int targetIndex(const GLenum* targets, int numTargets, GLenum target)
+	{
+		for (int i = 0; i < numTargets; i++)
+			if (targets[i] == target)
+				return i;
+		return -1;
+	}
+
+	void activeTexture(GLuint unit)
+	{
+		if (changes(ACTIVE_TEXTURE_CALL, state.activeTexture, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+}
+
+/**
+ * @brief Forgets the shadowed state, the next call of every kind reaches the driver.
+ * Call after changing GL state without the cache, and after deleting bound objects.
+*/
+void manaeste::resetGlState()
+{
+	GLuint* values = reinterpret_cast<GLuint*>(&state);
+	for (size_t i = 0; i < sizeof(GlState) / sizeof(GLuint); i++)
+		values[i] = UNKNOWN;
+	stateKnown = true;
+}
+
+/**
+ * @brief glEnable() or glDisable() a capability.
+ * @param capability capability
+ * @param enabled new value
+*/
+void manaeste::setCapability(GlCapability capability, bool enabled)
+{
+	if (!changes(ENABLE_CALL, state.capabilities[capability], enabled ? 1 : 0))
+		return;
+	COUNT_RENDER_STAT(capabilityToggles, 1);
+	if (enabled)
+		glEnable(CAPABILITIES[capability]);
+	else
+		glDisable(CAPABILITIES[capability]);
+}
+
+/**
+ * @brief glBlendFunc().
+ * @param source source factor
+ * @param destination destination factor
+*/
+void manaeste::setBlendFunc(GLenum source, GLenum destination)
+{
+	if (!stateKnown)
+		resetGlState();
+	if (!count(BLEND_FUNC_CALL, state.blendSource != source || state.blendDestination != destination))
+		return;
+	state.blendSource = source;
+	state.blendDestination = destination;
+	glBlendFunc(source, destination);
+}
+
+/**
+ * @brief glStencilFunc().
+ * @param func comparison
+ * @param ref reference value
+ * @param mask mask of the comparison
+*/
+void manaeste::setStencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	if (!stateKnown)
+		resetGlState();
+	if (!count(STENCIL_FUNC_CALL, state.stencilFunc != func || state.stencilRef != (GLuint)ref || state.stencilMask != mask))
+		return;
+	state.stencilFunc = func;
+	state.stencilRef = (GLuint)ref;
+	state.stencilMask = mask;
+	glStencilFunc(func, ref, mask);
+}
+
+/**
+ * @brief glStencilOp().
+ * @param stencilFail action when the stencil test fails
+ * @param depthFail action when the depth test fails
+ * @param depthPass action when both tests pass
+*/
+void manaeste::setStencilOp(GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+{
+	if (!stateKnown)
+		resetGlState();
+	if (!count(STENCIL_OP_CALL, state.stencilOp[0] != stencilFail || state.stencilOp[1] != depthFail || state.stencilOp[2] != depthPass))
+		return;
+	state.stencilOp[0] = stencilFail;
+	state.stencilOp[1] = depthFail;
+	state.stencilOp[2] = depthPass;
+	glStencilOp(stencilFail, depthFail, depthPass);
+}
+
+/**
+ * @brief glUseProgram().
+ * @param program program
+*/
+void manaeste::useProgram(GLuint program)
+{
+	if (!changes(USE_PROGRAM_CALL, state.program, program))
+		return;
+	glUseProgram(program);
+	COUNT_RENDER_STAT(programSwitches, 1);
+}
+
+/**
+ * @brief Program last set by useProgram().
+ * @return program, 0 when the cache does not know it
+*/
+GLuint manaeste::boundProgram()
+{
+	return (stateKnown && state.program != UNKNOWN) ? state.program : 0;
+}
+
+/**
+ * @brief glBindVertexArray().
+ * @param vao vertex array
+*/
+void manaeste::bindVertexArray(GLuint vao)
+{
+	if (!changes(BIND_VERTEX_ARRAY_CALL, state.vao, vao))
+		return;
+	glBindVertexArray(vao);
+	COUNT_RENDER_STAT(vertexArrayBinds, 1);
+}
+
+/**
+ * @brief glActiveTexture() when needed, then glBindTexture().
+ * @param unit texture unit, 0 for GL_TEXTURE0
+ * @param target texture target
+ * @param texture texture
+*/
+void manaeste::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if (!stateKnown)
+		resetGlState();
+	int index = targetIndex(TEXTURE_TARGETS, NUM_TEXTURE_TARGETS, target);
+	bool shadowed = (unit < SHADOWED_TEXTURE_UNITS && index >= 0);
+	if (!count(BIND_TEXTURE_CALL, !shadowed || state.textures[unit][index] != texture))
+		return;
+	if (shadowed)
+		state.textures[unit][index] = texture;
+	activeTexture(unit);
+	glBindTexture(target, texture);
+	COUNT_RENDER_STAT(textureBinds, 1);
+}
+
+/**
+ * @brief glBindBuffer(). GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array and is always bound.
+ * @param target buffer target
+ * @param buffer buffer
+*/
+void manaeste::bindBuffer(GLenum target, GLuint buffer)
+{
+	int index = targetIndex(BUFFER_TARGETS, NUM_BUFFER_TARGETS, target);
+	if (index < 0)
+	{
+		count(BIND_BUFFER_CALL, true);
+		glBindBuffer(target, buffer);
+	}
+	else if (changes(BIND_BUFFER_CALL, state.buffers[index], buffer))
+		glBindBuffer(target, buffer);
+}
+
+/**
+ * @brief glBindBufferRange(), which also binds the buffer to the generic target.
+ * Indexed bindings are not shadowed, the call is always made.
+ * @param target buffer target
+ * @param index binding point
+ * @param buffer buffer
+ * @param offset start of the range
+ * @param size size of the range
+*/
+void manaeste::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (!stateKnown)
+		resetGlState();
+	int generic = targetIndex(BUFFER_TARGETS, NUM_BUFFER_TARGETS, target);
+	if (generic >= 0)
+		state.buffers[generic] = buffer;
+	count(BIND_BUFFER_CALL, true);
+	glBindBufferRange(target, index, buffer, offset, size);
+}
+
+/**
+ * @brief Calls issued and elided since resetGlStateStats(), all zero without GL_STATE_DEBUG.
+ * @return state cache statistics
+*/
+GlStateStats manaeste::glStateStats()
+{
+	return stats;
+}
+
+/**
+ * @brief Restarts counting the calls of the state cache, call once per frame.
+*/
+void manaeste::resetGlStateStats()
+{
+	stats = GlStateStats();
+}
+
+/**
+ * @brief Sum over all kinds of calls.
+ * @param calls GlStateStats::issued or GlStateStats::elided
+ * @return number of calls
+*/
+unsigned int manaeste::totalGlStateCalls(const unsigned int (&calls)[NUM_GL_STATE_CALLS])
+{
+	unsigned int total = 0;
+	for (unsigned int count : calls)
+		total += count;
+	return total;
+}
@@ -0,0 +1,56 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    glstate.h : Header file for glstate.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Shadow copy of the GL state changed while drawing, skipping calls that change nothing.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "pgr.h"
+
+/// Count the calls issued and elided by the state cache; on in debug and bench builds.
+#if !defined(GL_STATE_DEBUG) && (defined(_DEBUG) || defined(WILDISLAND_BENCH))
+#define GL_STATE_DEBUG
+#endif
+
+namespace manaeste
+{
+	/// Capabilities shadowed by the state cache.
+	enum GlCapability { CAP_DEPTH_TEST, CAP_STENCIL_TEST, CAP_BLEND, NUM_GL_CAPABILITIES };
+
+	/// Kinds of calls going through the state cache.
+	enum GlStateCall
+	{
+		ENABLE_CALL, BLEND_FUNC_CALL, STENCIL_FUNC_CALL, STENCIL_OP_CALL, USE_PROGRAM_CALL, BIND_VERTEX_ARRAY_CALL,
+		ACTIVE_TEXTURE_CALL, BIND_TEXTURE_CALL, BIND_BUFFER_CALL, NUM_GL_STATE_CALLS
+	};
+
+	/// Texture units the cache shadows, higher units are always bound.
+	const GLuint SHADOWED_TEXTURE_UNITS = 6;
+
+	/// Calls made and skipped since resetGlStateStats(), counted only with GL_STATE_DEBUG.
+	typedef struct GlStateStats
+	{
+		unsigned int issued[NUM_GL_STATE_CALLS]{};
+		unsigned int elided[NUM_GL_STATE_CALLS]{};
+	} GlStateStats;
+
+	void resetGlState();
+	void setCapability(GlCapability capability, bool enabled);
+	void setBlendFunc(GLenum source, GLenum destination);
+	void setStencilFunc(GLenum func, GLint ref, GLuint mask);
+	void setStencilOp(GLenum stencilFail, GLenum depthFail, GLenum depthPass);
+	void useProgram(GLuint program);
+	GLuint boundProgram();
+	void bindVertexArray(GLuint vao);
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	GlStateStats glStateStats();
+	void resetGlStateStats();
+	unsigned int totalGlStateCalls(const unsigned int (&calls)[NUM_GL_STATE_CALLS]);
+}
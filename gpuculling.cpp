@@ -0,0 +1,213 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    gpuculling.cpp : Culling and level of detail selection on the GPU.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Large instance sets (terrain tiles, palms) keep their matrices in a storage buffer
+ *          uploaded once. Each frame cull.comp tests every instance against the view frustum,
+ *          picks its level of detail and appends the survivors to the indirect command of
+ *          that level, so the CPU work per set stays the same whatever the instance count.
+ *
+ * The render queue writes one command per level of detail with instanceCount 0 and a
+ * baseInstance leaving room for every instance of the set, dispatches cull.comp and draws the
+ * commands with glMultiDrawElementsIndirect() after a command barrier. The CPU only learns how
+ * many instances were drawn by reading the commands back (readGpuVisibleInstances()).
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include "gpuculling.h"
+#include "render.h"
+#include "resources.h"
+#include "glstate.h"
+#include "programcache.h"
+#include "renderstats.h"
+
+using namespace manaeste;
+
+GpuCullStats gpuCullStats; ///< instance sets culled on the GPU in the current frame
+
+namespace
+{
+	const GLuint CULL_GROUP_SIZE = 64; ///< local_size_x of cull.comp
+
+	struct CullProgram
+	{
+		GLuint program{};
+		GLint numInstancesLoc{ -1 };
+		GLint firstCommandLoc{ -1 };
+		GLint numLodsLoc{ -1 };
+		GLint materialLoc{ -1 };
+		GLint projViewMatrixLoc{ -1 };
+		GLint frustumPlanesLoc{ -1 };
+		GLint boundingSphereLoc{ -1 };
+		GLint lodRadiusLoc{ -1 };
+		GLint pixelsPerUnitLoc{ -1 };
+		GLint maxPixelErrorLoc{ -1 };
+		GLint lodErrorsLoc{ -1 };
+	} cullProgram;
+
+	/// Commands of the sets dispatched since beginGpuCulling(), first command and number of levels.
+	std::vector<std::pair<GLuint, GLuint>> dispatchedCommands;
+}
+
+/**
+ * @brief Builds cull.comp, from the program cache when it can. Needs compute shaders (GL 4.3),
+ *        call after the multi-draw program is created.
+ * @return true if the GPU culling program is ready
+*/
+bool manaeste::createGpuCulling()
+{
+	PendingProgram pending = beginProgram({ { GL_COMPUTE_SHADER, loadShaderSource("cull.comp") } }, {}, "cull.comp");
+	cullProgram.program = finishProgram(pending);
+	if (cullProgram.program == 0)
+	{
+		std::cerr << "createGpuCulling(): cull.comp failed, culling instance sets on the CPU" << std::endl;
+		return false;
+	}
+	registerResource(SHADER_PROGRAM, cullProgram.program, "cull.comp");
+
+	const GLuint program = cullProgram.program;
+	cullProgram.numInstancesLoc = glGetUniformLocation(program, "numInstances");
+	cullProgram.firstCommandLoc = glGetUniformLocation(program, "firstCommand");
+	cullProgram.numLodsLoc = glGetUniformLocation(program, "numLods");
+	cullProgram.materialLoc = glGetUniformLocation(program, "material");
+	cullProgram.projViewMatrixLoc = glGetUniformLocation(program, "projViewMatrix");
+	cullProgram.frustumPlanesLoc = glGetUniformLocation(program, "frustumPlanes");
+	cullProgram.boundingSphereLoc = glGetUniformLocation(program, "boundingSphere");
+	cullProgram.lodRadiusLoc = glGetUniformLocation(program, "lodRadius");
+	cullProgram.pixelsPerUnitLoc = glGetUniformLocation(program, "pixelsPerUnit");
+	cullProgram.maxPixelErrorLoc = glGetUniformLocation(program, "maxPixelError");
+	cullProgram.lodErrorsLoc = glGetUniformLocation(program, "lodErrors");
+
+	glUseProgram(program);
+	glUniform1f(cullProgram.maxPixelErrorLoc, LOD_PIXEL_ERROR);
+	glUseProgram(0);
+	CHECK_GL_ERROR();
+	return true;
+}
+
+/**
+ * @brief Deletes the GPU culling program.
+*/
+void manaeste::deleteGpuCulling()
+{
+	deleteResource(SHADER_PROGRAM, cullProgram.program);
+	cullProgram = CullProgram();
+	dispatchedCommands.clear();
+}
+
+/**
+ * @brief Whether cull.comp is compiled.
+ * @return true if instance sets can be culled on the GPU
+*/
+bool manaeste::gpuCullingReady()
+{
+	return cullProgram.program != 0;
+}
+
+/**
+ * @brief Replaces the instances of a set, computing their normal matrices.
+ * @param set instance set, its buffer is created on the first upload
+ * @param modelMats model matrix of every instance
+*/
+void manaeste::uploadInstanceSet(GpuInstanceSet& set, const std::vector<glm::mat4>& modelMats)
+{
+	std::vector<glm::mat4> matrices;
+	matrices.reserve(2 * modelMats.size());
+	for (const auto& modelMat : modelMats)
+	{
+		matrices.push_back(modelMat);
+		matrices.push_back(glm::transpose(glm::inverse(modelMat)));
+	}
+
+	if (set.buffer == 0)
+		set.buffer = createResource(STORAGE_BUFFER, "GPU culled instances");
+	const size_t bytes = std::max<size_t>(matrices.size(), 1) * sizeof(glm::mat4);
+	bindBuffer(GL_SHADER_STORAGE_BUFFER, set.buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, matrices.data(), GL_STATIC_DRAW);
+	setResourceBytes(STORAGE_BUFFER, set.buffer, bytes);
+	set.count = (uint32_t)modelMats.size();
+}
+
+/**
+ * @brief Deletes the buffer of an instance set.
+ * @param set instance set, emptied
+*/
+void manaeste::deleteInstanceSet(GpuInstanceSet& set)
+{
+	deleteResource(STORAGE_BUFFER, set.buffer);
+	set.count = 0;
+}
+
+/**
+ * @brief Starts a new frame of GPU culling statistics. Call once per frame before drawing.
+*/
+void manaeste::beginGpuCulling()
+{
+	gpuCullStats = GpuCullStats();
+	dispatchedCommands.clear();
+}
+
+/**
+ * @brief Culls an instance set into the commands written by the render queue. The tables and
+ *        commands of the frame must be uploaded, and the commands drawn after a
+ *        glMemoryBarrier() with GL_COMMAND_BARRIER_BIT and GL_SHADER_STORAGE_BARRIER_BIT.
+ * @param set instance set
+ * @param params mesh and camera values
+ * @param frustum view frustum
+ * @param material MaterialTable entry of the set
+ * @param firstCommand command of level 0, followed by one command per level
+*/
+void manaeste::dispatchGpuCulling(const GpuInstanceSet& set, const GpuCullParams& params, const Frustum& frustum, GLuint material,
+	GLuint firstCommand)
+{
+	if (cullProgram.program == 0 || set.count == 0)
+		return;
+
+	useProgram(cullProgram.program);
+	glUniform1ui(cullProgram.numInstancesLoc, set.count);
+	glUniform1ui(cullProgram.firstCommandLoc, firstCommand);
+	glUniform1ui(cullProgram.numLodsLoc, params.numLods);
+	glUniform1ui(cullProgram.materialLoc, material);
+	glUniformMatrix4fv(cullProgram.projViewMatrixLoc, 1, GL_FALSE, glm::value_ptr(params.projViewMat));
+	glUniform4fv(cullProgram.frustumPlanesLoc, 6, glm::value_ptr(frustum.planes[0]));
+	glUniform4fv(cullProgram.boundingSphereLoc, 1, glm::value_ptr(params.bounds));
+	glUniform1f(cullProgram.lodRadiusLoc, params.lodRadius);
+	glUniform1f(cullProgram.pixelsPerUnitLoc, params.pixelsPerUnit);
+	glUniform1fv(cullProgram.lodErrorsLoc, (GLsizei)params.numLods, params.lodErrors);
+	COUNT_RENDER_STAT(uniformCalls, 10);
+
+	bindBufferRange(GL_SHADER_STORAGE_BUFFER, SOURCE_INSTANCE_BINDING, set.buffer, 0, (GLsizeiptr)set.count * 2 * sizeof(glm::mat4));
+	glDispatchCompute((set.count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	dispatchedCommands.push_back({ firstCommand, params.numLods });
+	gpuCullStats.sets++;
+	gpuCullStats.instances += set.count;
+}
+
+/**
+ * @brief Reads back how many instances the sets dispatched this frame drew. Waits for the GPU,
+ *        meant for the benchmark after the frame has finished.
+ * @return visible instances of all sets culled on the GPU
+*/
+unsigned int manaeste::readGpuVisibleInstances()
+{
+	if (dispatchedCommands.empty() || indirectCommandBuffer() == 0)
+		return 0;
+
+	GLuint lastCommand = 0;
+	for (const auto& commands : dispatchedCommands)
+		lastCommand = std::max(lastCommand, commands.first + commands.second);
+	std::vector<DrawElementsIndirectCommand> commands(lastCommand);
+	bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommandBuffer());
+	glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+	unsigned int visible = 0;
+	for (const auto& range : dispatchedCommands)
+		for (GLuint command = range.first; command < range.first + range.second; command++)
+			visible += commands[command].instanceCount;
+	return visible;
+}
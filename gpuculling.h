@@ -0,0 +1,61 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    gpuculling.h : Header file for gpuculling.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Instances kept on the GPU, culled and given a level of detail by a compute shader.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "pgr.h"
+#include "culling.h"
+#include "megabuffer.h"
+
+namespace manaeste
+{
+	/// Levels of detail cull.comp chooses from, the coarser levels of longer chains are never drawn.
+	const uint32_t MAX_GPU_LODS = 8;
+
+	/// Model and normal matrix of every instance of one mesh, uploaded once.
+	typedef struct GpuInstanceSet
+	{
+		GLuint buffer{};
+		uint32_t count{};
+	} GpuInstanceSet;
+
+	/// Mesh and camera values cull.comp needs for one instance set.
+	typedef struct GpuCullParams
+	{
+		glm::mat4 projViewMat{};
+		glm::vec4 bounds{};             ///< object space bounding sphere around the box center, for the frustum
+		float lodRadius{};              ///< object space bounding sphere around the origin, as selectLod() uses
+		float pixelsPerUnit{};          ///< as in LodProjection
+		uint32_t numLods{};
+		float lodErrors[MAX_GPU_LODS]{};
+		uint32_t lodFirstIndex[MAX_GPU_LODS]{}; ///< in the index buffer of the mesh
+		uint32_t lodNumIndices[MAX_GPU_LODS]{};
+	} GpuCullParams;
+
+	/// Instance sets dispatched in the current frame.
+	typedef struct GpuCullStats
+	{
+		unsigned int sets{};
+		unsigned int instances{};  ///< tested on the GPU, the visible ones are only known after readGpuVisibleInstances()
+	} GpuCullStats;
+
+	bool createGpuCulling();
+	void deleteGpuCulling();
+	bool gpuCullingReady();
+
+	void uploadInstanceSet(GpuInstanceSet& set, const std::vector<glm::mat4>& modelMats);
+	void deleteInstanceSet(GpuInstanceSet& set);
+
+	void beginGpuCulling();
+	void dispatchGpuCulling(const GpuInstanceSet& set, const GpuCullParams& params, const Frustum& frustum, GLuint material,
+		GLuint firstCommand);
+	unsigned int readGpuVisibleInstances();
+}
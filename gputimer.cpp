@@ -0,0 +1,354 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    gputimer.cpp : GPU timing of the parts of a frame.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Every part of the frame is wrapped in a GL_TIME_ELAPSED query. Each of the last
+ *          GPU_TIMER_FRAMES frames has its own set of queries, so the queries of a frame are
+ *          read only once GL_QUERY_RESULT_AVAILABLE reports them done, usually one or two frames
+ *          later, and the CPU never waits for the GPU. A frame whose results are still missing
+ *          when its set is needed again is dropped.
+ *
+ * GL_TIME_ELAPSED queries cannot be active at the same time, so the timers do not nest:
+ * beginGpuTimer() ends the running timer. A part may be timed several times in a frame, the
+ * times are summed.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "gputimer.h"
+
+using namespace manaeste;
+
+GpuTimes gpuTimes;              ///< last frame whose results were collected
+GpuTimerStats gpuTimerStats;
+
+namespace
+{
+	/// Queries of one frame, in the order they were issued.
+	struct TimerFrame
+	{
+		std::vector<GLuint> queries;     ///< grows to the most queries a frame has needed
+		std::vector<GpuTimer> timers;    ///< timer of every used query
+		uint64_t number{};
+		bool pending{};                  ///< ended, results not collected yet
+	};
+
+	/// Overlay layout in pixels; a bar as wide as OVERLAY_WIDTH stands for OVERLAY_FULL_MS.
+	const int OVERLAY_MARGIN = 10;
+	const int OVERLAY_ROW = 8;
+	const int OVERLAY_GAP = 3;
+	const int OVERLAY_WIDTH = 240;
+	const float OVERLAY_FULL_MS = 16.0f;
+	const size_t OVERLAY_AVERAGE_FRAMES = 30;
+
+	const glm::vec3 timerColors[NUM_GPU_TIMERS] = {
+		{ 0.55f, 0.40f, 0.20f }, { 0.20f, 0.70f, 0.25f }, { 0.90f, 0.80f, 0.20f }, { 0.60f, 0.30f, 0.80f },
+		{ 0.30f, 0.60f, 0.95f }, { 0.95f, 0.45f, 0.15f }, { 0.90f, 0.30f, 0.50f }
+	};
+
+	bool supported = false;
+	TimerFrame frames[GPU_TIMER_FRAMES];
+	int current = -1;                    ///< frame being recorded, -1 outside beginGpuTimerFrame()/endGpuTimerFrame()
+	int latest = -1;                     ///< last frame ended
+	bool running = false;
+	uint64_t frameCount = 0;
+	std::deque<GpuTimes> history;
+
+	/// Reads the results of a frame when all of them are available, the last query finishes last.
+	bool collectFrame(TimerFrame& frame)
+	{
+		if (!frame.pending)
+			return false;
+
+		if (!frame.timers.empty())
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(frame.queries[frame.timers.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return false;
+		}
+
+		GpuTimes times;
+		times.frame = frame.number;
+		for (size_t i = 0; i < frame.timers.size(); i++)
+		{
+			GLuint64 elapsedNs = 0;
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &elapsedNs);
+			times.ms[frame.timers[i]] += elapsedNs * 1e-6;
+			times.totalMs += elapsedNs * 1e-6;
+		}
+		frame.pending = false;
+
+		gpuTimes = times;
+		gpuTimerStats.collected++;
+		history.push_back(times);
+		if (history.size() > GPU_TIMER_HISTORY)
+			history.pop_front();
+		return true;
+	}
+
+	/// Clears a rectangle to a color; the scissored clear needs no program.
+	void fillRect(int x, int y, int width, int height, const glm::vec3& color)
+	{
+		if (width <= 0)
+			return;
+		glScissor(x, y, width, height);
+		glClearColor(color.x, color.y, color.z, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+}
+
+/**
+ * @brief GL_TIME_ELAPSED queries are core since 3.3; older contexts need ARB_timer_query.
+ * @return true when timer queries can be used
+*/
+bool manaeste::timerQueriesSupported()
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 3 || (major == 3 && minor >= 3))
+		return true;
+
+	GLint numExtensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions; ++i)
+	{
+		if (std::string((const char*)glGetStringi(GL_EXTENSIONS, i)) == "GL_ARB_timer_query")
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Name of a timer, used in the summary and as a column of the CSV.
+ * @param timer part of the frame
+ * @return lowercase name
+*/
+const char* manaeste::gpuTimerName(GpuTimer timer)
+{
+	switch (timer)
+	{
+	case GPU_TERRAIN: return "terrain";
+	case GPU_PALMS: return "palms";
+	case GPU_PROPS: return "props";
+	case GPU_CULLING: return "culling";
+	case GPU_SKYBOX: return "skybox";
+	case GPU_SPARKLES: return "sparkles";
+	case GPU_BANNER: return "banner";
+	default: return "?";
+	}
+}
+
+/**
+ * @brief Checks for timer queries; without them the timers do nothing. The queries
+ *        themselves are generated as the frames need them.
+*/
+void manaeste::createGpuTimers()
+{
+	supported = timerQueriesSupported();
+	if (!supported)
+		std::cerr << "createGpuTimers(): timer queries not supported, GPU times are not measured" << std::endl;
+}
+
+/**
+ * @brief Deletes the queries of all frames and forgets the collected times.
+*/
+void manaeste::deleteGpuTimers()
+{
+	for (auto& frame : frames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+		frame = TimerFrame();
+	}
+	current = -1;
+	latest = -1;
+	running = false;
+	history.clear();
+	gpuTimes = GpuTimes();
+	gpuTimerStats = GpuTimerStats();
+}
+
+/**
+ * @brief Collects the finished frames and starts recording the queries of the next one,
+ *        reusing the set of the oldest frame.
+*/
+void manaeste::beginGpuTimerFrame()
+{
+	if (!supported)
+		return;
+	if (current >= 0)
+		endGpuTimerFrame();
+
+	collectGpuTimers();
+	current = (latest + 1) % GPU_TIMER_FRAMES;
+	TimerFrame& frame = frames[current];
+	if (frame.pending)
+	{
+		frame.pending = false;
+		gpuTimerStats.dropped++;
+	}
+	frame.timers.clear();
+	frame.number = frameCount++;
+}
+
+/**
+ * @brief Ends the running timer and the frame; its results are collected frames later.
+*/
+void manaeste::endGpuTimerFrame()
+{
+	if (current < 0)
+		return;
+
+	endGpuTimer();
+	frames[current].pending = true;
+	latest = current;
+	current = -1;
+}
+
+/**
+ * @brief Starts timing a part of the frame, ending the running timer first.
+ * @param timer part drawn next
+*/
+void manaeste::beginGpuTimer(GpuTimer timer)
+{
+	if (current < 0)
+		return;
+
+	endGpuTimer();
+	TimerFrame& frame = frames[current];
+	if (frame.timers.size() == frame.queries.size())
+	{
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.timers.size()]);
+	frame.timers.push_back(timer);
+	running = true;
+}
+
+/**
+ * @brief Ends the running timer, if any.
+*/
+void manaeste::endGpuTimer()
+{
+	if (!running)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	running = false;
+}
+
+/**
+ * @brief Reads the results of every ended frame the GPU has finished, oldest first, without waiting.
+ *        After glFinish() this includes the frame just ended.
+*/
+void manaeste::collectGpuTimers()
+{
+	if (latest < 0)
+		return;
+	for (int i = 1; i <= GPU_TIMER_FRAMES; i++)
+	{
+		// a frame is available only when all frames before it are, the oldest comes first
+		if (frames[(latest + i) % GPU_TIMER_FRAMES].pending && !collectFrame(frames[(latest + i) % GPU_TIMER_FRAMES]))
+			break;
+	}
+}
+
+/**
+ * @brief Mean GPU times of the last collected frames.
+ * @param frames number of frames, fewer when fewer were collected
+ * @return mean times, frame is that of the last frame
+*/
+GpuTimes manaeste::averageGpuTimes(size_t frames)
+{
+	GpuTimes mean;
+	const size_t count = std::min(frames, history.size());
+	if (count == 0)
+		return mean;
+
+	for (auto it = history.end() - count; it != history.end(); ++it)
+	{
+		for (int timer = 0; timer < NUM_GPU_TIMERS; timer++)
+			mean.ms[timer] += it->ms[timer] / count;
+		mean.totalMs += it->totalMs / count;
+	}
+	mean.frame = history.back().frame;
+	return mean;
+}
+
+/**
+ * @brief One line of the times, such as "GPU 2.41 ms | terrain 0.92 | palms 0.51 | ...".
+ * @param times times of a frame
+ * @return summary, parts the frame did not draw are left out
+*/
+std::string manaeste::gpuTimesSummary(const GpuTimes& times)
+{
+	std::ostringstream summary;
+	summary << std::fixed << std::setprecision(2) << "GPU " << times.totalMs << " ms";
+	for (int timer = 0; timer < NUM_GPU_TIMERS; timer++)
+	{
+		if (times.ms[timer] > 0.0)
+			summary << " | " << gpuTimerName((GpuTimer)timer) << " " << times.ms[timer];
+	}
+	return summary.str();
+}
+
+/**
+ * @brief Writes the collected frames, up to GPU_TIMER_HISTORY of them, one row per frame.
+ * @param out destination stream
+*/
+void manaeste::writeGpuTimesCsv(std::ostream& out)
+{
+	out << "frame";
+	for (int timer = 0; timer < NUM_GPU_TIMERS; timer++)
+		out << "," << gpuTimerName((GpuTimer)timer) << "_ms";
+	out << ",total_ms" << std::endl;
+
+	for (const auto& times : history)
+	{
+		out << times.frame;
+		for (int timer = 0; timer < NUM_GPU_TIMERS; timer++)
+			out << "," << times.ms[timer];
+		out << "," << times.totalMs << std::endl;
+	}
+}
+
+/**
+ * @brief Draws a bar for every timer and one for the total into the top left corner of the
+ *        framebuffer, averaged over the last frames. The bars are scissored clears, so the
+ *        overlay needs no program and leaves the depth and stencil buffers alone.
+ * @param width framebuffer width
+ * @param height framebuffer height
+*/
+void manaeste::drawGpuTimerOverlay(int width, int height)
+{
+	if (!supported || history.empty())
+		return;
+
+	const GpuTimes mean = averageGpuTimes(OVERLAY_AVERAGE_FRAMES);
+	const float pixelsPerMs = OVERLAY_WIDTH / OVERLAY_FULL_MS;
+	const int barWidth = std::min(OVERLAY_WIDTH, width - 2 * OVERLAY_MARGIN);
+	auto bar = [&](int row, double ms, const glm::vec3& color)
+	{
+		const int y = height - OVERLAY_MARGIN - (row + 1) * (OVERLAY_ROW + OVERLAY_GAP);
+		fillRect(OVERLAY_MARGIN, y, barWidth, OVERLAY_ROW, glm::vec3(0.1f));
+		fillRect(OVERLAY_MARGIN, y, std::min(barWidth, (int)(ms * pixelsPerMs + 0.5)), OVERLAY_ROW, color);
+	};
+
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	glEnable(GL_SCISSOR_TEST);
+	for (int timer = 0; timer < NUM_GPU_TIMERS; timer++)
+		bar(timer, mean.ms[timer], timerColors[timer]);
+	bar(NUM_GPU_TIMERS, mean.totalMs, glm::vec3(0.9f));
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
@@ -0,0 +1,64 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    gputimer.h : Header file for gputimer.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   GPU time of the parts of a frame, measured with timer queries read back frames later.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "pgr.h"
+
+namespace manaeste
+{
+	/// Parts of the frame timed on the GPU.
+	enum GpuTimer { GPU_TERRAIN, GPU_PALMS, GPU_PROPS, GPU_CULLING, GPU_SKYBOX, GPU_SPARKLES, GPU_BANNER, NUM_GPU_TIMERS };
+
+	/// Frames whose queries may be in flight; results are read this many frames late at the latest.
+	const int GPU_TIMER_FRAMES = 3;
+	/// Frames kept for writeGpuTimesCsv().
+	const size_t GPU_TIMER_HISTORY = 600;
+
+	/// GPU time of one frame.
+	typedef struct GpuTimes
+	{
+		uint64_t frame{};              ///< number of the frame, counted by beginGpuTimerFrame()
+		double ms[NUM_GPU_TIMERS]{};   ///< 0 for a part the frame did not draw
+		double totalMs{};              ///< sum of the parts, the time between them is not measured
+	} GpuTimes;
+
+	/// Frames timed since createGpuTimers().
+	typedef struct GpuTimerStats
+	{
+		unsigned int collected{};
+		unsigned int dropped{};        ///< results still not available after GPU_TIMER_FRAMES frames
+	} GpuTimerStats;
+
+	bool timerQueriesSupported();
+	const char* gpuTimerName(GpuTimer timer);
+	void createGpuTimers();
+	void deleteGpuTimers();
+	void beginGpuTimerFrame();
+	void endGpuTimerFrame();
+	void beginGpuTimer(GpuTimer timer);
+	void endGpuTimer();
+	void collectGpuTimers();
+	GpuTimes averageGpuTimes(size_t frames);
+	std::string gpuTimesSummary(const GpuTimes& times);
+	void writeGpuTimesCsv(std::ostream& out);
+	void drawGpuTimerOverlay(int width, int height);
+
+	/// Times the draws of its lifetime. Timers do not nest, so neither may the scopes.
+	struct GpuTimerScope
+	{
+		explicit GpuTimerScope(GpuTimer timer) { beginGpuTimer(timer); }
+		~GpuTimerScope() { endGpuTimer(); }
+		GpuTimerScope(const GpuTimerScope&) = delete;
+		GpuTimerScope& operator=(const GpuTimerScope&) = delete;
+	};
+}
@@ -0,0 +1,659 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    ktx.cpp : Baked textures.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Writes and reads KTX 1.1 containers holding every mipmap level of a texture
+ *          (or of the six faces of a cube map), either as RGBA8 or BC1/BC3 blocks.
+ *
+ * The bake tool stores the source images in the "WildIsland.sources" key/value entry; a
+ * container older than any of its sources is ignored at runtime. Block compression uses
+ * the principal axis of each 4x4 block, which is fast and good enough for the scene's
+ * diffuse maps.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include "ktx.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+using namespace manaeste;
+
+namespace
+{
+	const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const uint32_t KTX_ENDIANNESS = 0x04030201;
+	const char* KTX_SOURCES_KEY = "WildIsland.sources";
+
+	struct KtxHeader
+	{
+		unsigned char identifier[12];
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	bool s3tcSupported = false;
+
+	size_t padTo4(size_t size) { return (size + 3) & ~(size_t)3; }
+
+	// --- block compression --------------------------------------------------------------
+
+	/**
+	 * @brief Copies a 4x4 block of texels, repeating the edge for blocks crossing the border.
+	*/
+	void extractBlock(const DecodedImage& image, int blockX, int blockY, unsigned char block[64])
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			const int sy = std::min(4 * blockY + y, image.height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				const int sx = std::min(4 * blockX + x, image.width - 1);
+				std::memcpy(&block[4 * (4 * y + x)], &image.pixels[4 * ((size_t)sy * image.width + sx)], 4);
+			}
+		}
+	}
+
+	uint16_t packRgb565(const float color[3])
+	{
+		int r = (int)std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f);
+		int g = (int)std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f);
+		int b = (int)std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t packed, int color[3])
+	{
+		int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	/**
+	 * @brief Encodes the colors of a block as BC1 in four color mode: the endpoints are the
+	 * extremes of the block along its principal axis, slightly inset.
+	*/
+	void encodeColorBlock(const unsigned char block[64], unsigned char out[8])
+	{
+		float mean[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += block[4 * i + c] / 16.0f;
+
+		float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // xx xy xz yy yz zz
+		for (int i = 0; i < 16; i++)
+		{
+			float d[3] = { block[4 * i] - mean[0], block[4 * i + 1] - mean[1], block[4 * i + 2] - mean[2] };
+			cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+			cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+		}
+
+		float axis[3] = { 0.57735f, 0.57735f, 0.57735f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[3] = {
+				cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+				cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+				cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+			};
+			float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < 3; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float minT = INFINITY, maxT = -INFINITY;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = (block[4 * i] - mean[0]) * axis[0] + (block[4 * i + 1] - mean[1]) * axis[1] + (block[4 * i + 2] - mean[2]) * axis[2];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		const float inset = (maxT - minT) / 16.0f;
+		minT += inset;
+		maxT -= inset;
+
+		float end0[3], end1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			end0[c] = mean[c] + axis[c] * maxT;
+			end1[c] = mean[c] + axis[c] * minT;
+		}
+		uint16_t color0 = packRgb565(end0);
+		uint16_t color1 = packRgb565(end1);
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		int palette[4][3];
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		uint32_t indices = 0;
+		if (color0 != color1)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestDistance = INT32_MAX;
+				for (int p = 0; p < 4; p++)
+				{
+					int dr = block[4 * i] - palette[p][0], dg = block[4 * i + 1] - palette[p][1], db = block[4 * i + 2] - palette[p][2];
+					int distance = dr * dr + dg * dg + db * db;
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= (uint32_t)best << (2 * i);
+			}
+		}
+
+		out[0] = (unsigned char)(color0 & 0xFF);
+		out[1] = (unsigned char)(color0 >> 8);
+		out[2] = (unsigned char)(color1 & 0xFF);
+		out[3] = (unsigned char)(color1 >> 8);
+		for (int b = 0; b < 4; b++)
+			out[4 + b] = (unsigned char)(indices >> (8 * b));
+	}
+
+	/**
+	 * @brief Encodes the alpha of a block as a BC3 alpha block in eight value mode.
+	*/
+	void encodeAlphaBlock(const unsigned char block[64], unsigned char out[8])
+	{
+		int alpha0 = 0, alpha1 = 255;
+		for (int i = 0; i < 16; i++)
+		{
+			alpha0 = std::max(alpha0, (int)block[4 * i + 3]);
+			alpha1 = std::min(alpha1, (int)block[4 * i + 3]);
+		}
+
+		int palette[8] = { alpha0, alpha1 };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+		uint64_t indices = 0;
+		if (alpha0 != alpha1)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0;
+				for (int p = 1; p < 8; p++)
+				{
+					if (std::abs(block[4 * i + 3] - palette[p]) < std::abs(block[4 * i + 3] - palette[best]))
+						best = p;
+				}
+				indices |= (uint64_t)best << (3 * i);
+			}
+		}
+
+		out[0] = (unsigned char)alpha0;
+		out[1] = (unsigned char)alpha1;
+		for (int b = 0; b < 6; b++)
+			out[2 + b] = (unsigned char)(indices >> (8 * b));
+	}
+
+	void compressImage(const DecodedImage& image, BakeFormat format, std::vector<unsigned char>& out)
+	{
+		if (format == BAKE_RGBA8)
+		{
+			out = image.pixels;
+			return;
+		}
+
+		const int blocksX = (image.width + 3) / 4;
+		const int blocksY = (image.height + 3) / 4;
+		const size_t blockBytes = format == BAKE_BC1 ? 8 : 16;
+		out.resize(blockBytes * blocksX * blocksY);
+
+		unsigned char block[64];
+		unsigned char* dst = out.data();
+		for (int by = 0; by < blocksY; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++, dst += blockBytes)
+			{
+				extractBlock(image, bx, by, block);
+				if (format == BAKE_BC3)
+				{
+					encodeAlphaBlock(block, dst);
+					encodeColorBlock(block, dst + 8);
+				}
+				else
+				{
+					encodeColorBlock(block, dst);
+				}
+			}
+		}
+	}
+
+	void writeU32(std::ostream& out, uint32_t value)
+	{
+		out.write((const char*)&value, sizeof(value));
+	}
+}
+
+/**
+ * @brief Where the baked version of a texture is stored.
+ * @param name texture file, or the key of a cube map
+ * @return path of the KTX file
+*/
+std::string manaeste::bakedTexturePath(const std::string& name)
+{
+	return name + ".ktx";
+}
+
+/**
+ * @brief Memory taken by an RGBA8 texture with its full mipmap chain, as glGenerateMipmap() makes it.
+ * @param width width of the base level
+ * @param height height of the base level
+ * @return bytes
+*/
+size_t manaeste::rgbaMipChainBytes(int width, int height)
+{
+	size_t bytes = 0;
+	for (;;)
+	{
+		bytes += 4 * (size_t)width * height;
+		if (width <= 1 && height <= 1)
+			return bytes;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+}
+
+/**
+ * @brief Queries which compressed formats the context can upload. Call once on the GL thread
+ * before baked textures are opened.
+*/
+void manaeste::detectCompressedTextureSupport()
+{
+	GLint numExtensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions; ++i)
+	{
+		if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_EXT_texture_compression_s3tc") == 0)
+			s3tcSupported = true;
+	}
+}
+
+/**
+ * @brief Maps a KTX file and validates its layout.
+ * @param fileName KTX file
+ * @param ktx mapped texture
+ * @return true if the file is a valid 2D texture or cube map this loader understands
+*/
+bool manaeste::openKtx(const std::string& fileName, KtxTexture& ktx)
+{
+	if (!ktx.file.open(fileName) || ktx.file.size() < sizeof(KtxHeader))
+		return false;
+
+	KtxHeader header;
+	std::memcpy(&header, ktx.file.data(), sizeof(header));
+	if (std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS
+		|| header.pixelDepth != 0 || header.numberOfArrayElements != 0 || header.pixelWidth == 0 || header.pixelHeight == 0
+		|| (header.numberOfFaces != 1 && header.numberOfFaces != 6) || header.numberOfMipmapLevels == 0)
+	{
+		std::cerr << "openKtx(): " << fileName << " is not a supported KTX 1.1 texture" << std::endl;
+		return false;
+	}
+
+	switch (header.glInternalFormat)
+	{
+	case GL_RGBA8:
+		if (header.glFormat != GL_RGBA || header.glType != GL_UNSIGNED_BYTE)
+			return false;
+		ktx.compressed = false;
+		break;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		ktx.compressed = true;
+		break;
+	default:
+		std::cerr << "openKtx(): " << fileName << " has unsupported format 0x" << std::hex << header.glInternalFormat << std::dec << std::endl;
+		return false;
+	}
+
+	ktx.internalFormat = header.glInternalFormat;
+	ktx.width = header.pixelWidth;
+	ktx.height = header.pixelHeight;
+	ktx.numFaces = header.numberOfFaces;
+	ktx.numLevels = header.numberOfMipmapLevels;
+
+	// a chain ends at 1x1, floor(log2(max(width, height))) + 1 levels; more would shift the size out
+	uint32_t maxLevels = 1;
+	while ((std::max(ktx.width, ktx.height) >> maxLevels) != 0)
+		maxLevels++;
+	if (ktx.numLevels > maxLevels)
+		return false;
+
+	const unsigned char* data = ktx.file.data();
+	const size_t size = ktx.file.size();
+	size_t offset = sizeof(KtxHeader);
+	if (header.bytesOfKeyValueData > size - offset)
+		return false;
+
+	const size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+	while (offset + 4 <= keyValueEnd)
+	{
+		uint32_t pairSize;
+		std::memcpy(&pairSize, data + offset, 4);
+		offset += 4;
+		if (pairSize > keyValueEnd - offset)
+			return false;
+
+		const char* pair = (const char*)data + offset;
+		const size_t keyLength = strnlen(pair, pairSize);
+		if (std::string(pair, keyLength) == KTX_SOURCES_KEY && keyLength < pairSize)
+		{
+			std::string value(pair + keyLength + 1, strnlen(pair + keyLength + 1, pairSize - keyLength - 1));
+			for (size_t start = 0; start < value.size();)
+			{
+				size_t end = std::min(value.find('\n', start), value.size());
+				ktx.sources.push_back(value.substr(start, end - start));
+				start = end + 1;
+			}
+		}
+		offset += padTo4(pairSize);
+	}
+	offset = keyValueEnd;
+
+	ktx.imageSizes.clear();
+	ktx.images.clear();
+	for (uint32_t level = 0; level < ktx.numLevels; level++)
+	{
+		uint32_t imageSize;
+		if (size - offset < 4)
+			return false;
+		std::memcpy(&imageSize, data + offset, 4);
+		offset += 4;
+		ktx.imageSizes.push_back(imageSize);
+
+		// glTexImage2D() reads a whole level whatever the file claims
+		const uint64_t levelWidth = std::max<uint32_t>(1, ktx.width >> level);
+		const uint64_t levelHeight = std::max<uint32_t>(1, ktx.height >> level);
+		if (!ktx.compressed && imageSize < levelWidth * levelHeight * 4)
+			return false;
+
+		for (uint32_t face = 0; face < ktx.numFaces; face++)
+		{
+			if (size - offset < padTo4(imageSize))
+				return false;
+			ktx.images.push_back(data + offset);
+			offset += padTo4(imageSize);
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Tells whether the container is newer than all of its source images.
+ * @param fileName KTX file
+ * @param ktx opened container
+ * @return false if any existing source was modified after baking
+*/
+bool manaeste::isKtxFresh(const std::string& fileName, const KtxTexture& ktx)
+{
+	std::error_code error;
+	const auto bakedTime = std::filesystem::last_write_time(fileName, error);
+	if (error)
+		return false;
+
+	for (const auto& source : ktx.sources)
+	{
+		const auto sourceTime = std::filesystem::last_write_time(source, error);
+		if (!error && sourceTime > bakedTime)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Tells whether the context can upload the container's format.
+ * @param ktx opened container
+ * @return true if the format is supported
+*/
+bool manaeste::isKtxSupported(const KtxTexture& ktx)
+{
+	return !ktx.compressed || s3tcSupported;
+}
+
+/**
+ * @brief Opens the baked version of a texture if there is one the runtime can use.
+ * Safe to call from any thread once detectCompressedTextureSupport() ran.
+ * @param name texture file, or the key of a cube map
+ * @param ktx mapped texture
+ * @return true if a fresh, supported container exists
+*/
+bool manaeste::openBakedTexture(const std::string& name, KtxTexture& ktx)
+{
+	const std::string path = bakedTexturePath(name);
+	return openKtx(path, ktx) && isKtxFresh(path, ktx) && isKtxSupported(ktx);
+}
+
+/**
+ * @brief Uploads all levels of a container, no mipmaps are generated.
+ * @param ktx opened container
+ * @param bytes texel memory of the texture
+ * @return texture name
+*/
+GLuint manaeste::createTextureFromKtx(const KtxTexture& ktx, size_t& bytes)
+{
+	const GLenum target = ktx.numFaces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	bytes = 0;
+	for (uint32_t level = 0; level < ktx.numLevels; level++)
+	{
+		const GLsizei width = std::max<GLsizei>(1, ktx.width >> level);
+		const GLsizei height = std::max<GLsizei>(1, ktx.height >> level);
+		for (uint32_t face = 0; face < ktx.numFaces; face++)
+		{
+			const GLenum faceTarget = ktx.numFaces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+			const unsigned char* image = ktx.images[level * ktx.numFaces + face];
+			if (ktx.compressed)
+				glCompressedTexImage2D(faceTarget, level, ktx.internalFormat, width, height, 0, ktx.imageSizes[level], image);
+			else
+				glTexImage2D(faceTarget, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+			bytes += ktx.imageSizes[level];
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, ktx.numLevels - 1);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, ktx.numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (target == GL_TEXTURE_CUBE_MAP)
+	{
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(target, 0);
+	CHECK_GL_ERROR();
+
+	return texture;
+}
+
+/**
+ * @brief Tells whether any texel is not fully opaque.
+ * @param image decoded image
+ * @return true if the image needs an alpha channel
+*/
+bool manaeste::hasTransparency(const DecodedImage& image)
+{
+	for (size_t i = 3; i < image.pixels.size(); i += 4)
+	{
+		if (image.pixels[i] != 255)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Builds the whole mipmap chain with a 2x2 box filter, down to 1x1.
+ * @param image base level
+ * @param levels all levels, the first one being a copy of the image
+*/
+void manaeste::buildMipChain(const DecodedImage& image, std::vector<DecodedImage>& levels)
+{
+	levels.clear();
+	levels.push_back(image);
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const DecodedImage& src = levels.back();
+		DecodedImage dst;
+		dst.fileName = src.fileName;
+		dst.width = std::max(1, src.width / 2);
+		dst.height = std::max(1, src.height / 2);
+		dst.pixels.resize(4 * (size_t)dst.width * dst.height);
+
+		for (int y = 0; y < dst.height; y++)
+		{
+			const int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+			for (int x = 0; x < dst.width; x++)
+			{
+				const int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+				for (int c = 0; c < 4; c++)
+				{
+					int sum = src.pixels[4 * ((size_t)y0 * src.width + x0) + c] + src.pixels[4 * ((size_t)y0 * src.width + x1) + c]
+						+ src.pixels[4 * ((size_t)y1 * src.width + x0) + c] + src.pixels[4 * ((size_t)y1 * src.width + x1) + c];
+					dst.pixels[4 * ((size_t)y * dst.width + x) + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+		levels.push_back(std::move(dst));
+	}
+}
+
+/**
+ * @brief Bakes a texture (one face) or a cube map (six faces) into its KTX container.
+ * @param name texture file, or the key of a cube map
+ * @param faces decoded base levels, all of the same size
+ * @param sources source images recorded for the freshness check
+ * @param format texel format
+ * @param bakedBytes texel memory of the baked texture
+ * @return true if the container was written
+*/
+bool manaeste::bakeTexture(const std::string& name, const std::vector<const DecodedImage*>& faces,
+	const std::vector<std::string>& sources, BakeFormat format, size_t& bakedBytes)
+{
+	if ((faces.size() != 1 && faces.size() != 6) || faces[0]->pixels.empty())
+		return false;
+	for (const DecodedImage* face : faces)
+	{
+		if (face->width != faces[0]->width || face->height != faces[0]->height || face->pixels.empty())
+		{
+			std::cerr << "bakeTexture(): faces of " << name << " differ in size" << std::endl;
+			return false;
+		}
+	}
+
+	std::vector<std::vector<DecodedImage>> chains(faces.size());
+	for (size_t f = 0; f < faces.size(); f++)
+		buildMipChain(*faces[f], chains[f]);
+	const uint32_t numLevels = (uint32_t)chains[0].size();
+
+	KtxHeader header = {};
+	std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.endianness = KTX_ENDIANNESS;
+	header.glTypeSize = 1;
+	switch (format)
+	{
+	case BAKE_RGBA8:
+		header.glType = GL_UNSIGNED_BYTE;
+		header.glFormat = GL_RGBA;
+		header.glInternalFormat = GL_RGBA8;
+		header.glBaseInternalFormat = GL_RGBA;
+		break;
+	case BAKE_BC1:
+		header.glInternalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		header.glBaseInternalFormat = GL_RGB;
+		break;
+	case BAKE_BC3:
+		header.glInternalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		header.glBaseInternalFormat = GL_RGBA;
+		break;
+	}
+	header.pixelWidth = faces[0]->width;
+	header.pixelHeight = faces[0]->height;
+	header.numberOfFaces = (uint32_t)faces.size();
+	header.numberOfMipmapLevels = numLevels;
+
+	std::string sourceList;
+	for (const auto& source : sources)
+		sourceList += (sourceList.empty() ? "" : "\n") + source;
+	const uint32_t pairSize = (uint32_t)(std::strlen(KTX_SOURCES_KEY) + 1 + sourceList.size() + 1);
+	header.bytesOfKeyValueData = (uint32_t)(4 + padTo4(pairSize));
+
+	const std::string path = bakedTexturePath(name);
+	const std::string tempPath = path + ".tmp";
+	bakedBytes = 0;
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		const char zeros[4] = { 0, 0, 0, 0 };
+		file.write((const char*)&header, sizeof(header));
+		writeU32(file, pairSize);
+		file.write(KTX_SOURCES_KEY, std::strlen(KTX_SOURCES_KEY) + 1);
+		file.write(sourceList.c_str(), sourceList.size() + 1);
+		file.write(zeros, padTo4(pairSize) - pairSize);
+
+		std::vector<unsigned char> encoded;
+		for (uint32_t level = 0; level < numLevels; level++)
+		{
+			for (size_t f = 0; f < faces.size(); f++)
+			{
+				compressImage(chains[f][level], format, encoded);
+				if (f == 0)
+					writeU32(file, (uint32_t)encoded.size());
+				file.write((const char*)encoded.data(), encoded.size());
+				file.write(zeros, padTo4(encoded.size()) - encoded.size());
+				bakedBytes += encoded.size();
+			}
+		}
+
+		if (!file.good())
+			return false;
+	}
+
+	// replace the old container only once the new one is complete
+	std::remove(path.c_str());
+	return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
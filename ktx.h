@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    ktx.h : Header file for ktx.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Baked textures: KTX 1.1 containers with precomputed mipmaps, optionally
+ *          BC1/BC3 compressed.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "pgr.h"
+#include "mesh.h"
+#include "assets.h"
+
+namespace manaeste
+{
+	/// Texel format of a baked texture.
+	enum BakeFormat
+	{
+		BAKE_RGBA8, ///< uncompressed, 4 bytes per texel
+		BAKE_BC1,   ///< DXT1, 0.5 byte per texel, no alpha
+		BAKE_BC3    ///< DXT5, 1 byte per texel, interpolated alpha
+	};
+
+	/// Memory-mapped KTX 1.1 file.
+	typedef struct KtxTexture
+	{
+		MappedFile file;
+		GLenum internalFormat{};
+		bool compressed{};
+		uint32_t width{};
+		uint32_t height{};
+		uint32_t numFaces{};  ///< 1 or 6 (cube map)
+		uint32_t numLevels{};
+		std::vector<uint32_t> imageSizes;          ///< bytes of one face per level
+		std::vector<const unsigned char*> images;  ///< numLevels * numFaces, level-major
+		std::vector<std::string> sources;          ///< images the texture was baked from
+	} KtxTexture;
+
+	std::string bakedTexturePath(const std::string& name);
+	size_t rgbaMipChainBytes(int width, int height);
+
+	void detectCompressedTextureSupport();
+	bool openKtx(const std::string& fileName, KtxTexture& ktx);
+	bool isKtxFresh(const std::string& fileName, const KtxTexture& ktx);
+	bool isKtxSupported(const KtxTexture& ktx);
+	bool openBakedTexture(const std::string& name, KtxTexture& ktx);
+	GLuint createTextureFromKtx(const KtxTexture& ktx, size_t& bytes);
+
+	bool hasTransparency(const DecodedImage& image);
+	void buildMipChain(const DecodedImage& image, std::vector<DecodedImage>& levels);
+	bool bakeTexture(const std::string& name, const std::vector<const DecodedImage*>& faces,
+		const std::vector<std::string>& sources, BakeFormat format, size_t& bakedBytes);
+}
@@ -0,0 +1,240 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    lighting.cpp : Clustered forward lighting.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   The view frustum is split into a grid of clusters, screen tiles times slices of
+ *          view depth. Each frame every point light is assigned on the CPU to the clusters its
+ *          sphere of influence overlaps, and lights.frag evaluates only the lights of the
+ *          cluster a fragment falls into.
+ *
+ * Three buffer textures hold the frame, readable by the GLSL 1.40 and 4.30 light shaders alike:
+ *   light data     RGBA32F, two texels per light: view space position and radius, color and intensity
+ *   light grid     RG32UI, per cluster: first entry in the index list and number of lights
+ *   light indices  R32UI, the lights of every cluster one after another
+ * Depth slices are linear between the near and the far plane, so the orthographic cameras get
+ * the same grid as the perspective ones.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include "lighting.h"
+#include "resources.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "renderstats.h"
+
+using namespace manaeste;
+
+LightClusterStats lightClusterStats; ///< light assignment of the current frame
+
+namespace
+{
+	struct ClusterRange
+	{
+		int minX, maxX;
+		int minY, maxY;
+		int minSlice, maxSlice;
+	};
+
+	struct LightBuffer
+	{
+		GLuint buffer{};
+		GLuint texture{};
+		GLenum format{};
+	};
+
+	LightBuffer lightData;
+	LightBuffer lightGrid;
+	LightBuffer lightIndices;
+
+	std::vector<glm::vec4> lightTexels;       ///< two per light
+	std::vector<ClusterRange> lightRanges;    ///< clusters of every light, minX > maxX when it touches none
+	std::vector<GLuint> clusterLights;        ///< first entry and count of every cluster
+	std::vector<GLuint> lightIndexList;
+
+	void createLightBuffer(LightBuffer& light, GLenum format, const std::string& label)
+	{
+		light.buffer = createResource(LIGHT_BUFFER, label);
+		light.texture = createResource(BUFFER_TEXTURE, label);
+		light.format = format;
+	}
+
+	void deleteLightBuffer(LightBuffer& light)
+	{
+		deleteResource(BUFFER_TEXTURE, light.texture);
+		deleteResource(LIGHT_BUFFER, light.buffer);
+	}
+
+	/// Replaces the contents of a light buffer and binds its texture, never empty so the texture stays valid.
+	void uploadLightBuffer(LightBuffer& light, GLuint unit, const void* data, size_t bytes)
+	{
+		static const glm::vec4 empty(0.0f);
+		bindBuffer(GL_TEXTURE_BUFFER, light.buffer);
+		glBufferData(GL_TEXTURE_BUFFER, bytes > 0 ? bytes : sizeof(empty), bytes > 0 ? data : &empty, GL_STREAM_DRAW);
+		setResourceBytes(LIGHT_BUFFER, light.buffer, bytes > 0 ? bytes : sizeof(empty));
+		COUNT_RENDER_STAT(uploadedBytes, bytes > 0 ? bytes : sizeof(empty));
+
+		bindTexture(unit, GL_TEXTURE_BUFFER, light.texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, light.format, light.buffer);
+	}
+
+	/// View depth of a point on the view axis with the normalized device depth ndcZ.
+	float viewDepth(const glm::mat4& inverseProjMat, float ndcZ)
+	{
+		const glm::vec4 point = inverseProjMat * glm::vec4(0.0f, 0.0f, ndcZ, 1.0f);
+		return -point.z / point.w;
+	}
+
+	int tileOf(float ndc, int tiles)
+	{
+		return std::min(std::max((int)std::floor((ndc * 0.5f + 0.5f) * tiles), 0), tiles - 1);
+	}
+
+	/// Clusters touched by a view space sphere. Its bounding box is projected, which is
+	/// conservative; a box reaching behind a perspective camera covers every tile.
+	bool clusterRange(const glm::mat4& projMat, const glm::vec3& center, float radius, float nearDepth, float sliceScale,
+		ClusterRange& range)
+	{
+		const float depth = -center.z;
+		range.minSlice = (int)std::floor((depth - radius - nearDepth) * sliceScale);
+		range.maxSlice = (int)std::floor((depth + radius - nearDepth) * sliceScale);
+		if (range.maxSlice < 0 || range.minSlice >= CLUSTER_SLICES)
+			return false;
+		range.minSlice = std::max(range.minSlice, 0);
+		range.maxSlice = std::min(range.maxSlice, CLUSTER_SLICES - 1);
+
+		glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+		bool behind = false;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+			const glm::vec4 clip = projMat * glm::vec4(center + offset, 1.0f);
+			if (clip.w <= 0.0f)
+			{
+				behind = true;
+				break;
+			}
+			const glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+		}
+		if (behind)
+		{
+			ndcMin = glm::vec2(-1.0f);
+			ndcMax = glm::vec2(1.0f);
+		}
+		if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+			return false;
+
+		range.minX = tileOf(ndcMin.x, CLUSTER_TILES_X);
+		range.maxX = tileOf(ndcMax.x, CLUSTER_TILES_X);
+		range.minY = tileOf(ndcMin.y, CLUSTER_TILES_Y);
+		range.maxY = tileOf(ndcMax.y, CLUSTER_TILES_Y);
+		return true;
+	}
+
+	int clusterIndex(int x, int y, int slice)
+	{
+		return (slice * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+	}
+}
+
+/**
+ * @brief Creates the buffers and buffer textures of the light clusters.
+*/
+void manaeste::createLightClusters()
+{
+	createLightBuffer(lightData, GL_RGBA32F, "light data");
+	createLightBuffer(lightGrid, GL_RG32UI, "light grid");
+	createLightBuffer(lightIndices, GL_R32UI, "light indices");
+}
+
+/**
+ * @brief Deletes the buffers and buffer textures of the light clusters.
+*/
+void manaeste::deleteLightClusters()
+{
+	deleteLightBuffer(lightData);
+	deleteLightBuffer(lightGrid);
+	deleteLightBuffer(lightIndices);
+}
+
+/**
+ * @brief Assigns the lights to the clusters of the view, uploads the light buffers and binds
+ *        them to their texture units. Call once per frame before setFrameUniforms().
+ * @param lights point lights of the scene
+ * @param projMat projection matrix
+ * @param viewMat view matrix
+ * @param frame receives the light count and the cluster grid parameters
+*/
+void manaeste::buildLightClusters(const std::vector<PointLight>& lights, const glm::mat4& projMat, const glm::mat4& viewMat,
+	FrameUniforms& frame)
+{
+	PROFILE_ZONE("buildLightClusters");
+	lightClusterStats = LightClusterStats();
+	lightClusterStats.lights = (unsigned int)lights.size();
+
+	GLint viewport[4] = {};
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	const glm::mat4 inverseProjMat = glm::inverse(projMat);
+	const float nearDepth = viewDepth(inverseProjMat, -1.0f);
+	const float farDepth = viewDepth(inverseProjMat, 1.0f);
+	const float sliceScale = CLUSTER_SLICES / std::max(farDepth - nearDepth, 1e-6f);
+
+	frame.numLights = (GLint)lights.size();
+	frame.clusterParams = glm::vec4(CLUSTER_TILES_X / (float)std::max(viewport[2], 1), CLUSTER_TILES_Y / (float)std::max(viewport[3], 1),
+		sliceScale, -nearDepth * sliceScale);
+
+	// count the lights of every cluster, then place the indices of each cluster after the previous one
+	lightTexels.clear();
+	lightRanges.clear();
+	clusterLights.assign(2 * NUM_CLUSTERS, 0);
+	for (const auto& light : lights)
+	{
+		const glm::vec3 center = glm::vec3(viewMat * glm::vec4(light.position, 1.0f));
+		lightTexels.push_back(glm::vec4(center, light.radius));
+		lightTexels.push_back(glm::vec4(light.color, light.intensity));
+
+		ClusterRange range;
+		if (clusterRange(projMat, center, light.radius, nearDepth, sliceScale, range))
+			lightClusterStats.visible++;
+		else
+			range = { 1, 0, 1, 0, 1, 0 };
+		lightRanges.push_back(range);
+
+		for (int slice = range.minSlice; slice <= range.maxSlice; slice++)
+			for (int y = range.minY; y <= range.maxY; y++)
+				for (int x = range.minX; x <= range.maxX; x++)
+					clusterLights[2 * clusterIndex(x, y, slice) + 1]++;
+	}
+
+	GLuint offset = 0;
+	for (int cluster = 0; cluster < NUM_CLUSTERS; cluster++)
+	{
+		clusterLights[2 * cluster] = offset;
+		offset += clusterLights[2 * cluster + 1];
+		lightClusterStats.maxPerCluster = std::max(lightClusterStats.maxPerCluster, clusterLights[2 * cluster + 1]);
+		clusterLights[2 * cluster + 1] = 0;
+	}
+	lightClusterStats.entries = offset;
+
+	lightIndexList.resize(offset);
+	for (size_t i = 0; i < lightRanges.size(); i++)
+	{
+		const ClusterRange& range = lightRanges[i];
+		for (int slice = range.minSlice; slice <= range.maxSlice; slice++)
+			for (int y = range.minY; y <= range.maxY; y++)
+				for (int x = range.minX; x <= range.maxX; x++)
+				{
+					const int cluster = clusterIndex(x, y, slice);
+					lightIndexList[clusterLights[2 * cluster] + clusterLights[2 * cluster + 1]++] = (GLuint)i;
+				}
+	}
+
+	uploadLightBuffer(lightData, LIGHT_DATA_TEXTURE_UNIT, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+	uploadLightBuffer(lightGrid, LIGHT_GRID_TEXTURE_UNIT, clusterLights.data(), clusterLights.size() * sizeof(GLuint));
+	uploadLightBuffer(lightIndices, LIGHT_INDEX_TEXTURE_UNIT, lightIndexList.data(), lightIndexList.size() * sizeof(GLuint));
+}
@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    lighting.h : Header file for lighting.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Point lights assigned to a view space cluster grid for the light shaders.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "pgr.h"
+#include "render.h"
+
+namespace manaeste
+{
+	/// Cluster grid, tiles across the screen and slices of view depth; lights.frag repeats these.
+	const int CLUSTER_TILES_X = 16;
+	const int CLUSTER_TILES_Y = 8;
+	const int CLUSTER_SLICES = 16;
+	const int NUM_CLUSTERS = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+	/// Texture units of the light buffers, after the mesh, instance and material textures.
+	const GLuint LIGHT_DATA_TEXTURE_UNIT = 3;
+	const GLuint LIGHT_GRID_TEXTURE_UNIT = 4;
+	const GLuint LIGHT_INDEX_TEXTURE_UNIT = 5;
+
+	/// Point light of limited range, such as a campfire or a torch.
+	typedef struct PointLight
+	{
+		glm::vec3 position{};       ///< world space
+		float radius{ 1.0f };       ///< no light reaches farther
+		glm::vec3 color{ 1.0f };
+		float intensity{ 1.0f };
+	} PointLight;
+
+	/// Lights of the current frame and how they were assigned to the clusters.
+	typedef struct LightClusterStats
+	{
+		unsigned int lights{};
+		unsigned int visible{};     ///< in at least one cluster
+		unsigned int entries{};     ///< light indices of all clusters
+		unsigned int maxPerCluster{};
+	} LightClusterStats;
+
+	void createLightClusters();
+	void deleteLightClusters();
+	void buildLightClusters(const std::vector<PointLight>& lights, const glm::mat4& projMat, const glm::mat4& viewMat,
+		FrameUniforms& frame);
+}
@@ -1,4 +1,7 @@
 #version 140
+// Built as GLSL 4.30 with MULTI_DRAW defined for the multi-draw path, see lights.vert.
+// createShaders() builds every light permutation with LIGHT_VARIANT defined to its LIGHT_* bits,
+// so the light branches fold away; without it they branch on lightVariant of FrameData.
 
 struct Material
 {
@@ -9,189 +12,250 @@ struct Material
 	vec3 specular;
 };
 
-struct Light
+layout(std140) uniform FrameData
+{
+	mat4 Pmatrix;
+	mat4 Vmatrix;
+	vec3 sunDirection;       // view space, toward the sun
+	float currentTime;
+	vec3 pointLightPosition; // view space
+	int numLights;
+	vec3 reflectorPosition;  // view space
+	int lightVariant;        // LIGHT_* bits of the frame, read when LIGHT_VARIANT is not defined
+	vec3 reflectorDirection; // view space
+	float padding;
+	vec3 reflectorDiffuse;
+	float padding2;
+	vec4 clusterParams; // tiles per pixel in x and y, slices per unit of view depth, slice at depth 0
+};
+
+#ifdef MULTI_DRAW
+
+struct MaterialRecord
 {
 	vec3 ambient;
+	float shininess;
 	vec3 diffuse;
+	int textureLayer;
 	vec3 specular;
-	vec3 position;
-	vec3 spotDirection;
-	float spotCosCutOff;
-	float spotExponent;
+	int packedVertices;
+	vec3 positionScale;
+	uint firstVertexWord;
+	vec3 positionOffset;
+	int padding;
+	vec4 texCoordTransform;
+};
+
+layout(std430, binding = 2) readonly buffer MaterialTable
+{
+	MaterialRecord materials[];
+};
+
+uniform sampler2DArray materialTextures;
+
+flat in uint material_v;
+
+#else
+
+layout(std140) uniform DrawData
+{
+	mat4 PVMmatrix;
+	mat4 Mmatrix;
+	mat4 normalMatrix;
+	vec3 materialAmbient;
+	float materialShininess;
+	vec3 materialDiffuse;
+	int materialUseTexture;
+	vec3 materialSpecular;
+	int instanced;
+	vec3 positionScale;
+	int octahedralNormals;
+	vec3 positionOffset;
+	int instanceBase;
+	vec4 texCoordTransform;
 };
 
 uniform sampler2D textureSampler;
-uniform Material material;
-uniform float currentTime;
-uniform bool fogOn;
 
-uniform mat4 PVMmatrix;
-uniform mat4 Vmatrix;
-uniform mat4 Mmatrix;
-uniform mat4 normalMatrix;
+#endif
+
+// Clustered point lights, see lighting.cpp; the grid size repeats lighting.h.
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 8;
+const int CLUSTER_SLICES = 16;
+
+uniform samplerBuffer lightData;     // two texels per light: view space position and radius, color and intensity
+uniform usamplerBuffer lightGrid;    // per cluster: first entry in lightIndices and number of lights
+uniform usamplerBuffer lightIndices;
+
+// The same bits as LightVariantBit in render.h.
+#define LIGHT_SUN 1
+#define LIGHT_FLASH 2
+#define LIGHT_POINT 4
+#define LIGHT_FOG 8
+
+#ifdef LIGHT_VARIANT
+#define lightEnabled(bit) ((LIGHT_VARIANT & (bit)) != 0)
+#else
+#define lightEnabled(bit) ((lightVariant & (bit)) != 0)
+#endif
+
+const vec3 sunAmbient = vec3(0.5);
+const vec3 sunDiffuse = vec3(0.7);
+const vec3 sunSpecular = vec3(0.6);
+
+const vec3 sparklesAmbient = vec3(1.0);
+const vec3 sparklesDiffuse = vec3(0.5);
+const vec3 sparklesSpecular = vec3(0.1);
+
+const vec3 reflectorAmbient = vec3(0.1);
+const vec3 reflectorSpecular = vec3(1.0);
+const float reflectorCosCutOff = 0.95;
+const float reflectorExponent = 1.0;
 
 smooth in vec2 textureCoord_v;
 smooth in vec3 normal_v;
 smooth in vec3 position_v;
 out vec4 color_f;
 
-Light sunDirect;
-float sunSpeed = 0.8;
-uniform bool sunOn;
-
-Light sparklesPoint;
-uniform vec4 positionPointLight;
-uniform bool pointLightOn;
-uniform bool flashOn;
-
-Light flashReflector;
-uniform vec3 reflectorPosition;
-uniform vec3 reflectorDirection;
-float fogFactor;
+vec4 materialTexture(vec2 texCoords)
+{
+#ifdef MULTI_DRAW
+	int layer = materials[material_v].textureLayer;
+	return (layer >= 0) ? texture(materialTextures, vec3(texCoords, float(layer))) : vec4(1.0);
+#else
+	return texture(textureSampler, texCoords);
+#endif
+}
 
-vec4 directionalForSun(Light light, Material material, vec3 vertexPosition, vec3 vertexNormal, vec2 texCoords)
+// The light functions leave out the albedo, main() samples it once and multiplies.
+vec3 directionalForSun(Material material, vec3 vertexPosition, vec3 vertexNormal)
 {
-	vec3 lightDirection = normalize(light.position);
 	vec3 viewDirection = normalize(-vertexPosition);
-	vec3 reflectionDirection = reflect(-lightDirection, vertexNormal);
+	vec3 reflectionDirection = reflect(-sunDirection, vertexNormal);
 	
-	float cosTheta = max(dot(vertexNormal, lightDirection), 0.0);
+	float cosTheta = max(dot(vertexNormal, sunDirection), 0.0);
 	float cosAlpha = max(dot(viewDirection, reflectionDirection), 0.0);
 	
-	vec3 texColor = texture(textureSampler, texCoords).rgb;
+	vec3 ambientTerm = material.ambient * sunAmbient;
+	vec3 diffuseTerm = cosTheta * material.diffuse * sunDiffuse;
+	vec3 specularTerm = pow(cosAlpha, material.shininess) * material.specular * sunSpecular;
 	
-	vec3 ambientTerm = material.ambient * light.ambient;
-	vec3 diffuseTerm = cosTheta * material.diffuse * light.diffuse;
-	vec3 specularTerm = pow(cosAlpha, material.shininess) * material.specular * light.specular;
-	
-	vec3 color = texColor * (ambientTerm + diffuseTerm + specularTerm);
-	
-	return vec4(color, 1.0);
+	return ambientTerm + diffuseTerm + specularTerm;
 }
 
-vec4 pointForSparkles(Light light, Material material, vec3 vertexPosition, vec3 vertexNormal, vec2 texCoords)
+vec3 pointForSparkles(Material material, vec3 vertexPosition, vec3 vertexNormal)
 {
-	float dist = length(light.position - vertexPosition.xyz);
-	vec3 toLight = normalize(light.position - vertexPosition);
+	float dist = length(pointLightPosition - vertexPosition.xyz);
+	vec3 toLight = normalize(pointLightPosition - vertexPosition);
 	vec3 R = reflect(-toLight, vertexNormal);
 	vec3 N = normalize(toLight - vertexNormal);
 
 	float normalLightAngleCosinus = dot(vertexNormal, toLight);
 	float reflectionViewAngleCosinus = dot(R, N);
-	
-	vec3 textureColor = texture(textureSampler, texCoords).rgb;
 
-	vec3 ambientTerm = material.ambient * light.ambient;
-	vec3 diffuseTerm = max(normalLightAngleCosinus, 0.0) * light.diffuse * material.diffuse;
-	vec3 specularTerm = pow(max(reflectionViewAngleCosinus, 0.0), material.shininess) * light.specular * material.specular;
+	vec3 ambientTerm = material.ambient * sparklesAmbient;
+	vec3 diffuseTerm = max(normalLightAngleCosinus, 0.0) * sparklesDiffuse * material.diffuse;
+	vec3 specularTerm = pow(max(reflectionViewAngleCosinus, 0.0), material.shininess) * sparklesSpecular * material.specular;
 
-	vec3 color = textureColor * (ambientTerm + diffuseTerm + specularTerm);
-	color /= pow(dist, 2)*10;
+	vec3 color = ambientTerm + diffuseTerm + specularTerm;
+	color /= dist * dist * 10.0;
 	color *= material.shininess;
 	
-	return vec4(color, 1.0);
+	return color;
 }
 
-vec4 spotForFlashlight(Light light, Material material, vec3 vertexPosition, vec3 vertexNormal, vec2 texCoords)
+vec3 spotForFlashlight(Material material, vec3 vertexPosition, vec3 vertexNormal)
 {
-	vec3 direction = normalize(light.position - vertexPosition);
+	vec3 direction = normalize(reflectorPosition - vertexPosition);
 	float diffuseCoef = max(0.0, dot(vertexNormal, direction));
 	float specularCoef = max(0.0, dot(reflect(vertexNormal, -direction), normalize(-vertexPosition)));
 
-	float angleCosine = dot(-direction, light.spotDirection);
-	float spotCoef = 0.0;
-	if (angleCosine >= light.spotCosCutOff)
-	{
-		spotCoef = pow(angleCosine, light.spotExponent);
-	}
-
-	vec3 textureColor = texture(textureSampler, texCoords).rgb;
-
-	vec3 color = material.diffuse * light.diffuse * diffuseCoef * textureColor * material.shininess;
-	color += material.specular * light.specular * pow(specularCoef, material.shininess) * textureColor;
-	color += material.ambient * light.ambient * textureColor;
+	float angleCosine = dot(-direction, reflectorDirection);
+	if (angleCosine < reflectorCosCutOff)
+		return vec3(0.0);
+	float spotCoef = pow(angleCosine, reflectorExponent);
 
-	color *= spotCoef;
+	vec3 color = material.diffuse * reflectorDiffuse * diffuseCoef * material.shininess;
+	color += material.specular * reflectorSpecular * pow(specularCoef, material.shininess);
+	color += material.ambient * reflectorAmbient;
 
-	return vec4(color, 1.0);
+	return color * spotCoef;
 }
 
-void setupLights()
+vec3 clusteredPointLights(Material material, vec3 vertexPosition, vec3 vertexNormal)
 {
-	float fogDist = abs(position_v.z);
-	float fogDensity = 0.3;
-	fogFactor = exp(-fogDensity * fogDist);
-
-	sunDirect.ambient = vec3(0.5);
-	sunDirect.diffuse = vec3(0.7);
-	sunDirect.specular = vec3(0.6);
-	float sunAngle = currentTime * sunSpeed;
-	sunDirect.position = vec3(cos(sunAngle), 0.0, sin(sunAngle));
-
-	if (pointLightOn) {
-		sparklesPoint.ambient = vec3(1.0);
-		sparklesPoint.diffuse = vec3(0.5);
-		sparklesPoint.specular = vec3(0.1);
-		sparklesPoint.position = (Vmatrix * positionPointLight).xyz;
-	}
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterParams.xy), ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+	int slice = clamp(int(-vertexPosition.z * clusterParams.z + clusterParams.w), 0, CLUSTER_SLICES - 1);
+	uvec2 cluster = texelFetch(lightGrid, (slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x).xy;
 
-	mat4 MVmatrix = Vmatrix * Mmatrix;
-	vec4 reflectorPosition4 = vec4(reflectorPosition, 1.0);
-	vec4 worldSpacePosition = MVmatrix * reflectorPosition4;
-
-	flashReflector.position = worldSpacePosition.xyz;
-	flashReflector.ambient = vec3(0.1);
-	flashReflector.diffuse = vec3(0.9);
-	flashReflector.specular = vec3(1.0);
-	flashReflector.spotCosCutOff = 0.95;
-	flashReflector.spotExponent = 1.0;
-	flashReflector.position = (Vmatrix * vec4(reflectorPosition, 1.0)).xyz;
-	flashReflector.spotDirection = normalize((Vmatrix * vec4(reflectorDirection, 0.0))).xyz;
-
-	float reflectorDistance = length(flashReflector.position);
-	vec3 reflectorColor = mix(vec3(1.0), vec3(1.0, 0.5, 0.5), reflectorDistance / 10.0);
-	flashReflector.diffuse *= reflectorColor;
+	vec3 viewDirection = normalize(-vertexPosition);
+	vec3 color = vec3(0.0);
+	for (uint i = 0u; i < cluster.y; i++)
+	{
+		int light = int(texelFetch(lightIndices, int(cluster.x + i)).x);
+		vec4 positionRadius = texelFetch(lightData, 2 * light);
+		vec4 colorIntensity = texelFetch(lightData, 2 * light + 1);
+
+		vec3 toLight = positionRadius.xyz - vertexPosition;
+		float dist = length(toLight);
+		if (dist >= positionRadius.w)
+			continue;
+		toLight /= dist;
+
+		// smooth falloff reaching zero at the radius
+		float falloff = 1.0 - (dist * dist) / (positionRadius.w * positionRadius.w);
+		falloff *= falloff;
+
+		float diffuseCoef = max(dot(vertexNormal, toLight), 0.0);
+		float specularCoef = pow(max(dot(reflect(-toLight, vertexNormal), viewDirection), 0.0), material.shininess);
+		color += colorIntensity.rgb * colorIntensity.a * falloff * (diffuseCoef * material.diffuse + specularCoef * material.specular);
+	}
+	return color;
 }
 
-
 void main()
 {
-	setupLights();
+#ifdef MULTI_DRAW
+	MaterialRecord record = materials[material_v];
+	Material material = Material(record.textureLayer >= 0, record.shininess, record.ambient, record.diffuse, record.specular);
+#else
+	Material material = Material(materialUseTexture != 0, materialShininess, materialAmbient, materialDiffuse, materialSpecular);
+#endif
 
 	vec3 normal = normalize(normal_v);
+	vec3 albedo = material.useTexture ? materialTexture(textureCoord_v).rgb : vec3(1.0);
 	vec3 globalAmbientLight = vec3(0.2);
-	vec4 ambientColor = vec4(material.ambient * globalAmbientLight, 0.0);
-	vec4 outputColor = ambientColor;
+	vec3 outputColor = material.ambient * globalAmbientLight;
 
-	if (sunOn)
+	if (lightEnabled(LIGHT_SUN))
 	{
-		vec4 directionalColor = directionalForSun(sunDirect, material, position_v, normal, textureCoord_v);
-		outputColor.rgb += directionalColor.rgb;
+		outputColor += albedo * directionalForSun(material, position_v, normal);
 	}
 
-	if (material.useTexture)
+	outputColor *= albedo;
+
+	if (lightEnabled(LIGHT_FOG))
 	{
-		vec4 textureColor = texture(textureSampler, textureCoord_v);
-		outputColor.rgb *= textureColor.rgb;
+		vec3 fogColor = vec3(0.65);
+		float fogDensity = 0.3;
+		outputColor = mix(fogColor, outputColor, exp(-fogDensity * abs(position_v.z)));
 	}
 
-	if (fogOn)
+	if (lightEnabled(LIGHT_FLASH))
 	{
-		vec3 fogColor = vec3(0.65);
-		outputColor.rgb = mix(fogColor, outputColor.rgb, fogFactor);
+		outputColor += albedo * spotForFlashlight(material, position_v, normal);
 	}
 
-	if (flashOn)
+	if (lightEnabled(LIGHT_POINT))
 	{
-		vec4 spotColor = spotForFlashlight(flashReflector, material, position_v, normal, textureCoord_v);
-		outputColor.rgb += spotColor.rgb;
+		outputColor += albedo * pointForSparkles(material, position_v, normal);
 	}
 
-	if (pointLightOn)
+	if (numLights > 0)
 	{
-		vec4 pointColor = pointForSparkles(sparklesPoint, material, position_v, normal, textureCoord_v);
-		outputColor.rgb += pointColor.rgb;
+		outputColor += albedo * clusteredPointLights(material, position_v, normal);
 	}
 
-	color_f = outputColor;
+	color_f = vec4(outputColor, 0.0);
 }
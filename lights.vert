@@ -1,29 +1,174 @@
 #version 140
-
-in vec3 position;
-in vec3 normal;
-in vec2 textureCoord;
+// Built as GLSL 4.30 with MULTI_DRAW defined for the multi-draw path: the vertices are read
+// from the mega-buffer and the matrices and materials from the instance and material tables.
 
 out vec2 textureCoord_v;
 out vec3 normal_v;
 out vec3 position_v;
 
-uniform mat4 normalMatrix;
-uniform mat4 PVMmatrix;
-uniform mat4 Vmatrix;
-uniform mat4 Mmatrix;
+layout(std140) uniform FrameData
+{
+	mat4 Pmatrix;
+	mat4 Vmatrix;
+	vec3 sunDirection;       // view space, toward the sun
+	float currentTime;
+	vec3 pointLightPosition; // view space
+	int numLights;
+	vec3 reflectorPosition;  // view space
+	int lightVariant;        // LIGHT_* bits of the frame, read when LIGHT_VARIANT is not defined
+	vec3 reflectorDirection; // view space
+	float padding;
+	vec3 reflectorDiffuse;
+	float padding2;
+	vec4 clusterParams; // tiles per pixel in x and y, slices per unit of view depth, slice at depth 0
+};
+
+#ifdef MULTI_DRAW
+
+struct MaterialRecord
+{
+	vec3 ambient;
+	float shininess;
+	vec3 diffuse;
+	int textureLayer;
+	vec3 specular;
+	int packedVertices;
+	vec3 positionScale;
+	uint firstVertexWord;
+	vec3 positionOffset;
+	int padding;
+	vec4 texCoordTransform;
+};
+
+struct InstanceRecord
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	uint material;
+};
+
+layout(std430, binding = 0) readonly buffer VertexStorage
+{
+	uint vertexWords[]; // PackedVertex (4 words) or MeshVertex (8 words) of every mesh
+};
+
+layout(std430, binding = 1) readonly buffer InstanceTable
+{
+	InstanceRecord instances[];
+};
+
+layout(std430, binding = 2) readonly buffer MaterialTable
+{
+	MaterialRecord materials[];
+};
+
+in uint instanceIndex; // baseInstance + instance, from a buffer of consecutive integers
+
+flat out uint material_v;
+
+#else
+
+in vec3 position;     // object space, or fractions of the mesh bounds when packed
+in vec3 normal;       // object space, or octahedral encoding in [0, 1] when packed
+in vec2 textureCoord; // or fractions of the texture coordinate bounds when packed
+
+layout(std140) uniform DrawData
+{
+	mat4 PVMmatrix;
+	mat4 Mmatrix;
+	mat4 normalMatrix;
+	vec3 materialAmbient;
+	float materialShininess;
+	vec3 materialDiffuse;
+	int materialUseTexture;
+	vec3 materialSpecular;
+	int instanced;
+	vec3 positionScale;
+	int octahedralNormals;
+	vec3 positionOffset;
+	int instanceBase;
+	vec4 texCoordTransform;
+};
+
+uniform samplerBuffer instanceMatrices; // 8 texels per instance: model matrix, normal matrix columns
+
+#endif
 
 invariant gl_Position;
 
+vec3 decodeOctahedral(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n;
+}
+
+#ifdef MULTI_DRAW
+
 void main()
 {
-	vec3 eyeNormal = normalize((normalMatrix * vec4(normal, 0.0)).xyz);
+	InstanceRecord instance = instances[instanceIndex];
+	MaterialRecord material = materials[instance.material];
+	material_v = instance.material;
+
+	vec3 objectPosition;
+	vec3 objectNormal;
+	vec2 textureCoord;
+	if (material.packedVertices != 0)
+	{
+		uint word = material.firstVertexWord + uint(gl_VertexID) * 4u;
+		vec2 positionXY = unpackUnorm2x16(vertexWords[word]);
+		objectPosition = vec3(positionXY, unpackUnorm2x16(vertexWords[word + 1u]).x) * material.positionScale + material.positionOffset;
+		objectNormal = decodeOctahedral(unpackUnorm2x16(vertexWords[word + 2u]));
+		textureCoord = unpackUnorm2x16(vertexWords[word + 3u]);
+	}
+	else
+	{
+		uint word = material.firstVertexWord + uint(gl_VertexID) * 8u;
+		objectPosition = uintBitsToFloat(uvec3(vertexWords[word], vertexWords[word + 1u], vertexWords[word + 2u]));
+		objectNormal = uintBitsToFloat(uvec3(vertexWords[word + 3u], vertexWords[word + 4u], vertexWords[word + 5u]));
+		textureCoord = uintBitsToFloat(uvec2(vertexWords[word + 6u], vertexWords[word + 7u]));
+	}
+
+	normal_v = normalize((instance.normalMatrix * vec4(objectNormal, 0.0)).xyz);
+
+	vec4 viewPos = Vmatrix * instance.modelMatrix * vec4(objectPosition, 1);
+	position_v = viewPos.xyz;
+
+	gl_Position = Pmatrix * viewPos;
+
+	textureCoord_v = textureCoord * material.texCoordTransform.xy + material.texCoordTransform.zw;
+}
+
+#else
+
+void main()
+{
+	vec3 objectPosition = position * positionScale + positionOffset;
+	vec3 objectNormal = (octahedralNormals != 0) ? decodeOctahedral(normal.xy) : normal;
+
+	mat4 model = Mmatrix;
+	mat4 normalMat = normalMatrix;
+	if (instanced != 0)
+	{
+		int base = (gl_InstanceID + instanceBase) * 8;
+		model = mat4(texelFetch(instanceMatrices, base + 0), texelFetch(instanceMatrices, base + 1),
+			texelFetch(instanceMatrices, base + 2), texelFetch(instanceMatrices, base + 3));
+		normalMat = mat4(texelFetch(instanceMatrices, base + 4), texelFetch(instanceMatrices, base + 5),
+			texelFetch(instanceMatrices, base + 6), texelFetch(instanceMatrices, base + 7));
+	}
+
+	vec3 eyeNormal = normalize((normalMat * vec4(objectNormal, 0.0)).xyz);
 	normal_v = eyeNormal;
 
-	vec3 worldPos = (Vmatrix * Mmatrix * vec4(position, 1)).xyz;
-	position_v = worldPos;
+	vec4 viewPos = Vmatrix * model * vec4(objectPosition, 1);
+	position_v = viewPos.xyz;
 
-	gl_Position = PVMmatrix * vec4(position, 1);
+	gl_Position = (instanced != 0) ? Pmatrix * viewPos : PVMmatrix * vec4(objectPosition, 1);
 
-	textureCoord_v = textureCoord;
+	textureCoord_v = textureCoord * texCoordTransform.xy + texCoordTransform.zw;
 }
+
+#endif
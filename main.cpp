@@ -11,17 +11,30 @@
 #include <iostream>
 #include <list>
 #include <fstream>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
 #include <glm/gtx/rotate_vector.hpp>
 #include <unordered_map>
+#include <random>
+#include <stdexcept>
 
 #include "pgr.h"
 #include "render.h"
+#include "resources.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "lighting.h"
+#include "gputimer.h"
+#include "profiler.h"
+#include "renderstats.h"
 #include "utils.h"
 #include "settings.h"
 
 using namespace manaeste;
 
-extern MainShaderProgram shaderProgram;
+SceneState manaeste::sceneState;
+Camera manaeste::camera;
 
 struct SceneObjects
 {
@@ -34,8 +47,25 @@ struct SceneObjects
 	Object* diamond{};
 	GameObjectsList terrainElementsList;
 	GameObjectsList palmList;
+	std::vector<Object*> terrainDrawList; ///< terrain elements drawn, rebuilt by updateDrawLists()
+	std::vector<Object*> palmDrawList;    ///< palms drawn, rebuilt by updateDrawLists()
+	std::vector<PointLight> campfires;    ///< flickering point lights, placed by placeCampfires()
 } sceneObjects;
 
+namespace
+{
+	/// Seed of the generated scene content, fixed so every run and the benchmark see the same scene.
+	const std::mt19937::result_type CAMPFIRE_SEED = 20230524;
+	const std::mt19937::result_type SCATTER_SEED = 20230412;
+
+	/// Uniform in [-0.5, 0.5). Built from the raw output, which mt19937 defines on every standard
+	/// library, unlike std::uniform_real_distribution.
+	float jitter(std::mt19937& random)
+	{
+		return (float)(random() >> 8) / 16777216.0f - 0.5f;
+	}
+}
+
 /**
  * @brief Initializes specified object.
  * @param type TERRAIN_ELEMENT, PALM, SNOWMAN, RAIDER, FIRE, BANNER, COUCH, DUCK, DIAMOND. (see render.h).
@@ -128,6 +158,8 @@ void manaeste::deleteObjects()
 
 	for (auto& obj : sceneObjects.palmList) obj = nullptr;
 	sceneObjects.palmList.clear();
+	sceneObjects.terrainDrawList.clear();
+	sceneObjects.palmDrawList.clear();
 
 	delete sceneObjects.couch;
 	sceneObjects.couch = nullptr;
@@ -149,92 +181,150 @@ void manaeste::deleteObjects()
 }
 
 /**
- * @brief Draws all objects of the scene. Just objects.
- * @param orthoProjectionMatrix orthoProjection matrix
- * @param orthoViewMatrix orthoView matrix
- * @param viewMatrix view matrix
- * @param projectionMatrix projection matrix
+ * @brief Rebuilds the lists of drawn terrain elements and palms and uploads them for culling on
+ *        the GPU. Palms are the first NUM_PALMS of the hard-coded ones and every scattered one.
 */
-void manaeste::drawAllObjects(const glm::mat4& orthoProjectionMatrix, const glm::mat4& orthoViewMatrix, const glm::mat4& viewMatrix,
-	const glm::mat4& projectionMatrix)
+void manaeste::updateDrawLists()
 {
+	sceneObjects.terrainDrawList.clear();
 	for (auto& it : sceneObjects.terrainElementsList)
+		sceneObjects.terrainDrawList.push_back((Object*)it);
+
+	sceneObjects.palmDrawList.clear();
+	int index = 0;
+	for (auto& it : sceneObjects.palmList)
 	{
-		auto* terrainElement = (Object*)it;
-		drawObject(TERRAIN_ELEMENT, terrainElement, projectionMatrix, viewMatrix);
+		if (index < NUM_PALMS || index >= (int)std::size(palmsPositions))
+			sceneObjects.palmDrawList.push_back((Object*)it);
+		index++;
 	}
 
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 3, 0xFF);
-	auto it = sceneObjects.palmList.begin();
-	std::advance(it, NUM_PALMS);
-	for (auto it2 = sceneObjects.palmList.begin(); it2 != it; ++it2)
+	uploadGpuInstances(TERRAIN_ELEMENT, sceneObjects.terrainDrawList);
+	uploadGpuInstances(PALM, sceneObjects.palmDrawList);
+}
+
+/**
+ * @brief Adds objects on a jittered grid around the island, for measuring how drawing scales
+ *        with the number of objects. The jitter is the same on every run.
+ * @param type TERRAIN_ELEMENT or PALM, other types are ignored
+ * @param count number of objects to add
+*/
+void manaeste::scatterObjects(ObjectType type, int count)
+{
+	if ((type != TERRAIN_ELEMENT && type != PALM) || count <= 0)
+		return;
+
+	// terrain tiles keep the spacing of the hard-coded ones, palms stand closer
+	const float spacing = (type == TERRAIN_ELEMENT) ? 1.5f : 0.5f;
+	const int columns = (int)std::ceil(std::sqrt((float)count));
+	const float origin = -0.5f * spacing * (columns - 1);
+	GameObjectsList& list = (type == TERRAIN_ELEMENT) ? sceneObjects.terrainElementsList : sceneObjects.palmList;
+	std::mt19937 random(SCATTER_SEED);
+	for (int i = 0; i < count; i++)
 	{
-		auto* palm = (Object*)*it2;
-		drawObject(PALM, palm, projectionMatrix, viewMatrix);
+		glm::vec3 position(origin + spacing * (i % columns), origin + spacing * (i / columns), (type == TERRAIN_ELEMENT) ? -0.3f : 0.6f);
+		if (type == PALM)
+		{
+			position.x += spacing * jitter(random) * 0.5f;
+			position.y += spacing * jitter(random) * 0.5f;
+		}
+		list.push_back(setObject(type, position));
 	}
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
-
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 1, 0xFF);
-	drawObject(SNOWMAN, sceneObjects.snowman, projectionMatrix, viewMatrix);
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
+	updateDrawLists();
+}
 
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 2, 0xFF);
-	drawObject(RAIDER, sceneObjects.raider, projectionMatrix, viewMatrix);
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
+/**
+ * @brief Places campfire lights on a jittered grid over the island, replacing the previous ones.
+ *        The jitter is the same on every run, so a given count always gives the same lights.
+ * @param count number of lights
+*/
+void manaeste::placeCampfires(int count)
+{
+	sceneObjects.campfires.clear();
+	if (count <= 0)
+		return;
 
+	const int columns = (int)std::ceil(std::sqrt((float)count));
+	const glm::vec2 spacing(2.0f * SCENE_WIDTH / columns, 2.0f * SCENE_HEIGHT / columns);
+	std::mt19937 random(CAMPFIRE_SEED);
+	for (int i = 0; i < count; i++)
+	{
+		// one call per statement, the evaluation order of arguments is unspecified
+		const float offsetX = jitter(random);
+		const float offsetY = jitter(random);
+		const glm::vec2 offset(offsetX, offsetY);
+		PointLight light;
+		light.position = glm::vec3(-SCENE_WIDTH + spacing.x * (i % columns + 0.5f + 0.5f * offset.x),
+			-SCENE_HEIGHT + spacing.y * (i / columns + 0.5f + 0.5f * offset.y), 0.1f);
+		light.radius = 0.8f;
+		light.color = glm::vec3(1.0f, 0.45f + 0.2f * (jitter(random) + 0.5f), 0.15f);
+		sceneObjects.campfires.push_back(light);
+	}
+}
 
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 4, 0xFF);
+/**
+ * @brief Draws all objects of the scene. Just objects. The large objects are drawn into the
+ *        occlusion buffer first, then the meshes go through the render queue, each with the
+ *        stencil value object picking reads back.
+ * @param orthoProjectionMatrix orthoProjection matrix
+ * @param orthoViewMatrix orthoView matrix
+ * @param viewMatrix view matrix
+ * @param projectionMatrix projection matrix
+*/
+void manaeste::drawAllObjects(const glm::mat4& orthoProjectionMatrix, const glm::mat4& orthoViewMatrix, const glm::mat4& viewMatrix,
+	const glm::mat4& projectionMatrix)
+{
+	PROFILE_ZONE("drawAllObjects");
+	const std::vector<Object*>& terrainElements = sceneObjects.terrainDrawList;
+	const std::vector<Object*>& palms = sceneObjects.palmDrawList;
+
+	beginOcclusion(projectionMatrix, viewMatrix);
+	addOccluders(TERRAIN_ELEMENT, terrainElements);
+	addOccluders(PALM, palms);
+	addOccluders(SNOWMAN, { sceneObjects.snowman });
+	addOccluders(COUCH, { sceneObjects.couch });
+	rasterizeOccluders();
+
+	setQueueTimer(GPU_TERRAIN);
+	drawObject(TERRAIN_ELEMENT, terrainElements, projectionMatrix, viewMatrix);
+
+	setQueueTimer(GPU_PALMS);
+	setStencilRef(3);
+	drawObject(PALM, palms, projectionMatrix, viewMatrix);
+
+	setQueueTimer(GPU_PROPS);
+	setStencilRef(1);
+	drawObject(SNOWMAN, sceneObjects.snowman, projectionMatrix, viewMatrix);
+	setStencilRef(2);
+	drawObject(RAIDER, sceneObjects.raider, projectionMatrix, viewMatrix);
+	setStencilRef(4);
 	drawObject(COUCH, sceneObjects.couch, projectionMatrix, viewMatrix);
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
-
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 5, 0xFF);
+	setStencilRef(5);
 	drawObject(DUCK, sceneObjects.duck, projectionMatrix, viewMatrix);
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
-
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 6, 0xFF);
+	setStencilRef(6);
 	drawObject(DIAMOND, sceneObjects.diamond, projectionMatrix, viewMatrix);
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
 
-	drawCubeSkybox(projectionMatrix, viewMatrix);
+	submitRenderQueue();
+
+	{
+		GpuTimerScope timer(GPU_SKYBOX);
+		drawCubeSkybox(projectionMatrix, viewMatrix);
+	}
 
 	if (sceneState.sparklesOn)
+	{
+		GpuTimerScope timer(GPU_SPARKLES);
 		drawSparklesTexture(sceneObjects.sparkles, projectionMatrix, viewMatrix);
+	}
 
-	glEnable(GL_STENCIL_TEST);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilFunc(GL_ALWAYS, 7, 0xFF);
-	if (sceneState.amongusOn)
+	if (sceneState.amongusOn && sceneObjects.amongus != nullptr)
 	{
-		if (sceneObjects.amongus != nullptr)
-			drawAmongusMovingTexture(sceneObjects.amongus, orthoProjectionMatrix, orthoViewMatrix);
+		GpuTimerScope timer(GPU_BANNER);
+		setCapability(CAP_STENCIL_TEST, true);
+		setStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		setStencilFunc(GL_ALWAYS, 7, 0xFF);
+		drawAmongusMovingTexture(sceneObjects.amongus, orthoProjectionMatrix, orthoViewMatrix);
 	}
-	glDisable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
 }
 
 /**
@@ -256,6 +346,7 @@ glm::vec3 manaeste::correctCameraBoundsPosition(const glm::vec3& position)
 */
 void manaeste::moveCamera(Direction direction, float deltaAngle)
 {
+	PROFILE_ZONE("moveCamera");
 	glm::vec3 newPosition = camera.position;
 	switch (direction)
 	{
@@ -379,7 +470,6 @@ void manaeste::handleGameMenuChoice(int choice)
 		break;
 	case 8:
 		sceneState.fogOn = !sceneState.fogOn;
-		setFogState(sceneState.fogOn);
 		break;
 	case 9:
 		sparklesToggle();
@@ -390,6 +480,22 @@ void manaeste::handleGameMenuChoice(int choice)
 	case 11:
 		resetScene();
 		break;
+	case 12:
+		printTextureReport(std::cout);
+		printResourceReport(std::cout);
+		break;
+	case 13:
+		gpuTimerOverlayToggle();
+		break;
+	case 14:
+		exportGpuTimes();
+		break;
+	case 15:
+		writeCpuTrace(CPU_TRACE_FILE);
+		break;
+	case 16:
+		exportRenderStats();
+		break;
 	default:
 		break;
 	}
@@ -417,6 +523,11 @@ void manaeste::createMenu()
 	glutAddMenuEntry("Toggle Fire", 9);
 	glutAddMenuEntry("Toggle Banner", 10);
 	glutAddMenuEntry("Reset Scene", 11);
+	glutAddMenuEntry("Print Memory Report", 12);
+	glutAddMenuEntry("Toggle GPU Timer Overlay", 13);
+	glutAddMenuEntry("Export GPU Times", 14);
+	glutAddMenuEntry("Write CPU Trace", 15);
+	glutAddMenuEntry("Write Render Stats", 16);
 	glutAddMenuEntry("Exit", 3);
 	glutSetMenuFont(mainMenu, GLUT_BITMAP_HELVETICA_18);
 
@@ -477,10 +588,58 @@ void manaeste::bannerToggle()
 }
 
 /**
- * @brief Draws the complete scene.
+ * @brief Toggle the GPU timer overlay on/off; while it is on, the window title shows the times.
+*/
+void manaeste::gpuTimerOverlayToggle()
+{
+	sceneState.gpuTimerOverlay = !sceneState.gpuTimerOverlay;
+	if (!sceneState.gpuTimerOverlay)
+		glutSetWindowTitle(WINDOW_TITLE);
+}
+
+/**
+ * @brief Writes the GPU times of the last frames into GPU_TIMES_FILE.
+*/
+void manaeste::exportGpuTimes()
+{
+	std::ofstream file(GPU_TIMES_FILE);
+	if (!file)
+	{
+		std::cerr << "exportGpuTimes(): cannot write " << GPU_TIMES_FILE << std::endl;
+		return;
+	}
+	writeGpuTimesCsv(file);
+	std::cout << "GPU times written to " << GPU_TIMES_FILE << std::endl;
+}
+
+/**
+ * @brief Writes the rendering statistics of the last frames into RENDER_STATS_FILE.
+*/
+void manaeste::exportRenderStats()
+{
+#ifdef RENDER_STATS
+	std::ofstream file(RENDER_STATS_FILE);
+	if (!file)
+	{
+		std::cerr << "exportRenderStats(): cannot write " << RENDER_STATS_FILE << std::endl;
+		return;
+	}
+	writeRenderStatsHistory(file);
+	std::cout << "Render statistics written to " << RENDER_STATS_FILE << std::endl;
+#else
+	std::cerr << "exportRenderStats(): built without RENDER_STATS, nothing was counted" << std::endl;
+#endif
+}
+
+/**
+ * @brief Draws the complete scene. Its GPU time is collected frames later, see gputimer.cpp.
 */
 void manaeste::drawScene()
 {
+	PROFILE_ZONE("drawScene");
+	beginGpuTimerFrame();
+	beginRenderStatsFrame();
+
 	glm::mat4 orthoProjectionMatrix = glm::ortho(
 		-SCENE_WIDTH, SCENE_WIDTH,
 		-SCENE_HEIGHT, SCENE_HEIGHT,
@@ -525,16 +684,19 @@ void manaeste::drawScene()
 		viewMatrix = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	}
 
-	glUseProgram(shaderProgram.program);
-	glUniform1f(shaderProgram.timeLoc, sceneState.elapsedTime);
-	glUniform3fv(shaderProgram.reflectorPositionLoc, 1, glm::value_ptr(camera.position));
-	glUniform3fv(shaderProgram.reflectorDirectionLoc, 1, glm::value_ptr(camera.direction));
-	glUniform1i(shaderProgram.sunOnLoc, sceneState.sunOn);
-	glUniform1i(shaderProgram.flashOnLoc, sceneState.flashlightOn);
-	glUniform1i(shaderProgram.pointLightOnLoc, sceneState.sparklesOn);
-	glUniform4fv(shaderProgram.pointLightLoc, 1, glm::value_ptr(glm::vec4(sceneObjects.sparkles->position, 1.0f)));
-	glUniform1i(shaderProgram.fogOnLoc, sceneState.fogOn);
+	FrameUniforms frame;
+	frame.Pmatrix = projectionMatrix;
+	frame.Vmatrix = viewMatrix;
+	frame.currentTime = sceneState.elapsedTime;
+	frame.lightVariant = (sceneState.sunOn ? LIGHT_SUN : 0) | (sceneState.flashlightOn ? LIGHT_FLASH : 0) |
+		(sceneState.sparklesOn ? LIGHT_POINT : 0) | (sceneState.fogOn ? LIGHT_FOG : 0);
+	setFrameLights(frame, camera.position, camera.direction, sceneObjects.sparkles->position);
+	buildLightClusters(sceneObjects.campfires, projectionMatrix, viewMatrix, frame);
+	selectLightVariant(frame.lightVariant);
+	setFrameUniforms(frame);
 	drawAllObjects(orthoProjectionMatrix, orthoViewMatrix, viewMatrix, projectionMatrix);
+	endRenderStatsFrame();
+	endGpuTimerFrame();
 }
 
 /**
@@ -543,18 +705,21 @@ void manaeste::drawScene()
 */
 void manaeste::updateScene(float elapsedTime)
 {
+	PROFILE_ZONE("updateScene");
 	switch (sceneState.cameraNum) {
 	case 1:
 		camera.position = glm::vec3(0.0f);
 		camera.direction = glm::vec3(0.0f);
 		sceneState.freeCameraMode = false;
-		glutPassiveMotionFunc(NULL);
+		if (!sceneState.headless)
+			glutPassiveMotionFunc(NULL);
 		break;
 	case 2:
 		camera.position = glm::vec3(3.0f, 3.0f, 0.0f);
 		camera.direction = glm::vec3(-1.0f, 0.0f, 0.0f);
 		sceneState.freeCameraMode = false;
-		glutPassiveMotionFunc(NULL);
+		if (!sceneState.headless)
+			glutPassiveMotionFunc(NULL);
 		break;
 	case 5:
 		sceneState.flashlightOn = false;
@@ -581,6 +746,11 @@ void manaeste::updateScene(float elapsedTime)
 	{
 		sceneObjects.sparkles->currentTime = elapsedTime;
 	}
+
+	for (size_t i = 0; i < sceneObjects.campfires.size(); i++)
+	{
+		sceneObjects.campfires[i].intensity = 0.8f + 0.2f * sin(elapsedTime * 9.0f + 1.7f * i);
+	}
 }
 
 /**
@@ -594,7 +764,8 @@ void manaeste::resetScene()
 	if (sceneState.freeCameraMode)
 	{
 		sceneState.freeCameraMode = false;
-		glutPassiveMotionFunc(NULL);
+		if (!sceneState.headless)
+			glutPassiveMotionFunc(NULL);
 	}
 	sceneState.cameraNum = 4;
 
@@ -620,18 +791,23 @@ void manaeste::resetScene()
 		sceneObjects.palmList.push_back(setObject(PALM, position));
 	}
 
+	updateDrawLists();
+	placeCampfires(NUM_CAMPFIRES);
+
 	if (sceneObjects.sparkles == nullptr)
 	{
 		sceneObjects.sparkles = setObject(FIRE, glm::vec3(0.4f, 2.0f, 0.0f));
 	}
 
 	sceneState.fogOn = false;
-	setFogState(sceneState.fogOn);
 	sceneState.sparklesOn = false;
 	sceneState.sunOn = true;
 	sceneState.amongusOn = false;
 	sceneState.flashlightOn = false;
 
+	if (sceneState.headless)
+		return;
+
 	if (FULL_SCREEN)
 	{
 		glutFullScreen();
@@ -661,7 +837,10 @@ void manaeste::displayCb()
 {
 	clearGLbuffers();
 	drawScene();
+	if (sceneState.gpuTimerOverlay)
+		drawGpuTimerOverlay(sceneState.windowWidth, sceneState.windowHeight);
 	glutSwapBuffers();
+	markCpuFrame();
 }
 
 /**
@@ -727,7 +906,6 @@ void manaeste::keyboardUpCb(unsigned char keyReleased, int, int)
 		break;
 	case G_KEY:
 		sceneState.fogOn = !sceneState.fogOn;
-		setFogState(sceneState.fogOn);
 		break;
 	case B_KEY:
 		bannerToggle();
@@ -744,6 +922,12 @@ void manaeste::keyboardUpCb(unsigned char keyReleased, int, int)
 	case R_KEY:
 		resetScene();
 		break;
+	case T_KEY:
+		gpuTimerOverlayToggle();
+		break;
+	case C_KEY:
+		writeCpuTrace(CPU_TRACE_FILE);
+		break;
 	}
 }
 
@@ -866,6 +1050,7 @@ void manaeste::passiveMouseMotionCb(int mouseX, int mouseY)
 */
 void manaeste::timerCb(int)
 {
+	PROFILE_ZONE("timerCb");
 	sceneState.elapsedTime = 0.001f * (float)glutGet(GLUT_ELAPSED_TIME);
 
 	if (sceneState.cameraNum == 4)
@@ -906,6 +1091,11 @@ void manaeste::timerCb(int)
 		sceneObjects.amongus->currentTime = sceneState.elapsedTime;
 	}
 
+	if (sceneState.gpuTimerOverlay && sceneState.elapsedTime - sceneState.gpuTimesShownAt >= 0.5f)
+	{
+		glutSetWindowTitle((std::string(WINDOW_TITLE) + " - " + gpuTimesSummary(averageGpuTimes(30))).c_str());
+		sceneState.gpuTimesShownAt = sceneState.elapsedTime;
+	}
 
 	glutTimerFunc(33, timerCb, 33);
 
@@ -958,18 +1148,25 @@ void manaeste::loadConfig(const std::string& path)
 */
 void manaeste::initApplication()
 {
+	PROFILE_ZONE("initApplication");
 	std::srand(static_cast<unsigned int>(std::time(nullptr)));
+	setProfileThreadName("main");
 
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClearStencil(0);
 	glEnable(GL_DEPTH_TEST);
-	glutSetCursor(GLUT_CURSOR_CROSSHAIR);
+	if (!sceneState.headless)
+		glutSetCursor(GLUT_CURSOR_CROSSHAIR);
 
 	sceneObjects.amongus = nullptr;
 
 	createShaders();
 	loadMeshes();
+	finishShaders();
+	createGpuTimers();
 	resetScene();
+	// loading bound buffers and textures behind the back of the state cache
+	resetGlState();
 }
 
 /**
@@ -978,12 +1175,16 @@ void manaeste::initApplication()
 void manaeste::finalizeApplication()
 {
 	deleteObjects();
-	deleteAmongusAndSkyboxGeoms();
+	deleteMeshes();
+	deleteRenderQueue();
+	deleteGpuTimers();
 	delete sceneObjects.raider;
 	sceneObjects.raider = nullptr;
 	deleteShaders();
+	reportLeakedResources(std::cerr);
 }
 
+#ifndef WILDISLAND_BENCH
 /**
  * @brief Entry point of the application.
  * @param argc number of command-line arguments
@@ -995,6 +1196,21 @@ int main(int argc, char** argv)
 	loadConfig("config.txt");
 	glutInit(&argc, argv);
 
+	// glutInit() leaves the arguments it does not know
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) != "--trace-frames")
+			continue;
+		try
+		{
+			requestCpuTrace(CPU_TRACE_FILE, (unsigned int)std::max(std::stoi(argv[++i]), 0));
+		}
+		catch (const std::exception&)
+		{
+			std::cerr << "main(): usage: --trace-frames N, ignoring \"" << argv[i] << "\"" << std::endl;
+		}
+	}
+
 	glutInitContextVersion(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR);
 	glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
@@ -1024,3 +1240,5 @@ int main(int argc, char** argv)
 
 	return EXIT_SUCCESS;
 }
+
+#endif // WILDISLAND_BENCH
@@ -0,0 +1,364 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    megabuffer.cpp : Geometry and materials of the multi-draw path.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   With GL 4.3 every static mesh is suballocated from one vertex storage buffer and
+ *          one index buffer, and every mesh texture becomes a layer of one texture array, so
+ *          the whole opaque pass draws with a single program, vertex array and texture.
+ *
+ * Meshes keep their own vertex layout (PackedVertex or MeshVertex). lights.vert reads the
+ * vertices from the storage buffer by gl_VertexID instead of through vertex attributes, so
+ * both layouts live in the same buffer. The only attribute is the instance index, fetched
+ * with divisor 1 from a buffer of consecutive integers: baseInstance + gl_InstanceID, the
+ * InstanceTable entry of the instance, which gl_InstanceID alone does not give before GL 4.6.
+ *
+ * Each frame the render queue writes one MaterialTable entry per draw, one InstanceTable
+ * entry per instance and one indirect command per draw (uploadMultiDrawTables()). Instance
+ * sets culled on the GPU get InstanceTable space reserved behind the queued instances, which
+ * cull.comp fills, and commands whose instance counts it increments.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include "megabuffer.h"
+#include "resources.h"
+#include "glstate.h"
+#include "ktx.h"
+#include "renderstats.h"
+
+using namespace manaeste;
+
+namespace
+{
+	const size_t MIN_INSTANCE_INDICES = 1024;
+
+	std::vector<uint32_t> vertexWords;         ///< vertices of every mesh until uploadMegaBuffers()
+	std::vector<uint32_t> megaIndices;         ///< indices of every mesh, relative to the first vertex of the mesh
+	std::vector<GLuint> materialTextures;      ///< textures in layer order
+	std::unordered_map<GLuint, GLint> textureLayers;
+
+	GLuint vertexBuffer = 0;        ///< vertex storage read by lights.vert
+	GLuint indexBuffer = 0;
+	GLuint instanceIndexBuffer = 0; ///< 0, 1, 2, ... for the instanceIndex attribute
+	GLuint vertexArray = 0;
+	GLuint textureArray = 0;
+	GLuint instanceTable = 0;
+	GLuint materialTable = 0;
+	GLuint commandBuffer = 0;
+	size_t instanceIndexCapacity = 0;
+
+	template<typename Index>
+	void appendIndices(const void* source, uint32_t count)
+	{
+		const Index* indices = static_cast<const Index*>(source);
+		megaIndices.insert(megaIndices.end(), indices, indices + count);
+	}
+
+	/// Bilinear scaling of an RGBA8 image to a square.
+	void scaleImage(const std::vector<uint8_t>& source, int width, int height, std::vector<uint8_t>& target, int size)
+	{
+		target.resize(4 * (size_t)size * size);
+		for (int y = 0; y < size; y++)
+		{
+			const float sourceY = std::max(0.0f, (y + 0.5f) * height / size - 0.5f);
+			const int y0 = std::min((int)sourceY, height - 1);
+			const int y1 = std::min(y0 + 1, height - 1);
+			const float fy = sourceY - y0;
+			for (int x = 0; x < size; x++)
+			{
+				const float sourceX = std::max(0.0f, (x + 0.5f) * width / size - 0.5f);
+				const int x0 = std::min((int)sourceX, width - 1);
+				const int x1 = std::min(x0 + 1, width - 1);
+				const float fx = sourceX - x0;
+				for (int c = 0; c < 4; c++)
+				{
+					auto texel = [&](int tx, int ty) { return (float)source[4 * ((size_t)ty * width + tx) + c]; };
+					const float top = texel(x0, y0) + (texel(x1, y0) - texel(x0, y0)) * fx;
+					const float bottom = texel(x0, y1) + (texel(x1, y1) - texel(x0, y1)) * fx;
+					target[4 * ((size_t)y * size + x) + c] = (uint8_t)(top + (bottom - top) * fy + 0.5f);
+				}
+			}
+		}
+	}
+
+	/// Copies a 2D texture into a layer, from its smallest level still as large as the layer.
+	/// Compressed textures are decompressed by the driver when read back as RGBA8.
+	void copyLayer(GLuint texture, GLint layer, GLsizei layerSize)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		GLint level = 0, width = 0, height = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		for (;;)
+		{
+			GLint nextWidth = 0, nextHeight = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_WIDTH, &nextWidth);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_HEIGHT, &nextHeight);
+			if (nextWidth < layerSize || nextHeight < layerSize)
+				break;
+			level++;
+			width = nextWidth;
+			height = nextHeight;
+		}
+		if (width <= 0 || height <= 0)
+			return;
+
+		std::vector<uint8_t> pixels(4 * (size_t)width * height);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+		std::vector<uint8_t> scaled;
+		scaleImage(pixels, width, height, scaled, layerSize);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, layerSize, layerSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, scaled.data());
+	}
+
+	void createTextureArray()
+	{
+		GLsizei layerSize = 1;
+		for (GLuint texture : materialTextures)
+		{
+			GLint width = 0, height = 0;
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+			layerSize = std::max(layerSize, (GLsizei)std::max(width, height));
+		}
+		layerSize = std::min(layerSize, MATERIAL_LAYER_MAX_SIZE);
+
+		textureArray = createResource(TEXTURE, "material texture array");
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layerSize, layerSize, (GLsizei)materialTextures.size(), 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, nullptr);
+		for (size_t layer = 0; layer < materialTextures.size(); layer++)
+			copyLayer(materialTextures[layer], (GLint)layer, layerSize);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		setResourceBytes(TEXTURE, textureArray, rgbaMipChainBytes(layerSize, layerSize) * materialTextures.size());
+		CHECK_GL_ERROR();
+	}
+
+	/// Makes the instance index buffer hold at least count indices.
+	void reserveInstanceIndices(size_t count)
+	{
+		if (count <= instanceIndexCapacity)
+			return;
+		instanceIndexCapacity = std::max(MIN_INSTANCE_INDICES, instanceIndexCapacity);
+		while (instanceIndexCapacity < count)
+			instanceIndexCapacity *= 2;
+
+		std::vector<GLuint> indices(instanceIndexCapacity);
+		std::iota(indices.begin(), indices.end(), 0);
+		bindBuffer(GL_ARRAY_BUFFER, instanceIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		setResourceBytes(INSTANCE_BUFFER, instanceIndexBuffer, indices.size() * sizeof(GLuint));
+	}
+
+	/// Replaces the contents of a frame buffer, leaving room for reserved records after them, and
+	/// binds it to its storage block.
+	template<typename Record>
+	void uploadTable(GLuint buffer, GLuint binding, const std::vector<Record>& records, size_t reserved = 0)
+	{
+		const size_t bytes = std::max<size_t>(records.size() + reserved, 1) * sizeof(Record);
+		bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, records.size() * sizeof(Record), records.data());
+		setResourceBytes(STORAGE_BUFFER, buffer, bytes);
+		COUNT_RENDER_STAT(uploadedBytes, records.size() * sizeof(Record));
+		bindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, 0, bytes);
+	}
+}
+
+/**
+ * @brief The multi-draw path needs GL 4.3 (indirect multi-draw, storage buffers) and storage
+ *        buffers readable by the vertex shader, which GL 4.3 does not guarantee.
+ * @return true if the current context can draw the multi-draw path
+*/
+bool manaeste::multiDrawSupported()
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major < 4 || (major == 4 && minor < 3))
+		return false;
+
+	GLint vertexStorageBlocks = 0;
+	glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertexStorageBlocks);
+	return vertexStorageBlocks >= 3;
+}
+
+/**
+ * @brief Appends the vertices and indices of a mesh to the mega-buffer, uploaded by uploadMegaBuffers().
+ * @param vertices vertices exactly as they are uploaded to the vertex buffer of the mesh
+ * @param vertexBytes size of vertices, a multiple of 4
+ * @param mesh mesh, for its indices of all levels of detail
+ * @param packed vertices are PackedVertex, MeshVertex otherwise
+ * @return place of the mesh in the mega-buffer
+*/
+MegaRange manaeste::appendMegaMesh(const void* vertices, size_t vertexBytes, const MeshView& mesh, bool packed)
+{
+	MegaRange range;
+	range.firstVertexWord = (uint32_t)vertexWords.size();
+	range.firstIndex = (uint32_t)megaIndices.size();
+	range.packed = packed;
+
+	const uint32_t* words = static_cast<const uint32_t*>(vertices);
+	vertexWords.insert(vertexWords.end(), words, words + vertexBytes / sizeof(uint32_t));
+	if (mesh.indexType == GL_UNSIGNED_SHORT)
+		appendIndices<uint16_t>(mesh.indices, mesh.numIndices);
+	else
+		appendIndices<uint32_t>(mesh.indices, mesh.numIndices);
+	return range;
+}
+
+/**
+ * @brief Gives a texture a layer of the material texture array made by uploadMegaBuffers().
+ * @param texture 2D texture, 0 is ignored
+*/
+void manaeste::addMaterialTexture(GLuint texture)
+{
+	if (texture == 0 || textureLayers.count(texture) != 0)
+		return;
+	textureLayers[texture] = (GLint)materialTextures.size();
+	materialTextures.push_back(texture);
+}
+
+/**
+ * @brief Layer of a texture in the material texture array.
+ * @param texture 2D texture
+ * @return layer, -1 if the texture has none
+*/
+GLint manaeste::materialTextureLayer(GLuint texture)
+{
+	auto layer = textureLayers.find(texture);
+	return (layer != textureLayers.end() && textureArray != 0) ? layer->second : -1;
+}
+
+/**
+ * @brief Uploads the appended meshes and textures and creates the vertex array of the multi-draw
+ *        path. The appended data is freed, later meshes cannot join.
+ * @param instanceIndexLoc location of the instanceIndex attribute
+*/
+void manaeste::uploadMegaBuffers(GLuint instanceIndexLoc)
+{
+	if (vertexWords.empty() || megaIndices.empty())
+		return;
+
+	vertexBuffer = createResource(STORAGE_BUFFER, "mega-buffer vertices");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, vertexWords.size() * sizeof(uint32_t), vertexWords.data(), GL_STATIC_DRAW);
+	setResourceBytes(STORAGE_BUFFER, vertexBuffer, vertexWords.size() * sizeof(uint32_t));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_STORAGE_BINDING, vertexBuffer);
+
+	instanceTable = createResource(STORAGE_BUFFER, "instance table");
+	materialTable = createResource(STORAGE_BUFFER, "material table");
+	commandBuffer = createResource(INDIRECT_BUFFER, "indirect commands");
+	instanceIndexBuffer = createResource(INSTANCE_BUFFER, "instance indices");
+	indexBuffer = createResource(INDEX_BUFFER, "mega-buffer indices");
+	vertexArray = createResource(VERTEX_ARRAY, "mega-buffer");
+
+	glBindVertexArray(vertexArray);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, megaIndices.size() * sizeof(uint32_t), megaIndices.data(), GL_STATIC_DRAW);
+	setResourceBytes(INDEX_BUFFER, indexBuffer, megaIndices.size() * sizeof(uint32_t));
+
+	reserveInstanceIndices(MIN_INSTANCE_INDICES);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBuffer);
+	glEnableVertexAttribArray(instanceIndexLoc);
+	glVertexAttribIPointer(instanceIndexLoc, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+	glVertexAttribDivisor(instanceIndexLoc, 1);
+	glBindVertexArray(0);
+	CHECK_GL_ERROR();
+
+	if (!materialTextures.empty())
+		createTextureArray();
+
+	std::vector<uint32_t>().swap(vertexWords);
+	std::vector<uint32_t>().swap(megaIndices);
+}
+
+/**
+ * @brief Deletes the buffers and the texture array of the multi-draw path.
+*/
+void manaeste::deleteMegaBuffers()
+{
+	deleteResource(STORAGE_BUFFER, vertexBuffer);
+	deleteResource(STORAGE_BUFFER, instanceTable);
+	deleteResource(STORAGE_BUFFER, materialTable);
+	deleteResource(INDIRECT_BUFFER, commandBuffer);
+	deleteResource(INSTANCE_BUFFER, instanceIndexBuffer);
+	deleteResource(INDEX_BUFFER, indexBuffer);
+	deleteResource(VERTEX_ARRAY, vertexArray);
+	deleteResource(TEXTURE, textureArray);
+	instanceIndexCapacity = 0;
+
+	vertexWords.clear();
+	megaIndices.clear();
+	materialTextures.clear();
+	textureLayers.clear();
+}
+
+/**
+ * @brief Vertex array of the multi-draw path.
+ * @return vertex array, 0 until uploadMegaBuffers()
+*/
+GLuint manaeste::megaVertexArray()
+{
+	return vertexArray;
+}
+
+/**
+ * @brief Texture array holding the textures given to addMaterialTexture().
+ * @return texture array, 0 without textures
+*/
+GLuint manaeste::materialTextureArray()
+{
+	return textureArray;
+}
+
+/**
+ * @brief Buffer holding the indirect commands of the last uploadMultiDrawTables().
+ * @return buffer, 0 until uploadMegaBuffers()
+*/
+GLuint manaeste::indirectCommandBuffer()
+{
+	return commandBuffer;
+}
+
+/**
+ * @brief Uploads the tables and commands of the frame, binds them and leaves the command buffer
+ *        bound to GL_DRAW_INDIRECT_BUFFER.
+ * @param materials MaterialTable, one entry per draw
+ * @param instances InstanceTable, one entry per instance
+ * @param commands one command per draw
+ * @param reservedInstances InstanceTable entries after instances written on the GPU; the command
+ *        buffer is then also bound to COMMAND_STORAGE_BINDING
+*/
+void manaeste::uploadMultiDrawTables(const std::vector<MaterialRecord>& materials, const std::vector<InstanceRecord>& instances,
+	const std::vector<DrawElementsIndirectCommand>& commands, size_t reservedInstances)
+{
+	reserveInstanceIndices(instances.size() + reservedInstances);
+	uploadTable(materialTable, MATERIAL_STORAGE_BINDING, materials);
+	uploadTable(instanceTable, INSTANCE_STORAGE_BINDING, instances, reservedInstances);
+
+	const size_t commandBytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+	bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commandBytes, commands.data(), GL_STREAM_DRAW);
+	setResourceBytes(INDIRECT_BUFFER, commandBuffer, commandBytes);
+	COUNT_RENDER_STAT(uploadedBytes, commandBytes);
+	if (reservedInstances > 0 && commandBytes > 0)
+		bindBufferRange(GL_SHADER_STORAGE_BUFFER, COMMAND_STORAGE_BINDING, commandBuffer, 0, commandBytes);
+}
@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    megabuffer.h : Header file for megabuffer.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Shared vertex, index, material and instance storage of the GL 4.3 multi-draw path.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "pgr.h"
+#include "mesh.h"
+
+namespace manaeste
+{
+	/// Shader storage binding points of lights.vert and lights.frag built with MULTI_DRAW, and of cull.comp.
+	enum StorageBlockBinding
+	{
+		VERTEX_STORAGE_BINDING = 0, INSTANCE_STORAGE_BINDING = 1, MATERIAL_STORAGE_BINDING = 2, SOURCE_INSTANCE_BINDING = 3,
+		COMMAND_STORAGE_BINDING = 4
+	};
+
+	/// Texture unit of the material texture array.
+	const GLuint MATERIAL_TEXTURE_UNIT = 2;
+	/// Layers of the material texture array take the size of the largest texture, up to this side.
+	const GLsizei MATERIAL_LAYER_MAX_SIZE = 1024;
+
+	/// Where a mesh lives in the mega-buffer.
+	typedef struct MegaRange
+	{
+		uint32_t firstVertexWord{}; ///< first vertex, in 4 byte words of the vertex storage
+		uint32_t firstIndex{};      ///< index 0 of the mesh in the shared index buffer
+		bool packed{};              ///< PackedVertex layout, MeshVertex otherwise
+	} MegaRange;
+
+	/// std430 layout of a MaterialTable entry: material, texture layer and vertex decoding of one draw.
+	typedef struct MaterialRecord
+	{
+		glm::vec3 ambient{};
+		float shininess{};
+		glm::vec3 diffuse{};
+		GLint textureLayer{ -1 };    ///< -1 draws without texture
+		glm::vec3 specular{};
+		GLint packedVertices{};
+		glm::vec3 positionScale{ 1.0f };
+		GLuint firstVertexWord{};
+		glm::vec3 positionOffset{ 0.0f };
+		GLint padding{};
+		glm::vec4 texCoordTransform{ 1.0f, 1.0f, 0.0f, 0.0f };
+	} MaterialRecord;
+
+	/// std430 layout of an InstanceTable entry.
+	typedef struct InstanceRecord
+	{
+		glm::mat4 modelMatrix{};
+		glm::mat4 normalMatrix{};
+		GLuint material{};           ///< index into the MaterialTable
+		GLuint padding[3]{};
+	} InstanceRecord;
+
+	/// Command read by glMultiDrawElementsIndirect().
+	typedef struct DrawElementsIndirectCommand
+	{
+		GLuint count{};
+		GLuint instanceCount{};
+		GLuint firstIndex{};
+		GLint baseVertex{};
+		GLuint baseInstance{};       ///< first InstanceTable entry of the draw
+	} DrawElementsIndirectCommand;
+
+	bool multiDrawSupported();
+
+	MegaRange appendMegaMesh(const void* vertices, size_t vertexBytes, const MeshView& mesh, bool packed);
+	void addMaterialTexture(GLuint texture);
+	GLint materialTextureLayer(GLuint texture);
+	void uploadMegaBuffers(GLuint instanceIndexLoc);
+	void deleteMegaBuffers();
+
+	GLuint megaVertexArray();
+	GLuint materialTextureArray();
+	GLuint indirectCommandBuffer();
+	void uploadMultiDrawTables(const std::vector<MaterialRecord>& materials, const std::vector<InstanceRecord>& instances,
+		const std::vector<DrawElementsIndirectCommand>& commands, size_t reservedInstances = 0);
+}
@@ -0,0 +1,582 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    mesh.cpp : Model import and binary mesh cache.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Imports models with assimp and stores the post-processed meshes in a versioned
+ *          binary cache next to the model, which is memory-mapped on later runs.
+ *
+ * Cache layout (native endianness, every block 4-byte aligned):
+ *   MeshCacheHeader
+ *   per mesh: MeshCacheRecord, texture name (padded to 4 bytes), levels of detail (MeshLod),
+ *             interleaved vertices (MeshVertex), indices of all levels (16 or 32 bits each,
+ *             padded to 4 bytes)
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <utility>
+#include "mesh.h"
+#include "objparser.h"
+#include "simplify.h"
+#include "optimize.h"
+#include "profiler.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace manaeste;
+
+namespace
+{
+	const char MESH_CACHE_MAGIC[8] = { 'W', 'I', 'M', 'E', 'S', 'H', '\0', '\0' };
+
+	struct MeshCacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t importFlags;
+		uint64_t sourceHash;
+		uint32_t numMeshes;
+		uint32_t reserved;
+	};
+
+	struct MeshCacheRecord
+	{
+		uint32_t numVertices;
+		uint32_t numTriangles;
+		float ambient[3];
+		float diffuse[3];
+		float specular[3];
+		float shininess;
+		uint32_t textureNameLength;
+		uint32_t indexType;
+		uint32_t numIndices;
+		uint32_t numLods;
+	};
+
+	size_t alignTo4(size_t size)
+	{
+		return (size + 3) & ~size_t(3);
+	}
+
+	/// Tells whether every index addresses one of the vertices.
+	template<typename Index>
+	bool indicesInRange(const void* indices, size_t numIndices, uint32_t numVertices)
+	{
+		const Index* index = (const Index*)indices;
+		for (size_t i = 0; i < numIndices; ++i)
+		{
+			if (index[i] >= numVertices)
+				return false;
+		}
+		return true;
+	}
+
+	/// FNV-1a, continues from the given hash.
+	uint64_t fnv1a(const unsigned char* data, size_t size, uint64_t hash)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	void writePadded(std::ofstream& file, const void* data, size_t size)
+	{
+		static const char zeros[4] = {};
+		file.write((const char*)data, size);
+		file.write(zeros, alignTo4(size) - size);
+	}
+}
+
+/**
+ * @brief Narrows the indices to 16 bits if every vertex can be addressed with them.
+*/
+void MeshData::packIndices()
+{
+	if (vertices.size() > MAX_SHORT_INDEX_VERTICES || indices.empty())
+		return;
+
+	shortIndices.assign(indices.begin(), indices.end());
+	std::vector<uint32_t>().swap(indices);
+}
+
+/**
+ * @brief Returns a view of the mesh data.
+ * @return view pointing into the vectors of this mesh
+*/
+MeshView MeshData::view() const
+{
+	MeshView view;
+	view.numVertices = (uint32_t)vertices.size();
+	view.vertices = vertices.data();
+	if (!shortIndices.empty())
+	{
+		view.numIndices = (uint32_t)shortIndices.size();
+		view.indices = shortIndices.data();
+		view.indexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		view.numIndices = (uint32_t)indices.size();
+		view.indices = indices.data();
+		view.indexType = GL_UNSIGNED_INT;
+	}
+	view.lods = lods;
+	if (view.lods.empty())
+		view.lods.push_back({ 0, view.numIndices / 3, 0.0f });
+	view.numTriangles = view.lods[0].numTriangles;
+	view.material = material;
+	return view;
+}
+
+/**
+ * @brief Size of one index.
+ * @param indexType GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+ * @return bytes
+*/
+size_t manaeste::indexSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+/**
+ * @brief Sets the normal of every vertex to the average of the normals of its triangles,
+ *        weighted by their area.
+ * @param mesh mesh with 32-bit indices
+*/
+void manaeste::computeVertexNormals(MeshData& mesh)
+{
+	std::vector<glm::vec3> accumulated(mesh.vertices.size(), glm::vec3(0.0f));
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		const float* a = mesh.vertices[mesh.indices[i + 0]].position;
+		const float* b = mesh.vertices[mesh.indices[i + 1]].position;
+		const float* c = mesh.vertices[mesh.indices[i + 2]].position;
+		glm::vec3 faceNormal = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+		for (int corner = 0; corner < 3; corner++)
+			accumulated[mesh.indices[i + corner]] += faceNormal;
+	}
+
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+	{
+		float length = glm::length(accumulated[v]);
+		glm::vec3 normal = length > 0.0f ? accumulated[v] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		mesh.vertices[v].normal[0] = normal.x;
+		mesh.vertices[v].normal[1] = normal.y;
+		mesh.vertices[v].normal[2] = normal.z;
+	}
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+#ifdef _WIN32
+		std::swap(file_, other.file_);
+		std::swap(mapping_, other.mapping_);
+#endif
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/**
+ * @brief Maps the whole file into memory (read only).
+ * @param fileName file to map
+ * @return true if the file was mapped
+*/
+bool MappedFile::open(const std::string& fileName)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	data_ = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data_ == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_ = file;
+	mapping_ = mapping;
+	size_ = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	data_ = (const unsigned char*)data;
+	size_ = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+/**
+ * @brief Unmaps the file.
+*/
+void MappedFile::close()
+{
+	if (data_ == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(data_);
+	CloseHandle((HANDLE)mapping_);
+	CloseHandle((HANDLE)file_);
+	file_ = mapping_ = nullptr;
+#else
+	munmap((void*)data_, size_);
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
+
+/**
+ * @brief Hashes the model file and its material library (same name, .mtl).
+ * @param fileName model file
+ * @return hash of the sources, 0 if the model file cannot be read
+*/
+uint64_t manaeste::hashModelSource(const std::string& fileName)
+{
+	MappedFile model;
+	if (!model.open(fileName))
+		return 0;
+
+	uint64_t hash = fnv1a(model.data(), model.size(), 14695981039346656037ull);
+
+	size_t dot = fileName.find_last_of('.');
+	MappedFile materials;
+	if (dot != std::string::npos && materials.open(fileName.substr(0, dot) + ".mtl"))
+		hash = fnv1a(materials.data(), materials.size(), hash);
+
+	return hash;
+}
+
+/**
+ * @brief Path of the binary cache belonging to the model.
+ * @param fileName model file
+ * @return cache file path
+*/
+std::string manaeste::meshCachePath(const std::string& fileName)
+{
+	return fileName + ".meshcache";
+}
+
+/**
+ * @brief Loads all meshes of a model using assimp library.
+ * @param fileName file to open/load
+ * @param meshes post-processed meshes
+ * @return true if loading was successful
+*/
+bool manaeste::importModel(const std::string& fileName, std::vector<MeshData>& meshes)
+{
+	PROFILE_ZONE("importModel");
+	Assimp::Importer importer;
+
+	importer.SetPropertyInteger(AI_CONFIG_PP_PTV_NORMALIZE, 1);
+	const aiScene* scn = importer.ReadFile(fileName.c_str(), MESH_IMPORT_FLAGS);
+
+	if (scn == NULL)
+	{
+		std::cerr << "importModel(): assimp error - " << importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	meshes.resize(scn->mNumMeshes);
+	for (unsigned int i = 0; i < scn->mNumMeshes; i++)
+	{
+		const aiMesh* mesh = scn->mMeshes[i];
+		MeshData& data = meshes[i];
+
+		data.vertices.resize(mesh->mNumVertices);
+		for (unsigned int idx = 0; idx < mesh->mNumVertices; idx++)
+		{
+			MeshVertex& vertex = data.vertices[idx];
+			vertex.position[0] = mesh->mVertices[idx].x;
+			vertex.position[1] = mesh->mVertices[idx].y;
+			vertex.position[2] = mesh->mVertices[idx].z;
+			vertex.normal[0] = mesh->mNormals[idx].x;
+			vertex.normal[1] = mesh->mNormals[idx].y;
+			vertex.normal[2] = mesh->mNormals[idx].z;
+			vertex.texCoord[0] = mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0][idx].x : 0.0f;
+			vertex.texCoord[1] = mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0][idx].y : 0.0f;
+		}
+
+		data.indices.resize(3 * mesh->mNumFaces);
+		for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
+		{
+			data.indices[f * 3 + 0] = mesh->mFaces[f].mIndices[0];
+			data.indices[f * 3 + 1] = mesh->mFaces[f].mIndices[1];
+			data.indices[f * 3 + 2] = mesh->mFaces[f].mIndices[2];
+		}
+
+		const aiMaterial* mat = scn->mMaterials[mesh->mMaterialIndex];
+		aiColor4D color;
+
+		if (aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &color) != AI_SUCCESS)
+			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+		data.material.diffuse = glm::vec3(color.r, color.g, color.b);
+
+		if (aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &color) != AI_SUCCESS)
+			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+		data.material.ambient = glm::vec3(color.r, color.g, color.b);
+
+		if (aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &color) != AI_SUCCESS)
+			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
+		data.material.specular = glm::vec3(color.r, color.g, color.b);
+
+		ai_real shininess, strength;
+		unsigned int max;
+
+		max = 1;
+		if (aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS, &shininess, &max) != AI_SUCCESS)
+			shininess = 1.0f;
+		max = 1;
+		if (aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS_STRENGTH, &strength, &max) != AI_SUCCESS)
+			strength = 1.0f;
+		data.material.shininess = shininess * strength;
+
+		if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+		{
+			aiString path;
+			mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
+			std::string textureName = path.data;
+
+			size_t found = fileName.find_last_of("/\\");
+			if (found != std::string::npos)
+			{
+				textureName.insert(0, fileName.substr(0, found + 1));
+			}
+			data.material.textureName = textureName;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Maps the binary cache of the model if it matches the current sources and import flags.
+ * @param fileName model file
+ * @param sourceHash hash of the model sources (see hashModelSource())
+ * @param model filled with views into the mapped cache
+ * @return true if the cache was valid and mapped
+*/
+bool manaeste::readMeshCache(const std::string& fileName, uint64_t sourceHash, ModelData& model)
+{
+	PROFILE_ZONE("readMeshCache");
+	MappedFile file;
+	if (!file.open(meshCachePath(fileName)) || file.size() < sizeof(MeshCacheHeader))
+		return false;
+
+	MeshCacheHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION ||
+		header.importFlags != MESH_IMPORT_FLAGS ||
+		header.sourceHash != sourceHash)
+		return false;
+
+	std::vector<MeshView> meshes(header.numMeshes);
+	size_t offset = sizeof(MeshCacheHeader);
+	for (auto& mesh : meshes)
+	{
+		if (offset + sizeof(MeshCacheRecord) > file.size())
+			return false;
+
+		MeshCacheRecord record;
+		std::memcpy(&record, file.data() + offset, sizeof(record));
+		offset += sizeof(record);
+
+		if (record.indexType != GL_UNSIGNED_SHORT && record.indexType != GL_UNSIGNED_INT)
+			return false;
+
+		size_t nameSize = alignTo4(record.textureNameLength);
+		size_t lodsSize = (size_t)record.numLods * sizeof(MeshLod);
+		size_t indicesSize = alignTo4((size_t)record.numIndices * indexSize(record.indexType));
+		size_t dataSize = (size_t)record.numVertices * sizeof(MeshVertex) + indicesSize;
+		if (record.numLods == 0 || offset + nameSize + lodsSize + dataSize > file.size())
+			return false;
+
+		mesh.numVertices = record.numVertices;
+		mesh.numTriangles = record.numTriangles;
+		mesh.material.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+		mesh.material.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+		mesh.material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+		mesh.material.shininess = record.shininess;
+		mesh.material.textureName.assign((const char*)file.data() + offset, record.textureNameLength);
+		offset += nameSize;
+
+		mesh.lods.resize(record.numLods);
+		std::memcpy(mesh.lods.data(), file.data() + offset, lodsSize);
+		offset += lodsSize;
+		for (const auto& lod : mesh.lods)
+		{
+			if ((size_t)lod.firstIndex + (size_t)lod.numTriangles * 3 > record.numIndices)
+				return false;
+		}
+
+		mesh.vertices = (const MeshVertex*)(file.data() + offset);
+		offset += record.numVertices * sizeof(MeshVertex);
+		mesh.numIndices = record.numIndices;
+		mesh.indices = file.data() + offset;
+		mesh.indexType = record.indexType;
+		offset += indicesSize;
+
+		// a cache of the right size may still index past its vertices, reimport it instead
+		const bool inRange = (mesh.indexType == GL_UNSIGNED_SHORT) ?
+			indicesInRange<uint16_t>(mesh.indices, mesh.numIndices, mesh.numVertices) :
+			indicesInRange<uint32_t>(mesh.indices, mesh.numIndices, mesh.numVertices);
+		if (!inRange)
+			return false;
+	}
+
+	model.cache = std::move(file);
+	model.meshes = std::move(meshes);
+	model.fromCache = true;
+	return true;
+}
+
+/**
+ * @brief Stores the post-processed meshes next to the model.
+ * @param fileName model file
+ * @param sourceHash hash of the model sources (see hashModelSource())
+ * @param meshes meshes to store
+ * @return true if the cache was written
+*/
+bool manaeste::writeMeshCache(const std::string& fileName, uint64_t sourceHash, const std::vector<MeshData>& meshes)
+{
+	PROFILE_ZONE("writeMeshCache");
+	std::string cachePath = meshCachePath(fileName);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		MeshCacheHeader header = {};
+		std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+		header.version = MESH_CACHE_VERSION;
+		header.importFlags = MESH_IMPORT_FLAGS;
+		header.sourceHash = sourceHash;
+		header.numMeshes = (uint32_t)meshes.size();
+		file.write((const char*)&header, sizeof(header));
+
+		for (const auto& data : meshes)
+		{
+			const MeshView mesh = data.view();
+			MeshCacheRecord record = {};
+			record.numVertices = mesh.numVertices;
+			record.numTriangles = mesh.numTriangles;
+			std::memcpy(record.ambient, glm::value_ptr(mesh.material.ambient), sizeof(record.ambient));
+			std::memcpy(record.diffuse, glm::value_ptr(mesh.material.diffuse), sizeof(record.diffuse));
+			std::memcpy(record.specular, glm::value_ptr(mesh.material.specular), sizeof(record.specular));
+			record.shininess = mesh.material.shininess;
+			record.textureNameLength = (uint32_t)mesh.material.textureName.size();
+			record.indexType = mesh.indexType;
+			record.numIndices = mesh.numIndices;
+			record.numLods = (uint32_t)mesh.lods.size();
+			file.write((const char*)&record, sizeof(record));
+
+			writePadded(file, mesh.material.textureName.data(), mesh.material.textureName.size());
+			file.write((const char*)mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+			file.write((const char*)mesh.vertices, mesh.numVertices * sizeof(MeshVertex));
+			writePadded(file, mesh.indices, (size_t)mesh.numIndices * indexSize(mesh.indexType));
+		}
+
+		if (!file.good())
+			return false;
+	}
+
+	// replace the old cache only once the new one is complete
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+/**
+ * @brief Loads all meshes of a model, from the binary cache when it is up to date, otherwise
+ * with the built-in OBJ parser (assimp for other formats or when it fails), refreshing the
+ * cache afterwards.
+ * @param fileName model file
+ * @param model loaded meshes
+ * @return true if loading was successful
+*/
+bool manaeste::loadModelData(const std::string& fileName, ModelData& model)
+{
+	PROFILE_ZONE("loadModelData");
+	uint64_t sourceHash = hashModelSource(fileName);
+	if (sourceHash != 0 && readMeshCache(fileName, sourceHash, model))
+		return true;
+
+	bool parsed = hasObjExtension(fileName) && parseObjModel(fileName, model.imported);
+	if (!parsed && !importModel(fileName, model.imported))
+		return false;
+
+	model.meshes.clear();
+	for (auto& mesh : model.imported)
+	{
+		buildLodChain(mesh);
+		optimizeMesh(mesh);
+		mesh.packIndices();
+		model.meshes.push_back(mesh.view());
+	}
+	model.fromCache = false;
+
+	if (sourceHash != 0 && !writeMeshCache(fileName, sourceHash, model.imported))
+		std::cerr << "loadModelData(): could not write mesh cache " << meshCachePath(fileName) << std::endl;
+
+	return true;
+}
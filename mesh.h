@@ -0,0 +1,129 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    mesh.h : Header file for mesh.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   CPU side mesh data, model import and the binary mesh cache.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "pgr.h"
+
+namespace manaeste
+{
+	/// Assimp post-processing applied to every model; part of the mesh cache key.
+	const unsigned int MESH_IMPORT_FLAGS = 0
+		| aiProcess_Triangulate
+		| aiProcess_PreTransformVertices
+		| aiProcess_GenSmoothNormals
+		| aiProcess_JoinIdenticalVertices;
+
+	/// Bump whenever the cache layout or the import post-processing changes.
+	const uint32_t MESH_CACHE_VERSION = 5;
+
+	/// Meshes with at most this many vertices get 16-bit indices.
+	const uint32_t MAX_SHORT_INDEX_VERTICES = 65536;
+
+	typedef struct MeshMaterial
+	{
+		glm::vec3 ambient{};
+		glm::vec3 diffuse{};
+		glm::vec3 specular{};
+		float shininess{};
+		std::string textureName; ///< path of the diffuse texture, empty if the mesh has none
+	} MeshMaterial;
+
+	/// Interleaved vertex layout shared by the importers, the mesh cache and the vertex buffers.
+	typedef struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+		float texCoord[2];
+	} MeshVertex;
+
+	/// One level of detail, a range of the index buffer shared by all levels of the mesh.
+	typedef struct MeshLod
+	{
+		uint32_t firstIndex;
+		uint32_t numTriangles;
+		float error;          ///< largest distance from the full mesh, in object space units
+	} MeshLod;
+
+	/// Non-owning view of one post-processed mesh, ready to be uploaded to the GPU.
+	typedef struct MeshView
+	{
+		uint32_t numVertices{};
+		uint32_t numTriangles{};        ///< of the full mesh
+		uint32_t numIndices{};          ///< of all levels of detail together
+		const MeshVertex* vertices{};
+		const void* indices{};          ///< 3 indices per triangle, of indexType
+		GLenum indexType{ GL_UNSIGNED_INT }; ///< GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		std::vector<MeshLod> lods;      ///< from the full mesh to the coarsest level
+		MeshMaterial material;
+	} MeshView;
+
+	/// Mesh data owned on the heap, produced by the importer.
+	typedef struct MeshData
+	{
+		std::vector<MeshVertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<uint16_t> shortIndices; ///< replaces indices once packIndices() narrowed them
+		std::vector<MeshLod> lods;          ///< empty unless buildLodChain() simplified the mesh
+		MeshMaterial material;
+
+		void packIndices();
+		MeshView view() const;
+	} MeshData;
+
+	/// Read-only memory mapping of a whole file.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+		~MappedFile();
+
+		bool open(const std::string& fileName);
+		void close();
+
+		const unsigned char* data() const { return data_; }
+		size_t size() const { return size_; }
+
+	private:
+		const unsigned char* data_{};
+		size_t size_{};
+#ifdef _WIN32
+		void* file_{};
+		void* mapping_{};
+#endif
+	};
+
+	/// All meshes of one model file. The views point either into the mapped cache or into imported.
+	typedef struct ModelData
+	{
+		MappedFile cache;
+		std::vector<MeshData> imported;
+		std::vector<MeshView> meshes;
+		bool fromCache{};
+	} ModelData;
+
+	size_t indexSize(GLenum indexType);
+	void computeVertexNormals(MeshData& mesh);
+
+	uint64_t hashModelSource(const std::string& fileName);
+	std::string meshCachePath(const std::string& fileName);
+
+	bool importModel(const std::string& fileName, std::vector<MeshData>& meshes);
+	bool readMeshCache(const std::string& fileName, uint64_t sourceHash, ModelData& model);
+	bool writeMeshCache(const std::string& fileName, uint64_t sourceHash, const std::vector<MeshData>& meshes);
+
+	bool loadModelData(const std::string& fileName, ModelData& model);
+}
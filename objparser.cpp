@@ -0,0 +1,628 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    objparser.cpp : Built-in Wavefront OBJ/MTL reader.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Streams a memory-mapped OBJ file with a hand-written tokenizer and produces the
+ *          same meshes as assimp with MESH_IMPORT_FLAGS and AI_CONFIG_PP_PTV_NORMALIZE:
+ *          polygons are fan-triangulated, corners with equal position, texture coordinate
+ *          and normal are joined through hash tables, missing normals are smoothed, all
+ *          groups using one material form one mesh (in material order, the default
+ *          material first) and the whole model is centered and scaled to [-1, 1].
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include "objparser.h"
+#include "profiler.h"
+
+using namespace manaeste;
+
+namespace
+{
+	/// Cursor over a memory-mapped text file.
+	struct TextCursor
+	{
+		const char* pos;
+		const char* end;
+		size_t line;
+
+		bool atEnd() const { return pos >= end; }
+		bool atLineEnd() const { return pos >= end || *pos == '\n' || *pos == '\r' || *pos == '#'; }
+
+		void skipSpaces()
+		{
+			while (pos < end && (*pos == ' ' || *pos == '\t'))
+				pos++;
+		}
+
+		void skipLine()
+		{
+			while (pos < end && *pos != '\n')
+				pos++;
+			if (pos < end)
+				pos++;
+			line++;
+		}
+
+		/// Consumes the keyword if it starts at the cursor and is followed by a blank.
+		bool keyword(const char* word)
+		{
+			const char* p = pos;
+			while (*word != '\0')
+			{
+				if (p >= end || *p != *word)
+					return false;
+				p++;
+				word++;
+			}
+			if (p < end && *p != ' ' && *p != '\t')
+				return false;
+			pos = p;
+			return true;
+		}
+
+		/// Rest of the line without surrounding blanks.
+		std::string restOfLine()
+		{
+			skipSpaces();
+			const char* start = pos;
+			while (pos < end && *pos != '\n' && *pos != '\r')
+				pos++;
+			const char* last = pos;
+			while (last > start && (last[-1] == ' ' || last[-1] == '\t'))
+				last--;
+			return std::string(start, last);
+		}
+
+		bool parseInt(int32_t& value)
+		{
+			const char* p = pos;
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negative = *p++ == '-';
+
+			const char* digits = p;
+			int64_t result = 0;
+			while (p < end && *p >= '0' && *p <= '9' && result < INT32_MAX)
+				result = result * 10 + (*p++ - '0');
+			if (p == digits)
+				return false;
+
+			value = (int32_t)(negative ? -result : result);
+			pos = p;
+			return true;
+		}
+
+		bool parseFloat(float& value)
+		{
+			static const double POWERS_OF_TEN[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+
+			skipSpaces();
+			const char* p = pos;
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negative = *p++ == '-';
+
+			uint64_t mantissa = 0;
+			int significant = 0; // 19 decimal digits always fit into the mantissa
+			int exponent = 0;
+			bool anyDigit = false;
+
+			for (; p < end && *p >= '0' && *p <= '9'; p++, anyDigit = true)
+			{
+				if (significant < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					significant += mantissa != 0;
+				}
+				else
+				{
+					exponent++;
+				}
+			}
+			if (p < end && *p == '.')
+			{
+				for (p++; p < end && *p >= '0' && *p <= '9'; p++, anyDigit = true)
+				{
+					if (significant < 19)
+					{
+						mantissa = mantissa * 10 + (*p - '0');
+						significant += mantissa != 0;
+						exponent--;
+					}
+				}
+			}
+			if (!anyDigit)
+				return false;
+
+			if (p < end && (*p == 'e' || *p == 'E'))
+			{
+				pos = p + 1;
+				int32_t exponentPart;
+				if (!parseInt(exponentPart))
+					return false;
+				exponent += exponentPart;
+				p = pos;
+			}
+
+			double result = (double)mantissa;
+			const int magnitude = std::abs(exponent);
+			const double scale = magnitude <= 22 ? POWERS_OF_TEN[magnitude] : std::pow(10.0, magnitude);
+			result = exponent < 0 ? result / scale : result * scale;
+
+			value = (float)(negative ? -result : result);
+			pos = p;
+			return true;
+		}
+
+		/// Parses up to count floats, missing trailing ones stay untouched.
+		bool parseFloats(float* values, int count, int required)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				skipSpaces();
+				if (atLineEnd())
+					return i >= required;
+				if (!parseFloat(values[i]))
+					return false;
+			}
+			return true;
+		}
+	};
+
+	/// OBJ indices (0-based) of one face corner, -1 where the corner has none.
+	struct VertexKey
+	{
+		int32_t position;
+		int32_t texCoord;
+		int32_t normal;
+
+		bool operator==(const VertexKey& other) const
+		{
+			return position == other.position && texCoord == other.texCoord && normal == other.normal;
+		}
+	};
+
+	/// Open addressing hash table mapping OBJ index triples to output vertices.
+	class VertexTable
+	{
+	public:
+		VertexTable() : slots_(1024) {}
+
+		/**
+		 * @brief Returns the vertex of the key; unknown keys get newIndex.
+		*/
+		uint32_t findOrInsert(const VertexKey& key, uint32_t newIndex, bool& inserted)
+		{
+			if (2 * (count_ + 1) > slots_.size())
+				grow();
+
+			size_t mask = slots_.size() - 1;
+			for (size_t i = hash(key) & mask;; i = (i + 1) & mask)
+			{
+				Slot& slot = slots_[i];
+				if (slot.index == EMPTY)
+				{
+					slot.key = key;
+					slot.index = newIndex;
+					count_++;
+					inserted = true;
+					return newIndex;
+				}
+				if (slot.key == key)
+				{
+					inserted = false;
+					return slot.index;
+				}
+			}
+		}
+
+	private:
+		static const uint32_t EMPTY = UINT32_MAX;
+
+		struct Slot
+		{
+			VertexKey key{};
+			uint32_t index = EMPTY;
+		};
+
+		static size_t hash(const VertexKey& key)
+		{
+			uint64_t h = (uint32_t)key.position;
+			h = h * 0x9E3779B97F4A7C15ull ^ (uint32_t)key.texCoord;
+			h = h * 0x9E3779B97F4A7C15ull ^ (uint32_t)key.normal;
+			return (size_t)(h ^ (h >> 29));
+		}
+
+		void grow()
+		{
+			std::vector<Slot> old(2 * slots_.size());
+			old.swap(slots_);
+			size_t mask = slots_.size() - 1;
+			for (const Slot& slot : old)
+			{
+				if (slot.index == EMPTY)
+					continue;
+				size_t i = hash(slot.key) & mask;
+				while (slots_[i].index != EMPTY)
+					i = (i + 1) & mask;
+				slots_[i] = slot;
+			}
+		}
+
+		std::vector<Slot> slots_;
+		size_t count_{};
+	};
+
+	/// OBJ attribute array with exact duplicates folded, so corners equal by value share one vertex.
+	template<int N>
+	struct AttributeArray
+	{
+		std::vector<float> values;
+		std::vector<int32_t> remap; ///< OBJ index -> index into values
+		VertexTable table;
+
+		void add(const float* value)
+		{
+			int32_t bits[3] = { 0, 0, 0 };
+			for (int i = 0; i < N; i++)
+			{
+				float component = value[i] == 0.0f ? 0.0f : value[i]; // -0 equals 0
+				std::memcpy(&bits[i], &component, sizeof(float));
+			}
+			VertexKey key = { bits[0], bits[1], bits[2] };
+
+			bool inserted;
+			uint32_t index = table.findOrInsert(key, (uint32_t)(values.size() / N), inserted);
+			if (inserted)
+				values.insert(values.end(), value, value + N);
+			remap.push_back((int32_t)index);
+		}
+
+		size_t size() const { return remap.size(); }
+		const float* operator[](int32_t objIndex) const { return &values[N * (size_t)remap[objIndex]]; }
+		int32_t canonical(int32_t objIndex) const { return objIndex < 0 ? -1 : remap[objIndex]; }
+	};
+
+	/// Output mesh of one material.
+	struct MeshBuilder
+	{
+		MeshData data;
+		VertexTable table;
+		std::vector<int32_t> sourcePositions; ///< position of every output vertex
+		bool missingNormals{};
+	};
+
+	struct ObjMaterial
+	{
+		std::string name;
+		MeshMaterial material;
+	};
+
+	/**
+	 * @brief Default material of the assimp OBJ importer, used by faces without usemtl.
+	*/
+	ObjMaterial defaultMaterial()
+	{
+		ObjMaterial material;
+		material.name = "DefaultMaterial";
+		material.material.diffuse = glm::vec3(0.6f, 0.6f, 0.6f);
+		return material;
+	}
+
+	/**
+	 * @brief Reads all materials of a MTL file.
+	*/
+	bool parseMtl(const std::string& fileName, const std::string& directory, std::vector<ObjMaterial>& materials)
+	{
+		MappedFile file;
+		if (!file.open(fileName))
+			return false;
+
+		TextCursor c{ (const char*)file.data(), (const char*)file.data() + file.size(), 1 };
+		ObjMaterial* current = nullptr;
+		for (; !c.atEnd(); c.skipLine())
+		{
+			c.skipSpaces();
+			if (c.keyword("newmtl"))
+			{
+				materials.push_back(defaultMaterial());
+				current = &materials.back();
+				current->name = c.restOfLine();
+				continue;
+			}
+			if (current == nullptr)
+				continue;
+
+			MeshMaterial& material = current->material;
+			bool valid = true;
+			if (c.keyword("Ka"))
+				valid = c.parseFloats(&material.ambient.x, 3, 3);
+			else if (c.keyword("Kd"))
+				valid = c.parseFloats(&material.diffuse.x, 3, 3);
+			else if (c.keyword("Ks"))
+				valid = c.parseFloats(&material.specular.x, 3, 3);
+			else if (c.keyword("Ns"))
+				valid = c.parseFloats(&material.shininess, 1, 1);
+			else if (c.keyword("map_Kd"))
+			{
+				// options like -bm 1.0 may precede the file name, which is the last token
+				std::string value = c.restOfLine();
+				size_t found = value.find_last_of(" \t");
+				material.textureName = directory + (found == std::string::npos ? value : value.substr(found + 1));
+			}
+
+			if (!valid)
+			{
+				std::cerr << "parseObjModel(): " << fileName << ":" << c.line << ": malformed material" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Resolves a 1-based (or negative, relative) OBJ index.
+	*/
+	bool resolveIndex(int32_t index, size_t count, int32_t& resolved)
+	{
+		resolved = index > 0 ? index - 1 : (int32_t)count + index;
+		return index != 0 && resolved >= 0 && (size_t)resolved < count;
+	}
+
+	/**
+	 * @brief Parses one face corner: v, v/vt, v//vn or v/vt/vn.
+	*/
+	bool parseCorner(TextCursor& c, size_t numPositions, size_t numTexCoords, size_t numNormals, VertexKey& key)
+	{
+		int32_t index;
+		key.texCoord = key.normal = -1;
+		if (!c.parseInt(index) || !resolveIndex(index, numPositions, key.position))
+			return false;
+
+		if (c.pos < c.end && *c.pos == '/')
+		{
+			c.pos++;
+			if (c.pos < c.end && *c.pos != '/')
+			{
+				if (!c.parseInt(index) || !resolveIndex(index, numTexCoords, key.texCoord))
+					return false;
+			}
+			if (c.pos < c.end && *c.pos == '/')
+			{
+				c.pos++;
+				if (!c.parseInt(index) || !resolveIndex(index, numNormals, key.normal))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Averages face normals over all vertices sharing a position.
+	*/
+	void generateSmoothNormals(MeshBuilder& builder, size_t numPositions)
+	{
+		MeshData& data = builder.data;
+		std::vector<glm::vec3> accumulated(numPositions, glm::vec3(0.0f));
+
+		for (size_t i = 0; i < data.indices.size(); i += 3)
+		{
+			const float* a = data.vertices[data.indices[i + 0]].position;
+			const float* b = data.vertices[data.indices[i + 1]].position;
+			const float* c = data.vertices[data.indices[i + 2]].position;
+			glm::vec3 edge1(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+			glm::vec3 edge2(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+			glm::vec3 faceNormal = glm::cross(edge1, edge2);
+			for (int corner = 0; corner < 3; corner++)
+				accumulated[builder.sourcePositions[data.indices[i + corner]]] += faceNormal;
+		}
+
+		for (size_t v = 0; v < builder.sourcePositions.size(); v++)
+		{
+			glm::vec3 normal = accumulated[builder.sourcePositions[v]];
+			float length = glm::length(normal);
+			normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			data.vertices[v].normal[0] = normal.x;
+			data.vertices[v].normal[1] = normal.y;
+			data.vertices[v].normal[2] = normal.z;
+		}
+	}
+
+	/**
+	 * @brief Centers the model and scales it to [-1, 1] like AI_CONFIG_PP_PTV_NORMALIZE.
+	*/
+	void normalizeModel(std::vector<MeshData>& meshes)
+	{
+		glm::vec3 minCorner(INFINITY), maxCorner(-INFINITY);
+		for (const auto& mesh : meshes)
+		{
+			for (const auto& vertex : mesh.vertices)
+			{
+				glm::vec3 p(vertex.position[0], vertex.position[1], vertex.position[2]);
+				minCorner = glm::min(minCorner, p);
+				maxCorner = glm::max(maxCorner, p);
+			}
+		}
+
+		const glm::vec3 extent = maxCorner - minCorner;
+		const float halfSize = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f;
+		const glm::vec3 center = minCorner + extent * 0.5f;
+		if (!(halfSize > 0.0f))
+			return;
+
+		for (auto& mesh : meshes)
+		{
+			for (auto& vertex : mesh.vertices)
+			{
+				vertex.position[0] = (vertex.position[0] - center.x) / halfSize;
+				vertex.position[1] = (vertex.position[1] - center.y) / halfSize;
+				vertex.position[2] = (vertex.position[2] - center.z) / halfSize;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Tells whether the built-in parser handles the file.
+ * @param fileName model file
+ * @return true for .obj files
+*/
+bool manaeste::hasObjExtension(const std::string& fileName)
+{
+	if (fileName.size() < 4)
+		return false;
+	std::string extension = fileName.substr(fileName.size() - 4);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char ch) { return (char)std::tolower(ch); });
+	return extension == ".obj";
+}
+
+/**
+ * @brief Loads all meshes of an OBJ model without assimp.
+ * @param fileName file to open/load
+ * @param meshes post-processed meshes, equivalent to importModel()
+ * @return true if loading was successful
+*/
+bool manaeste::parseObjModel(const std::string& fileName, std::vector<MeshData>& meshes)
+{
+	PROFILE_ZONE("parseObjModel");
+	MappedFile file;
+	if (!file.open(fileName))
+	{
+		std::cerr << "parseObjModel(): cannot open " << fileName << std::endl;
+		return false;
+	}
+
+	std::string directory;
+	size_t found = fileName.find_last_of("/\\");
+	if (found != std::string::npos)
+		directory = fileName.substr(0, found + 1);
+
+	AttributeArray<3> positions;
+	AttributeArray<2> texCoords;
+	AttributeArray<3> normals;
+	std::vector<ObjMaterial> materials = { defaultMaterial() };
+	std::vector<std::unique_ptr<MeshBuilder>> builders;
+	std::vector<uint32_t> polygon;
+	size_t currentMaterial = 0;
+
+	auto fail = [&](const TextCursor& c, const char* what) {
+		std::cerr << "parseObjModel(): " << fileName << ":" << c.line << ": " << what << std::endl;
+		return false;
+	};
+
+	TextCursor c{ (const char*)file.data(), (const char*)file.data() + file.size(), 1 };
+	for (; !c.atEnd(); c.skipLine())
+	{
+		c.skipSpaces();
+		if (c.keyword("v"))
+		{
+			float p[3] = { 0.0f, 0.0f, 0.0f };
+			if (!c.parseFloats(p, 3, 3))
+				return fail(c, "malformed vertex");
+			positions.add(p);
+		}
+		else if (c.keyword("vt"))
+		{
+			float uv[2] = { 0.0f, 0.0f };
+			if (!c.parseFloats(uv, 2, 1))
+				return fail(c, "malformed texture coordinate");
+			texCoords.add(uv);
+		}
+		else if (c.keyword("vn"))
+		{
+			float n[3] = { 0.0f, 0.0f, 0.0f };
+			if (!c.parseFloats(n, 3, 3))
+				return fail(c, "malformed normal");
+			normals.add(n);
+		}
+		else if (c.keyword("f"))
+		{
+			if (builders.size() <= currentMaterial)
+				builders.resize(currentMaterial + 1);
+			if (!builders[currentMaterial])
+				builders[currentMaterial].reset(new MeshBuilder);
+			MeshBuilder& builder = *builders[currentMaterial];
+			MeshData& data = builder.data;
+
+			polygon.clear();
+			for (c.skipSpaces(); !c.atLineEnd(); c.skipSpaces())
+			{
+				VertexKey key;
+				if (!parseCorner(c, positions.size(), texCoords.size(), normals.size(), key))
+					return fail(c, "malformed face");
+
+				const float* p = positions[key.position];
+				const float* uv = key.texCoord >= 0 ? texCoords[key.texCoord] : nullptr;
+				const float* n = key.normal >= 0 ? normals[key.normal] : nullptr;
+				key = { positions.canonical(key.position), texCoords.canonical(key.texCoord), normals.canonical(key.normal) };
+
+				bool inserted;
+				uint32_t index = builder.table.findOrInsert(key, (uint32_t)builder.sourcePositions.size(), inserted);
+				if (inserted)
+				{
+					MeshVertex vertex = {};
+					std::copy(p, p + 3, vertex.position);
+					if (uv)
+						std::copy(uv, uv + 2, vertex.texCoord);
+					if (n)
+						std::copy(n, n + 3, vertex.normal);
+					data.vertices.push_back(vertex);
+					builder.missingNormals |= n == nullptr;
+					builder.sourcePositions.push_back(key.position);
+				}
+				polygon.push_back(index);
+			}
+
+			// points and lines are dropped, polygons become a triangle fan
+			for (size_t i = 2; i < polygon.size(); i++)
+			{
+				data.indices.push_back(polygon[0]);
+				data.indices.push_back(polygon[i - 1]);
+				data.indices.push_back(polygon[i]);
+			}
+		}
+		else if (c.keyword("usemtl"))
+		{
+			std::string name = c.restOfLine();
+			auto material = std::find_if(materials.begin(), materials.end(), [&name](const ObjMaterial& m) { return m.name == name; });
+			currentMaterial = material != materials.end() ? material - materials.begin() : 0;
+		}
+		else if (c.keyword("mtllib"))
+		{
+			std::string mtlName = directory + c.restOfLine();
+			if (!parseMtl(mtlName, directory, materials))
+				std::cerr << "parseObjModel(): cannot read material library " << mtlName << std::endl;
+		}
+	}
+
+	meshes.clear();
+	for (size_t m = 0; m < builders.size(); m++)
+	{
+		if (!builders[m] || builders[m]->data.indices.empty())
+			continue;
+
+		MeshBuilder& builder = *builders[m];
+		if (builder.missingNormals)
+			generateSmoothNormals(builder, positions.values.size() / 3);
+		builder.data.material = materials[m].material;
+		meshes.push_back(std::move(builder.data));
+	}
+
+	if (meshes.empty())
+	{
+		std::cerr << "parseObjModel(): " << fileName << " contains no faces" << std::endl;
+		return false;
+	}
+
+	normalizeModel(meshes);
+	return true;
+}
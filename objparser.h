@@ -0,0 +1,20 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    objparser.h : Header file for objparser.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Built-in Wavefront OBJ/MTL reader.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "mesh.h"
+
+namespace manaeste
+{
+	bool hasObjExtension(const std::string& fileName);
+	bool parseObjModel(const std::string& fileName, std::vector<MeshData>& meshes);
+}
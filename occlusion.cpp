@@ -0,0 +1,318 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    occlusion.cpp : Software occlusion culling.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   The large objects of the scene are drawn, as coarse levels of detail, into a small
+ *          depth buffer on the CPU before anything is queued for the GPU. Every other draw
+ *          first tests the screen rectangle of its bounding box against that buffer and is
+ *          dropped when the box lies behind the occluders everywhere.
+ *
+ * Rasterization uses edge functions evaluated for four pixels at once with SSE where the
+ * compiler targets it. Horizontal bands of OCCLUSION_BAND rows are independent and run on a
+ * TaskPool. Each band also keeps the farthest depth of its OCCLUSION_TILE tiles, so a box
+ * behind a whole tile is rejected without looking at its pixels.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <future>
+#include "occlusion.h"
+#include "profiler.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+using namespace manaeste;
+
+namespace
+{
+	/// Clips a polygon against the near plane (z > -w) of clip space.
+	size_t clipNear(const glm::vec4* input, size_t count, glm::vec4* output)
+	{
+		size_t numOutput = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const glm::vec4& a = input[i];
+			const glm::vec4& b = input[(i + 1) % count];
+			const float da = a.z + a.w;
+			const float db = b.z + b.w;
+			if (da >= 0.0f)
+				output[numOutput++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				output[numOutput++] = a + (b - a) * (da / (da - db));
+		}
+		return numOutput;
+	}
+
+	template<typename Index>
+	void appendIndices(const MeshView& mesh, const MeshLod& lod, std::vector<uint32_t>& indices)
+	{
+		const Index* source = static_cast<const Index*>(mesh.indices) + lod.firstIndex;
+		indices.assign(source, source + (size_t)lod.numTriangles * 3);
+	}
+}
+
+/**
+ * @brief Takes the finest level of detail of a mesh with at most maxTriangles triangles, or the
+ *        coarsest one, and keeps only the positions it uses.
+ * @param mesh mesh
+ * @param maxTriangles triangle budget of the occluder
+ * @return occluder mesh
+*/
+OccluderMesh manaeste::makeOccluderMesh(const MeshView& mesh, uint32_t maxTriangles)
+{
+	OccluderMesh occluder;
+	if (mesh.lods.empty())
+		return occluder;
+
+	size_t level = 0;
+	while (level + 1 < mesh.lods.size() && mesh.lods[level].numTriangles > maxTriangles)
+		level++;
+
+	std::vector<uint32_t> indices;
+	if (mesh.indexType == GL_UNSIGNED_SHORT)
+		appendIndices<uint16_t>(mesh, mesh.lods[level], indices);
+	else
+		appendIndices<uint32_t>(mesh, mesh.lods[level], indices);
+
+	std::vector<uint32_t> remap(mesh.numVertices, UINT32_MAX);
+	occluder.indices.reserve(indices.size());
+	for (uint32_t index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t)occluder.positions.size();
+			const float* position = mesh.vertices[index].position;
+			occluder.positions.push_back(glm::vec3(position[0], position[1], position[2]));
+		}
+		occluder.indices.push_back(remap[index]);
+	}
+	return occluder;
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+	: width_(width), height_(height), tilesX_((width + OCCLUSION_TILE - 1) / OCCLUSION_TILE), projViewMat_(1.0f),
+	depth_((size_t)width * height, 1.0f),
+	tileDepth_((size_t)tilesX_ * ((height + OCCLUSION_TILE - 1) / OCCLUSION_TILE), 1.0f)
+{
+}
+
+/**
+ * @brief Clears the buffer and drops the occluders of the previous frame.
+ * @param projViewMat projection * view matrix of the frame
+*/
+void OcclusionBuffer::begin(const glm::mat4& projViewMat)
+{
+	projViewMat_ = projViewMat;
+	triangles_.clear();
+	std::fill(depth_.begin(), depth_.end(), 1.0f);
+	std::fill(tileDepth_.begin(), tileDepth_.end(), 1.0f);
+}
+
+/**
+ * @brief Transforms and clips the triangles of an occluder, they are drawn by rasterize().
+ * @param mesh occluder mesh
+ * @param modelMat model matrix
+*/
+void OcclusionBuffer::addOccluder(const OccluderMesh& mesh, const glm::mat4& modelMat)
+{
+	const glm::mat4 mat = projViewMat_ * modelMat;
+	std::vector<glm::vec4> clip(mesh.positions.size());
+	for (size_t i = 0; i < mesh.positions.size(); i++)
+		clip[i] = mat * glm::vec4(mesh.positions[i], 1.0f);
+
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		const glm::vec4 triangle[3] = { clip[mesh.indices[i]], clip[mesh.indices[i + 1]], clip[mesh.indices[i + 2]] };
+		glm::vec4 clipped[4];
+		const size_t count = clipNear(triangle, 3, clipped);
+		for (size_t v = 2; v < count; v++)
+			addTriangle(clipped[0], clipped[v - 1], clipped[v]);
+	}
+}
+
+void OcclusionBuffer::addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+	ScreenTriangle triangle;
+	const glm::vec4* vertices[3] = { &a, &b, &c };
+	for (int v = 0; v < 3; v++)
+	{
+		const glm::vec4& vertex = *vertices[v];
+		const float invW = 1.0f / std::max(vertex.w, 1e-6f);
+		triangle.x[v] = (vertex.x * invW * 0.5f + 0.5f) * width_;
+		triangle.y[v] = (vertex.y * invW * 0.5f + 0.5f) * height_;
+		triangle.z[v] = std::min(vertex.z * invW * 0.5f + 0.5f, 1.0f);
+	}
+
+	const float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0])
+		- (triangle.y[1] - triangle.y[0]) * (triangle.x[2] - triangle.x[0]);
+	if (std::fabs(area) < 1e-8f)
+		return;
+	// both windings occlude, make the edge functions positive inside
+	if (area < 0.0f)
+	{
+		std::swap(triangle.x[1], triangle.x[2]);
+		std::swap(triangle.y[1], triangle.y[2]);
+		std::swap(triangle.z[1], triangle.z[2]);
+	}
+
+	const float minX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+	const float maxX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+	const float minY = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+	const float maxY = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width_ || minY >= height_)
+		return;
+	triangle.minY = std::max(0, (int)std::floor(minY));
+	triangle.maxY = std::min(height_ - 1, (int)std::ceil(maxY));
+	triangles_.push_back(triangle);
+}
+
+/**
+ * @brief Draws all added occluders and updates the tile depths.
+ * @param pool workers for the bands, nullptr draws on the calling thread
+*/
+void OcclusionBuffer::rasterize(TaskPool* pool)
+{
+	if (pool == nullptr || pool->size() < 2)
+	{
+		for (int row = 0; row < height_; row += OCCLUSION_BAND)
+			rasterizeBand(row, std::min(height_, row + OCCLUSION_BAND));
+		return;
+	}
+
+	std::vector<std::future<void>> bands;
+	for (int row = 0; row < height_; row += OCCLUSION_BAND)
+	{
+		const int endRow = std::min(height_, row + OCCLUSION_BAND);
+		bands.push_back(pool->submit([this, row, endRow]() { rasterizeBand(row, endRow); }));
+	}
+	for (auto& band : bands)
+		band.get();
+}
+
+void OcclusionBuffer::rasterizeBand(int firstRow, int endRow)
+{
+	PROFILE_ZONE("rasterizeBand");
+	for (const auto& triangle : triangles_)
+	{
+		if (triangle.maxY < firstRow || triangle.minY >= endRow)
+			continue;
+
+		// edge i is opposite vertex i: e(x, y) = A x + B y + C, positive inside
+		float A[3], B[3], C[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const int a = (i + 1) % 3;
+			const int b = (i + 2) % 3;
+			A[i] = -(triangle.y[b] - triangle.y[a]);
+			B[i] = triangle.x[b] - triangle.x[a];
+			C[i] = -B[i] * triangle.y[a] - A[i] * triangle.x[a];
+		}
+		const float area = A[0] * triangle.x[0] + B[0] * triangle.y[0] + C[0];
+		const float zx = (A[0] * triangle.z[0] + A[1] * triangle.z[1] + A[2] * triangle.z[2]) / area;
+		const float zy = (B[0] * triangle.z[0] + B[1] * triangle.z[1] + B[2] * triangle.z[2]) / area;
+		const float zc = (C[0] * triangle.z[0] + C[1] * triangle.z[1] + C[2] * triangle.z[2]) / area;
+
+		const float minX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+		const float maxX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+		const int x0 = std::max(0, (int)std::floor(minX)) & ~3;
+		const int x1 = std::min(width_, (int)std::ceil(maxX) + 1);
+		const int y0 = std::max(firstRow, triangle.minY);
+		const int y1 = std::min(endRow - 1, triangle.maxY);
+
+		for (int y = y0; y <= y1; y++)
+		{
+			const float py = y + 0.5f;
+			float* row = &depth_[(size_t)y * width_];
+			int x = x0;
+#ifdef OCCLUSION_SSE
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 steps = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			for (; x < x1; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), steps);
+				__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[0]), px), _mm_set1_ps(B[0] * py + C[0])), zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[1]), px), _mm_set1_ps(B[1] * py + C[1])), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[2]), px), _mm_set1_ps(B[2] * py + C[2])), zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+				const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), px), _mm_set1_ps(zy * py + zc));
+				const __m128 old = _mm_loadu_ps(row + x);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, z)), _mm_andnot_ps(inside, old)));
+			}
+#else
+			for (; x < x1; x++)
+			{
+				const float px = x + 0.5f;
+				if (A[0] * px + B[0] * py + C[0] < 0.0f || A[1] * px + B[1] * py + C[1] < 0.0f || A[2] * px + B[2] * py + C[2] < 0.0f)
+					continue;
+				row[x] = std::min(row[x], zx * px + zy * py + zc);
+			}
+#endif
+		}
+	}
+
+	for (int tileY = firstRow / OCCLUSION_TILE; tileY * OCCLUSION_TILE < endRow; tileY++)
+	{
+		for (int tileX = 0; tileX < tilesX_; tileX++)
+		{
+			float farthest = 0.0f;
+			for (int y = tileY * OCCLUSION_TILE; y < std::min(height_, (tileY + 1) * OCCLUSION_TILE); y++)
+				for (int x = tileX * OCCLUSION_TILE; x < std::min(width_, (tileX + 1) * OCCLUSION_TILE); x++)
+					farthest = std::max(farthest, depth_[(size_t)y * width_ + x]);
+			tileDepth_[(size_t)tileY * tilesX_ + tileX] = farthest;
+		}
+	}
+}
+
+/**
+ * @brief Tests whether any part of a box may be in front of the occluders. Boxes crossing the
+ *        near plane or leaving the screen are always visible.
+ * @param boundsMin object space box minimum
+ * @param boundsMax object space box maximum
+ * @param modelMat model matrix
+ * @return false when the box is hidden behind the occluders
+*/
+bool OcclusionBuffer::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMat) const
+{
+	const glm::mat4 mat = projViewMat_ * modelMat;
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const glm::vec3 position((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z);
+		const glm::vec4 clip = mat * glm::vec4(position, 1.0f);
+		if (clip.z < -clip.w || clip.w <= 1e-6f)
+			return true;
+		const float x = (clip.x / clip.w * 0.5f + 0.5f) * width_;
+		const float y = (clip.y / clip.w * 0.5f + 0.5f) * height_;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+	}
+	if (minX < 0.0f || minY < 0.0f || maxX > width_ || maxY > height_)
+		return true;
+
+	const int x0 = (int)std::floor(minX), x1 = std::min(width_ - 1, (int)std::ceil(maxX));
+	const int y0 = (int)std::floor(minY), y1 = std::min(height_ - 1, (int)std::ceil(maxY));
+	for (int tileY = y0 / OCCLUSION_TILE; tileY <= y1 / OCCLUSION_TILE; tileY++)
+	{
+		for (int tileX = x0 / OCCLUSION_TILE; tileX <= x1 / OCCLUSION_TILE; tileX++)
+		{
+			if (tileDepth_[(size_t)tileY * tilesX_ + tileX] < nearest)
+				continue;
+			for (int y = std::max(y0, tileY * OCCLUSION_TILE); y <= std::min(y1, (tileY + 1) * OCCLUSION_TILE - 1); y++)
+				for (int x = std::max(x0, tileX * OCCLUSION_TILE); x <= std::min(x1, (tileX + 1) * OCCLUSION_TILE - 1); x++)
+					if (depth_[(size_t)y * width_ + x] >= nearest)
+						return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,83 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    occlusion.h : Header file for occlusion.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Low resolution CPU depth buffer of the occluders, for culling hidden objects.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "mesh.h"
+#include "assets.h"
+
+namespace manaeste
+{
+	/// Size of the occlusion depth buffer in pixels; the width must be a multiple of 4.
+	const int OCCLUSION_WIDTH = 320;
+	const int OCCLUSION_HEIGHT = 160;
+	/// Side of the square tiles keeping the farthest depth of their pixels.
+	const int OCCLUSION_TILE = 8;
+	/// Rows rasterized by one task, a multiple of OCCLUSION_TILE.
+	const int OCCLUSION_BAND = 16;
+	/// Occluder meshes use the finest level of detail with at most this many triangles.
+	const uint32_t OCCLUDER_MAX_TRIANGLES = 512;
+
+	/// Object space triangles drawn into the occlusion buffer.
+	typedef struct OccluderMesh
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+	} OccluderMesh;
+
+	/// Occlusion culling work of the current frame.
+	typedef struct OcclusionStats
+	{
+		unsigned int occluderTriangles{}; ///< after near plane clipping and screen rejection
+		unsigned int tested{};
+		unsigned int occluded{};
+	} OcclusionStats;
+
+	OccluderMesh makeOccluderMesh(const MeshView& mesh, uint32_t maxTriangles = OCCLUDER_MAX_TRIANGLES);
+
+	/// Depth buffer of the occluders, smaller is nearer as in GL window space.
+	class OcclusionBuffer
+	{
+	public:
+		OcclusionBuffer(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT);
+
+		void begin(const glm::mat4& projViewMat);
+		void addOccluder(const OccluderMesh& mesh, const glm::mat4& modelMat);
+		void rasterize(TaskPool* pool = nullptr);
+		bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMat) const;
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		float depth(int x, int y) const { return depth_[(size_t)y * width_ + x]; }
+		unsigned int numTriangles() const { return (unsigned int)triangles_.size(); }
+
+	private:
+		struct ScreenTriangle
+		{
+			float x[3];
+			float y[3];
+			float z[3];
+			int minY;
+			int maxY;
+		};
+
+		void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+		void rasterizeBand(int firstRow, int endRow);
+
+		int width_;
+		int height_;
+		int tilesX_;
+		glm::mat4 projViewMat_;
+		std::vector<float> depth_;
+		std::vector<float> tileDepth_; ///< farthest depth of every tile
+		std::vector<ScreenTriangle> triangles_;
+	};
+}
@@ -0,0 +1,410 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    optimize.cpp : Mesh reordering.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Reorders the triangles of every level of detail for the post-transform vertex
+ *          cache (Tipsify, Sander et al. 2007), then groups them into clusters drawn from
+ *          the outside in to reduce overdraw, and finally renumbers the vertices in the order
+ *          the indices first use them so the vertex fetch walks memory linearly.
+ *
+ * The overdraw pass only moves whole clusters, which are cut where the vertex cache would
+ * start cold anyway or where the ACMR of the cluster so far is within OVERDRAW_THRESHOLD of
+ * the cache optimized order, so it costs little vertex cache efficiency.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "optimize.h"
+
+using namespace manaeste;
+
+namespace
+{
+	/// Resolution of the software rasterizer measuring overdraw.
+	const int OVERDRAW_GRID_SIZE = 256;
+
+	/// Simulated FIFO post-transform cache: a vertex stays cached until size later misses.
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t numVertices, uint32_t size) : timestamps_(numVertices, 0), time_(size + 1), size_(size) {}
+
+		/// Misses since the vertex was last loaded, above the cache size if it is not cached.
+		uint32_t age(uint32_t vertex) const { return time_ - timestamps_[vertex]; }
+
+		/// @return true on a miss
+		bool touch(uint32_t vertex)
+		{
+			if (age(vertex) <= size_)
+				return false;
+			timestamps_[vertex] = time_++;
+			return true;
+		}
+
+		/// @return misses of the triangle
+		uint32_t touchTriangle(const uint32_t* triangle)
+		{
+			return touch(triangle[0]) + touch(triangle[1]) + touch(triangle[2]);
+		}
+
+		void flush() { time_ += size_ + 1; }
+
+	private:
+		std::vector<uint32_t> timestamps_;
+		uint32_t time_;
+		uint32_t size_;
+	};
+
+	/// Cross product of two edges of the triangle, as long as twice its area.
+	void triangleNormal(const float* a, const float* b, const float* c, double normal[3])
+	{
+		const double u[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+		const double v[3] = { (double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2] };
+		normal[0] = u[1] * v[2] - u[2] * v[1];
+		normal[1] = u[2] * v[0] - u[0] * v[2];
+		normal[2] = u[0] * v[1] - u[1] * v[0];
+	}
+
+	/**
+	 * @brief Picks the next vertex to fan around: the oldest candidate that stays cached while
+	 * its remaining triangles are emitted, else a recently used vertex with triangles left.
+	*/
+	int64_t nextFanningVertex(const std::vector<uint32_t>& candidates, std::vector<uint32_t>& deadEnds,
+		const std::vector<uint32_t>& liveTriangles, const FifoCache& cache, uint32_t cacheSize, uint32_t& cursor)
+	{
+		int64_t best = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+				continue;
+			int64_t priority = 0;
+			if (cache.age(vertex) + 2 * liveTriangles[vertex] <= cacheSize)
+				priority = cache.age(vertex);
+			if (priority > bestPriority)
+			{
+				best = vertex;
+				bestPriority = priority;
+			}
+		}
+		if (best >= 0)
+			return best;
+
+		while (!deadEnds.empty())
+		{
+			const uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0)
+				return vertex;
+		}
+		for (; cursor < liveTriangles.size(); cursor++)
+		{
+			if (liveTriangles[cursor] > 0)
+				return cursor;
+		}
+		return -1;
+	}
+
+	/**
+	 * @brief Rasterizes the triangles in order with a depth test along the six axis directions.
+	 * @return shaded fragments per covered pixel
+	*/
+	float measureOverdraw(const uint32_t* indices, size_t numIndices, const MeshVertex* vertices)
+	{
+		float minPosition[3] = { INFINITY, INFINITY, INFINITY }, maxPosition[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (size_t i = 0; i < numIndices; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				minPosition[c] = std::min(minPosition[c], vertices[indices[i]].position[c]);
+				maxPosition[c] = std::max(maxPosition[c], vertices[indices[i]].position[c]);
+			}
+		}
+		float extent = 0.0f;
+		for (int c = 0; c < 3; c++)
+			extent = std::max(extent, maxPosition[c] - minPosition[c]);
+		if (numIndices == 0 || extent <= 0.0f)
+			return 0.0f;
+
+		const float scale = OVERDRAW_GRID_SIZE / extent;
+		std::vector<float> depth(OVERDRAW_GRID_SIZE * OVERDRAW_GRID_SIZE);
+		size_t shaded = 0, covered = 0;
+		for (int view = 0; view < 6; view++)
+		{
+			const int axis = view / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+			const float direction = (view % 2) ? -1.0f : 1.0f;
+			std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::infinity());
+
+			for (size_t i = 0; i + 2 < numIndices; i += 3)
+			{
+				float x[3], y[3], z[3];
+				for (int k = 0; k < 3; k++)
+				{
+					const float* position = vertices[indices[i + k]].position;
+					x[k] = (position[u] - minPosition[u]) * scale;
+					y[k] = (position[v] - minPosition[v]) * scale;
+					z[k] = position[axis] * direction;
+				}
+				const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+				if (area == 0.0f)
+					continue;
+
+				const int minX = std::max(0, (int)std::floor(std::min({ x[0], x[1], x[2] })));
+				const int maxX = std::min(OVERDRAW_GRID_SIZE - 1, (int)std::ceil(std::max({ x[0], x[1], x[2] })));
+				const int minY = std::max(0, (int)std::floor(std::min({ y[0], y[1], y[2] })));
+				const int maxY = std::min(OVERDRAW_GRID_SIZE - 1, (int)std::ceil(std::max({ y[0], y[1], y[2] })));
+				for (int py = minY; py <= maxY; py++)
+				{
+					const float cy = py + 0.5f;
+					for (int px = minX; px <= maxX; px++)
+					{
+						const float cx = px + 0.5f;
+						const float w0 = ((x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1])) / area;
+						const float w1 = ((x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2])) / area;
+						const float w2 = 1.0f - w0 - w1;
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+							continue;
+
+						float& pixel = depth[py * OVERDRAW_GRID_SIZE + px];
+						const float fragment = w0 * z[0] + w1 * z[1] + w2 * z[2];
+						if (fragment < pixel)
+						{
+							covered += std::isinf(pixel);
+							pixel = fragment;
+							shaded++;
+						}
+					}
+				}
+			}
+		}
+		return covered > 0 ? (float)shaded / covered : 0.0f;
+	}
+}
+
+/**
+ * @brief Reorders triangles so consecutive ones share vertices still in the post-transform cache (Tipsify).
+ * @param indices 3 indices per triangle, reordered in place
+ * @param numIndices index count
+ * @param numVertices count of the vertices the indices refer to
+ * @param cacheSize FIFO cache entries to optimize for
+*/
+void manaeste::optimizeVertexCache(uint32_t* indices, size_t numIndices, size_t numVertices, uint32_t cacheSize)
+{
+	const size_t numTriangles = numIndices / 3;
+	if (numTriangles == 0)
+		return;
+
+	// triangles around every vertex, the rows of vertex v being adjacency[offsets[v]..offsets[v + 1])
+	std::vector<uint32_t> liveTriangles(numVertices, 0);
+	for (size_t i = 0; i < numTriangles * 3; i++)
+		liveTriangles[indices[i]]++;
+	std::vector<uint32_t> offsets(numVertices + 1, 0);
+	std::partial_sum(liveTriangles.begin(), liveTriangles.end(), offsets.begin() + 1);
+	std::vector<uint32_t> adjacency(numTriangles * 3);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < numTriangles * 3; i++)
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+	std::vector<char> emitted(numTriangles, 0);
+	std::vector<uint32_t> result;
+	result.reserve(numTriangles * 3);
+	std::vector<uint32_t> deadEnds, candidates;
+	FifoCache cache(numVertices, cacheSize);
+	uint32_t cursor = 0;
+
+	int64_t fanning = indices[0];
+	while (fanning >= 0)
+	{
+		candidates.clear();
+		for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; k++)
+		{
+			const uint32_t triangle = adjacency[k];
+			if (emitted[triangle])
+				continue;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				const uint32_t vertex = indices[triangle * 3 + corner];
+				result.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				cache.touch(vertex);
+			}
+			emitted[triangle] = 1;
+		}
+		fanning = nextFanningVertex(candidates, deadEnds, liveTriangles, cache, cacheSize, cursor);
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+/**
+ * @brief Splits cache optimized triangles into clusters and sorts them so the ones facing
+ * away from the mesh center come first, which lets the depth test reject more of the rest.
+ * @param indices 3 indices per triangle in the order of optimizeVertexCache(), reordered in place
+ * @param numIndices index count
+ * @param vertices vertices the indices refer to
+ * @param numVertices vertex count
+ * @param threshold largest acceptable ACMR of a cluster relative to its cache optimized patch
+ * @param cacheSize FIFO cache entries to optimize for
+*/
+void manaeste::optimizeOverdraw(uint32_t* indices, size_t numIndices, const MeshVertex* vertices, size_t numVertices,
+	float threshold, uint32_t cacheSize)
+{
+	const uint32_t numTriangles = (uint32_t)(numIndices / 3);
+	if (numTriangles == 0)
+		return;
+
+	// patches start where all three vertices miss, the cache order jumped to disjoint geometry
+	FifoCache cache(numVertices, cacheSize);
+	std::vector<uint32_t> patches;
+	for (uint32_t t = 0; t < numTriangles; t++)
+	{
+		if (cache.touchTriangle(&indices[t * 3]) == 3 || t == 0)
+			patches.push_back(t);
+	}
+	patches.push_back(numTriangles);
+
+	std::vector<uint32_t> clusters;
+	for (size_t p = 0; p + 1 < patches.size(); p++)
+	{
+		const uint32_t start = patches[p], end = patches[p + 1];
+		cache.flush();
+		uint32_t misses = 0;
+		for (uint32_t t = start; t < end; t++)
+			misses += cache.touchTriangle(&indices[t * 3]);
+		const float limit = threshold * misses / (end - start);
+
+		cache.flush();
+		clusters.push_back(start);
+		uint32_t clusterStart = start, clusterMisses = 0;
+		for (uint32_t t = start; t < end; t++)
+		{
+			clusterMisses += cache.touchTriangle(&indices[t * 3]);
+			if (t + 1 < end && clusterMisses <= limit * (t + 1 - clusterStart))
+			{
+				clusters.push_back(t + 1);
+				cache.flush();
+				clusterStart = t + 1;
+				clusterMisses = 0;
+			}
+		}
+	}
+	clusters.push_back(numTriangles);
+
+	double meshCentroid[3] = {};
+	for (size_t i = 0; i < numTriangles * 3; i++)
+		for (int c = 0; c < 3; c++)
+			meshCentroid[c] += vertices[indices[i]].position[c] / (numTriangles * 3.0);
+
+	const size_t numClusters = clusters.size() - 1;
+	std::vector<double> keys(numClusters);
+	for (size_t cluster = 0; cluster < numClusters; cluster++)
+	{
+		double centroid[3] = {}, normal[3] = {}, area = 0.0;
+		for (uint32_t t = clusters[cluster]; t < clusters[cluster + 1]; t++)
+		{
+			const float* a = vertices[indices[t * 3 + 0]].position;
+			const float* b = vertices[indices[t * 3 + 1]].position;
+			const float* c = vertices[indices[t * 3 + 2]].position;
+			double faceNormal[3];
+			triangleNormal(a, b, c, faceNormal);
+			const double faceArea = std::sqrt(faceNormal[0] * faceNormal[0] + faceNormal[1] * faceNormal[1] + faceNormal[2] * faceNormal[2]);
+			for (int k = 0; k < 3; k++)
+			{
+				centroid[k] += (a[k] + b[k] + c[k]) / 3.0 * faceArea;
+				normal[k] += faceNormal[k];
+			}
+			area += faceArea;
+		}
+		const double normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		keys[cluster] = 0.0;
+		if (area > 0.0 && normalLength > 0.0)
+		{
+			for (int k = 0; k < 3; k++)
+				keys[cluster] += (centroid[k] / area - meshCentroid[k]) * normal[k] / normalLength;
+		}
+	}
+
+	std::vector<uint32_t> order(numClusters);
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(numTriangles * 3);
+	for (uint32_t cluster : order)
+		result.insert(result.end(), indices + clusters[cluster] * 3, indices + clusters[cluster + 1] * 3);
+	std::copy(result.begin(), result.end(), indices);
+}
+
+/**
+ * @brief Renumbers the vertices in the order the indices first use them, dropping unused ones.
+ * @param mesh mesh with 32-bit indices
+*/
+void manaeste::optimizeVertexFetch(MeshData& mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<MeshVertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t& index : mesh.indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t)vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+/**
+ * @brief Optimizes the triangle order of every level of detail, then the vertex order.
+ * @param mesh mesh with 32-bit indices
+*/
+void manaeste::optimizeMesh(MeshData& mesh)
+{
+	std::vector<MeshLod> lods = mesh.lods;
+	if (lods.empty())
+		lods.push_back({ 0, (uint32_t)(mesh.indices.size() / 3), 0.0f });
+
+	for (const auto& lod : lods)
+	{
+		uint32_t* indices = mesh.indices.data() + lod.firstIndex;
+		optimizeVertexCache(indices, lod.numTriangles * 3, mesh.vertices.size());
+		optimizeOverdraw(indices, lod.numTriangles * 3, mesh.vertices.data(), mesh.vertices.size());
+	}
+	optimizeVertexFetch(mesh);
+}
+
+/**
+ * @brief Measures the vertex cache efficiency and overdraw of the full detail triangles.
+ * @param mesh mesh with 32-bit indices
+ * @param cacheSize FIFO cache entries to simulate
+ * @return statistics of the current order
+*/
+MeshOrderStats manaeste::analyzeMeshOrder(const MeshData& mesh, uint32_t cacheSize)
+{
+	MeshOrderStats stats;
+	const size_t numIndices = mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].numTriangles * 3;
+	if (numIndices < 3)
+		return stats;
+
+	FifoCache cache(mesh.vertices.size(), cacheSize);
+	std::vector<char> referenced(mesh.vertices.size(), 0);
+	size_t misses = 0, numReferenced = 0;
+	for (size_t i = 0; i < numIndices; i++)
+	{
+		const uint32_t vertex = mesh.indices[i];
+		misses += cache.touch(vertex);
+		numReferenced += !referenced[vertex];
+		referenced[vertex] = 1;
+	}
+	stats.acmr = (float)misses / (numIndices / 3);
+	stats.atvr = (float)misses / numReferenced;
+	stats.overdraw = measureOverdraw(mesh.indices.data(), numIndices, mesh.vertices.data());
+	return stats;
+}
@@ -0,0 +1,38 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    optimize.h : Header file for optimize.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Triangle and vertex reordering for the post-transform cache, overdraw and vertex fetch.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "mesh.h"
+
+namespace manaeste
+{
+	/// Entries of the FIFO post-transform cache the triangle order is optimized for.
+	const uint32_t VERTEX_CACHE_SIZE = 16;
+	/// How much worse than the cache optimized order the overdraw optimized order may be (ACMR ratio).
+	const float OVERDRAW_THRESHOLD = 1.05f;
+
+	/// Efficiency of the triangle order of a mesh.
+	typedef struct MeshOrderStats
+	{
+		float acmr{};     ///< vertex shader invocations per triangle
+		float atvr{};     ///< vertex shader invocations per referenced vertex, 1 at best
+		float overdraw{}; ///< shaded fragments per covered pixel, averaged over six axis views
+	} MeshOrderStats;
+
+	void optimizeVertexCache(uint32_t* indices, size_t numIndices, size_t numVertices, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+	void optimizeOverdraw(uint32_t* indices, size_t numIndices, const MeshVertex* vertices, size_t numVertices,
+		float threshold = OVERDRAW_THRESHOLD, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+	void optimizeVertexFetch(MeshData& mesh);
+	void optimizeMesh(MeshData& mesh);
+
+	MeshOrderStats analyzeMeshOrder(const MeshData& mesh, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+}
@@ -0,0 +1,191 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    profiler.cpp : CPU frame profiler.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   PROFILE_ZONE() times a block with steady_clock and appends the zone to a ring
+ *          owned by the calling thread, so recording takes no lock. A thread registers its
+ *          ring once, on its first zone. writeCpuTrace() writes the zones of all rings in the
+ *          Chrome trace event format, which chrome://tracing and Perfetto open.
+ *
+ * The rings are read without stopping the threads. Write the trace between frames, when the
+ * workers are idle; a thread recording meanwhile may leave a torn zone in the trace.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "profiler.h"
+
+using namespace manaeste;
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Zone
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	struct ThreadRing
+	{
+		std::vector<Zone> zones = std::vector<Zone>(PROFILE_RING_ZONES);
+		std::atomic<uint64_t> recorded{};
+		std::string name;
+		unsigned int id{};
+	};
+
+	std::mutex ringsMutex;
+	std::vector<std::unique_ptr<ThreadRing>> rings; ///< never shrinks, the rings outlive their threads
+	thread_local ThreadRing* threadRing = nullptr;
+
+	uint64_t frameCount = 0;
+	uint64_t frameStart = 0;
+	std::string traceFileName;
+	uint64_t traceFrame = 0;             ///< frame after which traceFileName is written
+
+	ThreadRing& currentRing()
+	{
+		if (threadRing == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			rings.push_back(std::make_unique<ThreadRing>());
+			threadRing = rings.back().get();
+			threadRing->id = (unsigned int)rings.size();
+			threadRing->name = "thread " + std::to_string(threadRing->id);
+		}
+		return *threadRing;
+	}
+
+	double ticksToMicroseconds(uint64_t ticks)
+	{
+		return (double)ticks * Clock::period::num / Clock::period::den * 1e6;
+	}
+}
+
+/**
+ * @brief Current time in the clock ticks zones are recorded in.
+ * @return steady_clock ticks
+*/
+uint64_t manaeste::profileTicks()
+{
+	return (uint64_t)Clock::now().time_since_epoch().count();
+}
+
+/**
+ * @brief Appends a zone to the ring of the calling thread, overwriting its oldest zone when the ring is full.
+ * @param name zone name, must outlive the program
+ * @param startTicks start from profileTicks()
+ * @param endTicks end from profileTicks()
+*/
+void manaeste::recordProfileZone(const char* name, uint64_t startTicks, uint64_t endTicks)
+{
+	ThreadRing& ring = currentRing();
+	const uint64_t recorded = ring.recorded.load(std::memory_order_relaxed);
+	ring.zones[recorded % PROFILE_RING_ZONES] = { name, startTicks, endTicks };
+	ring.recorded.store(recorded + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Names the calling thread in the trace.
+ * @param name thread name
+*/
+void manaeste::setProfileThreadName(const std::string& name)
+{
+	ThreadRing& ring = currentRing();
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	ring.name = name;
+}
+
+/**
+ * @brief Ends a frame: records it as a "frame" zone since the previous call and writes the
+ *        trace requested by requestCpuTrace() once its frames have passed. Call from one thread only.
+*/
+void manaeste::markCpuFrame()
+{
+	const uint64_t now = profileTicks();
+#ifdef CPU_PROFILER
+	if (frameCount > 0)
+		recordProfileZone("frame", frameStart, now);
+#endif
+	frameStart = now;
+	frameCount++;
+
+	if (!traceFileName.empty() && frameCount >= traceFrame)
+	{
+		writeCpuTrace(traceFileName);
+		traceFileName.clear();
+	}
+}
+
+/**
+ * @brief Writes the trace once the given number of frames has been marked by markCpuFrame().
+ * @param fileName trace file
+ * @param frames frames from now
+*/
+void manaeste::requestCpuTrace(const std::string& fileName, unsigned int frames)
+{
+	traceFileName = fileName;
+	traceFrame = frameCount + frames;
+}
+
+/**
+ * @brief Writes the zones every thread still keeps as Chrome trace JSON.
+ * @param fileName trace file
+ * @return false if the file cannot be written
+*/
+bool manaeste::writeCpuTrace(const std::string& fileName)
+{
+	std::ofstream out(fileName);
+	if (!out)
+	{
+		std::cerr << "writeCpuTrace(): cannot write " << fileName << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	std::vector<std::vector<Zone>> zones(rings.size());
+	uint64_t origin = UINT64_MAX;
+	size_t numZones = 0;
+	for (size_t r = 0; r < rings.size(); r++)
+	{
+		const ThreadRing& ring = *rings[r];
+		const uint64_t recorded = ring.recorded.load(std::memory_order_acquire);
+		for (uint64_t i = recorded > PROFILE_RING_ZONES ? recorded - PROFILE_RING_ZONES : 0; i < recorded; i++)
+		{
+			zones[r].push_back(ring.zones[i % PROFILE_RING_ZONES]);
+			origin = std::min(origin, zones[r].back().start);
+		}
+		numZones += zones[r].size();
+	}
+
+	out << std::fixed << std::setprecision(3);
+	out << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+	for (size_t r = 0; r < rings.size(); r++)
+	{
+		out << "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << rings[r]->id
+			<< ", \"args\": { \"name\": \"" << rings[r]->name << "\" } }";
+		for (const auto& zone : zones[r])
+		{
+			out << "," << std::endl << "  { \"name\": \"" << zone.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << rings[r]->id
+				<< ", \"ts\": " << ticksToMicroseconds(zone.start - origin)
+				<< ", \"dur\": " << ticksToMicroseconds(zone.end - zone.start) << " }";
+		}
+		out << (r + 1 < rings.size() ? "," : "") << std::endl;
+	}
+	out << "] }" << std::endl;
+
+	std::cout << "CPU trace of " << numZones << " zones written to " << fileName << std::endl;
+	return true;
+}
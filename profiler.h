@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    profiler.h : Header file for profiler.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   CPU zones timed on every thread and written as a Chrome trace.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/// Zones are recorded unless WILDISLAND_NO_PROFILER is defined, then PROFILE_ZONE() expands to nothing.
+#if !defined(CPU_PROFILER) && !defined(WILDISLAND_NO_PROFILER)
+#define CPU_PROFILER
+#endif
+
+namespace manaeste
+{
+	/// Zones every thread keeps, a thread overwrites its oldest zones once it has recorded more.
+	const size_t PROFILE_RING_ZONES = 1 << 14;
+
+	uint64_t profileTicks();
+	void recordProfileZone(const char* name, uint64_t startTicks, uint64_t endTicks);
+	void setProfileThreadName(const std::string& name);
+	void markCpuFrame();
+	void requestCpuTrace(const std::string& fileName, unsigned int frames);
+	bool writeCpuTrace(const std::string& fileName);
+
+	/// Records the time between its construction and destruction under a name that must outlive the program.
+	class ProfileZone
+	{
+	public:
+		explicit ProfileZone(const char* name) : name_(name), start_(profileTicks()) {}
+		~ProfileZone() { recordProfileZone(name_, start_, profileTicks()); }
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+
+	private:
+		const char* name_;
+		uint64_t start_;
+	};
+}
+
+#ifdef CPU_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+/// Times the rest of the enclosing block, name is a string literal.
+#define PROFILE_ZONE(name) manaeste::ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
@@ -0,0 +1,402 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    programcache.cpp : Shader program binary cache.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Builds shader programs without asking for the result of the compiler until the
+ *          program is needed, and stores the linked binaries so later runs load them instead.
+ *
+ * A program is keyed by the FNV-1a hash of its sources, the attribute locations bound before
+ * linking and the GL vendor, renderer and version strings, so a driver update misses the cache.
+ * Every binary is a file of its own in the cache directory, named after the key in hex:
+ *   ProgramCacheHeader, binary returned by glGetProgramBinary()
+ * With GL_KHR_parallel_shader_compile the driver compiles on its own threads (the default
+ * number of them is kept) and programReady() tells when a program has linked; without it
+ * finishProgram() waits for whatever the driver has not done yet.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <utility>
+#include "programcache.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+using namespace manaeste;
+
+ProgramCacheStats programCacheStats; ///< programs built since openProgramCache()
+
+namespace
+{
+	const char PROGRAM_CACHE_MAGIC[8] = { 'W', 'I', 'P', 'R', 'O', 'G', '\0', '\0' };
+	const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+	struct ProgramCacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t binaryFormat;
+		uint64_t key;
+		uint32_t binaryLength;
+		uint32_t reserved;
+	};
+
+	std::string cacheDirectory;
+	bool binariesSupported = false; ///< program binaries (GL 4.1) with at least one format
+	bool parallelCompile = false;   ///< GL_KHR_parallel_shader_compile or its ARB twin
+	uint64_t driverHash = 0;        ///< vendor, renderer and version strings
+
+	/// FNV-1a, continues from the given hash.
+	uint64_t fnv1a(const void* data, size_t size, uint64_t hash)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	/// Hashes a string with its terminator, so neighbouring strings cannot run into each other.
+	uint64_t hashString(const std::string& text, uint64_t hash)
+	{
+		return fnv1a(text.c_str(), text.size() + 1, hash);
+	}
+
+	std::string glString(GLenum name)
+	{
+		const GLubyte* text = glGetString(name);
+		return text ? std::string((const char*)text) : std::string();
+	}
+
+	bool hasExtension(const char* name)
+	{
+		GLint numExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+		for (GLint i = 0; i < numExtensions; ++i)
+		{
+			if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	std::string cachePath(uint64_t key)
+	{
+		std::ostringstream path;
+		path << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return path.str();
+	}
+
+	/// Loads the cached binary of a program, false when there is none or the driver rejects it.
+	/// A corrupt or rejected entry is deleted, so it is not read again on every start.
+	bool loadProgramBinary(GLuint program, uint64_t key)
+	{
+		const std::string path = cachePath(key);
+		std::error_code error;
+		const uintmax_t fileSize = std::filesystem::file_size(path, error);
+		if (error)
+			return false;
+
+		std::vector<char> binary;
+		ProgramCacheHeader header;
+		{
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				return false;
+
+			// the length is checked against the file before anything is allocated for it
+			if (!file.read((char*)&header, sizeof(header)) ||
+				std::memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+				header.version != PROGRAM_CACHE_VERSION ||
+				header.key != key ||
+				header.binaryLength == 0 ||
+				header.binaryLength != fileSize - sizeof(header))
+			{
+				file.close();
+				std::filesystem::remove(path, error);
+				return false;
+			}
+
+			binary.resize(header.binaryLength);
+			if (!file.read(binary.data(), binary.size()))
+				return false;
+		}
+
+		glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+			std::filesystem::remove(path, error);
+		return linked == GL_TRUE;
+	}
+
+	/// Writes the binary of a linked program into the cache, replacing an older one only once complete.
+	bool storeProgramBinary(GLuint program, uint64_t key)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+
+		const std::string path = cachePath(key);
+		const std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+
+			ProgramCacheHeader header = {};
+			std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+			header.version = PROGRAM_CACHE_VERSION;
+			header.binaryFormat = format;
+			header.key = key;
+			header.binaryLength = (uint32_t)length;
+			file.write((const char*)&header, sizeof(header));
+			file.write(binary.data(), length);
+			if (!file.good())
+				return false;
+		}
+
+		std::remove(path.c_str());
+		return std::rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+
+	void deleteShaders(PendingProgram& pending)
+	{
+		for (GLuint shader : pending.shaders)
+		{
+			if (pending.program != 0)
+				glDetachShader(pending.program, shader);
+			glDeleteShader(shader);
+		}
+		pending.shaders.clear();
+	}
+
+	void printBuildLog(const PendingProgram& pending)
+	{
+		GLchar log[2048] = {};
+		for (GLuint shader : pending.shaders)
+		{
+			GLint compiled = GL_FALSE;
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+			if (compiled)
+				continue;
+			glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+			std::cerr << "finishProgram(): " << pending.label << " failed to compile: " << log << std::endl;
+			return;
+		}
+		glGetProgramInfoLog(pending.program, sizeof(log), nullptr, log);
+		std::cerr << "finishProgram(): " << pending.label << " failed to link: " << log << std::endl;
+	}
+}
+
+/**
+ * @brief Checks what the driver supports and where the binaries go. Call once with a current
+ *        context before building any program.
+ * @param directory directory of the cached binaries, created when missing
+*/
+void manaeste::openProgramCache(const std::string& directory)
+{
+	cacheDirectory = directory;
+	programCacheStats = ProgramCacheStats();
+
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	GLint numFormats = 0;
+	if (major > 4 || (major == 4 && minor >= 1) || hasExtension("GL_ARB_get_program_binary"))
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	binariesSupported = numFormats > 0;
+	parallelCompile = hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile");
+
+	driverHash = 14695981039346656037ull;
+	driverHash = hashString(glString(GL_VENDOR), driverHash);
+	driverHash = hashString(glString(GL_RENDERER), driverHash);
+	driverHash = hashString(glString(GL_VERSION), driverHash);
+
+	if (binariesSupported)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(cacheDirectory, error);
+	}
+}
+
+/**
+ * @brief Whether the driver compiles on threads of its own.
+ * @return true with GL_KHR_parallel_shader_compile
+*/
+bool manaeste::parallelShaderCompile()
+{
+	return parallelCompile;
+}
+
+/**
+ * @brief Reads a shader file.
+ * @param fileName shader file
+ * @param header replaces the #version line of the file, empty keeps the file as it is
+ * @return source of the shader, empty if the file cannot be read
+*/
+std::string manaeste::loadShaderSource(const std::string& fileName, const std::string& header)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "loadShaderSource(): cannot open " << fileName << std::endl;
+		return std::string();
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+	std::string text = source.str();
+	if (header.empty())
+		return text;
+
+	const size_t lineEnd = text.find('\n');
+	if (text.compare(0, 8, "#version") == 0 && lineEnd != std::string::npos)
+		text.erase(0, lineEnd + 1);
+	return header + text;
+}
+
+/**
+ * @brief Starts building a program. A cached binary is loaded right away; otherwise the shaders
+ *        are compiled and linked without asking for the result, so the driver can work on them
+ *        while the caller does something else.
+ * @param sources stages of the program
+ * @param attributes locations bound before linking
+ * @param label name of the program in the log
+ * @return program being built, finish it with finishProgram() or cancelProgram()
+*/
+PendingProgram manaeste::beginProgram(const std::vector<ShaderSource>& sources, const std::vector<AttributeLocation>& attributes,
+	const std::string& label)
+{
+	PendingProgram pending;
+	pending.label = label;
+	pending.key = driverHash;
+	for (const auto& source : sources)
+	{
+		pending.key = fnv1a(&source.type, sizeof(source.type), pending.key);
+		pending.key = hashString(source.source, pending.key);
+	}
+	for (const auto& attribute : attributes)
+	{
+		pending.key = fnv1a(&attribute.location, sizeof(attribute.location), pending.key);
+		pending.key = hashString(attribute.name, pending.key);
+	}
+
+	pending.program = glCreateProgram();
+	if (binariesSupported && loadProgramBinary(pending.program, pending.key))
+	{
+		pending.fromCache = true;
+		return pending;
+	}
+
+	for (const auto& source : sources)
+	{
+		GLuint shader = glCreateShader(source.type);
+		const GLchar* text = source.source.c_str();
+		glShaderSource(shader, 1, &text, nullptr);
+		glCompileShader(shader);
+		glAttachShader(pending.program, shader);
+		pending.shaders.push_back(shader);
+	}
+	for (const auto& attribute : attributes)
+		glBindAttribLocation(pending.program, attribute.location, attribute.name.c_str());
+	if (binariesSupported)
+		glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(pending.program);
+	return pending;
+}
+
+/**
+ * @brief Whether finishProgram() would return without waiting for the compiler. Without parallel
+ *        compilation there is no way to ask, and the program counts as ready.
+ * @param pending program started by beginProgram()
+ * @return true if the program is loaded or linked
+*/
+bool manaeste::programReady(const PendingProgram& pending)
+{
+	if (pending.fromCache || pending.program == 0 || !parallelCompile)
+		return true;
+
+	GLint done = GL_FALSE;
+	glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+/**
+ * @brief Waits for the program to link, prints the log if it failed and stores its binary in the
+ *        cache if it was compiled.
+ * @param pending program started by beginProgram(), left empty
+ * @return linked program, 0 if it failed
+*/
+GLuint manaeste::finishProgram(PendingProgram& pending)
+{
+	if (pending.program == 0)
+		return 0;
+	if (pending.fromCache)
+	{
+		programCacheStats.loaded++;
+		return std::exchange(pending.program, 0);
+	}
+
+	using Clock = std::chrono::steady_clock;
+	const auto start = Clock::now();
+	GLint linked = GL_FALSE;
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+	programCacheStats.waitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	if (!linked)
+	{
+		printBuildLog(pending);
+		programCacheStats.failed++;
+		cancelProgram(pending);
+		return 0;
+	}
+
+	deleteShaders(pending);
+	programCacheStats.compiled++;
+	if (binariesSupported && storeProgramBinary(pending.program, pending.key))
+		programCacheStats.stored++;
+	return std::exchange(pending.program, 0);
+}
+
+/**
+ * @brief Drops a program that is no longer needed, finished or not.
+ * @param pending program started by beginProgram(), left empty
+*/
+void manaeste::cancelProgram(PendingProgram& pending)
+{
+	deleteShaders(pending);
+	if (pending.program != 0)
+		glDeleteProgram(pending.program);
+	pending.program = 0;
+}
+
+/**
+ * @brief Prints how the programs were built.
+ * @param out output stream
+*/
+void manaeste::printProgramCacheReport(std::ostream& out)
+{
+	out << "Shader programs: " << programCacheStats.loaded << " loaded from " << cacheDirectory << ", "
+		<< programCacheStats.compiled << " compiled" << (parallelCompile ? " in parallel" : "") << ", "
+		<< programCacheStats.stored << " stored, " << programCacheStats.failed << " failed, "
+		<< std::fixed << std::setprecision(1) << programCacheStats.waitMs << " ms waiting for the compiler"
+		<< std::defaultfloat << std::endl;
+	if (!binariesSupported)
+		out << "  the driver offers no program binary formats, nothing is cached" << std::endl;
+}
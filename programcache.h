@@ -0,0 +1,66 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    programcache.h : Header file for programcache.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Shader programs built without waiting for the compiler, with their binaries cached on disk.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "pgr.h"
+
+namespace manaeste
+{
+	/// Directory of the cached program binaries, relative to the working directory.
+	const char* const PROGRAM_CACHE_DIRECTORY = "data/programs";
+
+	/// One stage of a program.
+	typedef struct ShaderSource
+	{
+		GLenum type{};
+		std::string source;
+	} ShaderSource;
+
+	/// Vertex attribute location bound before linking.
+	typedef struct AttributeLocation
+	{
+		GLuint location{};
+		std::string name;
+	} AttributeLocation;
+
+	/// Program started by beginProgram(); the driver may still be compiling it.
+	typedef struct PendingProgram
+	{
+		GLuint program{};
+		uint64_t key{};                ///< hash of the sources, attribute locations and driver
+		std::string label;
+		bool fromCache{};              ///< loaded from a cached binary, nothing left to compile
+		std::vector<GLuint> shaders;   ///< compiled from source, attached until the program is finished
+	} PendingProgram;
+
+	/// Programs built since openProgramCache().
+	typedef struct ProgramCacheStats
+	{
+		unsigned int loaded{};         ///< from a cached binary
+		unsigned int compiled{};       ///< from source
+		unsigned int stored{};         ///< binaries written to the cache
+		unsigned int failed{};
+		double waitMs{};               ///< finishProgram() waiting for the compiler
+	} ProgramCacheStats;
+
+	void openProgramCache(const std::string& directory);
+	bool parallelShaderCompile();
+	std::string loadShaderSource(const std::string& fileName, const std::string& header = std::string());
+	PendingProgram beginProgram(const std::vector<ShaderSource>& sources, const std::vector<AttributeLocation>& attributes,
+		const std::string& label);
+	bool programReady(const PendingProgram& pending);
+	GLuint finishProgram(PendingProgram& pending);
+	void cancelProgram(PendingProgram& pending);
+	void printProgramCacheReport(std::ostream& out);
+}
@@ -0,0 +1,179 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    quantize.cpp : Vertex quantization.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Packs the 32 byte float vertices into 16 bytes: positions and texture
+ *          coordinates as 16-bit fractions of their bounds, normals octahedrally encoded.
+ *
+ * Unsigned normalized integers are used throughout because their conversion to float is
+ * the same on every GL version, unlike the signed ones. Every mesh is decoded again after
+ * packing and the largest errors are kept, so the caller can reject meshes whose packed
+ * form would be visibly different.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include "quantize.h"
+
+using namespace manaeste;
+
+namespace
+{
+	const float UNORM16_MAX = 65535.0f;
+
+	uint16_t toUnorm16(float value)
+	{
+		return (uint16_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * UNORM16_MAX);
+	}
+
+	float fromUnorm16(uint16_t value)
+	{
+		return value / UNORM16_MAX;
+	}
+
+	/**
+	 * @brief Projects a unit vector onto the octahedron and unfolds it into [-1, 1]^2.
+	*/
+	void encodeOctahedral(const float normal[3], float encoded[2])
+	{
+		const float sum = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+		float x = sum > 0.0f ? normal[0] / sum : 0.0f;
+		float y = sum > 0.0f ? normal[1] / sum : 0.0f;
+		if (normal[2] < 0.0f)
+		{
+			const float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			const float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = foldedX;
+			y = foldedY;
+		}
+		encoded[0] = x;
+		encoded[1] = y;
+	}
+
+	/**
+	 * @brief Inverse of encodeOctahedral(), the same computation as in lights.vert.
+	*/
+	void decodeOctahedral(const float encoded[2], float normal[3])
+	{
+		float x = encoded[0], y = encoded[1];
+		const float z = 1.0f - std::fabs(x) - std::fabs(y);
+		if (z < 0.0f)
+		{
+			const float unfoldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			const float unfoldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = unfoldedX;
+			y = unfoldedY;
+		}
+		const float length = std::sqrt(x * x + y * y + z * z);
+		normal[0] = x / length;
+		normal[1] = y / length;
+		normal[2] = z / length;
+	}
+
+	float angleDegrees(const float a[3], const float b[3])
+	{
+		const float lengthA = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+		const float lengthB = std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+		if (lengthA == 0.0f || lengthB == 0.0f)
+			return 0.0f;
+		const float cosine = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / (lengthA * lengthB);
+		return std::acos(std::min(std::max(cosine, -1.0f), 1.0f)) * 180.0f / 3.14159265f;
+	}
+}
+
+/**
+ * @brief Packs the vertices of a mesh and measures the error of the packed form.
+ * @param mesh source mesh
+ * @param quantized packed vertices, decode parameters and the largest errors
+*/
+void manaeste::quantizeMesh(const MeshView& mesh, QuantizedMesh& quantized)
+{
+	float minPosition[3] = { INFINITY, INFINITY, INFINITY }, maxPosition[3] = { -INFINITY, -INFINITY, -INFINITY };
+	float minTexCoord[2] = { INFINITY, INFINITY }, maxTexCoord[2] = { -INFINITY, -INFINITY };
+	for (uint32_t v = 0; v < mesh.numVertices; v++)
+	{
+		const MeshVertex& vertex = mesh.vertices[v];
+		for (int c = 0; c < 3; c++)
+		{
+			minPosition[c] = std::min(minPosition[c], vertex.position[c]);
+			maxPosition[c] = std::max(maxPosition[c], vertex.position[c]);
+		}
+		for (int c = 0; c < 2; c++)
+		{
+			minTexCoord[c] = std::min(minTexCoord[c], vertex.texCoord[c]);
+			maxTexCoord[c] = std::max(maxTexCoord[c], vertex.texCoord[c]);
+		}
+	}
+	if (mesh.numVertices == 0)
+	{
+		std::fill(minPosition, minPosition + 3, 0.0f);
+		std::fill(maxPosition, maxPosition + 3, 0.0f);
+		std::fill(minTexCoord, minTexCoord + 2, 0.0f);
+		std::fill(maxTexCoord, maxTexCoord + 2, 0.0f);
+	}
+
+	float positionScale[3], texCoordScale[2];
+	float largestExtent = 0.0f;
+	for (int c = 0; c < 3; c++)
+	{
+		positionScale[c] = maxPosition[c] - minPosition[c];
+		largestExtent = std::max(largestExtent, positionScale[c]);
+	}
+	for (int c = 0; c < 2; c++)
+		texCoordScale[c] = maxTexCoord[c] - minTexCoord[c];
+
+	VertexDecode& decode = quantized.decode;
+	decode.positionScale = glm::vec3(positionScale[0], positionScale[1], positionScale[2]);
+	decode.positionOffset = glm::vec3(minPosition[0], minPosition[1], minPosition[2]);
+	decode.texCoordTransform = glm::vec4(texCoordScale[0], texCoordScale[1], minTexCoord[0], minTexCoord[1]);
+	decode.octahedralNormals = true;
+
+	QuantizationError& error = quantized.error;
+	error = QuantizationError();
+	quantized.vertices.resize(mesh.numVertices);
+	for (uint32_t v = 0; v < mesh.numVertices; v++)
+	{
+		const MeshVertex& vertex = mesh.vertices[v];
+		PackedVertex& packed = quantized.vertices[v];
+
+		for (int c = 0; c < 3; c++)
+		{
+			packed.position[c] = positionScale[c] > 0.0f ? toUnorm16((vertex.position[c] - minPosition[c]) / positionScale[c]) : 0;
+			const float decoded = fromUnorm16(packed.position[c]) * positionScale[c] + minPosition[c];
+			if (largestExtent > 0.0f)
+				error.position = std::max(error.position, std::fabs(decoded - vertex.position[c]) / largestExtent);
+		}
+		packed.position[3] = 0;
+
+		float encoded[2], decodedNormal[3];
+		encodeOctahedral(vertex.normal, encoded);
+		for (int c = 0; c < 2; c++)
+		{
+			packed.normal[c] = toUnorm16(encoded[c] * 0.5f + 0.5f);
+			encoded[c] = fromUnorm16(packed.normal[c]) * 2.0f - 1.0f;
+		}
+		decodeOctahedral(encoded, decodedNormal);
+		error.normalDegrees = std::max(error.normalDegrees, angleDegrees(vertex.normal, decodedNormal));
+
+		for (int c = 0; c < 2; c++)
+		{
+			packed.texCoord[c] = texCoordScale[c] > 0.0f ? toUnorm16((vertex.texCoord[c] - minTexCoord[c]) / texCoordScale[c]) : 0;
+			const float decoded = fromUnorm16(packed.texCoord[c]) * texCoordScale[c] + minTexCoord[c];
+			error.texCoord = std::max(error.texCoord, std::fabs(decoded - vertex.texCoord[c]));
+		}
+	}
+}
+
+/**
+ * @brief Tells whether a packed mesh would look the same as the original one.
+ * @param error largest errors of the packed mesh
+ * @param tolerance largest acceptable errors
+ * @return true if every error is within its tolerance
+*/
+bool manaeste::isWithinTolerance(const QuantizationError& error, const QuantizationError& tolerance)
+{
+	return error.position <= tolerance.position && error.normalDegrees <= tolerance.normalDegrees
+		&& error.texCoord <= tolerance.texCoord;
+}
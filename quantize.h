@@ -0,0 +1,56 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    quantize.h : Header file for quantize.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Compressed 16 byte vertex layout decoded in lights.vert.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "pgr.h"
+#include "mesh.h"
+
+namespace manaeste
+{
+	/// Vertex with every attribute stored as 16-bit unsigned normalized integers.
+	typedef struct PackedVertex
+	{
+		uint16_t position[4]; ///< relative to the mesh bounds, w is padding
+		uint16_t normal[2];   ///< octahedral encoding mapped to [0, 1]
+		uint16_t texCoord[2]; ///< relative to the texture coordinate bounds
+	} PackedVertex;
+
+	/// How lights.vert turns the vertex attributes back into object space values.
+	typedef struct VertexDecode
+	{
+		glm::vec3 positionScale{ 1.0f };
+		glm::vec3 positionOffset{ 0.0f };
+		glm::vec4 texCoordTransform{ 1.0f, 1.0f, 0.0f, 0.0f }; ///< scale in xy, offset in zw
+		bool octahedralNormals{};
+	} VertexDecode;
+
+	/// Largest differences between the source vertices and the decoded packed ones.
+	typedef struct QuantizationError
+	{
+		float position{};    ///< relative to the largest extent of the mesh
+		float normalDegrees{};
+		float texCoord{};    ///< in texture coordinate units
+	} QuantizationError;
+
+	/// Errors above these make the mesh keep its float layout.
+	const QuantizationError QUANTIZATION_TOLERANCE = { 1.0f / 4096.0f, 0.5f, 1.0f / 4096.0f };
+
+	typedef struct QuantizedMesh
+	{
+		std::vector<PackedVertex> vertices;
+		VertexDecode decode;
+		QuantizationError error;
+	} QuantizedMesh;
+
+	void quantizeMesh(const MeshView& mesh, QuantizedMesh& quantized);
+	bool isWithinTolerance(const QuantizationError& error, const QuantizationError& tolerance = QUANTIZATION_TOLERANCE);
+}
@@ -13,11 +13,32 @@
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <cstddef>
+#include <algorithm>
+#include <iterator>
+#include <iomanip>
+#include <cmath>
+#include <cfloat>
+#include <sstream>
 #include "data.h"
+#include "ktx.h"
+#include "resources.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "megabuffer.h"
+#include "gpuculling.h"
+#include "lighting.h"
+#include "programcache.h"
+#include "profiler.h"
+#include "renderstats.h"
 
 using namespace manaeste;
 
-bool useFog = true;
+bool quantizeVertices = true; ///< upload meshes in the 16 byte PackedVertex layout when within tolerance
+bool multiDraw = true;        ///< draw the opaque pass with glMultiDrawElementsIndirect() when the context has GL 4.3
 
 SingMeshGeom* amongusGeom = nullptr;  ///< moving texture object (banner) geometry
 SingMeshGeom* sparklesGeom = nullptr; ///< spritesheet object (sparkles) geometry
@@ -30,6 +51,27 @@ SingMeshGeom* diamondGeom = nullptr;  ///< diamond geometry
 MultMeshGeom snowmanGeom;             ///< snowman geometry
 MultMeshGeom couchGeom;               ///< couch geometry
 
+const GLsizei DRAW_UNIFORM_RING_SLOTS = 256; ///< per-draw blocks per frame before the ring wraps around
+GLuint frameUniformBuffer = 0;    ///< FrameData uniform block storage
+GLuint drawUniformBuffer = 0;     ///< ring of DrawData uniform blocks
+GLsizei drawUniformStride = 0;    ///< DrawUniforms size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+GLsizei drawUniformSlot = 0;      ///< next free slot of the ring
+DrawUniforms pendingDrawUniforms; ///< per-draw values collected until the draw is queued
+GLuint pendingTexture = 0;        ///< texture of the next queued draw, set by setUniformMaterial()
+LodProjection pendingLodProjection; ///< screen size of the model set by setUniformMatrices()
+float viewportHeight = 0.0f;      ///< in pixels, read once per frame for the level of detail selection
+std::vector<MeshMemory> meshMemory; ///< every mesh uploaded by createMeshGeom()
+bool occlusionCulling = true;     ///< test the draws against the occluders of the frame
+OcclusionBuffer occlusionBuffer;  ///< CPU depth buffer of the occluders
+OcclusionStats occlusionStats;    ///< occlusion culling work of the current frame
+std::unique_ptr<TaskPool> occlusionPool; ///< workers rasterizing the occlusion buffer
+bool gpuCulling = true;           ///< cull terrain and palms in cull.comp on the multi-draw path
+GpuInstanceSet terrainInstances;  ///< every terrain element, uploaded by uploadGpuInstances()
+GpuInstanceSet palmInstances;     ///< every drawn palm, uploaded by uploadGpuInstances()
+bool lightVariants = true;        ///< draw with the light permutation of the frame instead of the branching build
+bool multiDrawPrograms = false;   ///< the multi-draw light programs were started, meshes also go into the mega-buffer
+const float SUN_SPEED = 0.8f;     ///< radians per second the sun turns around the island
+
 const char* TERRAIN_MODEL = "data/ground/ground.obj";
 const char* SNOWMAN_MODEL = "data/snehulak/snehulak.obj";
 const char* RAIDER_MODEL = "data/raider/raider.obj";
@@ -43,6 +85,7 @@ const char* DIAMOND_TEXTURE = "data/diamond.png";
 const char* SKYBOX_TEXTURE_PREFIX = "data/skybox1/skybox";
 
 MainShaderProgram shaderProgram;
+MultiDrawShaderProgram multiDrawShaderProgram;
 AmongusShaderProgram amongusShaderProgram;
 SkyboxShaderProgram skyboxShaderProgram;
 SparklesShaderProgram sparklesShaderProgram;
@@ -53,34 +96,294 @@ struct SingleMeshModelInfo
 	SingMeshGeom** geometryPtr;
 };
 
+namespace
+{
+	/// Tests the bounding box of a draw against the occluders of the frame, false when it is hidden.
+	bool occludedDrawVisible(const SingMeshGeom* geom, const glm::mat4& modelMat)
+	{
+		if (!occlusionCulling)
+			return true;
+		occlusionStats.tested++;
+		if (occlusionBuffer.isVisible(geom->boundsMin, geom->boundsMax, modelMat))
+			return true;
+		occlusionStats.occluded++;
+		return false;
+	}
+
+	/// Packet drawing a level of detail of a mesh with the pending texture, on the path in use.
+	DrawPacket meshPacket(const SingMeshGeom* geom, const MeshLod& lod)
+	{
+		DrawPacket packet;
+		packet.indexType = geom->indexType;
+		packet.numIndices = (GLsizei)lod.numTriangles * 3;
+		packet.firstIndex = lod.firstIndex;
+		packet.mega = geom->mega;
+		if (multiDrawActive())
+		{
+			// every mesh shares the program, vertex array and texture array, the queue sorts by stencil and depth only
+			packet.program = multiDrawShaderProgram.program;
+			packet.vao = megaVertexArray();
+			packet.textureLayer = materialTextureLayer(pendingTexture);
+		}
+		else
+		{
+			packet.program = shaderProgram.program;
+			packet.vao = geom->vao;
+			packet.texture = pendingTexture;
+		}
+		return packet;
+	}
+
+	/// Instance set of the objects of a type culled on the GPU, nullptr for other types.
+	GpuInstanceSet* gpuInstanceSet(ObjectType type)
+	{
+		switch (type)
+		{
+		case TERRAIN_ELEMENT:
+			return &terrainInstances;
+		case PALM:
+			return &palmInstances;
+		default:
+			return nullptr;
+		}
+	}
+
+	/// Whether the objects of a type are drawn from their instance set, culled on the GPU.
+	bool gpuInstancesActive(ObjectType type)
+	{
+		const GpuInstanceSet* set = gpuInstanceSet(type);
+		return gpuCulling && set != nullptr && set->buffer != 0 && gpuCullingReady() && multiDrawActive();
+	}
+
+	/// Queues the instance set of a mesh for culling and level of detail selection in cull.comp.
+	void queueGpuInstanceSet(const SingMeshGeom* geom, const GpuInstanceSet& set, float shininess, const glm::mat4& projMat,
+		const glm::mat4& viewMat)
+	{
+		GpuCullParams params;
+		params.projViewMat = projMat * viewMat;
+		params.bounds = geom->bounds;
+		params.lodRadius = geom->radius;
+		params.pixelsPerUnit = std::fabs(projMat[1][1]) * 0.5f * viewportHeight;
+		params.numLods = (uint32_t)std::min<size_t>(geom->lods.size(), MAX_GPU_LODS);
+		for (uint32_t lod = 0; lod < params.numLods; lod++)
+		{
+			params.lodErrors[lod] = geom->lods[lod].error;
+			params.lodFirstIndex[lod] = geom->lods[lod].firstIndex;
+			params.lodNumIndices[lod] = geom->lods[lod].numTriangles * 3;
+		}
+
+		setUniformMatrices(projMat, viewMat, glm::mat4(1.0f));
+		setUniformMaterial(geom->texture, shininess, geom->ambient, geom->diffuse, geom->specular);
+		setVertexDecode(geom->decode);
+		queueGpuInstances(meshPacket(geom, geom->lods[0]), pendingDrawUniforms, set, params);
+	}
+
+	/// Light shader permutation being built, drawn with the branching build of its path until it is done.
+	struct PendingVariant
+	{
+		PendingProgram build;
+		GLuint* target;   ///< entry of the variants of MainShaderProgram or MultiDrawShaderProgram
+		bool multiDraw;
+	};
+
+	/// Attribute locations of the light shaders, bound before linking so every permutation draws from the same vertex arrays.
+	const GLuint POSITION_ATTRIB = 0;
+	const GLuint NORMAL_ATTRIB = 1;
+	const GLuint TEXTURE_COORD_ATTRIB = 2;
+	const GLuint INSTANCE_INDEX_ATTRIB = 3;
+	const std::vector<AttributeLocation> LIGHT_ATTRIBUTES = { { POSITION_ATTRIB, "position" }, { NORMAL_ATTRIB, "normal" },
+		{ TEXTURE_COORD_ATTRIB, "textureCoord" }, { INSTANCE_INDEX_ATTRIB, "instanceIndex" } };
+
+	PendingProgram pendingLightProgram;          ///< branching build of the GLSL 1.40 path
+	PendingProgram pendingMultiDrawLightProgram; ///< branching build of the multi-draw path
+	std::vector<PendingVariant> pendingVariants;
+
+	/// Binds the uniform blocks of a light shader program and points its samplers at their texture units.
+	void setupLightProgram(GLuint program)
+	{
+		GLuint frameDataIndex = glGetUniformBlockIndex(program, "FrameData");
+		GLuint drawDataIndex = glGetUniformBlockIndex(program, "DrawData");
+		glUniformBlockBinding(program, frameDataIndex, FRAME_DATA_BINDING);
+		if (drawDataIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, drawDataIndex, DRAW_DATA_BINDING);
+
+		// samplers never change, set them once instead of on every draw; missing ones are ignored.
+		// Permutations are set up mid-frame, so the program goes through the state cache and is put back.
+		const GLuint previous = boundProgram();
+		useProgram(program);
+		glUniform1i(glGetUniformLocation(program, "textureSampler"), 0);
+		glUniform1i(glGetUniformLocation(program, "instanceMatrices"), 1);
+		glUniform1i(glGetUniformLocation(program, "materialTextures"), MATERIAL_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(program, "lightData"), LIGHT_DATA_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(program, "lightGrid"), LIGHT_GRID_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(program, "lightIndices"), LIGHT_INDEX_TEXTURE_UNIT);
+		useProgram(previous);
+	}
+
+	/// Starts building lights.vert and lights.frag under a version header.
+	PendingProgram beginLightProgram(const std::string& header, const std::string& label)
+	{
+		return beginProgram({ { GL_VERTEX_SHADER, loadShaderSource("lights.vert", header) },
+			{ GL_FRAGMENT_SHADER, loadShaderSource("lights.frag", header) } }, LIGHT_ATTRIBUTES, label);
+	}
+
+	/// Waits for a light program and sets it up, 0 when it failed.
+	GLuint finishLightProgram(PendingProgram& pending)
+	{
+		const std::string label = pending.label;
+		GLuint program = finishProgram(pending);
+		registerResource(SHADER_PROGRAM, program, label);
+		if (program != 0)
+			setupLightProgram(program);
+		return program;
+	}
+
+	/// Starts the branching light program and every permutation under a version header. finishShaders()
+	/// waits for the branching one only; the permutations replace it as they finish, see finishLightVariants().
+	PendingProgram beginLightPrograms(const std::string& header, const std::string& name, GLuint (&variants)[NUM_LIGHT_VARIANTS],
+		bool multiDraw)
+	{
+		PendingProgram branching = beginLightProgram(header, "lights.vert + lights.frag (" + name + ")");
+		for (int variant = 0; variant < NUM_LIGHT_VARIANTS; variant++)
+		{
+			const std::string define = "LIGHT_VARIANT " + std::to_string(variant);
+			pendingVariants.push_back({ beginLightProgram(header + "#define " + define + "\n",
+				"lights.vert + lights.frag (" + name + ", " + define + ")"), &variants[variant], multiDraw });
+		}
+		return branching;
+	}
+
+	/// Puts the light permutations the driver is done with in place of the branching build, all of them
+	/// when wait is set. Without parallel compilation one is finished per call, spreading the wait over frames.
+	void finishLightVariants(bool wait)
+	{
+		bool finished = false;
+		for (auto it = pendingVariants.begin(); it != pendingVariants.end();)
+		{
+			if (!wait && (!programReady(it->build) || (finished && !parallelShaderCompile())))
+			{
+				++it;
+				continue;
+			}
+
+			GLuint program = finishLightProgram(it->build);
+			if (program != 0)
+				*it->target = program;
+			finished = true;
+			it = pendingVariants.erase(it);
+		}
+
+		if (finished && pendingVariants.empty())
+			printProgramCacheReport(std::cout);
+	}
+
+	/// Drops the light permutations still being built, of the multi-draw path only or all of them.
+	void cancelLightVariants(bool multiDrawOnly)
+	{
+		for (auto it = pendingVariants.begin(); it != pendingVariants.end();)
+		{
+			if (multiDrawOnly && !it->multiDraw)
+			{
+				++it;
+				continue;
+			}
+			cancelProgram(it->build);
+			it = pendingVariants.erase(it);
+		}
+	}
+
+	void deleteLightPrograms(GLuint& program, GLuint& branching, GLuint (&variants)[NUM_LIGHT_VARIANTS])
+	{
+		for (auto& variant : variants)
+		{
+			if (variant != branching)
+				deleteResource(SHADER_PROGRAM, variant);
+			variant = 0;
+		}
+		deleteResource(SHADER_PROGRAM, branching);
+		program = 0;
+	}
+}
+
+
+/**
+ * @brief Computes the per-frame light values in view space, so lights.frag does not repeat them for every fragment.
+ * @param frame Vmatrix and currentTime set, receives the light values
+ * @param reflectorPosition world space position of the flashlight
+ * @param reflectorDirection world space direction of the flashlight
+ * @param pointLightPosition world space position of the sparkles light
+*/
+void manaeste::setFrameLights(FrameUniforms& frame, const glm::vec3& reflectorPosition, const glm::vec3& reflectorDirection,
+	const glm::vec3& pointLightPosition)
+{
+	const float sunAngle = frame.currentTime * SUN_SPEED;
+	frame.sunDirection = glm::vec3(cos(sunAngle), 0.0f, sin(sunAngle));
+	frame.pointLightPosition = glm::vec3(frame.Vmatrix * glm::vec4(pointLightPosition, 1.0f));
+
+	frame.reflectorPosition = glm::vec3(frame.Vmatrix * glm::vec4(reflectorPosition, 1.0f));
+	const glm::vec3 direction = glm::vec3(frame.Vmatrix * glm::vec4(reflectorDirection, 0.0f));
+	frame.reflectorDirection = (glm::length(direction) > 0.0f) ? glm::normalize(direction) : direction;
+	const float reflectorDistance = glm::length(frame.reflectorPosition);
+	frame.reflectorDiffuse = glm::vec3(0.9f) * glm::mix(glm::vec3(1.0f), glm::vec3(1.0f, 0.5f, 0.5f), reflectorDistance / 10.0f);
+}
+
+/**
+ * @brief Selects the light shader permutation of the following draws, puts the permutations that
+ *        finished compiling in place first.
+ * @param variant LightVariantBit flags of the lights and fog that are on
+*/
+void manaeste::selectLightVariant(int variant)
+{
+	if (!pendingVariants.empty())
+		finishLightVariants(false);
+
+	variant &= NUM_LIGHT_VARIANTS - 1;
+	shaderProgram.program = lightVariants ? shaderProgram.variants[variant] : shaderProgram.branching;
+	if (multiDrawShaderProgram.branching != 0)
+		multiDrawShaderProgram.program = lightVariants ? multiDrawShaderProgram.variants[variant] : multiDrawShaderProgram.branching;
+}
 
 /**
- * @brief Set PVM, V, M and normal matrices to shaders.
+ * @brief Uploads the per-frame uniform block and restarts the per-draw ring. Call once per frame before drawing.
+ * @param frame camera, light and time state of the frame
+*/
+void manaeste::setFrameUniforms(const FrameUniforms& frame)
+{
+	resetGlStateStats();
+	beginGpuCulling();
+	setCullingFrustum(frame.Pmatrix * frame.Vmatrix);
+
+	GLint viewport[4] = {};
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	viewportHeight = (float)viewport[3];
+
+	bindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+	COUNT_RENDER_STAT(uniformBlockUploads, 1);
+	COUNT_RENDER_STAT(uploadedBytes, sizeof(FrameUniforms));
+
+	// orphan the ring so this frame's draws never wait for the previous frame to finish reading it
+	bindBuffer(GL_UNIFORM_BUFFER, drawUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, DRAW_UNIFORM_RING_SLOTS * drawUniformStride, nullptr, GL_STREAM_DRAW);
+	drawUniformSlot = 0;
+}
+
+/**
+ * @brief Set PVM, M and normal matrices of the next draw call.
  * @param projMat projection matrix
  * @param viewMat view matrix
  * @param modelMat model matrix
 */
 void manaeste::setUniformMatrices(const glm::mat4& projMat, const glm::mat4& viewMat, const glm::mat4& modelMat)
 {
-	GLint PVMLoc = glGetUniformLocation(shaderProgram.program, "PVMmatrix");
-	GLint VmatLoc = glGetUniformLocation(shaderProgram.program, "Vmatrix");
-	GLint MmatLoc = glGetUniformLocation(shaderProgram.program, "Mmatrix");
-	GLint normalMatLoc = glGetUniformLocation(shaderProgram.program, "normalMatrix");
-	GLint fogOnLoc = glGetUniformLocation(shaderProgram.program, "fogOn");
-	CHECK_GL_ERROR();
-
-	glm::mat4 PVM = projMat * viewMat * modelMat;
-	glUniformMatrix4fv(PVMLoc, 1, GL_FALSE, glm::value_ptr(PVM));
-
-	glUniformMatrix4fv(VmatLoc, 1, GL_FALSE, glm::value_ptr(viewMat));
-	glUniformMatrix4fv(MmatLoc, 1, GL_FALSE, glm::value_ptr(modelMat));
-	glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelMat));
-	glUniformMatrix4fv(normalMatLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-	glUniform1i(fogOnLoc, useFog);
+	pendingDrawUniforms.PVMmatrix = projMat * viewMat * modelMat;
+	pendingDrawUniforms.Mmatrix = modelMat;
+	pendingDrawUniforms.normalMatrix = glm::transpose(glm::inverse(modelMat));
+	pendingLodProjection = projectModel(projMat, viewMat, modelMat);
 }
 
 /**
- * @brief Sets material uniform values to shaders.
+ * @brief Sets material values and the texture of the next draw call.
  * @param texture texture GLuint
  * @param shininess shine factor
  * @param ambient ambient part of material
@@ -90,63 +393,165 @@ void manaeste::setUniformMatrices(const glm::mat4& projMat, const glm::mat4& vie
 void manaeste::setUniformMaterial(GLuint texture, float shininess, const glm::vec3& ambient, const glm::vec3& diffuse,
 	const glm::vec3& specular)
 {
-	auto diffuse_ptr = glm::value_ptr(diffuse);
-	auto ambient_ptr = glm::value_ptr(ambient);
-	auto specular_ptr = glm::value_ptr(specular);
+	pendingDrawUniforms.ambient = ambient;
+	pendingDrawUniforms.diffuse = diffuse;
+	pendingDrawUniforms.specular = specular;
+	pendingDrawUniforms.shininess = shininess;
 
-	glUniform3fv(shaderProgram.diffuseLoc, 1, diffuse_ptr);
-	glUniform3fv(shaderProgram.ambientLoc, 1, ambient_ptr);
-	glUniform3fv(shaderProgram.specularLoc, 1, specular_ptr);
-	glUniform1f(shaderProgram.shininessLoc, shininess);
+	pendingDrawUniforms.useTexture = (texture != 0);
+	pendingTexture = texture;
+}
 
-	bool hasTexture = (texture != 0);
-	glUniform1i(shaderProgram.useTextureLoc, hasTexture);
+/**
+ * @brief Writes per-draw values into the next slot of the uniform ring and binds it.
+ * @param uniforms DrawData values of the draw
+*/
+void manaeste::commitDrawUniforms(const DrawUniforms& uniforms)
+{
+	GLintptr offset = (GLintptr)drawUniformSlot * drawUniformStride;
+	drawUniformSlot = (drawUniformSlot + 1) % DRAW_UNIFORM_RING_SLOTS;
+
+	bindBuffer(GL_UNIFORM_BUFFER, drawUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(DrawUniforms), &uniforms);
+	bindBufferRange(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, drawUniformBuffer, offset, sizeof(DrawUniforms));
+	COUNT_RENDER_STAT(uniformBlockUploads, 1);
+	COUNT_RENDER_STAT(uploadedBytes, sizeof(DrawUniforms));
+}
 
-	if (hasTexture)
-	{
-		glUniform1i(shaderProgram.textureSamplerLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
-	}
+/**
+ * @brief Sets how the vertex shader decodes the vertices of the next draw call.
+ * @param decode vertex layout of the mesh
+*/
+void manaeste::setVertexDecode(const VertexDecode& decode)
+{
+	pendingDrawUniforms.positionScale = decode.positionScale;
+	pendingDrawUniforms.positionOffset = decode.positionOffset;
+	pendingDrawUniforms.texCoordTransform = decode.texCoordTransform;
+	pendingDrawUniforms.octahedralNormals = decode.octahedralNormals;
+}
+
+/**
+ * @brief Measures how large a model appears on the screen.
+ * @param projMat projection matrix
+ * @param viewMat view matrix
+ * @param modelMat model matrix
+ * @return depth and scale of the model
+*/
+LodProjection manaeste::projectModel(const glm::mat4& projMat, const glm::mat4& viewMat, const glm::mat4& modelMat)
+{
+	LodProjection projection;
+	projection.depth = (projMat * viewMat * modelMat[3]).w;
+	projection.scale = std::max(glm::length(glm::vec3(modelMat[0])),
+		std::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+	projection.pixelsPerUnit = std::fabs(projMat[1][1]) * 0.5f * viewportHeight;
+	return projection;
 }
 
 /**
- * @brief Creates shader programs and gets locations of shader variables.
+ * @brief Picks the coarsest level of detail whose error stays within LOD_PIXEL_ERROR on the screen.
+ * @param geom mesh to draw
+ * @param projection screen size of the model
+ * @return index into geom->lods
+*/
+size_t manaeste::selectLod(const SingMeshGeom* geom, const LodProjection& projection)
+{
+	// the nearest point of the bounding sphere decides, so large meshes do not coarsen under the camera
+	const float distance = projection.depth - geom->radius * projection.scale;
+	if (distance <= 0.0f)
+		return 0;
+
+	const float pixelsPerUnit = projection.scale * projection.pixelsPerUnit / distance;
+	size_t lod = 0;
+	while (lod + 1 < geom->lods.size() && geom->lods[lod + 1].error * pixelsPerUnit <= LOD_PIXEL_ERROR)
+		lod++;
+	return lod;
+}
+
+/**
+ * @brief Queues the level of detail of the mesh matching the screen size set by setUniformMatrices(),
+ *        with the pending per-draw uniforms.
+ * @param geom mesh to draw
+*/
+void manaeste::drawMeshElements(const SingMeshGeom* geom)
+{
+	if (!occludedDrawVisible(geom, pendingDrawUniforms.Mmatrix))
+		return;
+
+	const MeshLod& lod = geom->lods[selectLod(geom, pendingLodProjection)];
+	setVertexDecode(geom->decode);
+
+	DrawPacket packet = meshPacket(geom, lod);
+	queueDraw(packet, pendingDrawUniforms, pendingLodProjection.depth, transformSphere(geom->bounds, pendingDrawUniforms.Mmatrix));
+}
+
+/**
+ * @brief Whether the queued draws go through the multi-draw path: enabled, supported by the
+ *        context and the mega-buffer uploaded.
+ * @return true if drawMeshElements() queues packets for the multi-draw path
+*/
+bool manaeste::multiDrawActive()
+{
+	return multiDraw && multiDrawShaderProgram.program != 0 && megaVertexArray() != 0;
+}
+
+/**
+ * @brief Creates shader programs and gets locations of shader variables. The light programs are
+ *        only started, the driver compiles them while the meshes load; finishShaders() waits for them.
 */
 void manaeste::createShaders() {
-	auto createProgram = [](const char* vert, const char* frag)
+	PROFILE_ZONE("createShaders");
+	openProgramCache(PROGRAM_CACHE_DIRECTORY);
+
+	auto beginFiles = [](const char* vert, const char* frag)
+	{
+		return beginProgram({ { GL_VERTEX_SHADER, loadShaderSource(vert) }, { GL_FRAGMENT_SHADER, loadShaderSource(frag) } }, {},
+			std::string(vert) + " + " + frag);
+	};
+	auto finish = [](PendingProgram& pending)
 	{
-		std::vector<GLuint> shaderList{
-				pgr::createShaderFromFile(GL_VERTEX_SHADER, vert),
-				pgr::createShaderFromFile(GL_FRAGMENT_SHADER, frag)
-		};
-		return pgr::createProgram(shaderList);
+		const std::string label = pending.label;
+		GLuint program = finishProgram(pending);
+		registerResource(SHADER_PROGRAM, program, label);
+		return program;
 	};
 
-	shaderProgram.program = createProgram("lights.vert", "lights.frag");
-	shaderProgram.positionLoc = glGetAttribLocation(shaderProgram.program, "position");
-	shaderProgram.normalLoc = glGetAttribLocation(shaderProgram.program, "normal");
-	shaderProgram.textureCoordLoc = glGetAttribLocation(shaderProgram.program, "textureCoord");
-	shaderProgram.PVMmatrixLoc = glGetUniformLocation(shaderProgram.program, "PVMmatrix");
-	shaderProgram.VmatrixLoc = glGetUniformLocation(shaderProgram.program, "Vmatrix");
-	shaderProgram.MmatrixLoc = glGetUniformLocation(shaderProgram.program, "Mmatrix");
-	shaderProgram.normalMatrixLoc = glGetUniformLocation(shaderProgram.program, "normalMatrix");
-	shaderProgram.timeLoc = glGetUniformLocation(shaderProgram.program, "currentTime");
-	shaderProgram.ambientLoc = glGetUniformLocation(shaderProgram.program, "material.ambient");
-	shaderProgram.diffuseLoc = glGetUniformLocation(shaderProgram.program, "material.diffuse");
-	shaderProgram.specularLoc = glGetUniformLocation(shaderProgram.program, "material.specular");
-	shaderProgram.shininessLoc = glGetUniformLocation(shaderProgram.program, "material.shininess");
-	shaderProgram.textureSamplerLoc = glGetUniformLocation(shaderProgram.program, "textureSampler");
-	shaderProgram.useTextureLoc = glGetUniformLocation(shaderProgram.program, "material.useTexture");
-	shaderProgram.reflectorPositionLoc = glGetUniformLocation(shaderProgram.program, "reflectorPosition");
-	shaderProgram.reflectorDirectionLoc = glGetUniformLocation(shaderProgram.program, "reflectorDirection");
-	shaderProgram.sunOnLoc = glGetUniformLocation(shaderProgram.program, "sunOn");
-	shaderProgram.flashOnLoc = glGetUniformLocation(shaderProgram.program, "flashOn");
-	shaderProgram.pointLightLoc = glGetUniformLocation(shaderProgram.program, "positionPointLight");
-	shaderProgram.pointLightOnLoc = glGetUniformLocation(shaderProgram.program, "pointLightOn");
-	shaderProgram.fogOnLoc = glGetUniformLocation(shaderProgram.program, "fogOn");
-
-	sparklesShaderProgram.program = createProgram("sparkles.vert", "sparkles.frag");
+	PendingProgram sparkles = beginFiles("sparkles.vert", "sparkles.frag");
+	PendingProgram amongus = beginFiles("amongusMovingTexture.vert", "amongusMovingTexture.frag");
+	PendingProgram skybox = beginFiles("cubeSkybox.vert", "cubeSkybox.frag");
+
+	// a program per light permutation, all sharing the attribute locations and the uniform blocks
+	pendingLightProgram = beginLightPrograms("#version 140\n", "GLSL 1.40", shaderProgram.variants, false);
+	shaderProgram.positionLoc = POSITION_ATTRIB;
+	shaderProgram.normalLoc = NORMAL_ATTRIB;
+	shaderProgram.textureCoordLoc = TEXTURE_COORD_ATTRIB;
+	if (multiDrawSupported())
+	{
+		// the same light shaders as GLSL 4.30, reading geometry, matrices and materials from storage buffers
+		pendingMultiDrawLightProgram = beginLightPrograms("#version 430\n#define MULTI_DRAW\n", "MULTI_DRAW",
+			multiDrawShaderProgram.variants, true);
+		multiDrawShaderProgram.instanceIndexLoc = INSTANCE_INDEX_ATTRIB;
+		multiDrawPrograms = true;
+	}
+	createLightClusters();
+
+	GLint uniformAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	drawUniformStride = (GLsizei)((sizeof(DrawUniforms) + uniformAlignment - 1) / uniformAlignment * uniformAlignment);
+
+	frameUniformBuffer = createResource(UNIFORM_BUFFER, "FrameData");
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	setResourceBytes(UNIFORM_BUFFER, frameUniformBuffer, sizeof(FrameUniforms));
+	drawUniformBuffer = createResource(UNIFORM_BUFFER, "DrawData ring");
+	glBindBuffer(GL_UNIFORM_BUFFER, drawUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, DRAW_UNIFORM_RING_SLOTS * drawUniformStride, nullptr, GL_STREAM_DRAW);
+	setResourceBytes(UNIFORM_BUFFER, drawUniformBuffer, (size_t)DRAW_UNIFORM_RING_SLOTS * drawUniformStride);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, frameUniformBuffer);
+	CHECK_GL_ERROR();
+
+	// the vertex arrays loaded next need the attribute locations of these
+	sparklesShaderProgram.program = finish(sparkles);
 	sparklesShaderProgram.positionLoc = glGetAttribLocation(sparklesShaderProgram.program, "position");
 	sparklesShaderProgram.textureCoordLoc = glGetAttribLocation(sparklesShaderProgram.program, "textureCoord");
 	sparklesShaderProgram.PVMmatrixLoc = glGetUniformLocation(sparklesShaderProgram.program, "PVMmatrix");
@@ -155,74 +560,116 @@ void manaeste::createShaders() {
 	sparklesShaderProgram.textureSamplerLoc = glGetUniformLocation(sparklesShaderProgram.program, "textureSampler");
 	sparklesShaderProgram.frameDurationLoc = glGetUniformLocation(sparklesShaderProgram.program, "frameDuration");
 
-	amongusShaderProgram.program = createProgram("amongusMovingTexture.vert", "amongusMovingTexture.frag");
+	amongusShaderProgram.program = finish(amongus);
 	amongusShaderProgram.positionLoc = glGetAttribLocation(amongusShaderProgram.program, "position");
 	amongusShaderProgram.textureCoordLoc = glGetAttribLocation(amongusShaderProgram.program, "textureCoord");
 	amongusShaderProgram.PVMmatrixLoc = glGetUniformLocation(amongusShaderProgram.program, "PVMmatrix");
 	amongusShaderProgram.currentTimeLoc = glGetUniformLocation(amongusShaderProgram.program, "currentTime");
 	amongusShaderProgram.textureSamplerLoc = glGetUniformLocation(amongusShaderProgram.program, "textureSampler");
 
-	skyboxShaderProgram.program = createProgram("cubeSkybox.vert", "cubeSkybox.frag");
+	skyboxShaderProgram.program = finish(skybox);
 	skyboxShaderProgram.screenCoordLoc = glGetAttribLocation(skyboxShaderProgram.program, "screenCoord");
 	skyboxShaderProgram.skyboxSamplerLoc = glGetUniformLocation(skyboxShaderProgram.program, "skyboxSampler");
 	skyboxShaderProgram.inversePVmatrixLoc = glGetUniformLocation(skyboxShaderProgram.program, "inversePVmatrix");
 }
 
+/**
+ * @brief Waits for the branching light programs, which draw until the permutations replace them
+ *        (see selectLightVariant()). Call after loading the meshes, so the driver compiles meanwhile.
+*/
+void manaeste::finishShaders()
+{
+	PROFILE_ZONE("finishShaders");
+	shaderProgram.branching = finishLightProgram(pendingLightProgram);
+	if (shaderProgram.branching == 0)
+		pgr::dieWithError("finishShaders(): lights.vert + lights.frag failed");
+	std::fill(std::begin(shaderProgram.variants), std::end(shaderProgram.variants), shaderProgram.branching);
+	shaderProgram.program = shaderProgram.branching;
+	shaderProgram.textureSamplerLoc = glGetUniformLocation(shaderProgram.branching, "textureSampler");
+	shaderProgram.instanceMatricesLoc = glGetUniformLocation(shaderProgram.branching, "instanceMatrices");
+	shaderProgram.frameDataIndex = glGetUniformBlockIndex(shaderProgram.branching, "FrameData");
+	shaderProgram.drawDataIndex = glGetUniformBlockIndex(shaderProgram.branching, "DrawData");
+
+	if (multiDrawPrograms)
+	{
+		multiDrawShaderProgram.branching = finishLightProgram(pendingMultiDrawLightProgram);
+		if (multiDrawShaderProgram.branching != 0)
+		{
+			std::fill(std::begin(multiDrawShaderProgram.variants), std::end(multiDrawShaderProgram.variants), multiDrawShaderProgram.branching);
+			multiDrawShaderProgram.program = multiDrawShaderProgram.branching;
+			multiDrawShaderProgram.materialTexturesLoc = glGetUniformLocation(multiDrawShaderProgram.branching, "materialTextures");
+			multiDrawShaderProgram.frameDataIndex = glGetUniformBlockIndex(multiDrawShaderProgram.branching, "FrameData");
+			createGpuCulling();
+		}
+		else
+		{
+			std::cerr << "finishShaders(): multi-draw program failed, drawing without it" << std::endl;
+			cancelLightVariants(true);
+		}
+	}
+	CHECK_GL_ERROR();
+}
+
+/**
+ * @brief Waits for every light permutation still being compiled, for measurements that must not
+ *        draw with the branching build.
+*/
+void manaeste::waitForLightVariants()
+{
+	finishLightVariants(true);
+}
+
 /**
  * @brief Deletes shader programs.
 */
 void manaeste::deleteShaders()
 {
-	pgr::deleteProgramAndShaders(shaderProgram.program);
-	pgr::deleteProgramAndShaders(skyboxShaderProgram.program);
-	pgr::deleteProgramAndShaders(sparklesShaderProgram.program);
-	pgr::deleteProgramAndShaders(amongusShaderProgram.program);
+	cancelLightVariants(false);
+	cancelProgram(pendingLightProgram);
+	cancelProgram(pendingMultiDrawLightProgram);
+	multiDrawPrograms = false;
+	deleteLightPrograms(shaderProgram.program, shaderProgram.branching, shaderProgram.variants);
+	deleteResource(SHADER_PROGRAM, skyboxShaderProgram.program);
+	deleteResource(SHADER_PROGRAM, sparklesShaderProgram.program);
+	deleteResource(SHADER_PROGRAM, amongusShaderProgram.program);
+	deleteLightPrograms(multiDrawShaderProgram.program, multiDrawShaderProgram.branching, multiDrawShaderProgram.variants);
+	deleteGpuCulling();
+
+	deleteResource(UNIFORM_BUFFER, frameUniformBuffer);
+	deleteResource(UNIFORM_BUFFER, drawUniformBuffer);
+	deleteLightClusters();
 }
 
 /**
  * @brief Initialize geometry for diamond.
  * @param geom pointer to the geometry
- * @param shader shader program
+ * @param texture diamond texture
 */
-void manaeste::initDiamondGeom(SingMeshGeom** geom)
+void manaeste::initDiamondGeom(SingMeshGeom** geom, GLuint texture)
 {
-	*geom = new SingMeshGeom();
-
-	glGenVertexArrays(1, &(*geom)->vao);
-	glBindVertexArray((*geom)->vao);
-
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(diamondVerteces), diamondVerteces, GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(shaderProgram.positionLoc);
-	glVertexAttribPointer(shaderProgram.positionLoc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
-
-	glEnableVertexAttribArray(shaderProgram.textureCoordLoc);
-	glVertexAttribPointer(shaderProgram.textureCoordLoc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-
-	glEnableVertexAttribArray(shaderProgram.normalLoc);
-	glVertexAttribPointer(shaderProgram.normalLoc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(6 * sizeof(float)));
-
-	GLuint ebo;
-	glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(diamondIndices), diamondIndices, GL_STATIC_DRAW);
-
-	glBindVertexArray(0);
+	MeshData diamond;
+	const size_t numVertices = sizeof(diamondVerteces) / (5 * sizeof(float));
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		const float* source = &diamondVerteces[5 * i];
+		MeshVertex vertex = {};
+		std::copy(source, source + 3, vertex.position);
+		std::copy(source + 3, source + 5, vertex.texCoord);
+		diamond.vertices.push_back(vertex);
+	}
+	diamond.indices.assign(diamondIndices, diamondIndices + 3 * diamondNumTriangles);
+	computeVertexNormals(diamond);
+	diamond.packIndices();
 
-	(*geom)->vbo = vbo;
-	(*geom)->ebo = ebo;
-	(*geom)->numTriangles = diamondNumTriangles;
-	(*geom)->texture = pgr::createTexture(DIAMOND_TEXTURE);
+	*geom = createMeshGeom(diamond.view(), shaderProgram, texture, "diamond");
 }
 
 /**
  * @brief Initialize skybox geometry.
  * @param geom pointer to the geometry
+ * @param texture skybox cube map
 */
-void manaeste::initCubeSkyboxGeom(SingMeshGeom** geom)
+void manaeste::initCubeSkyboxGeom(SingMeshGeom** geom, GLuint texture)
 {
 	*geom = new SingMeshGeom;
 
@@ -233,12 +680,12 @@ void manaeste::initCubeSkyboxGeom(SingMeshGeom** geom)
 			 1.0f,  1.0f
 	};
 
-	GLuint vao, vbo;
-	glGenVertexArrays(1, &vao);
+	GLuint vao = createResource(VERTEX_ARRAY, "skybox");
 	glBindVertexArray(vao);
-	glGenBuffers(1, &vbo);
+	GLuint vbo = createResource(VERTEX_BUFFER, "skybox");
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(screenCoords), screenCoords, GL_STATIC_DRAW);
+	setResourceBytes(VERTEX_BUFFER, vbo, sizeof(screenCoords));
 
 	glEnableVertexAttribArray(skyboxShaderProgram.screenCoordLoc);
 	glVertexAttribPointer(skyboxShaderProgram.screenCoordLoc, 2, GL_FLOAT, GL_FALSE, 0, 0);
@@ -250,48 +697,29 @@ void manaeste::initCubeSkyboxGeom(SingMeshGeom** geom)
 	(*geom)->vbo = vbo;
 	(*geom)->numTriangles = 2;
 
-	const std::vector<std::string> suffixes = { "posx", "negx", "posy", "negy", "posz", "negz" };
-	const std::vector<GLenum> targets = {
-			GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-			GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-			GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-	};
-	for (const auto& suffix : suffixes)
+	if (texture == 0)
 	{
-		std::string texName = std::string(SKYBOX_TEXTURE_PREFIX) + "_" + suffix + ".jpg";
-
-		auto target = targets[&suffix - &suffixes[0]];
-		if (!pgr::loadTexImage2D(texName, target))
-		{
-			pgr::dieWithError("ERROR: Skybox textures loading failed");
-		}
+		pgr::dieWithError("ERROR: Skybox textures loading failed");
 	}
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, (*geom)->texture);
-	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	(*geom)->texture = texture;
 }
 
 /**
  * @brief Initialize geometry for the sparkles.
+ * @param geom pointer to the geometry
+ * @param texture sparkles texture
 */
-void manaeste::initSparklesGeom(SingMeshGeom** geom)
+void manaeste::initSparklesGeom(SingMeshGeom** geom, GLuint texture)
 {
 	*geom = new SingMeshGeom;
 
-	GLuint tempVao, tempVbo;
-	glGenVertexArrays(1, &tempVao);
-	glGenBuffers(1, &tempVbo);
+	GLuint tempVao = createResource(VERTEX_ARRAY, "sparkles");
+	GLuint tempVbo = createResource(VERTEX_BUFFER, "sparkles");
 
 	glBindVertexArray(tempVao);
 	glBindBuffer(GL_ARRAY_BUFFER, tempVbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(sparklesVertices), sparklesVertices, GL_STATIC_DRAW);
+	setResourceBytes(VERTEX_BUFFER, tempVbo, sizeof(sparklesVertices));
 
 	GLint positionLoc = sparklesShaderProgram.positionLoc;
 	glEnableVertexAttribArray(positionLoc);
@@ -305,24 +733,25 @@ void manaeste::initSparklesGeom(SingMeshGeom** geom)
 	(*geom)->vao = tempVao;
 	(*geom)->vbo = tempVbo;
 	(*geom)->numTriangles = sparklesNumVertices;
-	(*geom)->texture = pgr::createTexture(SPARKLES_TEXTURE);
+	(*geom)->texture = texture;
 }
 
 /**
  * @brief Initialize geometry for the moving texture.
  * @param geom pointer to the geometry
+ * @param texture banner texture
 */
-void manaeste::initAmongusGeom(SingMeshGeom** geom)
+void manaeste::initAmongusGeom(SingMeshGeom** geom, GLuint texture)
 {
 	*geom = new SingMeshGeom;
 
-	GLuint vao, vbo;
-	glGenVertexArrays(1, &vao);
-	glGenBuffers(1, &vbo);
+	GLuint vao = createResource(VERTEX_ARRAY, "banner");
+	GLuint vbo = createResource(VERTEX_BUFFER, "banner");
 
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(amongusVertices), amongusVertices, GL_STATIC_DRAW);
+	setResourceBytes(VERTEX_BUFFER, vbo, sizeof(amongusVertices));
 
 	GLint positionLoc = amongusShaderProgram.positionLoc;
 	glEnableVertexAttribArray(positionLoc);
@@ -336,29 +765,135 @@ void manaeste::initAmongusGeom(SingMeshGeom** geom)
 	(*geom)->vao = vao;
 	(*geom)->vbo = vbo;
 	(*geom)->numTriangles = amongusNumVertices;
-	(*geom)->texture = pgr::createTexture(AMONGUS_TEXTURE);
+	(*geom)->texture = texture;
+}
+
+/**
+ * @brief Deletes the buffers and vertex array of a geometry and releases its texture.
+ * @param geom geometry, set to nullptr
+*/
+void manaeste::deleteMeshGeom(SingMeshGeom*& geom)
+{
+	if (geom == nullptr)
+		return;
+
+	deleteResource(VERTEX_ARRAY, geom->vao);
+	deleteResource(INDEX_BUFFER, geom->ebo);
+	deleteResource(VERTEX_BUFFER, geom->vbo);
+	releaseTexture(geom->texture);
+
+	delete geom;
+	geom = nullptr;
+}
+
+/**
+ * @brief Deletes the geometry of every object loaded by loadMeshes().
+*/
+void manaeste::deleteMeshes()
+{
+	for (SingMeshGeom** geom : { &amongusGeom, &sparklesGeom, &skyboxGeom, &terrainGeom, &raiderGeom, &palmGeom, &duckGeom, &diamondGeom })
+		deleteMeshGeom(*geom);
+
+	for (MultMeshGeom* geoms : { &snowmanGeom, &couchGeom })
+	{
+		for (auto& geom : *geoms)
+			deleteMeshGeom(geom);
+		geoms->clear();
+	}
+	meshMemory.clear();
+	deleteMegaBuffers();
+	deleteInstanceSet(terrainInstances);
+	deleteInstanceSet(palmInstances);
+	occlusionPool.reset();
+}
+
+/**
+ * @brief Clears the occlusion buffer for a new frame. Call before adding the occluders and
+ *        before drawing anything that should be tested against them.
+ * @param projMat projection matrix
+ * @param viewMat view matrix
+*/
+void manaeste::beginOcclusion(const glm::mat4& projMat, const glm::mat4& viewMat)
+{
+	occlusionStats = OcclusionStats();
+	occlusionBuffer.begin(projMat * viewMat);
 }
 
 /**
- * @brief Deletes all vertex buffers and vertex arrays for all objects.
+ * @brief Adds the occluder meshes of objects to the occlusion buffer. Objects culled on the GPU
+ *        are left out, rasterizing them would cost CPU time for every instance.
+ * @param type object type, only terrain, palms, snowman and couch occlude
+ * @param objects objects hiding what is behind them
 */
-void manaeste::deleteAmongusAndSkyboxGeoms()
+void manaeste::addOccluders(ObjectType type, const std::vector<Object*>& objects)
 {
-	std::vector<std::reference_wrapper<SingMeshGeom>> geometries = { *amongusGeom, *skyboxGeom };
+	if (!occlusionCulling || gpuInstancesActive(type))
+		return;
 
-	for (auto& geometry : geometries)
+	std::vector<const SingMeshGeom*> geoms;
+	switch (type)
 	{
-		glDeleteVertexArrays(1, &geometry.get().vao);
-		glDeleteBuffers(1, &geometry.get().ebo);
-		glDeleteBuffers(1, &geometry.get().vbo);
+	case TERRAIN_ELEMENT:
+		geoms.push_back(terrainGeom);
+		break;
+	case PALM:
+		geoms.push_back(palmGeom);
+		break;
+	case SNOWMAN:
+		geoms.assign(snowmanGeom.begin(), snowmanGeom.end());
+		break;
+	case COUCH:
+		geoms.assign(couchGeom.begin(), couchGeom.end());
+		break;
+	default:
+		return;
+	}
 
-		if (geometry.get().texture != 0)
-			glDeleteTextures(1, &geometry.get().texture);
+	for (const auto* object : objects)
+	{
+		const glm::mat4 modelMat = setModelMat(type, object);
+		for (const auto* geom : geoms)
+		{
+			if (geom != nullptr)
+				occlusionBuffer.addOccluder(geom->occluder, modelMat);
+		}
 	}
 }
 
+/**
+ * @brief Draws the added occluders into the occlusion buffer, the draws queued afterwards are tested against it.
+*/
+void manaeste::rasterizeOccluders()
+{
+	PROFILE_ZONE("rasterizeOccluders");
+	if (!occlusionCulling)
+		return;
+	occlusionBuffer.rasterize(occlusionPool.get());
+	occlusionStats.occluderTriangles = occlusionBuffer.numTriangles();
+}
+
+/**
+ * @brief Uploads the model matrices of all objects of a type drawn as an instance set culled on
+ *        the GPU. Call again whenever the objects are created, moved or removed.
+ * @param type object type, only terrain and palms have an instance set
+ * @param objects every object of the type that is drawn
+*/
+void manaeste::uploadGpuInstances(ObjectType type, const std::vector<Object*>& objects)
+{
+	GpuInstanceSet* set = gpuInstanceSet(type);
+	if (set == nullptr || !gpuCullingReady())
+		return;
+
+	std::vector<glm::mat4> modelMats;
+	modelMats.reserve(objects.size());
+	for (const auto* object : objects)
+		modelMats.push_back(setModelMat(type, object));
+	uploadInstanceSet(*set, modelMats);
+}
+
 /**
  * @brief Univeral function for drawing objects besides sparkles, amongus and skybox.
+ * The draws are queued and issued by submitRenderQueue().
  * @param type object type
  * @param object pointer to object
  * @param projMat projection matrix
@@ -366,16 +901,112 @@ void manaeste::deleteAmongusAndSkyboxGeoms()
 */
 void manaeste::drawObject(ObjectType type, Object* object, const glm::mat4& projMat, const glm::mat4& viewMat)
 {
-	glUseProgram(shaderProgram.program);
-
+	COUNT_RENDER_STAT(objects, 1);
 	glm::mat4 modelMat = setModelMat(type, object);
 
 	setUniformMatrices(projMat, viewMat, modelMat);
-	glUniform1i(shaderProgram.useTextureLoc, true);
 
 	setMaterial(type, projMat, viewMat, modelMat);
-	glBindVertexArray(0);
-	glUseProgram(0);
+}
+
+/**
+ * @brief Draws many objects of the same type with one instanced draw call per level of detail.
+ * Model and normal matrices of all instances are queued for the buffer texture read by lights.vert,
+ * grouped by the level of detail each instance needs. The draws are issued by submitRenderQueue().
+ * Types without an instanced path fall back to drawing the objects one by one. Terrain and palms
+ * uploaded by uploadGpuInstances() skip all of this and are culled on the GPU, objects is then
+ * ignored.
+ * @param type object type
+ * @param objects objects to draw
+ * @param projMat projection matrix
+ * @param viewMat view matrix
+*/
+void manaeste::drawObject(ObjectType type, const std::vector<Object*>& objects, const glm::mat4& projMat, const glm::mat4& viewMat)
+{
+	if (objects.empty())
+		return;
+
+	SingMeshGeom* geom = nullptr;
+	float shininess = 0.0f;
+	switch (type)
+	{
+	case TERRAIN_ELEMENT:
+		geom = terrainGeom;
+		shininess = 3.0f;
+		break;
+	case PALM:
+		geom = palmGeom;
+		shininess = palmGeom ? palmGeom->shininess : 0.0f;
+		break;
+	default:
+		for (auto* object : objects)
+			drawObject(type, object, projMat, viewMat);
+		return;
+	}
+	if (geom == nullptr)
+		return;
+	COUNT_RENDER_STAT(objects, objects.size());
+	if (gpuInstancesActive(type))
+	{
+		queueGpuInstanceSet(geom, *gpuInstanceSet(type), shininess, projMat, viewMat);
+		return;
+	}
+
+	struct Instance
+	{
+		size_t lod;
+		float depth;
+		glm::mat4 modelMat;
+	};
+	static BoundsArray bounds;
+	static std::vector<uint8_t> visible;
+	std::vector<glm::mat4> modelMats;
+	modelMats.reserve(objects.size());
+	clearBounds(bounds);
+	for (const auto* object : objects)
+	{
+		modelMats.push_back(setModelMat(type, object));
+		addBounds(bounds, transformSphere(geom->bounds, modelMats.back()));
+	}
+	if (cullSpheres(cullingFrustum(), bounds, visible) == 0)
+		return;
+
+	std::vector<Instance> instances;
+	instances.reserve(objects.size());
+	for (size_t i = 0; i < modelMats.size(); i++)
+	{
+		if (!visible[i] || !occludedDrawVisible(geom, modelMats[i]))
+			continue;
+		LodProjection projection = projectModel(projMat, viewMat, modelMats[i]);
+		instances.push_back({ selectLod(geom, projection), projection.depth, modelMats[i] });
+	}
+	std::stable_sort(instances.begin(), instances.end(), [](const Instance& a, const Instance& b) { return a.lod < b.lod; });
+
+	modelMats.clear();
+	for (const auto& instance : instances)
+		modelMats.push_back(instance.modelMat);
+	const uint32_t instanceBase = queueInstances(modelMats.data(), modelMats.size());
+
+	setUniformMatrices(projMat, viewMat, glm::mat4(1.0f));
+	setUniformMaterial(geom->texture, shininess, geom->ambient, geom->diffuse, geom->specular);
+	setVertexDecode(geom->decode);
+
+	pendingDrawUniforms.instanced = true;
+	for (size_t first = 0; first < instances.size();)
+	{
+		size_t last = first;
+		float depth = instances[first].depth;
+		while (last < instances.size() && instances[last].lod == instances[first].lod)
+			depth = std::min(depth, instances[last++].depth);
+
+		DrawPacket packet = meshPacket(geom, geom->lods[instances[first].lod]);
+		packet.numInstances = (GLsizei)(last - first);
+		pendingDrawUniforms.instanceBase = (GLint)(instanceBase + first);
+		queueDraw(packet, pendingDrawUniforms, depth, glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+		first = last;
+	}
+	pendingDrawUniforms.instanced = false;
+	pendingDrawUniforms.instanceBase = 0;
 }
 
 /**
@@ -385,7 +1016,10 @@ void manaeste::drawObject(ObjectType type, Object* object, const glm::mat4& proj
 */
 void manaeste::drawCubeSkybox(const glm::mat4& projMat, const glm::mat4& viewMat)
 {
-	glUseProgram(skyboxShaderProgram.program);
+	setCapability(CAP_DEPTH_TEST, true);
+	setCapability(CAP_STENCIL_TEST, false);
+	setCapability(CAP_BLEND, false);
+	useProgram(skyboxShaderProgram.program);
 
 	glm::mat4 mat = projMat * viewMat;
 	glm::mat4 viewRotation = viewMat;
@@ -394,16 +1028,15 @@ void manaeste::drawCubeSkybox(const glm::mat4& projMat, const glm::mat4& viewMat
 
 	glUniformMatrix4fv(skyboxShaderProgram.inversePVmatrixLoc, 1, GL_FALSE, glm::value_ptr(invViewRotMatrix));
 	glUniform1i(skyboxShaderProgram.skyboxSamplerLoc, 0);
+	COUNT_RENDER_STAT(uniformCalls, 2);
 
-	glBindVertexArray(skyboxGeom->vao);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxGeom->texture);
+	bindVertexArray(skyboxGeom->vao);
+	bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxGeom->texture);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, skyboxGeom->numTriangles + 2);
-
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-	glUseProgram(0);
+	COUNT_RENDER_STAT(drawCalls, 1);
+	COUNT_RENDER_STAT(triangles, skyboxGeom->numTriangles);
+	COUNT_RENDER_STAT(instances, 1);
 }
 
 /**
@@ -414,10 +1047,12 @@ void manaeste::drawCubeSkybox(const glm::mat4& projMat, const glm::mat4& viewMat
 */
 void manaeste::drawSparklesTexture(Object* sparkles, const glm::mat4& projMat, const glm::mat4& viewMat)
 {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);
+	setCapability(CAP_DEPTH_TEST, true);
+	setCapability(CAP_STENCIL_TEST, false);
+	setCapability(CAP_BLEND, true);
+	setBlendFunc(GL_ONE, GL_ONE);
 
-	glUseProgram(sparklesShaderProgram.program);
+	useProgram(sparklesShaderProgram.program);
 	glUniform1i(sparklesShaderProgram.textureSamplerLoc, 0);
 	glUniform1f(sparklesShaderProgram.frameDurationLoc, sparkles->frameDuration);
 
@@ -430,97 +1065,45 @@ void manaeste::drawSparklesTexture(Object* sparkles, const glm::mat4& projMat, c
 	glUniformMatrix4fv(sparklesShaderProgram.PVMmatrixLoc, 1, GL_FALSE, glm::value_ptr(PVM));
 	glUniformMatrix4fv(sparklesShaderProgram.VmatrixLoc, 1, GL_FALSE, glm::value_ptr(viewMat));
 	glUniform1f(sparklesShaderProgram.timeLoc, sparkles->currentTime - sparkles->startTime);
+	COUNT_RENDER_STAT(uniformCalls, 5);
 
-	glBindVertexArray(sparklesGeom->vao);
-	glBindTexture(GL_TEXTURE_2D, sparklesGeom->texture);
+	bindVertexArray(sparklesGeom->vao);
+	bindTexture(0, GL_TEXTURE_2D, sparklesGeom->texture);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, sparklesGeom->numTriangles);
-
-	glBindVertexArray(0);
-	glUseProgram(0);
-	glDisable(GL_BLEND);
+	COUNT_RENDER_STAT(drawCalls, 1);
+	COUNT_RENDER_STAT(triangles, sparklesGeom->numTriangles - 2);
+	COUNT_RENDER_STAT(instances, 1);
 }
 
 /**
- * @brief Draw a moving texture.
+ * @brief Draw a moving texture over the scene, without the depth test. The stencil state is set by the caller.
  * @param amongus object to draw
  * @param projMat projection matrix
  * @param viewMat view matrix
 */
 void manaeste::drawAmongusMovingTexture(Object* amongus, const glm::mat4& projMat, const glm::mat4& viewMat)
 {
-	static bool blendEnabled = false;
-	static bool depthTestEnabled = true;
-	static GLuint shaderProgramId = 0;
-	static GLint pvmMatrixLoc = -1;
-	static GLint timeLoc = -1;
-	static GLint texSamplerLoc = -1;
-	static GLuint textureId = 0;
-	static GLuint vertexArrayObject = 0;
-	static GLsizei numTriangles = 0;
+	setCapability(CAP_DEPTH_TEST, false);
+	setCapability(CAP_BLEND, true);
+	setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	if (!shaderProgramId)
-	{
-		shaderProgramId = amongusShaderProgram.program;
-		pvmMatrixLoc = amongusShaderProgram.PVMmatrixLoc;
-		timeLoc = amongusShaderProgram.currentTimeLoc;
-		texSamplerLoc = amongusShaderProgram.textureSamplerLoc;
-		textureId = amongusGeom->texture;
-		vertexArrayObject = amongusGeom->vao;
-		numTriangles = amongusGeom->numTriangles;
-	}
-
-	if (!blendEnabled)
-	{
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		blendEnabled = true;
-	}
-
-	if (depthTestEnabled)
-	{
-		glDisable(GL_DEPTH_TEST);
-		depthTestEnabled = false;
-	}
-
-	glUseProgram(shaderProgramId);
+	useProgram(amongusShaderProgram.program);
 
 	glm::mat4 modelMat = glm::translate(glm::mat4(1.0f), amongus->position);
 	modelMat = glm::scale(modelMat, glm::vec3(amongus->size));
 
 	glm::mat4 PVM = projMat * viewMat * modelMat;
-	glUniformMatrix4fv(pvmMatrixLoc, 1, GL_FALSE, glm::value_ptr(PVM));
-	glUniform1f(timeLoc, amongus->currentTime - amongus->startTime);
-	glUniform1i(texSamplerLoc, 0);
-
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glBindVertexArray(vertexArrayObject);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, numTriangles);
-
-	glBindVertexArray(0);
-	glUseProgram(0);
-
-	if (!depthTestEnabled)
-	{
-		glEnable(GL_DEPTH_TEST);
-		depthTestEnabled = true;
-	}
-
-	if (blendEnabled)
-	{
-		glDisable(GL_BLEND);
-		blendEnabled = false;
-	}
-}
-
-/**
- * @brief Toggle fog on/off.
-*/
-void manaeste::setFogState(bool fogOn)
-{
-	if (fogOn)
-		useFog = true;
-	else
-		useFog = false;
+	glUniformMatrix4fv(amongusShaderProgram.PVMmatrixLoc, 1, GL_FALSE, glm::value_ptr(PVM));
+	glUniform1f(amongusShaderProgram.currentTimeLoc, amongus->currentTime - amongus->startTime);
+	glUniform1i(amongusShaderProgram.textureSamplerLoc, 0);
+	COUNT_RENDER_STAT(uniformCalls, 3);
+
+	bindTexture(0, GL_TEXTURE_2D, amongusGeom->texture);
+	bindVertexArray(amongusGeom->vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, amongusGeom->numTriangles);
+	COUNT_RENDER_STAT(drawCalls, 1);
+	COUNT_RENDER_STAT(triangles, amongusGeom->numTriangles - 2);
+	COUNT_RENDER_STAT(instances, 1);
 }
 
 /**
@@ -575,30 +1158,25 @@ void manaeste::setMaterial(const ObjectType& type, const glm::mat4& projMat, con
 	{
 	case TERRAIN_ELEMENT:
 		setUniformMaterial(terrainGeom->texture, 3.0f, terrainGeom->ambient, terrainGeom->diffuse, terrainGeom->specular);
-		glBindVertexArray(terrainGeom->vao);
-		glDrawElements(GL_TRIANGLES, terrainGeom->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		drawMeshElements(terrainGeom);
 		break;
 	case RAIDER:
 		setUniformMaterial(raiderGeom->texture, raiderGeom->shininess, raiderGeom->ambient, raiderGeom->diffuse, raiderGeom->specular);
-		glBindVertexArray(raiderGeom->vao);
-		glDrawElements(GL_TRIANGLES, raiderGeom->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		drawMeshElements(raiderGeom);
 		break;
 	case DUCK:
 		setUniformMaterial(duckGeom->texture, 3.0f, duckGeom->ambient, duckGeom->diffuse, duckGeom->specular);
-		glBindVertexArray(duckGeom->vao);
-		glDrawElements(GL_TRIANGLES, duckGeom->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		drawMeshElements(duckGeom);
 		break;
 	case PALM:
 		setUniformMaterial(palmGeom->texture, palmGeom->shininess, palmGeom->ambient, palmGeom->diffuse, palmGeom->specular);
-		glBindVertexArray(palmGeom->vao);
-		glDrawElements(GL_TRIANGLES, palmGeom->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		drawMeshElements(palmGeom);
 		break;
 	case SNOWMAN:
 		for (auto& snowGeomEl : snowmanGeom)
 		{
 			setUniformMaterial(snowGeomEl->texture, 2.0f, snowGeomEl->ambient, snowGeomEl->diffuse, snowGeomEl->specular);
-			glBindVertexArray(snowGeomEl->vao);
-			glDrawElements(GL_TRIANGLES, snowGeomEl->numTriangles * 3, GL_UNSIGNED_INT, 0);
+			drawMeshElements(snowGeomEl);
 		}
 		break;
 	case COUCH:
@@ -606,312 +1184,246 @@ void manaeste::setMaterial(const ObjectType& type, const glm::mat4& projMat, con
 		for (auto& couchGeomEl : couchGeom)
 		{
 			setUniformMaterial(couchGeomEl->texture, 2.0f, couchGeomEl->ambient, couchGeomEl->diffuse, couchGeomEl->specular);
-			glBindVertexArray(couchGeomEl->vao);
-			glDrawElements(GL_TRIANGLES, couchGeomEl->numTriangles * 3, GL_UNSIGNED_INT, 0);
+			drawMeshElements(couchGeomEl);
 		}
 		break;
 	case DIAMOND:
 		setUniformMaterial(diamondGeom->texture, 3.0f, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.7f, 0.7f, 0.7f), glm::vec3(1.0f, 1.0f, 1.0f));
-		glBindVertexArray(diamondGeom->vao);
-		glDrawElements(GL_TRIANGLES, diamondGeom->numTriangles * 3, GL_UNSIGNED_INT, 0);
+		drawMeshElements(diamondGeom);
 		break;
 	}
 }
 
 /**
- * @brief Load mesh using assimp library.
- * @param fileName file to open/load
+ * @brief Uploads one post-processed mesh to the GPU, packing its vertices unless that is
+ *        disabled or would change the mesh visibly.
+ * @param mesh mesh data (imported or mapped from the mesh cache)
  * @param shader vao will connect loaded data to shader
- * @param singMeshGeometry single mesh geometry
- * @return true if loading was successful
+ * @param texture diffuse texture of the mesh, 0 if none
+ * @param name mesh name for the memory report
+ * @return mesh geometry
 */
-bool manaeste::loadSingMesh(const std::string& fileName, MainShaderProgram& shader, SingMeshGeom** singMeshGeometry)
+SingMeshGeom* manaeste::createMeshGeom(const MeshView& mesh, MainShaderProgram& shader, GLuint texture, const std::string& name)
 {
-	Assimp::Importer importer;
-
-	importer.SetPropertyInteger(AI_CONFIG_PP_PTV_NORMALIZE, 1);
-	const aiScene* scn = importer.ReadFile(fileName.c_str(), 0
-		| aiProcess_Triangulate
-		| aiProcess_PreTransformVertices
-		| aiProcess_GenSmoothNormals
-		| aiProcess_JoinIdenticalVertices);
-
-	if (scn == NULL)
+	auto* geometry = new SingMeshGeom;
+
+	MeshMemory memory;
+	memory.name = name;
+	memory.numVertices = mesh.numVertices;
+	memory.numTriangles = mesh.numTriangles;
+	memory.indexBytes = indexSize(mesh.indexType) * mesh.numIndices;
+	memory.floatBytes = sizeof(MeshVertex) * mesh.numVertices + sizeof(uint32_t) * mesh.numIndices;
+	for (const auto& lod : mesh.lods)
+		memory.lodTriangles.push_back(lod.numTriangles);
+
+	QuantizedMesh quantized;
+	if (quantizeVertices)
 	{
-		std::cerr << "loadSingMesh(): assimp error - " << importer.GetErrorString() << std::endl;
-		*singMeshGeometry = nullptr;
-		return false;
+		quantizeMesh(mesh, quantized);
+		memory.error = quantized.error;
+		memory.packed = isWithinTolerance(quantized.error);
 	}
 
-	if (scn->mNumMeshes != 1)
+	(geometry)->vbo = createResource(VERTEX_BUFFER, name);
+	glBindBuffer(GL_ARRAY_BUFFER, (geometry)->vbo);
+	if (memory.packed)
 	{
-		std::cerr << "loadSingMesh(): this simplified loader can only process files with only one mesh" << std::endl;
-		*singMeshGeometry = nullptr;
-		return false;
+		memory.vertexBytes = sizeof(PackedVertex) * mesh.numVertices;
+		glBufferData(GL_ARRAY_BUFFER, memory.vertexBytes, quantized.vertices.data(), GL_STATIC_DRAW);
+		(geometry)->decode = quantized.decode;
 	}
-
-	const aiMesh* mesh = scn->mMeshes[0];
-
-	*singMeshGeometry = new SingMeshGeom;
-
-	glGenBuffers(1, &((*singMeshGeometry)->vbo));
-	glBindBuffer(GL_ARRAY_BUFFER, (*singMeshGeometry)->vbo);
-	glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(float) * mesh->mNumVertices, 0, GL_STATIC_DRAW); // allocate memory for vertices, normals, and texture coordinates
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * sizeof(float) * mesh->mNumVertices, mesh->mVertices);
-	glBufferSubData(GL_ARRAY_BUFFER, 3 * sizeof(float) * mesh->mNumVertices, 3 * sizeof(float) * mesh->mNumVertices, mesh->mNormals);
-
-	auto* textureCoords = new float[2 * mesh->mNumVertices];
-	float* currentTextureCoord = textureCoords;
-
-	aiVector3D vect;
-
-	if (mesh->HasTextureCoords(0))
+	else
 	{
-		for (unsigned int idx = 0; idx < mesh->mNumVertices; idx++)
-		{
-			vect = (mesh->mTextureCoords[0])[idx];
-			*currentTextureCoord++ = vect.x;
-			*currentTextureCoord++ = vect.y;
-		}
+		memory.vertexBytes = sizeof(MeshVertex) * mesh.numVertices;
+		glBufferData(GL_ARRAY_BUFFER, memory.vertexBytes, mesh.vertices, GL_STATIC_DRAW); // interleaved vertices, normals, and texture coordinates
 	}
 
-	glBufferSubData(GL_ARRAY_BUFFER, 6 * sizeof(float) * mesh->mNumVertices, 2 * sizeof(float) * mesh->mNumVertices, textureCoords);
-
-	auto* indices = new unsigned int[mesh->mNumFaces * 3];
-	for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
+	setResourceBytes(VERTEX_BUFFER, (geometry)->vbo, memory.vertexBytes);
+	if (multiDrawPrograms)
 	{
-		indices[f * 3 + 0] = mesh->mFaces[f].mIndices[0];
-		indices[f * 3 + 1] = mesh->mFaces[f].mIndices[1];
-		indices[f * 3 + 2] = mesh->mFaces[f].mIndices[2];
+		const void* vertices = memory.packed ? (const void*)quantized.vertices.data() : (const void*)mesh.vertices;
+		(geometry)->mega = appendMegaMesh(vertices, memory.vertexBytes, mesh, memory.packed);
+		addMaterialTexture(texture);
 	}
 
-	glGenBuffers(1, &((*singMeshGeometry)->ebo));
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*singMeshGeometry)->ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(unsigned) * mesh->mNumFaces, indices, GL_STATIC_DRAW);
-
-	delete[] indices;
-
-	const aiMaterial* mat = scn->mMaterials[mesh->mMaterialIndex];
-	aiColor4D color;
-	aiString name;
-	aiReturn retValue = AI_SUCCESS;
-
-	mat->Get(AI_MATKEY_NAME, name);
-
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-
-	(*singMeshGeometry)->diffuse = glm::vec3(color.r, color.g, color.b);
-
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-	(*singMeshGeometry)->ambient = glm::vec3(color.r, color.g, color.b);
+	(geometry)->ebo = createResource(INDEX_BUFFER, name);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (geometry)->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, memory.indexBytes, mesh.indices, GL_STATIC_DRAW);
+	setResourceBytes(INDEX_BUFFER, (geometry)->ebo, memory.indexBytes);
 
-	if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &color)) != AI_SUCCESS)
-		color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-	(*singMeshGeometry)->specular = glm::vec3(color.r, color.g, color.b);
-
-	ai_real shininess, strength;
-	unsigned int max;
-
-	max = 1;
-	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS, &shininess, &max)) != AI_SUCCESS)
-		shininess = 1.0f;
-	max = 1;
-	if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS_STRENGTH, &strength, &max)) != AI_SUCCESS)
-		strength = 1.0f;
-	(*singMeshGeometry)->shininess = shininess * strength;
-
-	(*singMeshGeometry)->texture = 0;
-
-	if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-	{
-		aiString path;
-
-		aiReturn texFound = mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-		std::string textureName = path.data;
-
-		size_t found = fileName.find_last_of("/\\");
-		if (found != std::string::npos)
-		{
-			textureName.insert(0, fileName.substr(0, found + 1));
-		}
-
-		std::cout << "Loading texture file: " << textureName << std::endl;
-		(*singMeshGeometry)->texture = pgr::createTexture(textureName);
-	}
+	(geometry)->diffuse = mesh.material.diffuse;
+	(geometry)->ambient = mesh.material.ambient;
+	(geometry)->specular = mesh.material.specular;
+	(geometry)->shininess = mesh.material.shininess;
+	(geometry)->texture = texture;
 	CHECK_GL_ERROR();
 
-	glGenVertexArrays(1, &((*singMeshGeometry)->vao));
-	glBindVertexArray((*singMeshGeometry)->vao);
+	(geometry)->vao = createResource(VERTEX_ARRAY, name);
+	glBindVertexArray((geometry)->vao);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*singMeshGeometry)->ebo); // bind our element array buffer (indices) to vao
-	glBindBuffer(GL_ARRAY_BUFFER, (*singMeshGeometry)->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (geometry)->ebo); // bind our element array buffer (indices) to vao
+	glBindBuffer(GL_ARRAY_BUFFER, (geometry)->vbo);
 
 	glEnableVertexAttribArray(shader.positionLoc);
-	glVertexAttribPointer(shader.positionLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
 	glEnableVertexAttribArray(shader.normalLoc);
-	glVertexAttribPointer(shader.normalLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3 * sizeof(float) * mesh->mNumVertices));
-
 	glEnableVertexAttribArray(shader.textureCoordLoc);
-	glVertexAttribPointer(shader.textureCoordLoc, 2, GL_FLOAT, GL_FALSE, 0, (void*)(6 * sizeof(float) * mesh->mNumVertices));
+	if (memory.packed)
+	{
+		glVertexAttribPointer(shader.positionLoc, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(shader.normalLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(shader.textureCoordLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoord));
+	}
+	else
+	{
+		glVertexAttribPointer(shader.positionLoc, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+		glVertexAttribPointer(shader.normalLoc, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+		glVertexAttribPointer(shader.textureCoordLoc, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, texCoord));
+	}
 	CHECK_GL_ERROR();
 
 	glBindVertexArray(0);
 
-	(*singMeshGeometry)->numTriangles = mesh->mNumFaces;
+	(geometry)->numTriangles = mesh.numTriangles;
+	(geometry)->indexType = mesh.indexType;
+	(geometry)->lods = mesh.lods;
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (uint32_t v = 0; v < mesh.numVertices; v++)
+	{
+		const float* p = mesh.vertices[v].position;
+		const glm::vec3 position(p[0], p[1], p[2]);
+		(geometry)->radius = std::max((geometry)->radius, glm::length(position));
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+	if (mesh.numVertices > 0)
+	{
+		const glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+		float sphereRadius = 0.0f;
+		for (uint32_t v = 0; v < mesh.numVertices; v++)
+		{
+			const float* p = mesh.vertices[v].position;
+			sphereRadius = std::max(sphereRadius, glm::distance(center, glm::vec3(p[0], p[1], p[2])));
+		}
+		(geometry)->boundsMin = boundsMin;
+		(geometry)->boundsMax = boundsMax;
+		(geometry)->bounds = glm::vec4(center, sphereRadius);
+	}
+	(geometry)->occluder = makeOccluderMesh(mesh);
+	meshMemory.push_back(memory);
 
-	return true;
+	return geometry;
 }
 
 /**
- * @brief Load multiple meshes using assimp library.
- * @param fileName file to open/load
- * @param shader vao will connect loaded data to shader
- * @param multMeshGeometry geometry
- * @return true if loading was successful
+ * @brief Prints the vertex and index memory of every uploaded mesh next to what the float
+ *        layout with 32-bit indices would take, the quantization errors and the triangles
+ *        of every level of detail.
+ * @param out output stream
 */
-bool manaeste::loadMultMesh(const std::string& fileName, MainShaderProgram& shader, MultMeshGeom& multMeshGeometry)
+void manaeste::printMeshReport(std::ostream& out)
 {
-	Assimp::Importer importer;
-
-	importer.SetPropertyInteger(AI_CONFIG_PP_PTV_NORMALIZE, 1);
-	const aiScene* scn = importer.ReadFile(fileName.c_str(), 0
-		| aiProcess_Triangulate
-		| aiProcess_PreTransformVertices
-		| aiProcess_GenSmoothNormals
-		| aiProcess_JoinIdenticalVertices);
-	if (scn == NULL)
-	{
-		std::cerr << "loadMultMesh(): assimp error: " << importer.GetErrorString() << std::endl;
-		return false;
-	}
+	const auto flags = out.flags();
+	const auto precision = out.precision();
 
-	for (size_t i = 0; i < scn->mNumMeshes; i++)
+	size_t totalBytes = 0, totalFloatBytes = 0;
+	out << std::fixed << std::setprecision(1);
+	out << "Meshes:" << std::endl;
+	for (const auto& memory : meshMemory)
 	{
-		const aiMesh* mesh = scn->mMeshes[i];
-
-		auto* geometry = new SingMeshGeom;
-
-		glGenBuffers(1, &((geometry)->vbo));
-		glBindBuffer(GL_ARRAY_BUFFER, (geometry)->vbo);
-		glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(float) * mesh->mNumVertices, 0, GL_STATIC_DRAW); // allocate memory for vertices, normals, and texture coordinates
-		glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * sizeof(float) * mesh->mNumVertices, mesh->mVertices);
-		glBufferSubData(GL_ARRAY_BUFFER, 3 * sizeof(float) * mesh->mNumVertices, 3 * sizeof(float) * mesh->mNumVertices, mesh->mNormals);
-
-		auto* textureCoords = new float[2 * mesh->mNumVertices];  // 2 floats per vertex
-		float* currentTextureCoord = textureCoords;
-
-		aiVector3D vect;
-
-		if (mesh->HasTextureCoords(0))
+		out << "  " << std::left << std::setw(34) << memory.name << std::right
+			<< std::setw(7) << memory.numVertices << " v" << std::setw(7) << memory.numTriangles << " t  "
+			<< (memory.packed ? "packed" : "float ")
+			<< std::setw(9) << (memory.vertexBytes + memory.indexBytes) / 1024.0 << " KiB (float "
+			<< std::setw(7) << memory.floatBytes / 1024.0 << " KiB)";
+		if (quantizeVertices)
 		{
-			for (unsigned int idx = 0; idx < mesh->mNumVertices; idx++)
-			{
-				vect = (mesh->mTextureCoords[0])[idx];
-				*currentTextureCoord++ = vect.x;
-				*currentTextureCoord++ = vect.y;
-			}
-		}
-
-		glBufferSubData(GL_ARRAY_BUFFER, 6 * sizeof(float) * mesh->mNumVertices, 2 * sizeof(float) * mesh->mNumVertices, textureCoords);
-
-		auto* indices = new unsigned int[mesh->mNumFaces * 3];
-		for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
-		{
-			indices[f * 3 + 0] = mesh->mFaces[f].mIndices[0];
-			indices[f * 3 + 1] = mesh->mFaces[f].mIndices[1];
-			indices[f * 3 + 2] = mesh->mFaces[f].mIndices[2];
+			out << std::setprecision(5) << "  error pos " << memory.error.position << " uv " << memory.error.texCoord
+				<< std::setprecision(3) << " normal " << memory.error.normalDegrees << " deg"
+				<< (memory.packed ? "" : "  over tolerance") << std::setprecision(1);
 		}
-
-		glGenBuffers(1, &((geometry)->ebo));
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (geometry)->ebo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(unsigned int) * mesh->mNumFaces, indices, GL_STATIC_DRAW);
-
-		delete[] indices;
-
-		const aiMaterial* mat = scn->mMaterials[mesh->mMaterialIndex];
-		aiColor4D color;
-		aiString name;
-		aiReturn retValue = AI_SUCCESS;
-
-		mat->Get(AI_MATKEY_NAME, name);
-
-		if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_DIFFUSE, &color)) != AI_SUCCESS)
-			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-
-		(geometry)->diffuse = glm::vec3(color.r, color.g, color.b);
-
-		if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_AMBIENT, &color)) != AI_SUCCESS)
-			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-		(geometry)->ambient = glm::vec3(color.r, color.g, color.b);
-
-		if ((retValue = aiGetMaterialColor(mat, AI_MATKEY_COLOR_SPECULAR, &color)) != AI_SUCCESS)
-			color = aiColor4D(0.0f, 0.0f, 0.0f, 0.0f);
-		(geometry)->specular = glm::vec3(color.r, color.g, color.b);
-
-		ai_real shininess, strength;
-		unsigned int max;
-
-		max = 1;
-		if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS, &shininess, &max)) != AI_SUCCESS)
-			shininess = 1.0f;
-		max = 1;
-		if ((retValue = aiGetMaterialFloatArray(mat, AI_MATKEY_SHININESS_STRENGTH, &strength, &max)) != AI_SUCCESS)
-			strength = 1.0f;
-		(geometry)->shininess = shininess * strength;
-
-		(geometry)->texture = 0;
-
-		if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+		if (memory.lodTriangles.size() > 1)
 		{
-			aiString path;
-
-			aiReturn texFound = mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-			std::string textureName = path.data;
-
-			size_t found = fileName.find_last_of("/\\");
-			if (found != std::string::npos)
-			{
-				textureName.insert(0, fileName.substr(0, found + 1));
-			}
-
-			std::cout << "Loading texture file: " << textureName << std::endl;
-			(geometry)->texture = pgr::createTexture(textureName);
+			out << "  lods";
+			for (uint32_t triangles : memory.lodTriangles)
+				out << ' ' << triangles;
 		}
-		CHECK_GL_ERROR();
-
-		glGenVertexArrays(1, &((geometry)->vao));
-		glBindVertexArray((geometry)->vao);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (geometry)->ebo);
-		glBindBuffer(GL_ARRAY_BUFFER, (geometry)->vbo);
+		out << std::endl;
+		totalBytes += memory.vertexBytes + memory.indexBytes;
+		totalFloatBytes += memory.floatBytes;
+	}
+	out << "  total " << totalBytes / 1024.0 << " KiB, float layout with 32-bit indices " << totalFloatBytes / 1024.0 << " KiB" << std::endl;
 
-		glEnableVertexAttribArray(shader.positionLoc);
-		glVertexAttribPointer(shader.positionLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	out.flags(flags);
+	out.precision(precision);
+}
 
-		glEnableVertexAttribArray(shader.normalLoc);
-		glVertexAttribPointer(shader.normalLoc, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3 * sizeof(float) * mesh->mNumVertices));
+/**
+ * @brief Upload single mesh model parsed by loadModelAsync().
+ * @param load parsed model with decoded textures
+ * @param shader vao will connect loaded data to shader
+ * @param singMeshGeometry single mesh geometry
+ * @return true if loading was successful
+*/
+bool manaeste::loadSingMesh(const ModelLoad& load, MainShaderProgram& shader, SingMeshGeom** singMeshGeometry)
+{
+	const ModelData& model = load.model;
+	if (!load.loaded)
+	{
+		*singMeshGeometry = nullptr;
+		return false;
+	}
 
-		glEnableVertexAttribArray(shader.textureCoordLoc);
-		glVertexAttribPointer(shader.textureCoordLoc, 2, GL_FLOAT, GL_FALSE, 0, (void*)(6 * sizeof(float) * mesh->mNumVertices));
-		CHECK_GL_ERROR();
+	if (model.meshes.size() != 1)
+	{
+		std::cerr << "loadSingMesh(): this simplified loader can only process files with only one mesh" << std::endl;
+		*singMeshGeometry = nullptr;
+		return false;
+	}
 
-		glBindVertexArray(0);
+	const std::string& textureName = model.meshes[0].material.textureName;
+	GLuint texture = textureName.empty() ? 0 : acquireTexture(textureName, load.images[0]);
+	*singMeshGeometry = createMeshGeom(model.meshes[0], shader, texture, load.fileName);
+	return true;
+}
 
-		(geometry)->numTriangles = mesh->mNumFaces;
+/**
+ * @brief Upload model with multiple meshes parsed by loadModelAsync().
+ * @param load parsed model with decoded textures
+ * @param shader vao will connect loaded data to shader
+ * @param multMeshGeometry geometry
+ * @return true if loading was successful
+*/
+bool manaeste::loadMultMesh(const ModelLoad& load, MainShaderProgram& shader, MultMeshGeom& multMeshGeometry)
+{
+	if (!load.loaded)
+		return false;
 
-		multMeshGeometry.push_back(geometry);
+	for (size_t i = 0; i < load.model.meshes.size(); i++)
+	{
+		const std::string& textureName = load.model.meshes[i].material.textureName;
+		GLuint texture = textureName.empty() ? 0 : acquireTexture(textureName, load.images[i]);
+		multMeshGeometry.push_back(createMeshGeom(load.model.meshes[i], shader, texture, load.fileName + "#" + std::to_string(i)));
 	}
+
 	return true;
 }
 
 /**
- * @brief Loads all meshes used in the scene.
+ * @brief Loads all meshes used in the scene. Models are parsed and images decoded on worker
+ *        threads while this thread uploads whatever is ready, in submission order.
 */
 void manaeste::loadMeshes()
 {
+	PROFILE_ZONE("loadMeshes");
+	typedef std::chrono::steady_clock Clock;
+	auto msSince = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+	const auto loadStart = Clock::now();
+
+	detectCompressedTextureSupport();
+	TaskPool pool;
+	std::vector<AssetTiming> timings;
+	meshMemory.clear();
+
 	std::vector<SingleMeshModelInfo> models = {
 			{ TERRAIN_MODEL, &terrainGeom },
 			{ RAIDER_MODEL, &raiderGeom },
@@ -919,23 +1431,78 @@ void manaeste::loadMeshes()
 			{ DUCK_MODEL, &duckGeom }
 	};
 
+	std::vector<std::future<ModelLoad>> modelLoads;
 	for (auto& model : models)
+		modelLoads.push_back(loadModelAsync(pool, model.modelName));
+	std::future<ModelLoad> snowmanLoad = loadModelAsync(pool, SNOWMAN_MODEL);
+	std::future<ModelLoad> couchLoad = loadModelAsync(pool, COUCH_MODEL);
+
+	std::shared_future<DecodedImage> diamondImage = requestTextureImage(pool, DIAMOND_TEXTURE);
+	std::shared_future<DecodedImage> sparklesImage = requestTextureImage(pool, SPARKLES_TEXTURE);
+	std::shared_future<DecodedImage> amongusImage = requestTextureImage(pool, AMONGUS_TEXTURE);
+	std::vector<std::shared_future<DecodedImage>> skyboxImages;
+	KtxTexture skyboxKtx;
+	const bool skyboxBaked = openBakedTexture(SKYBOX_TEXTURE_PREFIX, skyboxKtx);
+	if (!skyboxBaked)
+	{
+		for (const char* suffix : { "posx", "negx", "posy", "negy", "posz", "negz" })
+			skyboxImages.push_back(decodeImageAsync(pool, std::string(SKYBOX_TEXTURE_PREFIX) + "_" + suffix + ".jpg"));
+	}
+
+	auto uploadModel = [&](std::future<ModelLoad>& future, const std::function<bool(const ModelLoad&)>& upload) {
+		ModelLoad load = future.get();
+		AssetTiming timing;
+		timing.name = load.fileName + (load.model.fromCache ? " (cache)" : "");
+		timing.parseMs = load.parseMs;
+		timing.decodeMs = waitForImages(load);
+
+		const auto uploadStart = Clock::now();
+		if (!upload(load))
+			std::cerr << load.fileName << " loading failed." << std::endl;
+		timing.uploadMs = msSince(uploadStart);
+		timings.push_back(timing);
+	};
+
+	for (size_t i = 0; i < models.size(); i++)
 	{
-		if (!loadSingMesh(model.modelName, shaderProgram, model.geometryPtr))
-			std::cerr << model.modelName << " loading failed." << std::endl;
+		uploadModel(modelLoads[i], [&](const ModelLoad& load) { return loadSingMesh(load, shaderProgram, models[i].geometryPtr); });
 	}
+	uploadModel(snowmanLoad, [](const ModelLoad& load) { return loadMultMesh(load, shaderProgram, snowmanGeom); });
+	uploadModel(couchLoad, [](const ModelLoad& load) { return loadMultMesh(load, shaderProgram, couchGeom); });
+
+	auto uploadImage = [&](const char* fileName, const std::shared_future<DecodedImage>& image, const std::function<void(GLuint)>& init) {
+		AssetTiming timing;
+		timing.name = fileName;
+		if (image.valid())
+			timing.decodeMs = image.get().decodeMs;
+		const auto uploadStart = Clock::now();
+		init(acquireTexture(fileName, image));
+		timing.uploadMs = msSince(uploadStart);
+		timings.push_back(timing);
+	};
+
+	uploadImage(DIAMOND_TEXTURE, diamondImage, [](GLuint texture) { initDiamondGeom(&diamondGeom, texture); });
+	uploadImage(SPARKLES_TEXTURE, sparklesImage, [](GLuint texture) { initSparklesGeom(&sparklesGeom, texture); });
+	uploadImage(AMONGUS_TEXTURE, amongusImage, [](GLuint texture) { initAmongusGeom(&amongusGeom, texture); });
+
+	AssetTiming skyboxTiming;
+	skyboxTiming.name = skyboxBaked ? bakedTexturePath(SKYBOX_TEXTURE_PREFIX) : std::string(SKYBOX_TEXTURE_PREFIX) + "_*.jpg";
+	for (const auto& face : skyboxImages)
+		skyboxTiming.decodeMs += face.get().decodeMs;
+	const auto skyboxStart = Clock::now();
+	initCubeSkyboxGeom(&skyboxGeom, acquireCubeMap(SKYBOX_TEXTURE_PREFIX, skyboxImages));
+	skyboxTiming.uploadMs = msSince(skyboxStart);
+	timings.push_back(skyboxTiming);
 
-	if (!loadMultMesh(SNOWMAN_MODEL, shaderProgram, snowmanGeom))
-		std::cerr << "Snowman loading failed." << std::endl;
-	if (!loadMultMesh(COUCH_MODEL, shaderProgram, couchGeom))
-		std::cerr << "Couch loading failed." << std::endl;
+	if (multiDrawPrograms)
+		uploadMegaBuffers(multiDrawShaderProgram.instanceIndexLoc);
 
-	initDiamondGeom(&diamondGeom);
-	initSparklesGeom(&sparklesGeom);
-	initCubeSkyboxGeom(&skyboxGeom);
-	initAmongusGeom(&amongusGeom);
+	printStartupReport(std::cout, timings, pool.size(), msSince(loadStart));
+	printTextureReport(std::cout);
+	printMeshReport(std::cout);
+	printResourceReport(std::cout);
 
-	useFog = false;
+	occlusionPool = std::make_unique<TaskPool>();
 }
 
 /**
@@ -10,6 +10,13 @@
 #pragma once
 
 #include "pgr.h"
+#include "mesh.h"
+#include "assets.h"
+#include "textures.h"
+#include "quantize.h"
+#include "simplify.h"
+#include "occlusion.h"
+#include "megabuffer.h"
 
 namespace manaeste
 {
@@ -21,6 +28,15 @@ namespace manaeste
 		GLuint ebo{};
 		GLuint vao{};
 		GLsizei numTriangles{};
+		GLenum indexType{ GL_UNSIGNED_INT }; ///< type of the indices in ebo
+		VertexDecode decode;                 ///< layout of the vertices in vbo
+		std::vector<MeshLod> lods;           ///< ranges of ebo, from the full mesh to the coarsest level
+		float radius{};                      ///< bounding sphere around the object space origin
+		glm::vec3 boundsMin{};               ///< object space bounding box
+		glm::vec3 boundsMax{};
+		glm::vec4 bounds{};                  ///< bounding sphere around the box center, radius in w
+		OccluderMesh occluder;               ///< coarse triangles drawn into the occlusion buffer
+		MegaRange mega;                      ///< place in the mega-buffer of the multi-draw path
 
 		GLuint texture{};
 		float shininess{};
@@ -43,38 +59,104 @@ namespace manaeste
 		float frameDuration{};
 	} Object;
 
+	/// Lights and fog of a light shader permutation, lights.frag repeats these.
+	enum LightVariantBit { LIGHT_SUN = 1, LIGHT_FLASH = 2, LIGHT_POINT = 4, LIGHT_FOG = 8 };
+	const int NUM_LIGHT_VARIANTS = 16;
+
 	typedef struct MainShaderProgram
 	{
-		GLuint program{};
+		GLuint program{};                          ///< permutation selected by selectLightVariant()
+		GLuint branching{};                        ///< built without LIGHT_VARIANT, branches on the frame's lightVariant
+		GLuint variants[NUM_LIGHT_VARIANTS]{};     ///< built with LIGHT_VARIANT, the branching build where one failed
 
 		GLint positionLoc{};
 		GLint normalLoc{};
 		GLint textureCoordLoc{};
 
-		GLint PVMmatrixLoc{};
-		GLint VmatrixLoc{};
-		GLint MmatrixLoc{};
-		GLint normalMatrixLoc{};
-		GLint timeLoc{};
+		GLint textureSamplerLoc{};
+		GLint instanceMatricesLoc{};
 
-		GLint diffuseLoc{};
-		GLint ambientLoc{};
-		GLint specularLoc{};
-		GLint shininessLoc{};
+		GLuint frameDataIndex{};
+		GLuint drawDataIndex{};
+	} MainShaderProgram;
 
-		GLint useTextureLoc{};
-		GLint textureSamplerLoc{};
+	/// lights.vert and lights.frag built as GLSL 4.30 with MULTI_DRAW, drawing from the mega-buffer.
+	typedef struct MultiDrawShaderProgram
+	{
+		GLuint program{};                          ///< permutation selected by selectLightVariant()
+		GLuint branching{};
+		GLuint variants[NUM_LIGHT_VARIANTS]{};
 
-		GLint reflectorPositionLoc{};
-		GLint reflectorDirectionLoc{};
+		GLint instanceIndexLoc{};
+		GLint materialTexturesLoc{};
 
-		GLint sunOnLoc{};
-		GLint flashOnLoc{};
-		GLint fogOnLoc{};
+		GLuint frameDataIndex{};
+	} MultiDrawShaderProgram;
 
-		GLint pointLightLoc{};
-		GLint pointLightOnLoc{};
-	} MainShaderProgram;
+	/// Uniform block binding points shared by all programs using the light shaders.
+	enum UniformBlockBinding { FRAME_DATA_BINDING = 0, DRAW_DATA_BINDING = 1 };
+
+	/// std140 layout of the FrameData uniform block (lights.vert, lights.frag), uploaded once per frame.
+	typedef struct FrameUniforms
+	{
+		glm::mat4 Pmatrix{};
+		glm::mat4 Vmatrix{};
+		glm::vec3 sunDirection{};      ///< view space, toward the sun
+		float currentTime{};
+		glm::vec3 pointLightPosition{}; ///< view space
+		GLint numLights{};             ///< point lights in the light clusters
+		glm::vec3 reflectorPosition{}; ///< view space
+		GLint lightVariant{};          ///< LightVariantBit flags, read by the branching build only
+		glm::vec3 reflectorDirection{}; ///< view space
+		float padding{};
+		glm::vec3 reflectorDiffuse{};  ///< tinted with the distance of the flashlight
+		float padding2{};
+		glm::vec4 clusterParams{};     ///< tiles per pixel in x and y, slices per unit of view depth, slice at depth 0
+	} FrameUniforms;
+
+	/// std140 layout of the DrawData uniform block, written into a ring buffer once per draw call.
+	typedef struct DrawUniforms
+	{
+		glm::mat4 PVMmatrix{};
+		glm::mat4 Mmatrix{};
+		glm::mat4 normalMatrix{};
+		glm::vec3 ambient{};
+		float shininess{};
+		glm::vec3 diffuse{};
+		GLint useTexture{};
+		glm::vec3 specular{};
+		GLint instanced{};
+		glm::vec3 positionScale{ 1.0f };
+		GLint octahedralNormals{};
+		glm::vec3 positionOffset{ 0.0f };
+		GLint instanceBase{};          ///< first instance of the draw in the instance buffer
+		glm::vec4 texCoordTransform{ 1.0f, 1.0f, 0.0f, 0.0f };
+	} DrawUniforms;
+
+	/// A level of detail is good enough while its error covers at most this many pixels.
+	const float LOD_PIXEL_ERROR = 1.0f;
+
+	/// Where the model of the next draw call ends up on the screen, for picking its level of detail.
+	typedef struct LodProjection
+	{
+		float depth{};         ///< clip space w of the model origin
+		float scale{ 1.0f };   ///< largest scale of the model matrix
+		float pixelsPerUnit{}; ///< pixels covered by one view space unit at depth 1
+	} LodProjection;
+
+	/// GPU memory of one uploaded mesh, for the startup report.
+	typedef struct MeshMemory
+	{
+		std::string name;
+		uint32_t numVertices{};
+		uint32_t numTriangles{};
+		size_t vertexBytes{};
+		size_t indexBytes{};
+		size_t floatBytes{};   ///< vertex and index memory with float vertices and 32-bit indices
+		std::vector<uint32_t> lodTriangles; ///< triangles of every level of detail
+		bool packed{};
+		QuantizationError error;
+	} MeshMemory;
 
 	typedef struct AmongusShaderProgram
 	{
@@ -107,31 +189,51 @@ namespace manaeste
 	} SparklesShaderProgram;
 
 	void createShaders();
+	void finishShaders();
+	void waitForLightVariants();
 	void deleteShaders();
 
+	void setFrameLights(FrameUniforms& frame, const glm::vec3& reflectorPosition, const glm::vec3& reflectorDirection,
+		const glm::vec3& pointLightPosition);
+	void selectLightVariant(int variant);
+	void setFrameUniforms(const FrameUniforms& frame);
 	void setUniformMatrices(const glm::mat4& projMat, const glm::mat4& viewMat, const glm::mat4& modelMat);
 	void setUniformMaterial(GLuint texture, float shininess, const glm::vec3& ambient, const glm::vec3& diffuse,
 		const glm::vec3& specular);
-
-	void initDiamondGeom(SingMeshGeom** geom);
-	void initCubeSkyboxGeom(SingMeshGeom** geom);
-	void initSparklesGeom(SingMeshGeom** geom);
-	void initAmongusGeom(SingMeshGeom** geom);
-	void deleteAmongusAndSkyboxGeoms();
+	void commitDrawUniforms(const DrawUniforms& uniforms);
+	void setVertexDecode(const VertexDecode& decode);
+	LodProjection projectModel(const glm::mat4& projMat, const glm::mat4& viewMat, const glm::mat4& modelMat);
+	size_t selectLod(const SingMeshGeom* geom, const LodProjection& projection);
+	void drawMeshElements(const SingMeshGeom* geom);
+	bool multiDrawActive();
+
+	void initDiamondGeom(SingMeshGeom** geom, GLuint texture);
+	void initCubeSkyboxGeom(SingMeshGeom** geom, GLuint texture);
+	void initSparklesGeom(SingMeshGeom** geom, GLuint texture);
+	void initAmongusGeom(SingMeshGeom** geom, GLuint texture);
+	void deleteMeshGeom(SingMeshGeom*& geom);
+	void deleteMeshes();
 
 	void drawObject(ObjectType type, Object* object, const glm::mat4& projMat, const glm::mat4& viewMat);
+	void drawObject(ObjectType type, const std::vector<Object*>& objects, const glm::mat4& projMat, const glm::mat4& viewMat);
 	void drawCubeSkybox(const glm::mat4& projMat, const glm::mat4& viewMat);
 	void drawSparklesTexture(Object* fire, const glm::mat4& projMat, const glm::mat4& viewMat);
 	void drawAmongusMovingTexture(Object* banner, const glm::mat4& projMat, const glm::mat4& viewMat);
 
-	void setFogState(bool fogOn);
+	void beginOcclusion(const glm::mat4& projMat, const glm::mat4& viewMat);
+	void addOccluders(ObjectType type, const std::vector<Object*>& objects);
+	void rasterizeOccluders();
+
+	void uploadGpuInstances(ObjectType type, const std::vector<Object*>& objects);
 
 	glm::mat4 setModelMat(const ObjectType& type, const Object* object);
 	void setMaterial(const ObjectType& type, const glm::mat4& projMat, const glm::mat4& viewMat,
 		const glm::mat4& modelMat);
 
-	bool loadSingMesh(const std::string& fileName, MainShaderProgram& shader, SingMeshGeom** singMeshGeometry);
-	bool loadMultMesh(const std::string& fileName, MainShaderProgram& shader, MultMeshGeom& multMeshGeometry);
+	SingMeshGeom* createMeshGeom(const MeshView& mesh, MainShaderProgram& shader, GLuint texture, const std::string& name);
+	void printMeshReport(std::ostream& out);
+	bool loadSingMesh(const ModelLoad& load, MainShaderProgram& shader, SingMeshGeom** singMeshGeometry);
+	bool loadMultMesh(const ModelLoad& load, MainShaderProgram& shader, MultMeshGeom& multMeshGeometry);
 	void loadMeshes();
 
 	glm::mat4 getFrontDirectionMat(const glm::vec3& position, const glm::vec3& front, const glm::vec3& up);
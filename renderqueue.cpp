@@ -0,0 +1,524 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    renderqueue.cpp : Render queue of the light shader draws.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   drawObject() does not draw, it queues a packet with a 64-bit sort key. Once all
+ *          objects are queued the packets outside the view frustum are dropped, the keys
+ *          radix sorted and the packets submitted, changing only the state that differs from
+ *          the previous packet.
+ *
+ * Sort key, from the most significant bit:
+ *   pass (4) | program (8) | stencil reference (8) | vertex array (12) | texture (12) | depth (20)
+ * Programs, vertex arrays and textures enter the key as dense ids handed out in the order
+ * they are first queued in a frame, so GL names of any size keep distinct keys. Only a frame
+ * with more objects than a field holds shares ids, which costs state changes, never a wrong
+ * draw: the packet itself always holds the full names.
+ *
+ * On the multi-draw path all packets share the program and vertex array, and the sorted
+ * packets become one glMultiDrawElementsIndirect() per stencil reference, which has to be
+ * set between draws for object picking. Instance sets culled on the GPU skip the sort: each
+ * gets one command per level of detail, filled by cull.comp and drawn after the packets.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "renderqueue.h"
+#include "resources.h"
+#include "glstate.h"
+#include "culling.h"
+#include "profiler.h"
+#include "renderstats.h"
+
+using namespace manaeste;
+
+RenderQueueStats renderQueueStats; ///< state changes of the last submitted queue
+
+namespace
+{
+	struct SortItem
+	{
+		uint64_t key;
+		uint32_t packet;
+	};
+
+	/// Small ids of the GL objects queued in a frame, in the order they were first seen.
+	struct DenseIds
+	{
+		std::vector<GLuint> names;
+
+		uint64_t id(GLuint name)
+		{
+			// a frame uses few programs, vertex arrays and textures, a scan is enough
+			for (size_t i = 0; i < names.size(); i++)
+				if (names[i] == name)
+					return i;
+			names.push_back(name);
+			return names.size() - 1;
+		}
+	};
+
+	/// Instance set queued for culling on the GPU.
+	struct GpuGroup
+	{
+		DrawPacket packet;
+		GpuInstanceSet set;
+		GpuCullParams params;
+		GLuint material{};     ///< MaterialTable entry, set by submitIndirect()
+		GLuint firstCommand{}; ///< command of level 0, set by submitIndirect()
+	};
+
+	std::vector<DrawPacket> packets;
+	std::vector<DrawUniforms> packetUniforms;
+	std::vector<SortItem> sortItems;     ///< in queued order until submitRenderQueue() sorts them
+	std::vector<SortItem> sortScratch;
+	std::vector<glm::mat4> instanceData; ///< model and normal matrix of every queued instance
+	BoundsArray packetBounds;            ///< world space bounding sphere of every packet
+	std::vector<uint8_t> packetVisible;
+	std::vector<GpuGroup> gpuGroups;
+	GLint pendingStencilRef = 0;
+	GpuTimer pendingTimer = GPU_TERRAIN;
+	DenseIds programIds;
+	DenseIds vaoIds;
+	DenseIds textureIds;
+
+	std::vector<MaterialRecord> materialRecords; ///< multi-draw tables of the submitted packets
+	std::vector<InstanceRecord> instanceRecords;
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
+
+	GLuint instanceBuffer = 0;        ///< per-instance model and normal matrices for instanced draws
+	GLuint instanceBufferTexture = 0; ///< buffer texture the vertex shader fetches instance matrices from
+
+	uint64_t field(uint64_t value, int bits, int shift)
+	{
+		return (value & ((uint64_t(1) << bits) - 1)) << shift;
+	}
+
+	/// Positive floats order like their bit patterns, the top 20 bits keep the exponent and 11 bits of mantissa.
+	uint64_t depthBits(float depth)
+	{
+		if (!(depth > 0.0f))
+			return 0;
+		uint32_t bits;
+		std::memcpy(&bits, &depth, sizeof(bits));
+		return bits >> 12;
+	}
+
+	uint64_t sortKey(const DrawPacket& packet, float depth, RenderPass pass)
+	{
+		return field(pass, 4, 60) | field(programIds.id(packet.program), 8, 52) | field((uint64_t)packet.stencilRef, 8, 44)
+			| field(vaoIds.id(packet.vao), 12, 32) | field(textureIds.id(packet.texture), 12, 20) | field(depthBits(depth), 20, 0);
+	}
+
+	/// LSD radix sort by bytes, skipping the bytes every key shares. Stable.
+	void radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+	{
+		size_t counts[8][256] = {};
+		for (const auto& item : items)
+			for (int byte = 0; byte < 8; byte++)
+				counts[byte][(item.key >> (byte * 8)) & 0xFF]++;
+
+		scratch.resize(items.size());
+		for (int byte = 0; byte < 8; byte++)
+		{
+			size_t* count = counts[byte];
+			if (count[(items[0].key >> (byte * 8)) & 0xFF] == items.size())
+				continue;
+
+			size_t offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++)
+			{
+				size_t n = count[bucket];
+				count[bucket] = offset;
+				offset += n;
+			}
+			for (const auto& item : items)
+				scratch[count[(item.key >> (byte * 8)) & 0xFF]++] = item;
+			items.swap(scratch);
+		}
+	}
+
+	/// Counts the state a packet changes after the previous one.
+	void countChanges(const DrawPacket& previous, const DrawPacket& next, StateChanges& changes)
+	{
+		if (next.program != previous.program)
+			changes.programs++;
+		if (next.vao != previous.vao)
+			changes.vertexArrays++;
+		if (next.texture != 0 && next.texture != previous.texture)
+			changes.textures++;
+		if (next.stencilRef != previous.stencilRef)
+			changes.stencils++;
+	}
+
+	/// State left bound by a packet; a packet without a texture keeps the previous one.
+	DrawPacket boundState(const DrawPacket& previous, const DrawPacket& next)
+	{
+		DrawPacket bound = next;
+		if (next.texture == 0)
+			bound.texture = previous.texture;
+		return bound;
+	}
+
+	void clearQueue()
+	{
+		packets.clear();
+		packetUniforms.clear();
+		sortItems.clear();
+		instanceData.clear();
+		gpuGroups.clear();
+		clearBounds(packetBounds);
+		programIds.names.clear();
+		vaoIds.names.clear();
+		textureIds.names.clear();
+	}
+
+	void uploadInstances()
+	{
+		if (instanceBuffer == 0)
+		{
+			instanceBuffer = createResource(INSTANCE_BUFFER, "instance matrices");
+			instanceBufferTexture = createResource(BUFFER_TEXTURE, "instance matrices");
+		}
+		bindBuffer(GL_TEXTURE_BUFFER, instanceBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, instanceData.size() * sizeof(glm::mat4), instanceData.data(), GL_STREAM_DRAW);
+		setResourceBytes(INSTANCE_BUFFER, instanceBuffer, instanceData.size() * sizeof(glm::mat4));
+		COUNT_RENDER_STAT(uploadedBytes, instanceData.size() * sizeof(glm::mat4));
+
+		bindTexture(1, GL_TEXTURE_BUFFER, instanceBufferTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBuffer);
+	}
+
+	/// Appends the MaterialTable entry of a packet.
+	GLuint addMaterialRecord(const DrawPacket& packet)
+	{
+		const DrawUniforms& uniforms = packetUniforms[packet.uniforms];
+
+		MaterialRecord material;
+		material.ambient = uniforms.ambient;
+		material.shininess = uniforms.shininess;
+		material.diffuse = uniforms.diffuse;
+		material.textureLayer = uniforms.useTexture ? packet.textureLayer : -1;
+		material.specular = uniforms.specular;
+		material.packedVertices = packet.mega.packed ? 1 : 0;
+		material.positionScale = uniforms.positionScale;
+		material.firstVertexWord = packet.mega.firstVertexWord;
+		material.positionOffset = uniforms.positionOffset;
+		material.texCoordTransform = uniforms.texCoordTransform;
+		materialRecords.push_back(material);
+		return (GLuint)(materialRecords.size() - 1);
+	}
+
+	/// Writes the multi-draw tables and commands of the sorted packets.
+	void buildIndirectDraws()
+	{
+		materialRecords.clear();
+		instanceRecords.clear();
+		indirectCommands.clear();
+		for (const auto& item : sortItems)
+		{
+			const DrawPacket& packet = packets[item.packet];
+			const DrawUniforms& uniforms = packetUniforms[packet.uniforms];
+			const GLuint materialIndex = addMaterialRecord(packet);
+
+			DrawElementsIndirectCommand command;
+			command.count = (GLuint)packet.numIndices;
+			command.instanceCount = (GLuint)std::max(packet.numInstances, 1);
+			command.firstIndex = packet.mega.firstIndex + packet.firstIndex;
+			command.baseInstance = (GLuint)instanceRecords.size();
+			indirectCommands.push_back(command);
+
+			InstanceRecord instance;
+			instance.material = materialIndex;
+			if (packet.numInstances == 0)
+			{
+				instance.modelMatrix = uniforms.Mmatrix;
+				instance.normalMatrix = uniforms.normalMatrix;
+				instanceRecords.push_back(instance);
+			}
+			for (GLsizei i = 0; i < packet.numInstances; i++)
+			{
+				instance.modelMatrix = instanceData[2 * ((size_t)uniforms.instanceBase + i)];
+				instance.normalMatrix = instanceData[2 * ((size_t)uniforms.instanceBase + i) + 1];
+				instanceRecords.push_back(instance);
+			}
+		}
+	}
+
+	/// Writes the material and the empty commands of every GPU culled set, each command with
+	/// room for all instances of the set.
+	/// @return InstanceTable entries reserved for cull.comp
+	size_t buildGpuGroupDraws()
+	{
+		size_t reserved = 0;
+		for (auto& group : gpuGroups)
+		{
+			group.material = addMaterialRecord(group.packet);
+			group.firstCommand = (GLuint)indirectCommands.size();
+			for (uint32_t lod = 0; lod < group.params.numLods; lod++)
+			{
+				DrawElementsIndirectCommand command;
+				command.count = group.params.lodNumIndices[lod];
+				command.firstIndex = group.packet.mega.firstIndex + group.params.lodFirstIndex[lod];
+				command.baseInstance = (GLuint)(instanceRecords.size() + reserved);
+				indirectCommands.push_back(command);
+				reserved += group.set.count;
+			}
+		}
+		return reserved;
+	}
+
+	/// Sets the state of an indirect draw.
+	void bindIndirectState(const DrawPacket& packet, DrawPacket& bound)
+	{
+		countChanges(bound, packet, renderQueueStats.submitted);
+		bound = boundState(bound, packet);
+
+		useProgram(packet.program);
+		bindVertexArray(packet.vao);
+		setCapability(CAP_STENCIL_TEST, packet.stencilRef != 0);
+		if (packet.stencilRef != 0)
+			setStencilFunc(GL_ALWAYS, packet.stencilRef, 0xFF);
+	}
+
+	/// Draws the sorted packets with one glMultiDrawElementsIndirect() per run of the same stencil
+	/// reference and GPU timer, then every GPU culled set with one glMultiDrawElementsIndirect() of its levels.
+	void submitIndirect()
+	{
+		buildIndirectDraws();
+		const size_t reserved = buildGpuGroupDraws();
+		uploadMultiDrawTables(materialRecords, instanceRecords, indirectCommands, reserved);
+		bindTexture(MATERIAL_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, materialTextureArray());
+
+		int timed = -1; // running GPU timer
+		if (!gpuGroups.empty())
+		{
+			beginGpuTimer(GPU_CULLING);
+			timed = GPU_CULLING;
+			for (const auto& group : gpuGroups)
+				dispatchGpuCulling(group.set, group.params, cullingFrustum(), group.material, group.firstCommand);
+			glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		DrawPacket bound;
+		for (size_t first = 0; first < sortItems.size();)
+		{
+			const DrawPacket& packet = packets[sortItems[first].packet];
+			size_t last = first;
+			while (last < sortItems.size() && packets[sortItems[last].packet].stencilRef == packet.stencilRef &&
+				packets[sortItems[last].packet].timer == packet.timer)
+			{
+				COUNT_RENDER_STAT(triangles, indirectCommands[last].count / 3 * indirectCommands[last].instanceCount);
+				COUNT_RENDER_STAT(instances, indirectCommands[last].instanceCount);
+				last++;
+			}
+			if (packet.timer != timed)
+			{
+				beginGpuTimer(packet.timer);
+				timed = packet.timer;
+			}
+			bindIndirectState(packet, bound);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(first * sizeof(DrawElementsIndirectCommand)),
+				(GLsizei)(last - first), 0);
+			COUNT_RENDER_STAT(drawCalls, 1);
+			first = last;
+		}
+
+		// the instance counts are only known on the GPU, these draws add no triangles to the statistics
+		for (const auto& group : gpuGroups)
+		{
+			if (group.packet.timer != timed)
+			{
+				beginGpuTimer(group.packet.timer);
+				timed = group.packet.timer;
+			}
+			bindIndirectState(group.packet, bound);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(const void*)((size_t)group.firstCommand * sizeof(DrawElementsIndirectCommand)), (GLsizei)group.params.numLods, 0);
+			COUNT_RENDER_STAT(drawCalls, 1);
+		}
+	}
+}
+
+/**
+ * @brief Sum of all state changes.
+ * @param changes state changes
+ * @return number of changes
+*/
+unsigned int manaeste::totalStateChanges(const StateChanges& changes)
+{
+	return changes.programs + changes.vertexArrays + changes.textures + changes.stencils;
+}
+
+/**
+ * @brief Sets the stencil reference written by the draws queued next, used for picking objects.
+ * @param ref stencil value, 0 draws without the stencil test
+*/
+void manaeste::setStencilRef(GLint ref)
+{
+	pendingStencilRef = ref;
+}
+
+/**
+ * @brief Sets the GPU timer measuring the draws queued next. submitRenderQueue() switches
+ *        timers between the draws, which is cheap only as long as a timer's draws share
+ *        their stencil reference.
+ * @param timer part of the frame the draws belong to
+*/
+void manaeste::setQueueTimer(GpuTimer timer)
+{
+	pendingTimer = timer;
+}
+
+/**
+ * @brief Adds instances to the instance buffer uploaded by submitRenderQueue().
+ * @param modelMats model matrix of every instance
+ * @param count number of instances
+ * @return instanceBase of a packet drawing these instances
+*/
+uint32_t manaeste::queueInstances(const glm::mat4* modelMats, size_t count)
+{
+	uint32_t base = (uint32_t)(instanceData.size() / 2);
+	for (size_t i = 0; i < count; i++)
+	{
+		instanceData.push_back(modelMats[i]);
+		instanceData.push_back(glm::transpose(glm::inverse(modelMats[i])));
+	}
+	return base;
+}
+
+/**
+ * @brief Queues a draw until submitRenderQueue().
+ * @param packet draw, its stencil reference is taken from setStencilRef()
+ * @param uniforms DrawData values of the draw
+ * @param depth clip space w of the object, opaque draws are sorted front to back within the same state
+ * @param bounds world space bounding sphere, culled when outside the view frustum; a negative radius is never culled
+ * @param pass pass of the draw
+*/
+void manaeste::queueDraw(const DrawPacket& packet, const DrawUniforms& uniforms, float depth, const glm::vec4& bounds,
+	RenderPass pass)
+{
+	DrawPacket queued = packet;
+	queued.stencilRef = pendingStencilRef;
+	queued.timer = pendingTimer;
+	queued.uniforms = (uint32_t)packetUniforms.size();
+	packetUniforms.push_back(uniforms);
+
+	sortItems.push_back({ sortKey(queued, depth, pass), (uint32_t)packets.size() });
+	packets.push_back(queued);
+	addBounds(packetBounds, bounds);
+}
+
+/**
+ * @brief Queues an instance set culled on the GPU until submitRenderQueue(). Only on the
+ *        multi-draw path, the set is drawn after the sorted packets.
+ * @param packet draw of level 0 of the mesh, its stencil reference is taken from setStencilRef()
+ * @param uniforms material and vertex decoding of the set
+ * @param set instances, uploaded by uploadInstanceSet()
+ * @param params mesh and camera values for cull.comp
+*/
+void manaeste::queueGpuInstances(const DrawPacket& packet, const DrawUniforms& uniforms, const GpuInstanceSet& set,
+	const GpuCullParams& params)
+{
+	GpuGroup group;
+	group.packet = packet;
+	group.packet.stencilRef = pendingStencilRef;
+	group.packet.timer = pendingTimer;
+	group.packet.uniforms = (uint32_t)packetUniforms.size();
+	packetUniforms.push_back(uniforms);
+	group.set = set;
+	group.params = params;
+	gpuGroups.push_back(group);
+}
+
+/**
+ * @brief Culls, sorts and draws the queued packets with the depth test and without blending, and
+ *        empties the queue.
+*/
+void manaeste::submitRenderQueue()
+{
+	PROFILE_ZONE("submitRenderQueue");
+	renderQueueStats = RenderQueueStats();
+	pendingStencilRef = 0;
+	pendingTimer = GPU_TERRAIN;
+	if (packets.empty() && gpuGroups.empty())
+		return;
+
+	cullSpheres(cullingFrustum(), packetBounds, packetVisible);
+	sortItems.erase(std::remove_if(sortItems.begin(), sortItems.end(),
+		[](const SortItem& item) { return packetVisible[item.packet] == 0; }), sortItems.end());
+	renderQueueStats.packets = (unsigned int)sortItems.size();
+	if (sortItems.empty() && gpuGroups.empty())
+	{
+		clearQueue();
+		return;
+	}
+
+	DrawPacket bound;
+	for (const auto& item : sortItems)
+	{
+		countChanges(bound, packets[item.packet], renderQueueStats.queued);
+		bound = boundState(bound, packets[item.packet]);
+	}
+
+	if (!sortItems.empty())
+		radixSort(sortItems, sortScratch);
+
+	setCapability(CAP_DEPTH_TEST, true);
+	setCapability(CAP_BLEND, false);
+	setStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	if (multiDrawActive())
+	{
+		submitIndirect();
+		endGpuTimer();
+		clearQueue();
+		return;
+	}
+
+	if (!instanceData.empty())
+		uploadInstances();
+
+	bound = DrawPacket();
+	for (size_t i = 0; i < sortItems.size(); i++)
+	{
+		const DrawPacket& packet = packets[sortItems[i].packet];
+		countChanges(bound, packet, renderQueueStats.submitted);
+		if (i == 0 || packet.timer != bound.timer)
+			beginGpuTimer(packet.timer);
+		bound = boundState(bound, packet);
+
+		useProgram(packet.program);
+		bindVertexArray(packet.vao);
+		if (packet.texture != 0)
+			bindTexture(0, GL_TEXTURE_2D, packet.texture);
+		setCapability(CAP_STENCIL_TEST, packet.stencilRef != 0);
+		if (packet.stencilRef != 0)
+			setStencilFunc(GL_ALWAYS, packet.stencilRef, 0xFF);
+
+		commitDrawUniforms(packetUniforms[packet.uniforms]);
+		const void* offset = (const void*)((size_t)packet.firstIndex * indexSize(packet.indexType));
+		if (packet.numInstances > 0)
+			glDrawElementsInstanced(GL_TRIANGLES, packet.numIndices, packet.indexType, offset, packet.numInstances);
+		else
+			glDrawElements(GL_TRIANGLES, packet.numIndices, packet.indexType, offset);
+
+		COUNT_RENDER_STAT(drawCalls, 1);
+		COUNT_RENDER_STAT(triangles, packet.numIndices / 3 * (unsigned int)std::max(packet.numInstances, 1));
+		COUNT_RENDER_STAT(instances, (unsigned int)std::max(packet.numInstances, 1));
+	}
+
+	endGpuTimer();
+	clearQueue();
+}
+
+/**
+ * @brief Deletes the buffer holding instance matrices and drops any queued packets.
+*/
+void manaeste::deleteRenderQueue()
+{
+	deleteResource(BUFFER_TEXTURE, instanceBufferTexture);
+	deleteResource(INSTANCE_BUFFER, instanceBuffer);
+	clearQueue();
+}
@@ -0,0 +1,68 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    renderqueue.h : Header file for renderqueue.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Draw packets collected during a frame and submitted sorted by render state.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "render.h"
+#include "gpuculling.h"
+#include "gputimer.h"
+
+namespace manaeste
+{
+	/// Passes of a frame, the queue submits them in this order.
+	enum RenderPass { OPAQUE_PASS };
+
+	/// Everything needed to issue one draw call of the light shaders.
+	typedef struct DrawPacket
+	{
+		GLuint program{};
+		GLuint vao{};
+		GLuint texture{};          ///< bound to unit 0, 0 keeps whatever is bound
+		GLint stencilRef{};        ///< written into the stencil buffer, 0 draws without the stencil test
+		GpuTimer timer{};          ///< measures the GPU time of the draw
+		GLenum indexType{ GL_UNSIGNED_INT };
+		GLsizei numIndices{};
+		uint32_t firstIndex{};
+		GLsizei numInstances{};    ///< 0 for a draw that is not instanced
+		uint32_t uniforms{};       ///< DrawData values of the packet, index into the queue
+		MegaRange mega;            ///< mesh in the mega-buffer, for the multi-draw path
+		GLint textureLayer{ -1 };  ///< layer of the material texture array, for the multi-draw path
+	} DrawPacket;
+
+	/// Render state changes made by a sequence of draw packets.
+	typedef struct StateChanges
+	{
+		unsigned int programs{};
+		unsigned int vertexArrays{};
+		unsigned int textures{};
+		unsigned int stencils{};   ///< stencil test toggles and reference changes
+	} StateChanges;
+
+	/// Packets and state changes of the last submitted queue.
+	typedef struct RenderQueueStats
+	{
+		unsigned int packets{};    ///< submitted, after culling
+		StateChanges submitted;    ///< in the sorted order
+		StateChanges queued;       ///< had the packets been submitted in the order they were queued
+	} RenderQueueStats;
+
+	unsigned int totalStateChanges(const StateChanges& changes);
+
+	void setStencilRef(GLint ref);
+	void setQueueTimer(GpuTimer timer);
+	uint32_t queueInstances(const glm::mat4* modelMats, size_t count);
+	void queueDraw(const DrawPacket& packet, const DrawUniforms& uniforms, float depth, const glm::vec4& bounds,
+		RenderPass pass = OPAQUE_PASS);
+	void queueGpuInstances(const DrawPacket& packet, const DrawUniforms& uniforms, const GpuInstanceSet& set,
+		const GpuCullParams& params);
+	void submitRenderQueue();
+	void deleteRenderQueue();
+}
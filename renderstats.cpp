@@ -0,0 +1,71 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    renderstats.cpp : Rendering statistics.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   The draw code counts its work into renderStats with COUNT_RENDER_STAT(), which
+ *          expands to nothing without RENDER_STATS, so release builds pay nothing for it.
+ *          drawScene() brackets each frame with beginRenderStatsFrame() and
+ *          endRenderStatsFrame(), and the last RENDER_STATS_HISTORY frames are kept for
+ *          writeRenderStatsHistory().
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <deque>
+#include "renderstats.h"
+
+using namespace manaeste;
+
+RenderStats manaeste::renderStats;
+
+namespace
+{
+	std::deque<RenderStats> history;
+	const RenderStats noStats;
+}
+
+/**
+ * @brief Clears the counters, work done between frames is not counted.
+*/
+void manaeste::beginRenderStatsFrame()
+{
+	renderStats = RenderStats();
+}
+
+/**
+ * @brief Appends the counters of the frame to the history, dropping the oldest frame once it is full.
+*/
+void manaeste::endRenderStatsFrame()
+{
+#ifdef RENDER_STATS
+	history.push_back(renderStats);
+	if (history.size() > RENDER_STATS_HISTORY)
+		history.pop_front();
+#endif
+}
+
+/**
+ * @brief Counters of the last frame ended by endRenderStatsFrame().
+ * @return counters, all zero without RENDER_STATS
+*/
+const RenderStats& manaeste::lastRenderStats()
+{
+	return history.empty() ? noStats : history.back();
+}
+
+/**
+ * @brief Writes the history as CSV, oldest frame first, one row per frame.
+ * @param out destination stream
+*/
+void manaeste::writeRenderStatsHistory(std::ostream& out)
+{
+	out << "frame,objects,draw_calls,triangles,instances,program_switches,vertex_array_binds,texture_binds,"
+		<< "capability_toggles,uniform_calls,uniform_block_uploads,uploaded_bytes" << std::endl;
+	for (size_t frame = 0; frame < history.size(); frame++)
+	{
+		const RenderStats& stats = history[frame];
+		out << frame << "," << stats.objects << "," << stats.drawCalls << "," << stats.triangles << "," << stats.instances << ","
+			<< stats.programSwitches << "," << stats.vertexArrayBinds << "," << stats.textureBinds << "," << stats.capabilityToggles << ","
+			<< stats.uniformCalls << "," << stats.uniformBlockUploads << "," << stats.uploadedBytes << std::endl;
+	}
+}
@@ -0,0 +1,54 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    renderstats.h : Header file for renderstats.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Per-frame counters of the rendering work and a history of the last frames.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+/// Count the rendering work of every frame; on in debug and bench builds, like GL_STATE_DEBUG.
+#if !defined(RENDER_STATS) && (defined(_DEBUG) || defined(WILDISLAND_BENCH))
+#define RENDER_STATS
+#endif
+
+namespace manaeste
+{
+	/// Frames kept by endRenderStatsFrame().
+	const size_t RENDER_STATS_HISTORY = 300;
+
+	/// Rendering work of one frame, counted only with RENDER_STATS.
+	typedef struct RenderStats
+	{
+		unsigned int objects{};            ///< objects passed to drawObject()
+		unsigned int drawCalls{};          ///< glDraw* calls, a multi-draw counts once
+		unsigned int triangles{};          ///< the GPU culled sets add none, their counts stay on the GPU
+		unsigned int instances{};          ///< meshes drawn, an instanced draw counts every instance
+		unsigned int programSwitches{};    ///< glUseProgram() calls passed on by the state cache
+		unsigned int vertexArrayBinds{};
+		unsigned int textureBinds{};
+		unsigned int capabilityToggles{};  ///< glEnable() and glDisable() calls
+		unsigned int uniformCalls{};       ///< glUniform* calls
+		unsigned int uniformBlockUploads{};
+		size_t uploadedBytes{};            ///< written into buffers
+	} RenderStats;
+
+	extern RenderStats renderStats;        ///< frame being drawn
+
+	void beginRenderStatsFrame();
+	void endRenderStatsFrame();
+	const RenderStats& lastRenderStats();
+	void writeRenderStatsHistory(std::ostream& out);
+}
+
+#ifdef RENDER_STATS
+/// Adds amount to a RenderStats counter of the frame being drawn.
+#define COUNT_RENDER_STAT(counter, amount) (manaeste::renderStats.counter += (amount))
+#else
+#define COUNT_RENDER_STAT(counter, amount) ((void)0)
+#endif
@@ -0,0 +1,256 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    resources.cpp : GL resource registry.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Buffers, vertex arrays, textures and programs are created and deleted through
+ *          this registry, which keeps a label and the memory of every live object. The
+ *          memory report sums them per category; whatever is still registered when the
+ *          application finishes is reported as leaked.
+ *
+ * Only the GL thread may use the registry.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "resources.h"
+#include "glstate.h"
+
+using namespace manaeste;
+
+namespace
+{
+	/// GL object name spaces, a buffer and a texture may share the same name.
+	enum ResourceKind { BUFFER_KIND, VERTEX_ARRAY_KIND, TEXTURE_KIND, PROGRAM_KIND };
+
+	struct ResourceEntry
+	{
+		ResourceCategory category{};
+		std::string label;
+		size_t bytes{};
+		size_t serial{}; ///< creation order
+	};
+
+	std::map<std::pair<ResourceKind, GLuint>, ResourceEntry> resources;
+	ResourceStats stats;
+
+	ResourceKind kindOf(ResourceCategory category)
+	{
+		switch (category)
+		{
+		case VERTEX_ARRAY: return VERTEX_ARRAY_KIND;
+		case TEXTURE:
+		case BUFFER_TEXTURE: return TEXTURE_KIND;
+		case SHADER_PROGRAM: return PROGRAM_KIND;
+		default: return BUFFER_KIND;
+		}
+	}
+
+	void setBytes(ResourceEntry& entry, size_t bytes)
+	{
+		stats.bytes[entry.category] += bytes - entry.bytes;
+		stats.totalBytes += bytes - entry.bytes;
+		stats.peakBytes = std::max(stats.peakBytes, stats.totalBytes);
+		entry.bytes = bytes;
+	}
+
+	double mebibytes(size_t bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+}
+
+/**
+ * @brief Human readable name of a category.
+ * @param category resource category
+ * @return plural name
+*/
+const char* manaeste::resourceCategoryName(ResourceCategory category)
+{
+	switch (category)
+	{
+	case VERTEX_BUFFER: return "vertex buffers";
+	case INDEX_BUFFER: return "index buffers";
+	case UNIFORM_BUFFER: return "uniform buffers";
+	case INSTANCE_BUFFER: return "instance buffers";
+	case STORAGE_BUFFER: return "storage buffers";
+	case INDIRECT_BUFFER: return "indirect buffers";
+	case LIGHT_BUFFER: return "light buffers";
+	case VERTEX_ARRAY: return "vertex arrays";
+	case TEXTURE: return "textures";
+	case BUFFER_TEXTURE: return "buffer textures";
+	case SHADER_PROGRAM: return "programs";
+	default: return "?";
+	}
+}
+
+/**
+ * @brief Generates a buffer, vertex array or texture name and registers it without memory.
+ * Programs are made by pgr::createProgram() and registered with registerResource().
+ * @param category what the object is used for
+ * @param label name shown in the reports
+ * @return object name, 0 for programs
+*/
+GLuint manaeste::createResource(ResourceCategory category, const std::string& label)
+{
+	GLuint name = 0;
+	switch (kindOf(category))
+	{
+	case BUFFER_KIND: glGenBuffers(1, &name); break;
+	case VERTEX_ARRAY_KIND: glGenVertexArrays(1, &name); break;
+	case TEXTURE_KIND: glGenTextures(1, &name); break;
+	case PROGRAM_KIND:
+		std::cerr << "createResource(): programs are registered after pgr::createProgram()" << std::endl;
+		return 0;
+	}
+	registerResource(category, name, label);
+	return name;
+}
+
+/**
+ * @brief Registers an object created elsewhere.
+ * @param category what the object is used for
+ * @param name object name, 0 is ignored
+ * @param label name shown in the reports
+ * @param bytes memory of the object
+*/
+void manaeste::registerResource(ResourceCategory category, GLuint name, const std::string& label, size_t bytes)
+{
+	if (name == 0)
+		return;
+
+	ResourceEntry& entry = resources[{ kindOf(category), name }];
+	if (entry.serial != 0)
+	{
+		std::cerr << "registerResource(): " << label << " reuses " << name << " of " << entry.label << std::endl;
+		setBytes(entry, 0);
+		stats.count[entry.category]--;
+	}
+	entry.category = category;
+	entry.label = label;
+	entry.serial = ++stats.created;
+	stats.count[category]++;
+	setBytes(entry, bytes);
+}
+
+/**
+ * @brief Updates the memory of an object, call after every glBufferData() or texture upload.
+ * @param category what the object is used for
+ * @param name object name
+ * @param bytes memory of the object
+*/
+void manaeste::setResourceBytes(ResourceCategory category, GLuint name, size_t bytes)
+{
+	auto found = resources.find({ kindOf(category), name });
+	if (found == resources.end())
+	{
+		std::cerr << "setResourceBytes(): " << resourceCategoryName(category) << " " << name << " is not registered" << std::endl;
+		return;
+	}
+	setBytes(found->second, bytes);
+}
+
+/**
+ * @brief Deletes an object and unregisters it.
+ * @param category what the object is used for
+ * @param name object name, set to 0
+*/
+void manaeste::deleteResource(ResourceCategory category, GLuint& name)
+{
+	if (name == 0)
+		return;
+
+	auto found = resources.find({ kindOf(category), name });
+	if (found == resources.end())
+	{
+		std::cerr << "deleteResource(): " << resourceCategoryName(category) << " " << name << " is not registered" << std::endl;
+	}
+	else
+	{
+		setBytes(found->second, 0);
+		stats.count[found->second.category]--;
+		stats.deleted++;
+		resources.erase(found);
+	}
+
+	switch (kindOf(category))
+	{
+	case BUFFER_KIND: glDeleteBuffers(1, &name); break;
+	case VERTEX_ARRAY_KIND: glDeleteVertexArrays(1, &name); break;
+	case TEXTURE_KIND: glDeleteTextures(1, &name); break;
+	case PROGRAM_KIND: pgr::deleteProgramAndShaders(name); break;
+	}
+	name = 0;
+	// a deleted object is unbound, and its name may come back for a new one
+	resetGlState();
+}
+
+/**
+ * @brief Current totals of the registry.
+ * @return resource statistics
+*/
+ResourceStats manaeste::resourceStats()
+{
+	return stats;
+}
+
+/**
+ * @brief Prints the live objects and their memory per category.
+ * @param out output stream
+*/
+void manaeste::printResourceReport(std::ostream& out)
+{
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << std::fixed << std::setprecision(2);
+	out << "GL resources: " << resources.size() << " live, " << mebibytes(stats.totalBytes) << " MiB (peak "
+		<< mebibytes(stats.peakBytes) << " MiB), " << stats.created << " created, " << stats.deleted << " deleted" << std::endl;
+	for (int category = 0; category < NUM_RESOURCE_CATEGORIES; category++)
+	{
+		if (stats.count[category] == 0)
+			continue;
+		out << "  " << std::left << std::setw(18) << resourceCategoryName((ResourceCategory)category) << std::right
+			<< std::setw(5) << stats.count[category] << std::setw(10) << mebibytes(stats.bytes[category]) << " MiB" << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
+
+/**
+ * @brief Lists every object still registered, in creation order. Call once everything
+ * should have been deleted.
+ * @param out output stream
+ * @return number of leaked objects
+*/
+size_t manaeste::reportLeakedResources(std::ostream& out)
+{
+	if (resources.empty())
+	{
+		out << "GL resources: all " << stats.created << " objects deleted" << std::endl;
+		return 0;
+	}
+
+	std::vector<std::pair<GLuint, const ResourceEntry*>> leaked;
+	for (const auto& resource : resources)
+		leaked.push_back({ resource.first.second, &resource.second });
+	std::sort(leaked.begin(), leaked.end(), [](const std::pair<GLuint, const ResourceEntry*>& a, const std::pair<GLuint, const ResourceEntry*>& b)
+		{ return a.second->serial < b.second->serial; });
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << std::fixed << std::setprecision(2);
+	out << "GL resources: " << leaked.size() << " leaked, " << mebibytes(stats.totalBytes) << " MiB" << std::endl;
+	for (const auto& resource : leaked)
+	{
+		const ResourceEntry* entry = resource.second;
+		out << "  " << std::left << std::setw(18) << resourceCategoryName(entry->category) << std::right << std::setw(6) << resource.first
+			<< "  " << std::left << std::setw(40) << entry->label << std::right << std::setw(10) << mebibytes(entry->bytes) << " MiB" << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+	return leaked.size();
+}
@@ -0,0 +1,46 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    resources.h : Header file for resources.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Registry of every GL object of the scene with its memory, for leak hunting.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include "pgr.h"
+
+namespace manaeste
+{
+	/// What a GL object is used for. Decides how it is created and deleted and where its memory is counted.
+	enum ResourceCategory
+	{
+		VERTEX_BUFFER, INDEX_BUFFER, UNIFORM_BUFFER, INSTANCE_BUFFER, STORAGE_BUFFER, INDIRECT_BUFFER, LIGHT_BUFFER, VERTEX_ARRAY,
+		TEXTURE, BUFFER_TEXTURE, SHADER_PROGRAM, NUM_RESOURCE_CATEGORIES
+	};
+
+	/// Live objects and their memory per category.
+	typedef struct ResourceStats
+	{
+		size_t count[NUM_RESOURCE_CATEGORIES]{};
+		size_t bytes[NUM_RESOURCE_CATEGORIES]{};
+		size_t totalBytes{};
+		size_t peakBytes{};    ///< largest totalBytes so far
+		size_t created{};
+		size_t deleted{};
+	} ResourceStats;
+
+	const char* resourceCategoryName(ResourceCategory category);
+
+	GLuint createResource(ResourceCategory category, const std::string& label);
+	void registerResource(ResourceCategory category, GLuint name, const std::string& label, size_t bytes = 0);
+	void setResourceBytes(ResourceCategory category, GLuint name, size_t bytes);
+	void deleteResource(ResourceCategory category, GLuint& name);
+
+	ResourceStats resourceStats();
+	void printResourceReport(std::ostream& out);
+	size_t reportLeakedResources(std::ostream& out);
+}
@@ -23,6 +23,11 @@ int BIG_PALMS;   ///< 0 - small palms, 1 - big palms (set in config.txt)
 int BIG_DUCK;	 ///< 0 - small duck, 1 - big duck (set in config.txt)
 int BIG_SNOWMAN; ///< 0 - small snowman, 1 - big snowman (set in config.txt)
 
+const int NUM_CAMPFIRES = 24;    ///< point lights placed around the island
+const char* GPU_TIMES_FILE = "gpu_times.csv"; ///< written by the "Export GPU Times" menu entry
+const char* RENDER_STATS_FILE = "render_stats.csv"; ///< written by the "Write Render Stats" menu entry
+const char* CPU_TRACE_FILE = "cpu_trace.json"; ///< written by the "Write CPU Trace" menu entry, C and --trace-frames
+
 constexpr unsigned char ESC_KEY = 27;
 constexpr unsigned char W_KEY = 'w';
 constexpr unsigned char A_KEY = 'a';
@@ -35,6 +40,8 @@ constexpr unsigned char G_KEY = 'g';
 constexpr unsigned char H_KEY = 'h';
 constexpr unsigned char J_KEY = 'j';
 constexpr unsigned char P_KEY = 'p';
+constexpr unsigned char T_KEY = 't';
+constexpr unsigned char C_KEY = 'c';
 
 glm::vec3 palmsPositions[] = {
 	{2.0f, 0.0f, 0.25f},
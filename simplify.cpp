@@ -0,0 +1,488 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    simplify.cpp : Mesh simplification.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Builds the levels of detail of a mesh by collapsing edges in the order of their
+ *          quadric error (Garland & Heckbert), reusing the original vertices.
+ *
+ * Vertices sharing a position are welded for the collapses, so normal and texture seams do
+ * not tear apart. An edge collapse moves one position onto the other, which is why every
+ * level can index the vertex buffer of the full mesh: each corner of the moved position is
+ * replaced by a vertex of the target position with the same texture coordinates and the
+ * closest normal. Positions on open borders are locked, which keeps adjacent terrain tiles
+ * connected at every level.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include "simplify.h"
+
+using namespace manaeste;
+
+namespace
+{
+	/// Sum of squared distances to a set of planes, weighted by their triangle areas.
+	struct Quadric
+	{
+		double xx{}, xy{}, xz{}, xw{}, yy{}, yz{}, yw{}, zz{}, zw{}, ww{};
+		double area{};
+
+		void addPlane(const double normal[3], double distance, double weight)
+		{
+			xx += weight * normal[0] * normal[0];
+			xy += weight * normal[0] * normal[1];
+			xz += weight * normal[0] * normal[2];
+			xw += weight * normal[0] * distance;
+			yy += weight * normal[1] * normal[1];
+			yz += weight * normal[1] * normal[2];
+			yw += weight * normal[1] * distance;
+			zz += weight * normal[2] * normal[2];
+			zw += weight * normal[2] * distance;
+			ww += weight * distance * distance;
+			area += weight;
+		}
+
+		void add(const Quadric& other)
+		{
+			xx += other.xx; xy += other.xy; xz += other.xz; xw += other.xw;
+			yy += other.yy; yz += other.yz; yw += other.yw;
+			zz += other.zz; zw += other.zw; ww += other.ww;
+			area += other.area;
+		}
+
+		/// Root mean square distance of the point to the planes.
+		double distance(const float point[3]) const
+		{
+			const double x = point[0], y = point[1], z = point[2];
+			const double sum = xx * x * x + yy * y * y + zz * z * z
+				+ 2.0 * (xy * x * y + xz * x * z + yz * y * z)
+				+ 2.0 * (xw * x + yw * y + zw * z) + ww;
+			return area > 0.0 ? std::sqrt(std::max(sum, 0.0) / area) : 0.0;
+		}
+	};
+
+	/// Candidate moving position from onto position to, valid while both stamps are current.
+	struct Collapse
+	{
+		double error;
+		uint32_t from, to;
+		uint32_t fromStamp, toStamp;
+
+		bool operator>(const Collapse& other) const { return error > other.error; }
+	};
+
+	void cross(const float a[3], const float b[3], const float c[3], double normal[3])
+	{
+		const double u[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+		const double v[3] = { (double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2] };
+		normal[0] = u[1] * v[2] - u[2] * v[1];
+		normal[1] = u[2] * v[0] - u[0] * v[2];
+		normal[2] = u[0] * v[1] - u[1] * v[0];
+	}
+
+	double dot(const double a[3], const double b[3])
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	float dot(const float a[3], const float b[3])
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	/**
+	 * @brief Numbers the distinct values of the vertices, equal vertices getting the same number.
+	 * @param numVertices vertex count
+	 * @param less strict weak ordering of vertex indices
+	 * @param ids one number per vertex, from 0 up to the returned count
+	 * @return count of distinct values
+	*/
+	template <typename Less>
+	uint32_t numberDistinct(uint32_t numVertices, Less less, std::vector<uint32_t>& ids)
+	{
+		std::vector<uint32_t> order(numVertices);
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), less);
+
+		ids.assign(numVertices, 0);
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < numVertices; i++)
+		{
+			if (i > 0 && less(order[i - 1], order[i]))
+				count++;
+			ids[order[i]] = count;
+		}
+		return numVertices > 0 ? count + 1 : 0;
+	}
+
+	class Simplifier
+	{
+	public:
+		explicit Simplifier(const MeshData& mesh);
+
+		uint32_t liveTriangles() const { return numLive_; }
+		bool collapseNext(double maxError, double& error);
+		void snapshot(std::vector<uint32_t>& indices) const;
+
+	private:
+		const float* point(uint32_t position) const { return mesh_.vertices[positionVertex_[position]].position; }
+		uint32_t cornerAt(uint32_t triangle, uint32_t position) const;
+		void neighbours(uint32_t position, std::vector<uint32_t>& result) const;
+		void pushCollapses(uint32_t position);
+		bool tryCollapse(uint32_t from, uint32_t to);
+
+		const MeshData& mesh_;
+		std::vector<uint32_t> corners_;             ///< 3 vertex indices per triangle
+		std::vector<char> live_;                    ///< per triangle
+		uint32_t numLive_{};
+
+		std::vector<uint32_t> vertexPosition_;      ///< welded position of every vertex
+		std::vector<uint32_t> vertexGroup_;         ///< position and texture coordinates of every vertex
+		std::vector<uint32_t> positionVertex_;      ///< a vertex of every position
+		std::vector<std::vector<uint32_t>> groupVertices_;
+		std::vector<std::vector<uint32_t>> positionTriangles_;
+		std::vector<Quadric> quadrics_;
+		std::vector<uint32_t> stamps_;
+		std::vector<char> locked_;
+		std::vector<char> removed_;
+
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue_;
+		std::vector<std::pair<uint32_t, uint32_t>> groupMap_;
+		std::vector<uint32_t> fromNeighbours_, toNeighbours_;
+	};
+
+	Simplifier::Simplifier(const MeshData& mesh) : mesh_(mesh), corners_(mesh.indices)
+	{
+		const uint32_t numVertices = (uint32_t)mesh.vertices.size();
+		const MeshVertex* vertices = mesh.vertices.data();
+		auto lessPosition = [vertices](uint32_t a, uint32_t b)
+		{
+			return std::lexicographical_compare(vertices[a].position, vertices[a].position + 3,
+				vertices[b].position, vertices[b].position + 3);
+		};
+		const uint32_t numPositions = numberDistinct(numVertices, lessPosition, vertexPosition_);
+		const std::vector<uint32_t>& vertexPosition = vertexPosition_;
+		auto lessGroup = [vertices, &vertexPosition](uint32_t a, uint32_t b)
+		{
+			if (vertexPosition[a] != vertexPosition[b])
+				return vertexPosition[a] < vertexPosition[b];
+			return std::lexicographical_compare(vertices[a].texCoord, vertices[a].texCoord + 2,
+				vertices[b].texCoord, vertices[b].texCoord + 2);
+		};
+		const uint32_t numGroups = numberDistinct(numVertices, lessGroup, vertexGroup_);
+
+		positionVertex_.resize(numPositions);
+		groupVertices_.resize(numGroups);
+		for (uint32_t v = 0; v < numVertices; v++)
+		{
+			positionVertex_[vertexPosition_[v]] = v;
+			groupVertices_[vertexGroup_[v]].push_back(v);
+		}
+
+		const uint32_t numTriangles = (uint32_t)(corners_.size() / 3);
+		live_.assign(numTriangles, 0);
+		positionTriangles_.resize(numPositions);
+		quadrics_.resize(numPositions);
+		stamps_.assign(numPositions, 0);
+		locked_.assign(numPositions, 0);
+		removed_.assign(numPositions, 0);
+
+		std::unordered_map<uint64_t, uint32_t> edgeUses;
+		for (uint32_t t = 0; t < numTriangles; t++)
+		{
+			const uint32_t p[3] = { vertexPosition_[corners_[t * 3 + 0]], vertexPosition_[corners_[t * 3 + 1]],
+				vertexPosition_[corners_[t * 3 + 2]] };
+			// triangles without area are left out of every simplified level
+			if (p[0] == p[1] || p[1] == p[2] || p[2] == p[0])
+				continue;
+
+			live_[t] = 1;
+			numLive_++;
+
+			double normal[3];
+			cross(point(p[0]), point(p[1]), point(p[2]), normal);
+			const double length = std::sqrt(dot(normal, normal));
+			for (int k = 0; k < 3; k++)
+			{
+				positionTriangles_[p[k]].push_back(t);
+				const uint32_t a = std::min(p[k], p[(k + 1) % 3]), b = std::max(p[k], p[(k + 1) % 3]);
+				edgeUses[((uint64_t)a << 32) | b]++;
+			}
+			if (length == 0.0)
+				continue;
+			for (int c = 0; c < 3; c++)
+				normal[c] /= length;
+			const float* a = point(p[0]);
+			const double distance = -(normal[0] * a[0] + normal[1] * a[1] + normal[2] * a[2]);
+			for (int k = 0; k < 3; k++)
+				quadrics_[p[k]].addPlane(normal, distance, 0.5 * length);
+		}
+
+		// borders and non-manifold edges stay where they are
+		for (const auto& edge : edgeUses)
+		{
+			if (edge.second == 2)
+				continue;
+			locked_[(uint32_t)(edge.first >> 32)] = 1;
+			locked_[(uint32_t)edge.first] = 1;
+		}
+
+		for (uint32_t p = 0; p < numPositions; p++)
+			pushCollapses(p);
+	}
+
+	uint32_t Simplifier::cornerAt(uint32_t triangle, uint32_t position) const
+	{
+		for (uint32_t k = 0; k < 3; k++)
+			if (vertexPosition_[corners_[triangle * 3 + k]] == position)
+				return k;
+		return 3;
+	}
+
+	void Simplifier::neighbours(uint32_t position, std::vector<uint32_t>& result) const
+	{
+		result.clear();
+		for (uint32_t t : positionTriangles_[position])
+		{
+			if (!live_[t])
+				continue;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t other = vertexPosition_[corners_[t * 3 + k]];
+				if (other != position)
+					result.push_back(other);
+			}
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	}
+
+	/**
+	 * @brief Queues the collapses of every edge around a position, in both directions.
+	*/
+	void Simplifier::pushCollapses(uint32_t position)
+	{
+		neighbours(position, fromNeighbours_);
+		for (uint32_t other : fromNeighbours_)
+		{
+			for (int direction = 0; direction < 2; direction++)
+			{
+				const uint32_t from = direction == 0 ? position : other;
+				const uint32_t to = direction == 0 ? other : position;
+				if (locked_[from])
+					continue;
+				Quadric quadric = quadrics_[from];
+				quadric.add(quadrics_[to]);
+				queue_.push({ quadric.distance(point(to)), from, to, stamps_[from], stamps_[to] });
+			}
+		}
+	}
+
+	/**
+	 * @brief Moves a position onto a neighbouring one unless that would tear a texture seam,
+	 * make the surface non-manifold or flip a triangle.
+	 * @return true if the position was collapsed
+	*/
+	bool Simplifier::tryCollapse(uint32_t from, uint32_t to)
+	{
+		// every texture coordinate group of the moved position needs its counterpart across the edge
+		groupMap_.clear();
+		uint32_t sharedTriangles = 0;
+		for (uint32_t t : positionTriangles_[from])
+		{
+			if (!live_[t])
+				continue;
+			const uint32_t fromGroup = vertexGroup_[corners_[t * 3 + cornerAt(t, from)]];
+			const uint32_t toCorner = cornerAt(t, to);
+			const uint32_t toGroup = toCorner < 3 ? vertexGroup_[corners_[t * 3 + toCorner]] : UINT32_MAX;
+			sharedTriangles += toCorner < 3;
+
+			auto mapped = std::find_if(groupMap_.begin(), groupMap_.end(),
+				[fromGroup](const std::pair<uint32_t, uint32_t>& entry) { return entry.first == fromGroup; });
+			if (mapped == groupMap_.end())
+				groupMap_.push_back({ fromGroup, toGroup });
+			else if (mapped->second == UINT32_MAX)
+				mapped->second = toGroup;
+			else if (toGroup != UINT32_MAX && mapped->second != toGroup)
+				return false;
+		}
+		for (const auto& entry : groupMap_)
+			if (entry.second == UINT32_MAX)
+				return false;
+
+		// link condition: the two positions may only share the neighbours opposite the edge
+		neighbours(from, fromNeighbours_);
+		neighbours(to, toNeighbours_);
+		uint32_t sharedNeighbours = 0;
+		for (uint32_t other : fromNeighbours_)
+			sharedNeighbours += std::binary_search(toNeighbours_.begin(), toNeighbours_.end(), other);
+		if (sharedNeighbours != sharedTriangles)
+			return false;
+
+		for (uint32_t t : positionTriangles_[from])
+		{
+			if (!live_[t] || cornerAt(t, to) < 3)
+				continue;
+			const float* before[3];
+			const float* after[3];
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t position = vertexPosition_[corners_[t * 3 + k]];
+				before[k] = point(position);
+				after[k] = position == from ? point(to) : before[k];
+			}
+			double normalBefore[3], normalAfter[3];
+			cross(before[0], before[1], before[2], normalBefore);
+			cross(after[0], after[1], after[2], normalAfter);
+			const double lengths = std::sqrt(dot(normalBefore, normalBefore) * dot(normalAfter, normalAfter));
+			if (dot(normalBefore, normalAfter) <= 0.25 * lengths)
+				return false;
+		}
+
+		for (uint32_t t : positionTriangles_[from])
+		{
+			if (!live_[t])
+				continue;
+			if (cornerAt(t, to) < 3)
+			{
+				live_[t] = 0;
+				numLive_--;
+				continue;
+			}
+
+			uint32_t& corner = corners_[t * 3 + cornerAt(t, from)];
+			const uint32_t fromGroup = vertexGroup_[corner];
+			const uint32_t toGroup = std::find_if(groupMap_.begin(), groupMap_.end(),
+				[fromGroup](const std::pair<uint32_t, uint32_t>& entry) { return entry.first == fromGroup; })->second;
+			const float* normal = mesh_.vertices[corner].normal;
+			uint32_t best = groupVertices_[toGroup].front();
+			for (uint32_t candidate : groupVertices_[toGroup])
+				if (dot(mesh_.vertices[candidate].normal, normal) > dot(mesh_.vertices[best].normal, normal))
+					best = candidate;
+			corner = best;
+			positionTriangles_[to].push_back(t);
+		}
+
+		std::vector<uint32_t>& toTriangles = positionTriangles_[to];
+		toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(),
+			[this](uint32_t t) { return !live_[t]; }), toTriangles.end());
+		std::vector<uint32_t>().swap(positionTriangles_[from]);
+
+		quadrics_[to].add(quadrics_[from]);
+		removed_[from] = 1;
+		stamps_[to]++;
+		pushCollapses(to);
+		return true;
+	}
+
+	/**
+	 * @brief Performs the cheapest valid collapse.
+	 * @param maxError largest acceptable distance of the simplified surface from the original
+	 * @param error raised to the error of the performed collapse
+	 * @return false once no collapse within maxError is left
+	*/
+	bool Simplifier::collapseNext(double maxError, double& error)
+	{
+		while (!queue_.empty())
+		{
+			const Collapse collapse = queue_.top();
+			if (collapse.error > maxError)
+				return false;
+			queue_.pop();
+
+			if (removed_[collapse.from] || removed_[collapse.to] ||
+				stamps_[collapse.from] != collapse.fromStamp || stamps_[collapse.to] != collapse.toStamp)
+				continue;
+			if (tryCollapse(collapse.from, collapse.to))
+			{
+				error = std::max(error, collapse.error);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Simplifier::snapshot(std::vector<uint32_t>& indices) const
+	{
+		indices.clear();
+		indices.reserve(numLive_ * 3);
+		for (uint32_t t = 0; t < live_.size(); t++)
+			if (live_[t])
+				indices.insert(indices.end(), corners_.begin() + t * 3, corners_.begin() + t * 3 + 3);
+	}
+}
+
+/**
+ * @brief Simplifies a mesh progressively, keeping a copy of the indices at every target.
+ * @param mesh mesh with 32-bit indices
+ * @param targetTriangles decreasing triangle counts of the wanted levels
+ * @param maxError largest acceptable distance from the original surface, in object space
+ * @param levels indices of every level reached, into the vertices of the mesh
+ * @param errors largest collapse error of every level reached
+*/
+void manaeste::simplifyMesh(const MeshData& mesh, const std::vector<uint32_t>& targetTriangles, float maxError,
+	std::vector<std::vector<uint32_t>>& levels, std::vector<float>& errors)
+{
+	levels.clear();
+	errors.clear();
+
+	Simplifier simplifier(mesh);
+	double error = 0.0;
+	for (uint32_t target : targetTriangles)
+	{
+		while (simplifier.liveTriangles() > target)
+		{
+			if (!simplifier.collapseNext(maxError, error))
+				return;
+		}
+		levels.emplace_back();
+		simplifier.snapshot(levels.back());
+		errors.push_back((float)error);
+	}
+}
+
+/**
+ * @brief Appends the simplified levels of detail to the indices of a large enough mesh.
+ * @param mesh mesh with 32-bit indices, gets its lods filled
+*/
+void manaeste::buildLodChain(MeshData& mesh)
+{
+	mesh.lods.clear();
+	const uint32_t numTriangles = (uint32_t)(mesh.indices.size() / 3);
+	if (numTriangles < LOD_MIN_TRIANGLES)
+		return;
+
+	float minPosition[3] = { INFINITY, INFINITY, INFINITY }, maxPosition[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (const MeshVertex& vertex : mesh.vertices)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minPosition[c] = std::min(minPosition[c], vertex.position[c]);
+			maxPosition[c] = std::max(maxPosition[c], vertex.position[c]);
+		}
+	}
+	float largestExtent = 0.0f;
+	for (int c = 0; c < 3; c++)
+		largestExtent = std::max(largestExtent, maxPosition[c] - minPosition[c]);
+
+	std::vector<uint32_t> targets;
+	for (size_t level = 1; level < MAX_MESH_LODS; level++)
+		targets.push_back(numTriangles >> level);
+
+	std::vector<std::vector<uint32_t>> levels;
+	std::vector<float> errors;
+	simplifyMesh(mesh, targets, LOD_MAX_RELATIVE_ERROR * largestExtent, levels, errors);
+
+	mesh.lods.push_back({ 0, numTriangles, 0.0f });
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		mesh.lods.push_back({ (uint32_t)mesh.indices.size(), (uint32_t)(levels[level].size() / 3), errors[level] });
+		mesh.indices.insert(mesh.indices.end(), levels[level].begin(), levels[level].end());
+	}
+}
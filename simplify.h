@@ -0,0 +1,28 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    simplify.h : Header file for simplify.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Level of detail generation by quadric error edge collapse.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "mesh.h"
+
+namespace manaeste
+{
+	/// Meshes with fewer triangles are always drawn at full detail.
+	const uint32_t LOD_MIN_TRIANGLES = 1024;
+	/// Levels of detail per mesh, the full mesh followed by halving triangle counts.
+	const size_t MAX_MESH_LODS = 5;
+	/// Simplification stops once the error would exceed this fraction of the mesh extent.
+	const float LOD_MAX_RELATIVE_ERROR = 0.05f;
+
+	void simplifyMesh(const MeshData& mesh, const std::vector<uint32_t>& targetTriangles, float maxError,
+		std::vector<std::vector<uint32_t>>& levels, std::vector<float>& errors);
+	void buildLodChain(MeshData& mesh);
+}
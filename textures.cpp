@@ -0,0 +1,277 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    textures.cpp : Texture registry.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Every texture loaded from a file is registered under its canonical path and
+ *          reference counted, so a file is decoded and uploaded only once no matter how
+ *          many meshes use it. A texture baked into a KTX container next to its file
+ *          is uploaded from there instead, with its stored mipmaps.
+ */
+ //----------------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include "textures.h"
+#include "ktx.h"
+#include "resources.h"
+
+using namespace manaeste;
+
+namespace
+{
+	struct TextureEntry
+	{
+		GLuint texture{};
+		GLenum target{};
+		size_t bytes{};
+		int refCount{};
+		bool baked{};
+	};
+
+	std::mutex registryMutex;
+	std::map<std::string, TextureEntry> textures; ///< resident textures by canonical path
+	std::map<std::string, std::shared_future<DecodedImage>> pendingImages; ///< decodes not uploaded yet
+	size_t acquisitions = 0;
+	size_t uploads = 0;
+
+	/**
+	 * @brief Shares an already resident texture. Expects registryMutex to be locked.
+	*/
+	GLuint shareResident(const std::string& path)
+	{
+		auto found = textures.find(path);
+		if (found == textures.end())
+			return 0;
+
+		found->second.refCount++;
+		return found->second.texture;
+	}
+
+	/**
+	 * @brief Registers a freshly uploaded texture. Expects registryMutex to be locked.
+	*/
+	GLuint registerTexture(const std::string& path, GLuint texture, GLenum target, size_t bytes, bool baked = false)
+	{
+		pendingImages.erase(path);
+		if (texture == 0)
+			return 0;
+
+		uploads++;
+		textures[path] = TextureEntry{ texture, target, bytes, 1, baked };
+		registerResource(TEXTURE, texture, path, bytes);
+		return texture;
+	}
+
+	/**
+	 * @brief Uploads the baked version of a texture if there is a usable one. Expects
+	 * registryMutex to be locked.
+	*/
+	GLuint registerBaked(const std::string& path, GLenum target)
+	{
+		KtxTexture ktx;
+		if (!openBakedTexture(path, ktx) || (ktx.numFaces == 6) != (target == GL_TEXTURE_CUBE_MAP))
+			return 0;
+
+		size_t bytes = 0;
+		GLuint texture = createTextureFromKtx(ktx, bytes);
+		return registerTexture(path, texture, target, bytes, true);
+	}
+}
+
+/**
+ * @brief Normalizes a texture path so that every spelling of one file gives the same key:
+ *        backslashes become slashes, "." segments are dropped and ".." segments resolved.
+ * @param fileName texture path as written in a material
+ * @return canonical path
+*/
+std::string manaeste::canonicalTexturePath(const std::string& fileName)
+{
+	std::string path = fileName;
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	std::vector<std::string> segments;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find('/', start);
+		if (end == std::string::npos)
+			end = path.size();
+
+		std::string segment = path.substr(start, end - start);
+		if (segment == ".." && !segments.empty() && segments.back() != "..")
+			segments.pop_back();
+		else if (!segment.empty() && segment != ".")
+			segments.push_back(segment);
+		start = end + 1;
+	}
+
+	std::string canonical = !path.empty() && path[0] == '/' ? "/" : "";
+	for (size_t i = 0; i < segments.size(); i++)
+		canonical += (i > 0 ? "/" : "") + segments[i];
+	return canonical;
+}
+
+/**
+ * @brief Schedules decoding of a texture unless it is resident, baked or already being
+ * decoded. Safe to call from worker threads.
+ * @param pool worker pool
+ * @param fileName texture file
+ * @return decode job to pass to acquireTexture(), invalid if there is nothing to decode
+*/
+std::shared_future<DecodedImage> manaeste::requestTextureImage(TaskPool& pool, const std::string& fileName)
+{
+	const std::string path = canonicalTexturePath(fileName);
+	KtxTexture ktx;
+	if (openBakedTexture(path, ktx))
+		return {};
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	if (textures.count(path) != 0)
+		return {};
+
+	auto pending = pendingImages.find(path);
+	if (pending != pendingImages.end())
+		return pending->second;
+
+	std::shared_future<DecodedImage> image = decodeImageAsync(pool, path);
+	pendingImages[path] = image;
+	return image;
+}
+
+/**
+ * @brief Returns the texture of a file and takes a reference to it. The first acquisition
+ * uploads the baked texture if there is one, otherwise the image, decoding it here unless
+ * a decode job is given.
+ * @param fileName texture file
+ * @param image decode job from requestTextureImage(), may be invalid
+ * @return texture name, 0 if the file cannot be loaded
+*/
+GLuint manaeste::acquireTexture(const std::string& fileName, const std::shared_future<DecodedImage>& image)
+{
+	const std::string path = canonicalTexturePath(fileName);
+
+	// wait outside of the lock, the workers need it to schedule decodes
+	if (image.valid())
+		image.wait();
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	acquisitions++;
+	if (GLuint texture = shareResident(path))
+		return texture;
+
+	DecodedImage decoded;
+	if (!image.valid())
+	{
+		if (GLuint texture = registerBaked(path, GL_TEXTURE_2D))
+			return texture;
+		decodeImage(path, decoded);
+	}
+	const DecodedImage& source = image.valid() ? image.get() : decoded;
+
+	return registerTexture(path, createTextureFromImage(source), GL_TEXTURE_2D, rgbaMipChainBytes(source.width, source.height));
+}
+
+/**
+ * @brief Returns the cube map made of the given faces and takes a reference to it, from
+ * its baked version if there is one.
+ * @param name key of the cube map
+ * @param faces decode jobs of the faces in the order +x, -x, +y, -y, +z, -z, may be empty
+ *        when the cube map is baked
+ * @return texture name, 0 if any face cannot be loaded
+*/
+GLuint manaeste::acquireCubeMap(const std::string& name, const std::vector<std::shared_future<DecodedImage>>& faces)
+{
+	const std::string path = canonicalTexturePath(name);
+	for (const auto& face : faces)
+		face.wait();
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	acquisitions++;
+	if (GLuint texture = shareResident(path))
+		return texture;
+	if (GLuint texture = registerBaked(path, GL_TEXTURE_CUBE_MAP))
+		return texture;
+	if (faces.size() != 6)
+	{
+		std::cerr << "acquireCubeMap(): " << path << " is not baked and has no faces" << std::endl;
+		return registerTexture(path, 0, GL_TEXTURE_CUBE_MAP, 0);
+	}
+
+	size_t bytes = 0;
+	for (const auto& face : faces)
+		bytes += rgbaMipChainBytes(face.get().width, face.get().height);
+
+	return registerTexture(path, createCubeMapFromImages(faces), GL_TEXTURE_CUBE_MAP, bytes);
+}
+
+/**
+ * @brief Drops a reference, the texture is deleted with the last one.
+ * @param texture texture name returned by one of the acquire functions
+*/
+void manaeste::releaseTexture(GLuint texture)
+{
+	if (texture == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto found = std::find_if(textures.begin(), textures.end(),
+		[texture](const std::pair<const std::string, TextureEntry>& entry) { return entry.second.texture == texture; });
+	if (found == textures.end())
+	{
+		std::cerr << "releaseTexture(): texture " << texture << " is not registered" << std::endl;
+		return;
+	}
+
+	if (--found->second.refCount == 0)
+	{
+		deleteResource(TEXTURE, found->second.texture);
+		textures.erase(found);
+	}
+}
+
+/**
+ * @brief Current totals of the registry.
+ * @return texture statistics
+*/
+TextureStats manaeste::textureStats()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	TextureStats stats;
+	stats.numTextures = textures.size();
+	for (const auto& entry : textures)
+		stats.bytesResident += entry.second.bytes;
+	stats.acquisitions = acquisitions;
+	stats.uploads = uploads;
+	return stats;
+}
+
+/**
+ * @brief Prints every resident texture with its references and memory.
+ * @param out output stream
+*/
+void manaeste::printTextureReport(std::ostream& out)
+{
+	const TextureStats stats = textureStats();
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << std::fixed << std::setprecision(2);
+	out << "Textures: " << stats.numTextures << " resident, " << stats.bytesResident / (1024.0 * 1024.0) << " MiB, "
+		<< stats.uploads << " uploads for " << stats.acquisitions << " acquisitions" << std::endl;
+	for (const auto& entry : textures)
+	{
+		out << "  " << std::left << std::setw(40) << entry.first << std::right
+			<< " refs " << std::setw(3) << entry.second.refCount
+			<< std::setw(10) << entry.second.bytes / (1024.0 * 1024.0) << " MiB"
+			<< (entry.second.baked ? "  baked" : "") << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
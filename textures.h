@@ -0,0 +1,38 @@
+//----------------------------------------------------------------------------------------
+/**
+ * @file    textures.h : Header file for textures.cpp.
+ * @author  Stepan Manaenko
+ * @date    2023
+ * @brief   Registry of the textures loaded from files, shared by canonical path.
+ */
+ //----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "pgr.h"
+#include "assets.h"
+
+namespace manaeste
+{
+	/// Totals of the texture registry.
+	typedef struct TextureStats
+	{
+		size_t numTextures{};  ///< distinct textures resident
+		size_t bytesResident{}; ///< texel memory of all resident textures including mipmaps
+		size_t acquisitions{}; ///< acquire calls
+		size_t uploads{};      ///< acquire calls that had to upload, the rest were shared
+	} TextureStats;
+
+	std::string canonicalTexturePath(const std::string& fileName);
+
+	std::shared_future<DecodedImage> requestTextureImage(TaskPool& pool, const std::string& fileName);
+	GLuint acquireTexture(const std::string& fileName, const std::shared_future<DecodedImage>& image = {});
+	GLuint acquireCubeMap(const std::string& name, const std::vector<std::shared_future<DecodedImage>>& faces);
+	void releaseTexture(GLuint texture);
+
+	TextureStats textureStats();
+	void printTextureReport(std::ostream& out);
+}
@@ -46,14 +46,21 @@ namespace manaeste
 		bool amongusOn{};
 		bool sparklesOn{};
 		bool fullScreen = false;
-	} sceneState;
+		bool headless{}; ///< no GLUT window exists (headless benchmark), skip window-system calls
+		bool gpuTimerOverlay{};
+		float gpuTimesShownAt{}; ///< elapsed time the window title last showed the GPU times
+	};
+
+	extern SceneState sceneState;
 
 	struct Camera
 	{
 		glm::vec3 position{};
 		glm::vec3 direction{};
 		float viewAngle{};
-	} camera;
+	};
+
+	extern Camera camera;
 
 	typedef std::list<void*> GameObjectsList;
 
@@ -65,6 +72,9 @@ namespace manaeste
 
 	Object* setObject(ObjectType type, glm::vec3 pos);
 	void deleteObjects();
+	void updateDrawLists();
+	void scatterObjects(ObjectType type, int count);
+	void placeCampfires(int count);
 
 	void drawAllObjects(const glm::mat4& orthoProjectionMatrix, const glm::mat4& orthoViewMatrix, const glm::mat4& viewMatrix,
 		const glm::mat4& projectionMatrix);
@@ -84,6 +94,9 @@ namespace manaeste
 	void flashlightToggle();
 	void sunToggle();
 	void bannerToggle();
+	void gpuTimerOverlayToggle();
+	void exportGpuTimes();
+	void exportRenderStats();
 
 	void drawScene();
 	void updateScene(float elapsedTime);